@@ -0,0 +1,41 @@
+#ifndef MC_ARCHIVE_H
+#define MC_ARCHIVE_H
+
+#include "mc_server.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The tar stream of an ARCHIVE reply, produced as it is read. open lists
+ * the tree and works out the stream's exact length before anything is sent,
+ * so it can go in the reply header; read then hands out the next bytes,
+ * opening each file only when its data comes up and closing it after. A
+ * file that shrank or went away since the listing is padded with zeros and
+ * one that grew is cut at its listed size, so the stream always has the
+ * length announced.
+ */
+typedef struct mc_archive mc_archive_t;
+
+/* dir is the request's filename field (empty for the whole tree). */
+int mc_archive_open(const mc_server_config_t *config,
+                    const char *dir,
+                    mc_archive_t **out,
+                    uint64_t *total,
+                    char *err,
+                    size_t err_len);
+
+/* Fills buf with the next len bytes, fewer only at the end; returns how many. */
+size_t mc_archive_read(mc_archive_t *archive, uint8_t *buf, size_t len);
+
+void mc_archive_close(mc_archive_t *archive);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MC_ARCHIVE_H */
@@ -0,0 +1,64 @@
+#ifndef MC_CACHE_H
+#define MC_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Hot-file cache: the content of small, often downloaded files, kept in one
+ * shared anonymous mapping so forked children and workers all fill and hit
+ * the same copy (under a process-shared mutex).
+ *
+ * The mapping is cut into MC_CACHE_PAGE pages, each split into equal slots
+ * of one size class like a slab allocator, and every class keeps its own LRU
+ * list. When a class is full a newcomer only takes the place of its least
+ * recently used file if a TinyLFU frequency sketch says it is asked for more
+ * often, so a scan of one-off downloads cannot flush the files clients keep
+ * coming back for.
+ *
+ * Entries are keyed by name and carry the stamp of the stored file they were
+ * read from. A lookup with a different stamp misses and drops the entry, so
+ * a replaced file is never served, even by a process that has not seen its
+ * invalidation yet.
+ */
+#define MC_CACHE_MAX_FILE (64U * 1024U)
+#define MC_CACHE_PAGE     (1U << 20)
+
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t size; /* of the stored file, which may be a manifest or a container */
+} mc_cache_stamp_t;
+
+/*
+ * Maps bytes (whole pages) before any process forks; less than a page leaves
+ * the cache off. Returns the pages mapped, or -1.
+ */
+long mc_cache_open(uint64_t bytes);
+bool mc_cache_enabled(void);
+
+/*
+ * Counts an access to name and, when its entry matches stamp, copies the
+ * content into data (MC_CACHE_MAX_FILE bytes): returns its length and *crc
+ * (CRC32C of all of it), or -1 on a miss.
+ */
+long mc_cache_get(const char *name, const mc_cache_stamp_t *stamp, uint8_t *data, uint32_t *crc);
+
+/* Offers len bytes (at most MC_CACHE_MAX_FILE) read under stamp; admission may turn them away. */
+void mc_cache_put(const char *name, const mc_cache_stamp_t *stamp, const uint8_t *data, size_t len, uint32_t crc);
+
+/* Drops name's entry, if any: called whenever name is replaced or removed. */
+void mc_cache_invalidate(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MC_CACHE_H */
@@ -0,0 +1,95 @@
+#ifndef MC_CHUNKSTORE_H
+#define MC_CHUNKSTORE_H
+
+#include "mc_sha256.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Deduplicating chunk store (MC_STORAGE_MODE=chunked). Uploads are cut into
+ * content-defined chunks with a FastCDC-style gear hash, so an insert or
+ * delete only changes the chunks around it, and every chunk is stored once
+ * under <storage>/.chunks/<first two hex digits>/<sha256>. The file name
+ * itself then holds a small manifest listing its chunks in order, tagged
+ * MC_MANIFEST_FORMAT (see MC_STORAGE_FORMAT_XATTR); an untagged file is a
+ * plain upload even if it starts with the manifest magic. The mode needs a
+ * file system with user xattrs.
+ *
+ * Chunks are never removed while the server runs; DELETE or an overwrite
+ * only drops the manifest and mc_chunkstore_gc() sweeps the orphans at the
+ * next start.
+ */
+#define MC_CHUNKSTORE_DIR ".chunks"
+
+#define MC_CHUNK_MIN (16U * 1024U)
+#define MC_CHUNK_AVG (64U * 1024U)
+#define MC_CHUNK_MAX (256U * 1024U)
+
+#define MC_MANIFEST_MAGIC "MCCHUNK1"
+#define MC_MANIFEST_FORMAT "chunks"
+
+#pragma pack(push, 1)
+typedef struct {
+    char magic[8];
+    uint64_t total_size;
+    uint64_t chunk_count;
+} mc_manifest_header_t;
+
+typedef struct {
+    uint32_t length;
+    uint8_t hash[MC_SHA256_DIGEST_LEN];
+} mc_chunk_ref_t;
+#pragma pack(pop)
+
+typedef struct {
+    uint64_t total_size;
+    size_t count;
+    mc_chunk_ref_t *chunks;
+} mc_manifest_t;
+
+/*
+ * Returns the length of the next chunk of data[0..len). Pass fewer than
+ * MC_CHUNK_MAX bytes only at the end of the input: a short buffer is cut
+ * where it ends.
+ */
+size_t mc_cdc_cut(const uint8_t *data, size_t len);
+
+/*
+ * Chunks everything readable from src_fd (from offset 0) into the store,
+ * writes the manifest to tmp_name and renames it over final_name, both
+ * names in directory dir_fd.
+ */
+int mc_chunkstore_ingest(const char *storage_dir,
+                         int src_fd,
+                         int dir_fd,
+                         const char *tmp_name,
+                         const char *final_name,
+                         char *err,
+                         size_t err_len);
+
+/* 1 and the file's logical size if fd holds a tagged manifest, 0 if not, -1 on error. */
+int mc_chunkstore_probe(int fd, uint64_t *total_size);
+
+/* Same as probe but loads the chunk list; free it with mc_chunkstore_free_manifest(). */
+int mc_chunkstore_read_manifest(int fd, mc_manifest_t *out);
+void mc_chunkstore_free_manifest(mc_manifest_t *manifest);
+
+/*
+ * Reassembles a manifest into an unlinked temporary file and returns its
+ * descriptor (offset 0), which the engines then serve like any other file.
+ */
+int mc_chunkstore_materialize(const char *storage_dir, const mc_manifest_t *manifest, char *err, size_t err_len);
+
+/* Removes chunks no manifest in storage_dir refers to; returns how many, or -1. */
+long mc_chunkstore_gc(const char *storage_dir);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MC_CHUNKSTORE_H */
@@ -1,16 +1,30 @@
 #ifndef MC_CLIENT_H
 #define MC_CLIENT_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#define MC_CLIENT_DEFAULT_PIPELINE 16
+#define MC_CLIENT_MAX_PIPELINE 64
+#define MC_CLIENT_DEFAULT_CONNECTIONS 4
+#define MC_CLIENT_MAX_CONNECTIONS 32
+
 typedef struct {
     const char *host;
     uint16_t port;
     const char *auth_token;
+    unsigned int pipeline_depth; /* requests in flight per batch; 1 = v1, 0 = default */
+    bool multiplex;              /* ask for framed stream mode (v3) */
+    unsigned int connections;    /* DOWNLOAD ALL connection pool size; 1 = one connection */
+    bool delta;                  /* re-uploads send only the blocks the server lacks (v2+) */
+    bool check_have;             /* ask by content hash first and skip what the server has (v2+) */
+    bool checksums;              /* CRC32C trailer on every file transfer (v2+) */
+    bool compress;               /* LZ4 on upload and download bodies (v2+) */
+    bool bundle;                 /* small files of a batch travel together in bundles (v2+) */
 } mc_client_config_t;
 
 int mc_client_run(const mc_client_config_t *config);
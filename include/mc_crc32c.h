@@ -0,0 +1,29 @@
+#ifndef MC_CRC32C_H
+#define MC_CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * CRC32C (Castagnoli), the end-to-end transfer checksum. Start with crc = 0
+ * and feed the data in any number of pieces. The first call picks the
+ * fastest kernel the CPU has (SSE4.2 or ARMv8 CRC instructions) and falls
+ * back to a portable slicing-by-8 table otherwise.
+ */
+uint32_t mc_crc32c_update(uint32_t crc, const void *data, size_t len);
+
+/* The table-driven kernel, always available (tests compare against it). */
+uint32_t mc_crc32c_portable(uint32_t crc, const void *data, size_t len);
+
+/* Name of the kernel mc_crc32c_update() uses: "sse4.2", "armv8" or "portable". */
+const char *mc_crc32c_impl(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MC_CRC32C_H */
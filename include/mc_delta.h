@@ -0,0 +1,39 @@
+#ifndef MC_DELTA_H
+#define MC_DELTA_H
+
+#include "mc_protocol.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MC_DELTA_MIN_BLOCK (2U * 1024U)
+#define MC_DELTA_MAX_BLOCK (128U * 1024U)
+
+/*
+ * Block size for a file of file_size bytes: about sqrt(file_size), rounded up
+ * to a KiB and clamped, so the signature list grows with the square root of
+ * the file rather than linearly.
+ */
+uint32_t mc_delta_block_size(uint64_t file_size);
+
+/*
+ * rsync-style weak checksum of len bytes: a = sum of bytes, b = sum of
+ * (len - i) * byte[i], both mod 2^16, packed as (b << 16) | a.
+ */
+uint32_t mc_delta_weak(const uint8_t *data, size_t len);
+
+/* Slides a len-byte window one byte: drops out, appends in. */
+uint32_t mc_delta_roll(uint32_t weak, uint8_t out, uint8_t in, size_t len);
+
+/* Leading MC_DELTA_STRONG_LEN bytes of the block's SHA-256. */
+void mc_delta_strong(const uint8_t *data, size_t len, uint8_t out[MC_DELTA_STRONG_LEN]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MC_DELTA_H */
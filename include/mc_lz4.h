@@ -0,0 +1,85 @@
+#ifndef MC_LZ4_H
+#define MC_LZ4_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Compressed payloads are a stream of blocks, each holding at most
+ * MC_LZ4_BLOCK_MAX file bytes: {raw_len, wire_len} (network order) and then
+ * wire_len bytes. With MC_LZ4_STORED set in wire_len the bytes are the raw
+ * data; otherwise they are one LZ4 block (the LZ4 block format, no frame).
+ */
+#define MC_LZ4_BLOCK_MAX    (64U * 1024U)
+#define MC_LZ4_BLOCK_HEADER 8U
+#define MC_LZ4_BLOCK_BOUND  (MC_LZ4_BLOCK_HEADER + MC_LZ4_BLOCK_MAX)
+#define MC_LZ4_STORED       0x80000000U
+
+#define MC_LZ4_HASH_LOG 12
+
+/*
+ * Block encoder. Blocks that do not shrink are sent stored, and after such a
+ * block the next few are stored without trying (the run grows while the
+ * data stays incompressible), so already-compressed files cost little CPU.
+ */
+typedef struct {
+    uint16_t table[1U << MC_LZ4_HASH_LOG];
+    unsigned int skip;    /* blocks still to store without trying */
+    unsigned int backoff; /* length of the next skip run */
+} mc_lz4_encoder_t;
+
+void mc_lz4_encoder_init(mc_lz4_encoder_t *enc);
+
+/* Encodes len (<= MC_LZ4_BLOCK_MAX) bytes into out (MC_LZ4_BLOCK_BOUND bytes); returns the bytes written. */
+size_t mc_lz4_encode_block(mc_lz4_encoder_t *enc, const uint8_t *src, size_t len, uint8_t *out);
+
+/*
+ * Raw LZ4 block codec. compress returns the compressed size, or 0 when the
+ * result would not fit in cap; decompress returns the decoded size, or -1
+ * on malformed input or when it would overrun cap.
+ */
+size_t mc_lz4_compress(mc_lz4_encoder_t *enc, const uint8_t *src, size_t len, uint8_t *dst, size_t cap);
+long mc_lz4_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap);
+
+/*
+ * Incremental block-stream decoder. want() says where the next wire bytes
+ * go and how many are needed to finish the current piece; received()
+ * accounts for n of them and returns 1 when a block is decoded (out,
+ * out_len), 0 when more input is needed, or -1 with errno EPROTO (malformed)
+ * or EFBIG (more than limit decoded bytes in total; UINT64_MAX for none).
+ */
+typedef struct {
+    uint8_t header[MC_LZ4_BLOCK_HEADER];
+    size_t have;          /* bytes of the current header or block received */
+    bool in_block;
+    uint32_t raw_len;
+    uint32_t wire_len;
+    bool stored;
+    uint64_t limit;
+    uint64_t total;       /* decoded bytes so far */
+    const uint8_t *out;
+    size_t out_len;
+    uint8_t block[MC_LZ4_BLOCK_MAX];
+    uint8_t raw[MC_LZ4_BLOCK_MAX];
+} mc_lz4_decoder_t;
+
+void mc_lz4_decoder_init(mc_lz4_decoder_t *dec, uint64_t limit);
+uint8_t *mc_lz4_decoder_want(mc_lz4_decoder_t *dec, size_t *want);
+int mc_lz4_decoder_received(mc_lz4_decoder_t *dec, size_t n);
+
+/* Feeds bytes from *data, advancing it; stops after each decoded block. Same results as received(). */
+int mc_lz4_decoder_push(mc_lz4_decoder_t *dec, const uint8_t **data, size_t *len);
+
+/* True when the stream ended cleanly between blocks. */
+bool mc_lz4_decoder_idle(const mc_lz4_decoder_t *dec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MC_LZ4_H */
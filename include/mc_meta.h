@@ -0,0 +1,113 @@
+#ifndef MC_META_H
+#define MC_META_H
+
+#include "mc_protocol.h"
+#include "mc_sha256.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Metadata index: name -> {size, mtime, SHA-256 when known}, kept in memory
+ * and sorted by name so LIST never has to read the storage directory.
+ *
+ * Every process serving the directory (forked children, workers) holds its
+ * own copy. Changes are appended to a journal file and applied from there,
+ * so each process replays the same records in the same order; a process
+ * catches up on whatever the others appended before it answers from its
+ * copy. The journal is rewritten as one record per file at startup, before
+ * any other process exists, and again by whichever writer finds it has grown
+ * past MC_META_COMPACT_FACTOR records per live file.
+ *
+ * Each rewrite is a new generation: the snapshot opens with a GENERATION
+ * record, is renamed over the journal, and the same record is then appended
+ * to the file it replaced. A process reading that record anywhere but at the
+ * start knows its journal is retired and reloads from the path. Writers hold
+ * a shared fcntl() lock on the journal while appending, and the rewriter an
+ * exclusive one from the snapshot until the retire record, so no record
+ * lands in a journal after its snapshot was taken.
+ */
+#define MC_META_MAGIC "MCMETA01"
+
+#pragma pack(push, 1)
+typedef struct {
+    uint8_t op;         /* MC_META_OP_* */
+    uint8_t has_digest;
+    uint16_t name_len;  /* name bytes follow the record */
+    uint32_t reserved;
+    uint64_t size;
+    int64_t mtime;
+    uint8_t digest[MC_SHA256_DIGEST_LEN];
+} mc_meta_record_t;
+#pragma pack(pop)
+
+enum { MC_META_OP_PUT = 1, MC_META_OP_DELETE = 2, MC_META_OP_GENERATION = 3 /* in size; no name */ };
+
+#define MC_META_COMPACT_FACTOR 4U
+#define MC_META_COMPACT_MIN 1024U /* records below which a journal is never rewritten */
+
+typedef struct {
+    uint64_t size;  /* content size (a manifest's or container's total) */
+    int64_t mtime;  /* seconds since the epoch */
+    bool has_digest;
+    uint8_t digest[MC_SHA256_DIGEST_LEN];
+} mc_meta_info_t;
+
+/*
+ * Startup. open loads journal_path into the index when replay is set and it
+ * holds a journal (returns 1), otherwise starts empty (returns 0) for the
+ * caller to seed(); commit then rewrites the journal from the index and
+ * enables it. Returns -1 on failure, with the index left disabled.
+ */
+int mc_meta_open(const char *journal_path, bool replay);
+int mc_meta_seed(const char *name, const mc_meta_info_t *info);
+int mc_meta_commit(void);
+
+bool mc_meta_enabled(void);
+size_t mc_meta_count(void);
+
+/* Applies records other processes appended since this one last looked. */
+void mc_meta_refresh(void);
+
+/* Journal a change and apply it; -1 if the journal could not be written. */
+int mc_meta_put(const char *name, const mc_meta_info_t *info);
+int mc_meta_remove(const char *name);
+
+/* 1 and *out when name is indexed, 0 when it is not. */
+int mc_meta_get(const char *name, mc_meta_info_t *out);
+
+/*
+ * Builds the LIST payload in name order: "name\n", or "name\tsize\n" with
+ * with_sizes; "(empty)\n" when there is nothing. Caller frees *out.
+ */
+int mc_meta_list(bool with_sizes, char **out, size_t *out_len);
+
+/*
+ * LIST_QUERY: builds one reply page (see mc_list_query_t; query in host
+ * order, *out in network order, caller frees it). mc_meta_query answers
+ * from the index; mc_meta_page does the same over a caller's items in any
+ * order, for when the index is off.
+ */
+typedef struct {
+    const char *name;
+    mc_meta_info_t info;
+} mc_meta_item_t;
+
+int mc_meta_query(const char *pattern, const mc_list_query_t *query, uint8_t **out, size_t *out_len);
+int mc_meta_page(mc_meta_item_t *items,
+                 size_t count,
+                 const char *pattern,
+                 const mc_list_query_t *query,
+                 uint8_t **out,
+                 size_t *out_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MC_META_H */
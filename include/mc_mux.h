@@ -0,0 +1,50 @@
+#ifndef MC_MUX_H
+#define MC_MUX_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MC_MUX_MAX_STREAMS 64
+
+/**
+ * Framed stream mode (protocol v3). After the AUTH exchange every byte on the
+ * connection travels in mc_frame_header_t frames. Each stream carries one
+ * ordinary request and its reply, so the request/response code runs
+ * unchanged on a local socketpair end while the mux moves frames:
+ *
+ *   - a reader thread routes incoming frames to the stream's socketpair,
+ *     creating streams on demand through the accept callback (server side);
+ *   - a writer thread polls every stream and sends at most one frame per
+ *     ready stream per pass, so a large transfer cannot starve a small one.
+ *
+ * There is no per-stream credit window: the consumer of every stream is a
+ * request handler or client transfer that always drains its end, so the
+ * reader only waits for as long as one chunk takes to hit the disk.
+ */
+typedef struct mc_mux mc_mux_t;
+
+/* Called on the reader thread for a stream the peer opened; owns stream_fd. */
+typedef int (*mc_mux_accept_fn)(void *ctx, uint32_t stream_id, int stream_fd);
+
+mc_mux_t *mc_mux_start(int sock_fd, mc_mux_accept_fn accept_fn, void *ctx);
+
+/* Opens a local stream and returns the caller's end (close it when done). */
+int mc_mux_open_stream(mc_mux_t *mux, uint32_t stream_id);
+
+/* Blocks until the peer has finished sending (server side). */
+void mc_mux_wait_peer(mc_mux_t *mux);
+
+/*
+ * Waits for every stream to drain, half-closes the socket, waits for the peer
+ * to close its side and frees the mux. sock_fd stays open for the caller.
+ */
+void mc_mux_finish(mc_mux_t *mux);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MC_MUX_H */
@@ -1,9 +1,11 @@
 #ifndef MC_PROTOCOL_H
 #define MC_PROTOCOL_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -12,10 +14,61 @@ extern "C" {
 /**
  * Mini Cloud wire protocol constants
  */
-#define MC_PROTOCOL_VERSION 1
+#define MC_PROTOCOL_VERSION           1 /* baseline: one request at a time */
+#define MC_PROTOCOL_VERSION_PIPELINED 2 /* header carries request_id */
+#define MC_PROTOCOL_VERSION_MUX       3 /* AUTH only: switch to framed streams */
+#define MC_PROTOCOL_VERSION_MAX       MC_PROTOCOL_VERSION_MUX
 #define MC_PROTOCOL_MAGIC   0x4D434C44U /* 'MCLD' */
 #define MC_MAX_FILENAME_LEN 255
 
+/*
+ * File names may be paths: "/"-separated components below the storage
+ * root, none of them empty, "." or containing "..". Listings (LIST and
+ * LIST_QUERY) cover every level and show a directory as "name/", with size
+ * and mtime 0; an upload creates the directories its name needs.
+ */
+
+/*
+ * LIST options travel in the filename field. MC_LIST_OPT_SIZES makes every
+ * line "name\tsize"; servers that predate it ignore the field.
+ */
+#define MC_LIST_OPT_SIZES "sizes"
+
+/*
+ * AUTH options (v2+) travel in the AUTH filename field as a comma-separated
+ * list; a successful AUTH reply echoes, in its filename field, the ones the
+ * server accepted, and those stay on for the rest of the connection.
+ * Servers that predate an option simply leave it out of the echo.
+ *
+ * MC_AUTH_OPT_CRC32C: every UPLOAD / UPLOAD_APPEND / DELTA request payload
+ * and every DOWNLOAD / DOWNLOAD_RANGE / ARCHIVE reply payload is followed by
+ * MC_CHECKSUM_SIZE bytes: the CRC32C of the file bytes, in network order
+ * (for DOWNLOAD_RANGE, of the bytes after the mc_range_t). The trailer is
+ * not counted in payload_len and ERROR replies never carry one.
+ *
+ * MC_AUTH_OPT_LZ4: UPLOAD / UPLOAD_APPEND request payloads and DOWNLOAD /
+ * DOWNLOAD_RANGE / ARCHIVE reply bodies (after the mc_range_t) are LZ4 block streams
+ * (see mc_lz4.h). A request's payload_len counts the bytes on the wire so a
+ * refused upload can be skipped undecoded; a reply's stays the decoded size,
+ * the blocks being self-delimiting, so the server streams without
+ * compressing ahead. Checksums cover the decoded bytes.
+ *
+ * MC_AUTH_OPT_BUNDLE: the server takes BUNDLE_UPLOAD / BUNDLE_DOWNLOAD (see
+ * mc_bundle_entry_t). It changes nothing else on the connection.
+ */
+#define MC_AUTH_OPT_CRC32C "crc32c"
+#define MC_AUTH_OPT_LZ4    "lz4"
+#define MC_AUTH_OPT_BUNDLE "bundle"
+#define MC_CHECKSUM_SIZE   4U
+
+#define MC_AUTH_CAP_CRC32C 0x1U
+#define MC_AUTH_CAP_LZ4    0x2U
+#define MC_AUTH_CAP_BUNDLE 0x4U
+
+/* Bytes on the wire: v1 stops after payload_len, v2 appends request_id. */
+#define MC_HEADER_V1_SIZE 18U
+#define MC_HEADER_V2_SIZE 22U
+
 /**
  * Commands supported by the Mini Cloud protocol.
  */
@@ -26,7 +79,20 @@ typedef enum {
     MC_CMD_LIST = 3,
     MC_CMD_QUIT = 4,
     MC_CMD_AUTH = 5,
-    MC_CMD_DELETE = 6
+    MC_CMD_DELETE = 6,
+    MC_CMD_DOWNLOAD_RANGE = 7, /* v2+: payload is an mc_range_t or mc_range_if_t */
+    MC_CMD_UPLOAD_BEGIN = 8,   /* v2+: payload is an mc_upload_begin_t */
+    MC_CMD_UPLOAD_APPEND = 9,  /* v2+: filename is the session key */
+    MC_CMD_UPLOAD_COMMIT = 10, /* v2+: payload is an mc_upload_begin_t */
+    MC_CMD_SIGNATURES = 11,    /* v2+: reply payload is an mc_signature_header_t + blocks */
+    MC_CMD_DELTA = 12,         /* v2+: payload is an mc_delta_header_t + ops */
+    MC_CMD_HAVE = 13,          /* v2+: payload is an mc_have_t */
+    MC_CMD_LIST_QUERY = 14,    /* v2+: payload is an mc_list_query_t */
+    MC_CMD_MKDIR = 15,         /* filename is the directory; parents are created */
+    MC_CMD_RMDIR = 16,         /* filename is the directory, which must be empty */
+    MC_CMD_BUNDLE_UPLOAD = 17, /* v2+: payload is a bundle (see mc_bundle_entry_t) */
+    MC_CMD_BUNDLE_DOWNLOAD = 18, /* v2+: payload is a bundle of names, so is the reply */
+    MC_CMD_ARCHIVE = 19          /* filename is the directory, empty for all; reply is a tar stream */
 } mc_command_t;
 
 #pragma pack(push, 1)
@@ -36,9 +102,235 @@ typedef struct {
     uint8_t  command;      /* mc_command_t */
     uint32_t filename_len; /* bytes, not including null terminator */
     uint64_t payload_len;  /* bytes of payload that follow */
+    uint32_t request_id;   /* v2+: echoed in the reply; 0 and not sent for v1 */
 } mc_packet_header_t;
 #pragma pack(pop)
 
+/*
+ * DOWNLOAD_RANGE request payload: offset and length, length 0 meaning "to the
+ * end of the file". The reply payload starts with an mc_range_t holding the
+ * offset actually served and the total file size (in length), followed by
+ * the bytes, so a client can tell whether its copy is now complete.
+ *
+ * A client resuming a partial file sends an mc_range_if_t instead
+ * (MC_RANGE_IF_SIZE bytes): validator is the one the reply that started
+ * the file carried, 0 for a fresh download. The reply then starts with an
+ * mc_range_if_t as well, holding the stored copy's current validator. When
+ * the request's validator is set and no longer matches, the file changed
+ * since: the offset is ignored and the whole file is served from 0 (like
+ * HTTP If-Range), so bytes of two different copies are never joined.
+ */
+#define MC_RANGE_SIZE 16U
+#define MC_RANGE_IF_SIZE 24U
+
+#pragma pack(push, 1)
+typedef struct {
+    uint64_t offset;
+    uint64_t length;
+} mc_range_t;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t length;
+    uint64_t validator;
+} mc_range_if_t;
+#pragma pack(pop)
+
+/*
+ * Resumable upload sessions. UPLOAD_BEGIN names the target file and the
+ * version of the source being sent (total size, a client tag such as its
+ * mtime and the SHA-256 of the whole file); the server derives a session key
+ * from all of them, so re-running the same upload later finds the same
+ * session and a source whose content changed never continues an old one.
+ * Its reply carries the key in the filename field and an mc_range_t
+ * {committed bytes, total size}.
+ * UPLOAD_APPEND (filename = key) adds its payload at the committed offset
+ * and answers with the new offset; whatever arrived before a failure stays
+ * committed. UPLOAD_COMMIT repeats the BEGIN payload and publishes the file
+ * once every byte is there and the bytes hash to sha256; a session that does
+ * not is discarded.
+ */
+#define MC_UPLOAD_KEY_LEN 16U
+
+#pragma pack(push, 1)
+typedef struct {
+    uint64_t total_size;
+    uint64_t tag;
+    uint8_t  sha256[32];
+} mc_upload_begin_t;
+#pragma pack(pop)
+
+/*
+ * Delta sync. SIGNATURES asks for the block signatures of the server's copy
+ * of a file: an mc_signature_header_t followed by block_count mc_block_sig_t,
+ * each block block_size bytes except possibly the last. DELTA then rebuilds
+ * the file from an mc_delta_header_t followed by ops: COPY {block, count}
+ * takes count blocks of the old copy starting at block, LITERAL {length, 0}
+ * is followed by length new bytes. The server checks that its copy still
+ * matches base_size/block_size and that the result hashes to sha256 before
+ * replacing the file.
+ */
+#define MC_DELTA_STRONG_LEN 16U
+#define MC_DELTA_OP_COPY 'C'
+#define MC_DELTA_OP_LITERAL 'L'
+
+#pragma pack(push, 1)
+typedef struct {
+    uint32_t block_size;
+    uint32_t block_count;
+    uint64_t file_size;
+} mc_signature_header_t;
+
+typedef struct {
+    uint32_t weak;                        /* rolling checksum, see mc_delta.h */
+    uint8_t  strong[MC_DELTA_STRONG_LEN]; /* leading bytes of the SHA-256 */
+} mc_block_sig_t;
+
+typedef struct {
+    uint32_t block_size;
+    uint32_t block_count;
+    uint64_t base_size;
+    uint64_t new_size;
+    uint8_t  sha256[32];
+} mc_delta_header_t;
+
+typedef struct {
+    uint8_t  type; /* MC_DELTA_OP_* */
+    uint32_t arg;  /* COPY: first block, LITERAL: byte count */
+    uint32_t count; /* COPY: block count, LITERAL: 0 */
+} mc_delta_op_t;
+#pragma pack(pop)
+
+/*
+ * HAVE asks whether the server can store name with the given content
+ * without receiving it: it answers MC_HAVE_STORED once name holds that
+ * content (it already did, or an identical blob was linked in) and
+ * MC_HAVE_MISSING when the bytes have to be uploaded.
+ */
+#define MC_HAVE_STORED "STORED"
+#define MC_HAVE_MISSING "MISSING"
+
+#pragma pack(push, 1)
+typedef struct {
+    uint64_t size;
+    uint8_t  sha256[32];
+} mc_have_t;
+#pragma pack(pop)
+
+/*
+ * LIST_QUERY: one page of the listing as binary records. The filename field
+ * is an fnmatch() pattern (empty for every file; "*" also matches "/", so
+ * "dir/" followed by "*" is everything below dir); the payload is an
+ * mc_list_query_t. The reply payload is an mc_list_page_t, cursor_len
+ * cursor bytes, then count records, each an mc_list_record_t followed by
+ * name_len name bytes. A non-empty cursor means more files follow: sending
+ * it back in the next query (same pattern and sort) resumes right after the
+ * last record. Pages hold at most MC_LIST_PAGE_MAX records; limit 0 asks
+ * for MC_LIST_PAGE_DEFAULT.
+ */
+#define MC_LIST_CURSOR_MAX   280U
+#define MC_LIST_PAGE_DEFAULT 1000U
+#define MC_LIST_PAGE_MAX     10000U
+#define MC_LIST_HAS_DIGEST   0x1U
+
+typedef enum {
+    MC_LIST_SORT_NAME = 0,
+    MC_LIST_SORT_NAME_DESC = 1,
+    MC_LIST_SORT_SIZE_DESC = 2, /* ties in name order, as for the others */
+    MC_LIST_SORT_SIZE = 3,
+    MC_LIST_SORT_MTIME_DESC = 4
+} mc_list_sort_t;
+
+#pragma pack(push, 1)
+typedef struct {
+    uint32_t limit;
+    uint8_t  sort;        /* mc_list_sort_t */
+    uint8_t  reserved;
+    uint16_t cursor_len;
+    char     cursor[MC_LIST_CURSOR_MAX]; /* from the previous page */
+} mc_list_query_t;
+
+typedef struct {
+    uint32_t count;
+    uint16_t cursor_len;
+    uint16_t reserved;
+} mc_list_page_t;
+
+typedef struct {
+    uint64_t size;
+    int64_t  mtime;       /* seconds since the epoch */
+    uint16_t name_len;
+    uint8_t  flags;       /* MC_LIST_HAS_DIGEST: sha256 is the content's */
+    uint8_t  reserved;
+    uint8_t  sha256[32];
+} mc_list_record_t;
+#pragma pack(pop)
+
+/*
+ * Bundles carry many small files in one request. A bundle is a run of
+ * records, each an mc_bundle_entry_t, name_len name bytes, then size bytes
+ * of data whose CRC32C is crc.
+ *
+ * BUNDLE_UPLOAD stores each record's data under its name (the filename
+ * field is unused). The whole bundle is checked first (names, sizes, CRCs),
+ * so a bad record stores nothing; then the files are stored in order, each
+ * replaced atomically as by UPLOAD. The reply message counts them.
+ *
+ * BUNDLE_DOWNLOAD names the files as records without data. The reply is a
+ * bundle with one record per name, in order: MC_BUNDLE_OK with the content,
+ * MC_BUNDLE_ERROR with the error message as its data, or MC_BUNDLE_SKIPPED
+ * (no data) for a file over MC_BUNDLE_FILE_MAX or one that would take the
+ * reply past MC_BUNDLE_DATA_MAX, to be downloaded on its own.
+ *
+ * A bundle holds at most MC_BUNDLE_MAX_FILES records of at most
+ * MC_BUNDLE_FILE_MAX bytes, MC_BUNDLE_DATA_MAX in all. The checksum and LZ4
+ * options do not apply to bundles.
+ */
+#define MC_BUNDLE_MAX_FILES 4096U
+#define MC_BUNDLE_FILE_MAX  (1U << 20)
+#define MC_BUNDLE_DATA_MAX  (16U << 20)
+#define MC_BUNDLE_ENTRY_SIZE 16U
+#define MC_BUNDLE_WIRE_MAX \
+    ((uint64_t)MC_BUNDLE_DATA_MAX + (uint64_t)MC_BUNDLE_MAX_FILES * (MC_BUNDLE_ENTRY_SIZE + MC_MAX_FILENAME_LEN))
+
+#define MC_BUNDLE_OK      0U
+#define MC_BUNDLE_ERROR   1U
+#define MC_BUNDLE_SKIPPED 2U
+
+#pragma pack(push, 1)
+typedef struct {
+    uint64_t size;
+    uint32_t crc;
+    uint16_t name_len;
+    uint8_t  status;   /* replies: MC_BUNDLE_*; requests send MC_BUNDLE_OK */
+    uint8_t  reserved;
+} mc_bundle_entry_t;
+#pragma pack(pop)
+
+/*
+ * ARCHIVE replies with everything stored below the directory in the
+ * filename field (all of storage when it is empty) as one tar stream (see
+ * mc_tar.h), built while it is sent: nothing is staged on the server.
+ * Entries keep their full names, the directory's own entry comes first and
+ * every directory precedes its contents. payload_len is the exact length of
+ * the stream, and the checksum and LZ4 options apply as to a DOWNLOAD body.
+ */
+
+/*
+ * Framed stream mode (v3): once the server answers a v3 AUTH with a v3
+ * header, both directions carry only frames. length == 0 ends the sender's
+ * half of the stream.
+ */
+#define MC_FRAME_HEADER_SIZE 8U
+#define MC_FRAME_MAX_PAYLOAD (64U * 1024U)
+
+#pragma pack(push, 1)
+typedef struct {
+    uint32_t stream_id;
+    uint32_t length;
+} mc_frame_header_t;
+#pragma pack(pop)
+
 /**
  * Lightweight descriptor after parsing the header and optional filename.
  */
@@ -52,16 +344,97 @@ int mc_build_header(mc_packet_header_t *out,
                     const char *filename,
                     uint64_t payload_len);
 
+/*
+ * Builds a reply to request: same header version and request_id, so a
+ * pipelining client can match it and a v1 client still gets a v1 header.
+ */
+int mc_build_reply_header(mc_packet_header_t *out,
+                          const mc_packet_header_t *request,
+                          mc_command_t command,
+                          const char *filename,
+                          uint64_t payload_len);
+
 int mc_validate_header(const mc_packet_header_t *header);
 
+/* Wire size for header->version; safe on either byte order. */
+size_t mc_header_wire_size(const mc_packet_header_t *header);
+
 void mc_header_host_to_network(mc_packet_header_t *header);
 void mc_header_network_to_host(mc_packet_header_t *header);
 
+void mc_range_host_to_network(mc_range_t *range);
+void mc_range_network_to_host(mc_range_t *range);
+
+void mc_range_if_host_to_network(mc_range_if_t *range);
+void mc_range_if_network_to_host(mc_range_if_t *range);
+
+void mc_upload_begin_host_to_network(mc_upload_begin_t *begin);
+void mc_upload_begin_network_to_host(mc_upload_begin_t *begin);
+
+void mc_signature_host_to_network(mc_signature_header_t *sig);
+void mc_signature_network_to_host(mc_signature_header_t *sig);
+
+void mc_delta_host_to_network(mc_delta_header_t *delta);
+void mc_delta_network_to_host(mc_delta_header_t *delta);
+
+void mc_have_host_to_network(mc_have_t *have);
+void mc_have_network_to_host(mc_have_t *have);
+
+void mc_list_query_host_to_network(mc_list_query_t *query);
+void mc_list_query_network_to_host(mc_list_query_t *query);
+void mc_list_page_host_to_network(mc_list_page_t *page);
+void mc_list_page_network_to_host(mc_list_page_t *page);
+void mc_list_record_host_to_network(mc_list_record_t *record);
+void mc_list_record_network_to_host(mc_list_record_t *record);
+void mc_bundle_entry_host_to_network(mc_bundle_entry_t *entry);
+void mc_bundle_entry_network_to_host(mc_bundle_entry_t *entry);
+
+/* Whether a checksummed connection appends a trailer to this request / reply. */
+int mc_request_has_checksum(uint8_t command);
+int mc_reply_has_checksum(uint8_t command);
+
+/* Whether an LZ4 connection compresses this request payload / reply body. */
+int mc_request_is_compressed(uint8_t command);
+int mc_reply_is_compressed(uint8_t command);
+
+/* The MC_AUTH_CAP_* bits of the connection's caps that apply to this request / reply. */
+unsigned int mc_request_caps(unsigned int caps, uint8_t command);
+unsigned int mc_reply_caps(unsigned int caps, uint8_t command);
+
+/*
+ * AUTH option lists: parse maps the known names to MC_AUTH_CAP_* bits and
+ * ignores the rest; format writes the list for caps ("" for none).
+ */
+unsigned int mc_auth_parse_options(const char *options);
+void mc_auth_format_options(unsigned int caps, char *out, size_t out_len);
+
+void mc_frame_host_to_network(mc_frame_header_t *frame);
+void mc_frame_network_to_host(mc_frame_header_t *frame);
+
 ssize_t mc_send_all(int fd, const void *buf, size_t len);
 ssize_t mc_recv_all(int fd, void *buf, size_t len);
 int mc_send_header(int fd, const mc_packet_header_t *header);
 int mc_recv_header(int fd, mc_packet_header_t *out);
 
+/*
+ * Gathered sends: one sendmsg() (writev() on non-sockets) per call instead
+ * of a write per piece. iov is consumed as bytes go out. more sets
+ * MSG_MORE so a header that is followed by a body shares its segment.
+ */
+int mc_send_iov_all(int fd, struct iovec *iov, int count, bool more);
+/* Header (host order), filename (header->filename_len bytes) and payload. */
+int mc_send_packet(int fd,
+                   const mc_packet_header_t *header,
+                   const char *filename,
+                   const void *payload,
+                   size_t payload_len,
+                   bool more);
+/* TCP_CORK on/off around a body and its trailer; no-op on non-TCP fds. */
+void mc_set_cork(int fd, bool on);
+
+/* 0 on success, -1 on EOF or I/O error, -2 on an oversized frame. */
+int mc_recv_frame_header(int fd, mc_frame_header_t *out);
+
 #ifdef __cplusplus
 }
 #endif
@@ -7,12 +7,47 @@
 extern "C" {
 #endif
 
+typedef enum {
+    MC_SERVER_ENGINE_FORK = 0, /* one child process per connection */
+    MC_SERVER_ENGINE_EPOLL = 1, /* single process, non-blocking sockets + epoll */
+    MC_SERVER_ENGINE_URING = 2  /* single process, completion-based io_uring */
+} mc_server_engine_t;
+
+typedef enum {
+    MC_STORAGE_MODE_PLAIN = 0,     /* one file per upload */
+    MC_STORAGE_MODE_CHUNKED = 1,   /* deduplicated chunks + per-file manifests */
+    MC_STORAGE_MODE_COMPRESSED = 2 /* LZ4 block containers with a seek index */
+} mc_storage_mode_t;
+
+typedef enum {
+    MC_META_INDEX_MEMORY = 0,  /* in-memory index, rebuilt by scanning the dir at startup */
+    MC_META_INDEX_PERSIST = 1, /* same, but loaded from the journal left by the last run */
+    MC_META_INDEX_OFF = 2      /* no index: LIST reads the directory every time */
+} mc_meta_mode_t;
+
+typedef enum {
+    MC_STORAGE_LAYOUT_FLAT = 0,   /* every name is stored at its own path */
+    MC_STORAGE_LAYOUT_SHARDED = 1 /* every entry sits in xx/yy/ below its directory (see mc_storage.h) */
+} mc_storage_layout_t;
+
+typedef enum {
+    MC_DOWNLOAD_IO_SENDFILE = 0, /* sendfile(), or read into a per-connection buffer */
+    MC_DOWNLOAD_IO_MMAP = 1      /* large bodies are sent straight from a shared file mapping */
+} mc_download_io_t;
+
 typedef struct {
     uint16_t port;
     int backlog;
     const char *storage_dir;
     const char *auth_token;    /* optional shared secret, NULL to disable */
     uint64_t max_upload_bytes; /* 0 means unlimited */
+    mc_server_engine_t engine;
+    int workers;               /* >0: pre-forked workers with SO_REUSEPORT listeners */
+    mc_storage_mode_t storage_mode;
+    mc_meta_mode_t meta_mode;
+    mc_storage_layout_t storage_layout;
+    uint64_t file_cache_bytes; /* hot-file cache size, 0 to disable */
+    mc_download_io_t download_io;
 } mc_server_config_t;
 
 int mc_server_run(const mc_server_config_t *config);
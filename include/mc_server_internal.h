@@ -0,0 +1,157 @@
+#ifndef MC_SERVER_INTERNAL_H
+#define MC_SERVER_INTERNAL_H
+
+#include "mc_protocol.h"
+#include "mc_server.h"
+#include "mc_storage.h"
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MC_MAX_AUTH_TOKEN_LEN 256
+#define MC_SPLICE_PIPE_SIZE (1 << 20)
+
+/*
+ * Helpers shared between mc_server.c and the alternative engines.
+ */
+int mc_server_should_terminate(void);
+void mc_server_log_command(const struct sockaddr_in *addr, const mc_packet_info_t *info);
+
+/*
+ * The range a DOWNLOAD_RANGE reply starts with, in network order in out:
+ * returns its size on the wire, which follows the request's form
+ * (MC_RANGE_SIZE or MC_RANGE_IF_SIZE), or 0 for a plain DOWNLOAD.
+ */
+size_t mc_server_range_prefix(const mc_packet_header_t *request, const mc_download_t *body, mc_range_if_t *out);
+
+/*
+ * Options a successful AUTH reply echoes in its filename field: returns the
+ * MC_AUTH_CAP_* bits accepted out of a v2+ request's option list (0 for v1)
+ * and writes their names to echo. They hold for the rest of the connection.
+ */
+#define MC_AUTH_ECHO_MAX 64
+unsigned int mc_server_auth_options(const mc_packet_info_t *info, char *echo, size_t echo_len);
+
+/*
+ * Client-facing error for an upload body that arrived in full but did not
+ * decode or verify: problem is EFBIG (decoded past the upload limit), EPROTO
+ * (malformed LZ4 stream) or EBADMSG (checksum mismatch).
+ */
+void mc_server_body_error(const mc_server_config_t *config, int problem, char *err, size_t err_len);
+
+/*
+ * Body of a reply served from the hot-file cache (see
+ * mc_storage_cached_reply) in the form caps ask for: iov gets the bytes, or
+ * one LZ4 block encoded into scratch (MC_LZ4_BLOCK_BOUND bytes, only needed
+ * then), and then *trailer when checksums are on. Returns the iovec count,
+ * or -1.
+ */
+int mc_server_cached_body(const uint8_t *data,
+                          const mc_download_t *body,
+                          unsigned int caps,
+                          uint8_t *scratch,
+                          uint32_t *trailer,
+                          struct iovec iov[2]);
+
+/*
+ * MC_DOWNLOAD_IO=mmap: a download body of at least MC_MMAP_MIN_BODY bytes is
+ * mapped read-only and shared, so every connection sending the same file
+ * reads the same page cache pages and no per-connection read buffer is
+ * needed. The mapping is advised sequential, and mc_server_mapped_at keeps
+ * MADV_WILLNEED readahead MC_MMAP_WINDOW bytes in front of the sender.
+ */
+#define MC_MMAP_MIN_BODY (1U << 20)
+#define MC_MMAP_WINDOW   (8U << 20)
+
+typedef struct {
+    void *base;          /* NULL when the body is not mapped */
+    size_t map_len;
+    const uint8_t *data; /* the body's first byte */
+    uint64_t offset;     /* file offset of data[0] */
+    uint64_t length;
+    uint64_t advised;    /* body bytes covered by WILLNEED so far */
+} mc_mapped_body_t;
+
+/* Maps length bytes of fd from offset when config asks for it; false (map cleared) to use fd. */
+bool mc_server_map_body(const mc_server_config_t *config,
+                        int fd,
+                        uint64_t offset,
+                        uint64_t length,
+                        mc_mapped_body_t *map);
+/* The body byte at file offset at, advising the window after it. */
+const uint8_t *mc_server_mapped_at(mc_mapped_body_t *map, uint64_t at);
+void mc_server_unmap_body(mc_mapped_body_t *map);
+
+/*
+ * Zero-copy upload path: socket -> pipe -> file via splice(). The helper
+ * returns the bytes taken from the socket, 0 at EOF or -1 on error (EAGAIN
+ * when nonblock is set and nothing is queued). A failed file write sets
+ * *file_failed; the socket bytes are still consumed so framing stays intact.
+ */
+int mc_server_open_splice_pipe(int pipe_fds[2]);
+void mc_server_close_splice_pipe(int pipe_fds[2]);
+ssize_t mc_server_splice_to_file(int sock_fd,
+                                 const int pipe_fds[2],
+                                 int file_fd,
+                                 size_t len,
+                                 bool nonblock,
+                                 bool *file_failed);
+
+/*
+ * Storage work too slow for an event loop (SIGNATURES reads the whole file,
+ * HAVE may hash one) runs on a thread of its own instead: the engine fills in a job, submits it
+ * and leaves the connection waiting; finished jobs are collected with
+ * mc_offload_reap once mc_offload_fd (an eventfd) turns readable, and the
+ * reply is queued from their results. A connection that goes away meanwhile
+ * clears owner and the job is simply freed when it comes back.
+ */
+typedef struct mc_offload mc_offload_t;
+
+typedef struct mc_offload_job {
+    struct mc_offload_job *next; /* reap list */
+    mc_offload_t *offload;
+    void *owner;                 /* the engine's connection, NULL once it is gone */
+    mc_command_t command;        /* MC_CMD_SIGNATURES or MC_CMD_HAVE */
+    char filename[MC_MAX_FILENAME_LEN + 1];
+    mc_have_t have;              /* HAVE request, host order */
+    int rc;                      /* 0, or -1 with err */
+    char err[256];
+    uint8_t *payload;            /* SIGNATURES reply payload */
+    size_t payload_len;
+    bool stored;                 /* HAVE answer */
+} mc_offload_job_t;
+
+/* NULL when no eventfd could be had; the engine then runs jobs inline. */
+mc_offload_t *mc_offload_create(const mc_server_config_t *config);
+int mc_offload_fd(const mc_offload_t *offload);
+/* -1 when no thread could be started: run the job inline with mc_offload_run. */
+int mc_offload_submit(mc_offload_t *offload, mc_offload_job_t *job);
+void mc_offload_run(const mc_server_config_t *config, mc_offload_job_t *job);
+/* The jobs finished since the last call, linked through next. */
+mc_offload_job_t *mc_offload_reap(mc_offload_t *offload);
+void mc_offload_free_job(mc_offload_job_t *job);
+/* Jobs still running free themselves when they finish. */
+void mc_offload_destroy(mc_offload_t *offload);
+
+/* Event-driven engine: serves listen_fd until termination is requested. */
+int mc_server_run_epoll(const mc_server_config_t *config, int listen_fd);
+
+/*
+ * Completion-based engine on io_uring. Fails with ENOSYS before serving
+ * anything when the kernel (or the build) lacks the required operations, so
+ * the caller can fall back to epoll.
+ */
+int mc_server_run_uring(const mc_server_config_t *config, int listen_fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MC_SERVER_INTERNAL_H */
@@ -0,0 +1,39 @@
+#ifndef MC_SHA256_H
+#define MC_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MC_SHA256_DIGEST_LEN 32U
+#define MC_SHA256_HEX_LEN    64U
+
+/* Incremental SHA-256 (FIPS 180-4), used to name content by its hash. */
+typedef struct {
+    uint32_t state[8];
+    uint64_t total_len;
+    uint8_t block[64];
+    size_t block_len;
+} mc_sha256_t;
+
+void mc_sha256_init(mc_sha256_t *ctx);
+void mc_sha256_update(mc_sha256_t *ctx, const void *data, size_t len);
+void mc_sha256_final(mc_sha256_t *ctx, uint8_t digest[MC_SHA256_DIGEST_LEN]);
+
+/* One-shot helper. */
+void mc_sha256(const void *data, size_t len, uint8_t digest[MC_SHA256_DIGEST_LEN]);
+
+/* Lowercase hex; out must hold MC_SHA256_HEX_LEN + 1 bytes. */
+void mc_sha256_to_hex(const uint8_t digest[MC_SHA256_DIGEST_LEN], char *out);
+
+/* Parses MC_SHA256_HEX_LEN lowercase hex digits; returns -1 on anything else. */
+int mc_sha256_from_hex(const char *hex, uint8_t digest[MC_SHA256_DIGEST_LEN]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MC_SHA256_H */
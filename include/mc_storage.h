@@ -0,0 +1,407 @@
+#ifndef MC_STORAGE_H
+#define MC_STORAGE_H
+
+#include "mc_meta.h"
+#include "mc_protocol.h"
+#include "mc_server.h"
+#include "mc_sha256.h"
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MC_STORAGE_PATH_MAX PATH_MAX
+
+/* Upload session files live here, out of LIST's way. */
+#define MC_STORAGE_SESSION_DIR ".uploads"
+
+/* Content index for HAVE: <storage>/.blobs/<xx>/<sha256> hard links to stored files. */
+#define MC_STORAGE_BLOB_DIR ".blobs"
+
+/* Metadata index journal (see mc_meta.h), kept for MC_META_INDEX=persist. */
+#define MC_STORAGE_META_LOG ".meta.log"
+
+/*
+ * Sharded layout (MC_STORAGE_LAYOUT=sharded): each entry of a directory, the
+ * root included, is kept two levels further down in <xx>/<yy>/, two hex
+ * digits each from a hash of the entry's own name, so a million names in
+ * one directory spread over 65536 small ones on disk. "docs/a.txt" is stored as
+ * <xx>/<yy>/docs/<xx>/<yy>/a.txt. Names, LIST and the index are unchanged.
+ * The marker file records that a storage dir is sharded; the staging
+ * directory only exists while migrate_layout runs.
+ */
+#define MC_STORAGE_LAYOUT_FILE ".layout"
+#define MC_STORAGE_LAYOUT_STAGING ".relayout"
+
+/*
+ * Stored files that are not the uploaded bytes themselves (LZ4 containers,
+ * chunk manifests) carry this extended attribute naming their format. A
+ * file without it is served exactly as stored, whatever its first bytes, so
+ * an upload that happens to look like a container comes back unchanged.
+ */
+#define MC_STORAGE_FORMAT_XATTR "user.mc.format"
+
+/* Tags fd with format; -1 with errno (ENOTSUP where the file system has no user xattrs). */
+int mc_storage_mark_format(int fd, const char *format);
+/* Whether fd was tagged with format by mc_storage_mark_format(). */
+bool mc_storage_has_format(int fd, const char *format);
+
+/**
+ * An in-flight upload, published by mc_storage_commit_upload(). The temp file
+ * is created, renamed and removed relative to dir_fd, so a directory swapped
+ * for a symlink after the check cannot redirect the upload.
+ */
+typedef struct {
+    int fd;                               /* hidden temp file, -1 until opened */
+    int dir_fd;                           /* directory of both paths, opened when the name is checked */
+    bool keep_partial;                    /* abort keeps what arrived (sessions) */
+    bool compress;                        /* compressed mode: commit publishes an LZ4 container if smaller */
+    bool digest_known;                    /* digest holds the content SHA-256 (a verified delta) */
+    uint8_t digest[MC_SHA256_DIGEST_LEN]; /* recorded in the metadata index by commit */
+    uint64_t append_from;                 /* where this UPLOAD_APPEND started */
+    const char *chunk_root;               /* chunked mode: commit feeds the chunk store instead */
+    char name[MC_MAX_FILENAME_LEN + 1];   /* the stored name, for the metadata index */
+    char tmp_path[MC_STORAGE_PATH_MAX];   /* temp file; the session file for UPLOAD_APPEND */
+    char final_path[MC_STORAGE_PATH_MAX]; /* publish target; empty for UPLOAD_APPEND */
+} mc_upload_t;
+
+/*
+ * Storage operations shared by every server engine. On failure they return -1
+ * and leave a client-facing message in err.
+ *
+ * Names are paths below the storage root (see MC_MAX_FILENAME_LEN). Their
+ * directories are opened one component at a time with openat() and never
+ * through a symlink, so a name cannot lead outside the root. Uploads create
+ * the directories they need.
+ */
+int mc_storage_is_safe_name(const char *name);
+
+/*
+ * Validates, opens the target's directory and fills in the paths; fd stays
+ * -1 (for async engines, which open mc_storage_leaf(tmp_path) against
+ * dir_fd themselves). commit, abort and finish_append release dir_fd; an
+ * engine that publishes on its own calls mc_storage_release_upload().
+ */
+int mc_storage_prepare_upload(const mc_server_config_t *config,
+                              const char *name,
+                              uint64_t payload_len,
+                              mc_upload_t *out,
+                              char *err,
+                              size_t err_len);
+int mc_storage_begin_upload(const mc_server_config_t *config,
+                            const char *name,
+                            uint64_t payload_len,
+                            mc_upload_t *out,
+                            char *err,
+                            size_t err_len);
+int mc_storage_commit_upload(mc_upload_t *upload, char *err, size_t err_len);
+void mc_storage_abort_upload(mc_upload_t *upload);
+void mc_storage_release_upload(mc_upload_t *upload);
+
+/* The last component of path: what the *at() calls take against dir_fd. */
+const char *mc_storage_leaf(const char *path);
+
+/*
+ * Drops a payload that arrived complete but failed its checksum: unlike
+ * abort, an append is also cut back to append_from so the session never
+ * commits the damaged bytes.
+ */
+void mc_storage_reject_upload(mc_upload_t *upload);
+
+/*
+ * Decoded bytes this upload may still take under MC_MAX_UPLOAD_BYTES
+ * (UINT64_MAX when unlimited). Compressed payloads are begun with
+ * payload_len 0 and held to this as they are decoded instead.
+ */
+uint64_t mc_storage_upload_room(const mc_server_config_t *config, const mc_upload_t *upload);
+
+/*
+ * Upload sessions (UPLOAD_BEGIN/APPEND/COMMIT). begin creates the session
+ * file if needed and reports its key and committed size. prepare_append only
+ * fills in the paths (async engines open the file themselves and then call
+ * check_append); begin_append opens, locks and positions it at the end.
+ * finish_append hashes the bytes the append added into the session's running
+ * SHA-256 (<key>.part.sha256), closes it and reports the new committed size.
+ * commit_session finishes that hash, publishes the session file only once it
+ * matches begin->sha256 and discards it when it does not.
+ */
+int mc_storage_begin_session(const mc_server_config_t *config,
+                             const char *name,
+                             const mc_upload_begin_t *begin,
+                             char *key_out,
+                             uint64_t *committed,
+                             char *err,
+                             size_t err_len);
+int mc_storage_prepare_append(const mc_server_config_t *config,
+                              const char *key,
+                              mc_upload_t *out,
+                              char *err,
+                              size_t err_len);
+int mc_storage_check_append(const mc_server_config_t *config,
+                            mc_upload_t *upload,
+                            uint64_t payload_len,
+                            uint64_t *committed,
+                            char *err,
+                            size_t err_len);
+int mc_storage_begin_append(const mc_server_config_t *config,
+                            const char *key,
+                            uint64_t payload_len,
+                            mc_upload_t *out,
+                            char *err,
+                            size_t err_len);
+int mc_storage_finish_append(mc_upload_t *upload, uint64_t *committed, char *err, size_t err_len);
+int mc_storage_commit_session(const mc_server_config_t *config,
+                              const char *name,
+                              const mc_upload_begin_t *begin,
+                              char *err,
+                              size_t err_len);
+
+/*
+ * Validates name for command op and opens the directory holding it (sharded
+ * or not): *dir_fd, which the caller closes, and the leaf to use against it.
+ */
+int mc_storage_resolve(const mc_server_config_t *config,
+                       const char *name,
+                       const char *op,
+                       int *dir_fd,
+                       char *leaf,
+                       size_t leaf_len,
+                       char *err,
+                       size_t err_len);
+
+int mc_storage_open_download(const mc_server_config_t *config,
+                             const char *name,
+                             int *out_fd,
+                             uint64_t *out_size,
+                             char *err,
+                             size_t err_len);
+
+/*
+ * The body of a DOWNLOAD/DOWNLOAD_RANGE reply: length file bytes from offset,
+ * read from fd at that offset. A compressed-mode container only has the
+ * blocks in the range decoded. When the reply goes out as LZ4 blocks and the
+ * container already holds exactly those (see mc_zfile_block_span),
+ * stored_blocks is set instead: fd is the container itself, the body is its
+ * wire_len bytes from wire_offset as they are, and crc is the trailer.
+ * validator identifies the stored copy (see mc_storage_validator).
+ */
+typedef struct {
+    int fd;
+    uint64_t validator;
+    uint64_t file_size;
+    uint64_t offset;
+    uint64_t length;
+    bool stored_blocks;
+    uint64_t wire_offset;
+    uint64_t wire_len;
+    uint32_t crc;
+} mc_download_t;
+
+/* range is NULL for a plain DOWNLOAD; caps are the reply's (mc_reply_caps). */
+int mc_storage_open_reply(const mc_server_config_t *config,
+                          const char *name,
+                          const mc_range_if_t *range,
+                          unsigned int caps,
+                          mc_download_t *out,
+                          char *err,
+                          size_t err_len);
+
+/*
+ * Hot-file cache (see mc_cache.h), tried ahead of open_reply, which fills it
+ * when it opens a small file to send whole. Returns 1 when name's current
+ * copy is resident: data (MC_CACHE_MAX_FILE bytes) gets the whole file, the
+ * reply is its out->length bytes from out->offset, out->crc is their CRC32C
+ * and out->fd is -1. Returns 0 to go to disk (missing files included) and
+ * -1 with err for a range past the end.
+ */
+int mc_storage_cached_reply(const mc_server_config_t *config,
+                            const char *name,
+                            const mc_range_if_t *range,
+                            uint8_t *data,
+                            mc_download_t *out,
+                            char *err,
+                            size_t err_len);
+
+/*
+ * The DOWNLOAD_RANGE validator of a stored file: any upload replaces the
+ * file (a new inode) and any change in place moves its mtime, so a partial
+ * download cut from another copy never matches. Never 0.
+ */
+uint64_t mc_storage_validator(uint64_t ino, int64_t mtime_sec, int64_t mtime_nsec, uint64_t size);
+
+/*
+ * Starts out (offset, length, validator) for the stored copy validator
+ * names: range as requested (NULL for the whole file), or the whole file
+ * when range carries the validator of another copy. Clamp it afterwards.
+ */
+void mc_storage_start_range(const mc_range_if_t *range, uint64_t validator, mc_download_t *out);
+
+/*
+ * Clamps a DOWNLOAD_RANGE request to a file of file_size bytes: length 0, or
+ * one running past the end, becomes "to the end". An offset beyond the end
+ * is an error; offset == file_size yields an empty range.
+ */
+int mc_storage_clamp_range(uint64_t file_size,
+                           uint64_t offset,
+                           uint64_t *length,
+                           char *err,
+                           size_t err_len);
+
+/*
+ * Delta sync. build_signatures returns the SIGNATURES reply payload (network
+ * byte order, caller frees *out). apply_delta takes a DELTA payload already
+ * received into delta's temp file, rebuilds name from it and the current copy
+ * and publishes the result like an upload; the delta temp file is always
+ * removed.
+ */
+int mc_storage_build_signatures(const mc_server_config_t *config,
+                                const char *name,
+                                uint8_t **out,
+                                size_t *out_len,
+                                char *err,
+                                size_t err_len);
+int mc_storage_apply_delta(const mc_server_config_t *config,
+                           const char *name,
+                           mc_upload_t *delta,
+                           char *err,
+                           size_t err_len);
+
+/*
+ * HAVE: sets *stored when name now holds the content described by have,
+ * either because it already did or because an indexed blob with that hash
+ * was linked in. A name whose size matches but is not indexed yet is hashed
+ * once and, if it matches, indexed. have_unhashed answers the same without
+ * reading any file: it returns 1 where only hashing name could tell, for the
+ * caller to run mc_storage_have where blocking is fine.
+ */
+int mc_storage_have(const mc_server_config_t *config,
+                    const char *name,
+                    const mc_have_t *have,
+                    bool *stored,
+                    char *err,
+                    size_t err_len);
+int mc_storage_have_unhashed(const mc_server_config_t *config,
+                             const char *name,
+                             const mc_have_t *have,
+                             bool *stored,
+                             char *err,
+                             size_t err_len);
+
+/*
+ * Metadata index. open_index loads or rebuilds it per config->meta_mode
+ * before the server starts taking connections; returns the number of files
+ * indexed, or -1. The other operations keep it current themselves; engines
+ * that publish or delete with their own syscalls (io_uring's rename and
+ * unlink) report it with note_committed / note_deleted afterwards, which
+ * also drop the name from the hot-file cache.
+ */
+long mc_storage_open_index(const mc_server_config_t *config);
+void mc_storage_note_committed(const mc_upload_t *upload);
+void mc_storage_note_deleted(const char *name);
+
+/*
+ * Startup check that the storage dir is in config's layout: a flat dir with
+ * nothing stored yet is marked sharded on the spot, any other mismatch (or a
+ * staging directory left by an interrupted migration) is an error.
+ */
+int mc_storage_check_layout(const mc_server_config_t *config, char *err, size_t err_len);
+
+/*
+ * Rewrites storage_dir (with no server running) into layout to, moving
+ * every entry by rename into a staging directory and then back into the
+ * root. Rerunning it with the same target finishes an interrupted run.
+ * *moved counts the files and directories moved.
+ */
+int mc_storage_migrate_layout(const char *storage_dir,
+                              mc_storage_layout_t to,
+                              long *moved,
+                              char *err,
+                              size_t err_len);
+
+/* Drops blobs nothing but the index links to any more; returns how many, or -1. */
+long mc_storage_gc_blobs(const mc_server_config_t *config);
+
+int mc_storage_delete(const mc_server_config_t *config,
+                      const char *name,
+                      char *err,
+                      size_t err_len);
+
+/* MKDIR creates name and any missing parents; RMDIR removes name if it is empty. */
+int mc_storage_mkdir(const mc_server_config_t *config,
+                     const char *name,
+                     char *err,
+                     size_t err_len);
+int mc_storage_rmdir(const mc_server_config_t *config,
+                     const char *name,
+                     char *err,
+                     size_t err_len);
+
+/*
+ * Builds the newline separated LIST payload; caller frees *out. options is
+ * the request's filename field (see MC_LIST_OPT_SIZES); unknown ones are
+ * ignored.
+ */
+int mc_storage_build_listing(const mc_server_config_t *config,
+                             const char *options,
+                             char **out,
+                             size_t *out_len,
+                             char *err,
+                             size_t err_len);
+
+/*
+ * LIST_QUERY: one page of the listing, filtered by the fnmatch() pattern
+ * (NULL or empty for everything). query is in host order; *out is the
+ * reply payload in network order (see mc_list_page_t), caller frees it.
+ */
+int mc_storage_query_listing(const mc_server_config_t *config,
+                             const char *pattern,
+                             const mc_list_query_t *query,
+                             uint8_t **out,
+                             size_t *out_len,
+                             char *err,
+                             size_t err_len);
+
+/*
+ * ARCHIVE: everything stored below dir_name (the whole tree when NULL or
+ * empty), sorted by name, with the directory itself first. Files carry their
+ * content size and mtime, directories come as "name/" with a zero info.
+ * Caller frees the list with mc_storage_free_items.
+ */
+int mc_storage_list_tree(const mc_server_config_t *config,
+                         const char *dir_name,
+                         mc_meta_item_t **items,
+                         size_t *count,
+                         char *err,
+                         size_t err_len);
+void mc_storage_free_items(mc_meta_item_t *items, size_t count);
+
+/*
+ * Bundles (see mc_bundle_entry_t). store_bundle checks every record of a
+ * BUNDLE_UPLOAD payload and then stores them in order like uploads; *stored
+ * counts those stored, even on failure. build_bundle returns the
+ * BUNDLE_DOWNLOAD reply for a request payload (caller frees *out).
+ */
+int mc_storage_store_bundle(const mc_server_config_t *config,
+                            const uint8_t *payload,
+                            size_t len,
+                            long *stored,
+                            char *err,
+                            size_t err_len);
+int mc_storage_build_bundle(const mc_server_config_t *config,
+                            const uint8_t *request,
+                            size_t request_len,
+                            uint8_t **out,
+                            size_t *out_len,
+                            char *err,
+                            size_t err_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MC_STORAGE_H */
@@ -0,0 +1,57 @@
+#ifndef MC_TAR_H
+#define MC_TAR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The tar format of ARCHIVE replies: POSIX ustar headers of
+ * MC_TAR_BLOCK bytes, each followed by its data padded to a whole block,
+ * and two zero blocks at the end. Regular files and directories only. A
+ * name that does not fit ustar's name/prefix split is sent the GNU way, as
+ * a "././@LongLink" entry of type 'L' holding the name, right before the
+ * entry it names; sizes past ustar's 11 octal digits use GNU base-256.
+ * Plain tar(1) reads the stream as it is.
+ */
+#define MC_TAR_BLOCK      512U
+#define MC_TAR_HEADER_MAX (3U * MC_TAR_BLOCK)
+
+#define MC_TAR_TYPE_FILE     '0'
+#define MC_TAR_TYPE_DIR      '5'
+#define MC_TAR_TYPE_LONGNAME 'L'
+
+typedef struct {
+    char name[MC_TAR_BLOCK];  /* NUL-terminated: prefix and name joined */
+    char type;
+    uint64_t size;
+    int64_t mtime;
+} mc_tar_entry_t;
+
+/*
+ * Writes the header blocks for one entry (a directory's name ends in "/")
+ * to out; returns their length, a multiple of MC_TAR_BLOCK.
+ */
+size_t mc_tar_header(const char *name, bool is_dir, uint64_t size, int64_t mtime, uint8_t out[MC_TAR_HEADER_MAX]);
+
+/* Zero bytes after size bytes of data up to the next block. */
+uint64_t mc_tar_padding(uint64_t size);
+
+/* Bytes an entry takes in the stream: headers, data and padding. */
+uint64_t mc_tar_entry_size(const char *name, bool is_dir, uint64_t size);
+
+/*
+ * Reads one header block: 1 with *out filled in, 0 for a zero block (the
+ * end of the archive), -1 when the checksum or a field is invalid.
+ */
+int mc_tar_parse(const uint8_t block[MC_TAR_BLOCK], mc_tar_entry_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MC_TAR_H */
@@ -0,0 +1,86 @@
+#ifndef MC_ZFILE_H
+#define MC_ZFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Compressed-at-rest files (MC_STORAGE_MODE=compressed). An upload is kept
+ * as a container: a header, the file as LZ4 blocks of MC_LZ4_BLOCK_MAX bytes
+ * laid out exactly as they go on the wire (see mc_lz4.h), then an index of
+ * where each block starts. A range only decodes the blocks it touches, and
+ * a client that negotiated lz4 can be sent the blocks as they are.
+ *
+ * Uploads that would not shrink are stored as they arrived. A container is
+ * tagged MC_ZFILE_FORMAT (see MC_STORAGE_FORMAT_XATTR) and readers go by
+ * that tag, never by the header alone, so a storage dir may hold both and an
+ * upload that starts with the magic stays the user's bytes. Where the file
+ * system has no user xattrs every upload is stored as it arrived.
+ */
+#define MC_ZFILE_MAGIC "MCLZ4F01"
+#define MC_ZFILE_FORMAT "lz4"
+
+#pragma pack(push, 1)
+typedef struct {
+    char magic[8];
+    uint64_t total_size;   /* decoded size */
+    uint64_t block_count;
+    uint64_t index_offset; /* the blocks end here; block_count + 1 offsets follow */
+    uint32_t crc;          /* CRC32C of the decoded file */
+    uint32_t reserved;
+} mc_zfile_header_t;
+#pragma pack(pop)
+
+typedef struct {
+    uint64_t total_size;
+    uint32_t crc;
+    size_t count;
+    uint64_t *offsets; /* count + 1 entries: block i is [offsets[i], offsets[i + 1]) */
+} mc_zfile_index_t;
+
+/*
+ * Compresses everything readable from src_fd (from offset 0) into a
+ * container named tmp_name in directory dir_fd. Returns 1 when it was
+ * written, 0 when it would not be smaller than the source (tmp_name is then
+ * removed), or -1.
+ */
+int mc_zfile_pack(int src_fd, int dir_fd, const char *tmp_name, char *err, size_t err_len);
+
+/* 1 and the decoded size if fd holds a tagged container, 0 if not, -1 on error. */
+int mc_zfile_probe(int fd, uint64_t *total_size);
+
+/* Same as probe but loads the index; free it with mc_zfile_free_index(). */
+int mc_zfile_read_index(int fd, mc_zfile_index_t *out);
+void mc_zfile_free_index(mc_zfile_index_t *index);
+
+/*
+ * Where the blocks holding [offset, offset + length) start in the
+ * container, if that range is exactly those blocks: it starts on a block
+ * boundary and runs to the end of the file.
+ */
+bool mc_zfile_block_span(const mc_zfile_index_t *index, uint64_t offset, uint64_t length, uint64_t *wire_offset);
+
+/*
+ * Decodes the blocks covering [offset, offset + length) into an unlinked
+ * temporary file of the full decoded size, each at its own offset; the rest
+ * stays a hole. Returns the descriptor, which the engines then serve like
+ * any other file.
+ */
+int mc_zfile_materialize(const char *storage_dir,
+                         int fd,
+                         const mc_zfile_index_t *index,
+                         uint64_t offset,
+                         uint64_t length,
+                         char *err,
+                         size_t err_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MC_ZFILE_H */
@@ -77,10 +77,113 @@ int main(int argc, char **argv) {
         }
     }
 
+    unsigned int pipeline_depth = MC_CLIENT_DEFAULT_PIPELINE;
+    const char *pipeline_env = getenv("MC_CLIENT_PIPELINE");
+    if (pipeline_env && *pipeline_env) {
+        char *pipeline_end = NULL;
+        long depth = strtol(pipeline_env, &pipeline_end, 10);
+        if (!pipeline_end || *pipeline_end != '\0' || depth < 1 || depth > MC_CLIENT_MAX_PIPELINE) {
+            fprintf(stderr, "Invalid MC_CLIENT_PIPELINE: %s (expected 1-%d)\n", pipeline_env, MC_CLIENT_MAX_PIPELINE);
+            free(token_from_file);
+            return EXIT_FAILURE;
+        }
+        pipeline_depth = (unsigned int)depth;
+    }
+
+    bool multiplex = true;
+    const char *mux_env = getenv("MC_CLIENT_MUX");
+    if (mux_env && *mux_env) {
+        if ((mux_env[0] != '0' && mux_env[0] != '1') || mux_env[1] != '\0') {
+            fprintf(stderr, "Invalid MC_CLIENT_MUX: %s (expected 0 or 1)\n", mux_env);
+            free(token_from_file);
+            return EXIT_FAILURE;
+        }
+        multiplex = mux_env[0] == '1';
+    }
+
+    unsigned int connections = MC_CLIENT_DEFAULT_CONNECTIONS;
+    const char *connections_env = getenv("MC_CLIENT_CONNECTIONS");
+    if (connections_env && *connections_env) {
+        char *connections_end = NULL;
+        long value = strtol(connections_env, &connections_end, 10);
+        if (!connections_end || *connections_end != '\0' || value < 1 || value > MC_CLIENT_MAX_CONNECTIONS) {
+            fprintf(stderr,
+                    "Invalid MC_CLIENT_CONNECTIONS: %s (expected 1-%d)\n",
+                    connections_env,
+                    MC_CLIENT_MAX_CONNECTIONS);
+            free(token_from_file);
+            return EXIT_FAILURE;
+        }
+        connections = (unsigned int)value;
+    }
+
+    bool delta = true;
+    const char *delta_env = getenv("MC_CLIENT_DELTA");
+    if (delta_env && *delta_env) {
+        if ((delta_env[0] != '0' && delta_env[0] != '1') || delta_env[1] != '\0') {
+            fprintf(stderr, "Invalid MC_CLIENT_DELTA: %s (expected 0 or 1)\n", delta_env);
+            free(token_from_file);
+            return EXIT_FAILURE;
+        }
+        delta = delta_env[0] == '1';
+    }
+
+    bool check_have = true;
+    const char *have_env = getenv("MC_CLIENT_HAVE");
+    if (have_env && *have_env) {
+        if ((have_env[0] != '0' && have_env[0] != '1') || have_env[1] != '\0') {
+            fprintf(stderr, "Invalid MC_CLIENT_HAVE: %s (expected 0 or 1)\n", have_env);
+            free(token_from_file);
+            return EXIT_FAILURE;
+        }
+        check_have = have_env[0] == '1';
+    }
+
+    bool checksums = true;
+    const char *checksum_env = getenv("MC_CLIENT_CHECKSUM");
+    if (checksum_env && *checksum_env) {
+        if ((checksum_env[0] != '0' && checksum_env[0] != '1') || checksum_env[1] != '\0') {
+            fprintf(stderr, "Invalid MC_CLIENT_CHECKSUM: %s (expected 0 or 1)\n", checksum_env);
+            free(token_from_file);
+            return EXIT_FAILURE;
+        }
+        checksums = checksum_env[0] == '1';
+    }
+
+    bool compress = true;
+    const char *compress_env = getenv("MC_CLIENT_COMPRESS");
+    if (compress_env && *compress_env) {
+        if ((compress_env[0] != '0' && compress_env[0] != '1') || compress_env[1] != '\0') {
+            fprintf(stderr, "Invalid MC_CLIENT_COMPRESS: %s (expected 0 or 1)\n", compress_env);
+            free(token_from_file);
+            return EXIT_FAILURE;
+        }
+        compress = compress_env[0] == '1';
+    }
+
+    bool bundle = true;
+    const char *bundle_env = getenv("MC_CLIENT_BUNDLE");
+    if (bundle_env && *bundle_env) {
+        if ((bundle_env[0] != '0' && bundle_env[0] != '1') || bundle_env[1] != '\0') {
+            fprintf(stderr, "Invalid MC_CLIENT_BUNDLE: %s (expected 0 or 1)\n", bundle_env);
+            free(token_from_file);
+            return EXIT_FAILURE;
+        }
+        bundle = bundle_env[0] == '1';
+    }
+
     mc_client_config_t config = {
         .host = argv[1],
         .port = (uint16_t)port_long,
         .auth_token = token_arg,
+        .pipeline_depth = pipeline_depth,
+        .multiplex = multiplex,
+        .connections = connections,
+        .delta = delta,
+        .check_have = check_have,
+        .checksums = checksums,
+        .compress = compress,
+        .bundle = bundle,
     };
 
     if (mc_client_run(&config) != 0) {
@@ -1,26 +1,44 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include "mc_client.h"
+#include "mc_crc32c.h"
+#include "mc_lz4.h"
+#include "mc_delta.h"
+#include "mc_mux.h"
 #include "mc_protocol.h"
+#include "mc_sha256.h"
+#include "mc_tar.h"
 
 #include <arpa/inet.h>
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #define MC_CLIENT_READ_CHUNK 4096
+#define MC_CLIENT_PARTIAL_SUFFIX ".part"
+#define MC_CLIENT_VALIDATOR_SUFFIX ".part.validator"
 #define MC_CLIENT_MAX_BATCH 32
+#define MC_CLIENT_UPLOAD_CHUNK (8ULL * 1024 * 1024)
+#define MC_CLIENT_DELTA_MIN (1024ULL * 1024)
+#define MC_CLIENT_HAVE_MIN (1024ULL * 1024)
+#define MC_CLIENT_DELTA_LITERAL_MAX (1U << 30)
+#define MC_CLIENT_LIST_PAGE 1000U
 
 typedef enum {
     CLI_ACTION_NONE = 0,
@@ -28,15 +46,39 @@ typedef enum {
     CLI_ACTION_DOWNLOAD,
     CLI_ACTION_DOWNLOAD_ALL,
     CLI_ACTION_DELETE,
+    CLI_ACTION_MKDIR,
+    CLI_ACTION_RMDIR,
     CLI_ACTION_LIST,
     CLI_ACTION_QUIT
 } cli_action_t;
 
+/*
+ * One server connection and the header version agreed on it. In framed mode
+ * (v3) requests do not use fd directly: each one opens a stream on mux and
+ * runs on a stream session whose fd is the local end of that stream.
+ */
+typedef struct {
+    int fd;
+    uint8_t version;          /* MC_PROTOCOL_VERSION_PIPELINED enables request ids */
+    unsigned int depth;       /* requests allowed in flight at once */
+    uint32_t next_request_id;
+    mc_mux_t *mux;            /* framed mode only */
+    uint32_t next_stream_id;
+    bool is_stream;
+    unsigned int caps;        /* MC_AUTH_CAP_* agreed at AUTH */
+    const mc_client_config_t *config; /* for opening more connections */
+    const char *upload_dir;   /* UPLOAD --to=: server directory for the files, or NULL */
+} cli_session_t;
+
 typedef struct {
     cli_action_t action;
     char arg[MC_MAX_FILENAME_LEN + 1];
     size_t arg_count;
     char args[MC_CLIENT_MAX_BATCH][MC_MAX_FILENAME_LEN + 1];
+    uint8_t sort; /* LIST: mc_list_sort_t */
+    char upload_dir[MC_MAX_FILENAME_LEN + 1]; /* UPLOAD --to= */
+    bool archive;                             /* DOWNLOAD ALL --archive */
+    char archive_dir[MC_MAX_FILENAME_LEN + 1]; /* --archive=: only this server directory */
 } cli_request_t;
 
 static void lowercase(char *s) {
@@ -69,6 +111,18 @@ static const char *basename_safe(const char *path) {
     return slash + 1;
 }
 
+/* The server name for an upload: the local file's name, inside UPLOAD --to= when given. */
+static int upload_name(const cli_session_t *session, const char *local_path, char *out, size_t out_len) {
+    const char *base = basename_safe(local_path);
+    int written = session->upload_dir ? snprintf(out, out_len, "%s/%s", session->upload_dir, base)
+                                      : snprintf(out, out_len, "%s", base);
+    if (written < 0 || (size_t)written >= out_len) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
 static bool append_request_arg(cli_request_t *req, const char *value) {
     if (!req || !value || *value == '\0') {
         return false;
@@ -110,64 +164,177 @@ static int connect_to_server(const mc_client_config_t *config) {
         return -1;
     }
 
+    /* requests are written whole, so Nagle would only delay pipelined ones */
+    int one = 1;
+    (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); /* setsockopt() 시스템 콜로 Nagle 비활성화 */
     return fd;
 }
 
-static int send_header_and_filename(int fd, mc_command_t command, const char *filename, uint64_t payload_len) {
+/*
+ * Sends header, filename and the in-memory part of the payload (extra, may
+ * be empty) in one sendmsg(). When more payload follows from the caller the
+ * send carries MSG_MORE so the header is not pushed out as a segment of its
+ * own. On a pipelined session the request gets the next id, returned through
+ * out_id (0 on v1) for reply matching.
+ */
+static int send_request_prefix(cli_session_t *session,
+                               mc_command_t command,
+                               const char *filename,
+                               uint64_t payload_len,
+                               const void *extra,
+                               size_t extra_len,
+                               uint32_t *out_id) {
     mc_packet_header_t header;
     if (mc_build_header(&header, command, filename, payload_len) != 0) {
         return -1;
     }
-
-    if (mc_send_header(fd, &header) != 0) {
-        return -1;
-    }
-
-    if (filename && filename[0]) {
-        size_t len = strlen(filename);
-        if (mc_send_all(fd, filename, len) != (ssize_t)len) {
-            return -1;
+    if (session->version >= MC_PROTOCOL_VERSION_PIPELINED) {
+        header.version = session->version;
+        if (++session->next_request_id == 0) {
+            session->next_request_id = 1;
         }
+        header.request_id = session->next_request_id;
     }
-    return 0;
+    if (out_id) {
+        *out_id = header.request_id;
+    }
+
+    return mc_send_packet(session->fd, &header, filename, extra, extra_len, payload_len > extra_len);
 }
 
-static int send_list(int fd) {
-    return send_header_and_filename(fd, MC_CMD_LIST, NULL, 0);
+static int send_header_and_filename(cli_session_t *session,
+                                    mc_command_t command,
+                                    const char *filename,
+                                    uint64_t payload_len,
+                                    uint32_t *out_id) {
+    return send_request_prefix(session, command, filename, payload_len, NULL, 0, out_id);
 }
 
-static int send_quit(int fd) {
-    return send_header_and_filename(fd, MC_CMD_QUIT, NULL, 0);
+static int send_list(cli_session_t *session, const char *options) {
+    return send_header_and_filename(session, MC_CMD_LIST, options, 0, NULL);
 }
 
-static int send_download(int fd, const char *remote_name) {
-    return send_header_and_filename(fd, MC_CMD_DOWNLOAD, remote_name, 0);
+static int send_quit(cli_session_t *session) {
+    return send_header_and_filename(session, MC_CMD_QUIT, NULL, 0, NULL);
 }
 
-static int send_delete(int fd, const char *remote_name) {
-    return send_header_and_filename(fd, MC_CMD_DELETE, remote_name, 0);
+static void sanitize_download_name(const char *input, char *out, size_t out_len);
+
+/* A download lands in "<name>.part" and is renamed once complete. */
+static void partial_path(const char *local_name, char *out, size_t out_len) {
+    snprintf(out, out_len, "%s%s", local_name, MC_CLIENT_PARTIAL_SUFFIX);
 }
 
-static int send_auth(int fd, const char *token) {
-    size_t len = token ? strlen(token) : 0;
-    mc_packet_header_t header;
-    if (mc_build_header(&header, MC_CMD_AUTH, NULL, len) != 0) {
-        return -1;
+/*
+ * The validator of the copy "<name>.part" was cut from (see mc_range_if_t),
+ * kept beside it in "<name>.part.validator" as 16 hex digits.
+ */
+static void validator_path(const char *local_name, char *out, size_t out_len) {
+    snprintf(out, out_len, "%s%s", local_name, MC_CLIENT_VALIDATOR_SUFFIX);
+}
+
+/* The validator kept for local_name's partial file, or 0 when there is none. */
+static uint64_t load_validator(const char *local_name) {
+    char path[MC_MAX_FILENAME_LEN + sizeof(MC_CLIENT_VALIDATOR_SUFFIX)];
+    char text[17] = {0};
+    validator_path(local_name, path, sizeof(path));
+    int fd = open(path, O_RDONLY); /* open() 시스템 콜로 검증자 파일 열기 */
+    if (fd == -1) {
+        return 0;
     }
-    if (mc_send_header(fd, &header) != 0) {
-        return -1;
+    ssize_t got = read(fd, text, 16); /* read() 시스템 콜로 검증자 읽기 */
+    close(fd);
+    char *end = NULL;
+    uint64_t validator = got == 16 ? (uint64_t)strtoull(text, &end, 16) : 0;
+    return end && *end == '\0' ? validator : 0;
+}
+
+/* Remembers validator for local_name's partial file, before any of its bytes arrive. */
+static void save_validator(const char *local_name, uint64_t validator) {
+    char path[MC_MAX_FILENAME_LEN + sizeof(MC_CLIENT_VALIDATOR_SUFFIX)];
+    char text[18];
+    validator_path(local_name, path, sizeof(path));
+    snprintf(text, sizeof(text), "%016" PRIx64 "\n", validator);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644); /* open() 시스템 콜로 검증자 파일 생성 */
+    if (fd == -1) {
+        return; /* without it the next DOWNLOAD just starts over */
     }
-    if (len > 0) {
-        if (mc_send_all(fd, token, len) != (ssize_t)len) {
-            return -1;
+    if (write(fd, text, 17) != 17) { /* write() 시스템 콜로 검증자 기록 */
+        close(fd);
+        unlink(path);
+        return;
+    }
+    close(fd);
+}
+
+static void drop_validator(const char *local_name) {
+    char path[MC_MAX_FILENAME_LEN + sizeof(MC_CLIENT_VALIDATOR_SUFFIX)];
+    validator_path(local_name, path, sizeof(path));
+    unlink(path); /* unlink() 시스템 콜로 검증자 파일 제거 */
+}
+
+/*
+ * A pipelined session asks with DOWNLOAD_RANGE in its mc_range_if_t form, so
+ * the reply carries the validator that lets a broken transfer resume later:
+ * from a leftover "<name>.part" when its validator was kept (the server
+ * starts over if the file changed since), else from 0. Against v1 servers it
+ * asks for the whole file.
+ */
+static int send_download(cli_session_t *session, const char *remote_name, uint32_t *out_id) {
+    char local_name[MC_MAX_FILENAME_LEN + 1];
+    char part[MC_MAX_FILENAME_LEN + sizeof(MC_CLIENT_PARTIAL_SUFFIX)];
+    sanitize_download_name(remote_name, local_name, sizeof(local_name));
+    partial_path(local_name, part, sizeof(part));
+
+    if (session->version < MC_PROTOCOL_VERSION_PIPELINED) {
+        return send_header_and_filename(session, MC_CMD_DOWNLOAD, remote_name, 0, out_id);
+    }
+    mc_range_if_t range = {.offset = 0, .length = 0, .validator = 0};
+    struct stat st;
+    if (stat(part, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) { /* stat() 시스템 콜로 이어받을 부분 파일 확인 */
+        /* a partial file without its validator cannot be checked: it is started over */
+        range.validator = load_validator(local_name);
+        if (range.validator != 0) {
+            range.offset = (uint64_t)st.st_size;
+            printf("[CLIENT] 이어받기: %s (%lld bytes부터)\n", remote_name, (long long)st.st_size);
         }
     }
-    return 0;
+    mc_range_if_host_to_network(&range);
+    return send_request_prefix(session, MC_CMD_DOWNLOAD_RANGE, remote_name, MC_RANGE_IF_SIZE, &range, sizeof(range), out_id);
+}
+
+static int send_delete(cli_session_t *session, const char *remote_name, uint32_t *out_id) {
+    return send_header_and_filename(session, MC_CMD_DELETE, remote_name, 0, out_id);
+}
+
+/* AUTH options a v2+ session asks for; only the server's echo turns them on. */
+static unsigned int wanted_caps(const cli_session_t *session) {
+    unsigned int caps = 0;
+    if (session->config && session->version >= MC_PROTOCOL_VERSION_PIPELINED) {
+        caps |= session->config->checksums ? MC_AUTH_CAP_CRC32C : 0U;
+        caps |= session->config->compress ? MC_AUTH_CAP_LZ4 : 0U;
+        caps |= session->config->bundle ? MC_AUTH_CAP_BUNDLE : 0U;
+    }
+    return caps;
+}
+
+static int send_auth(cli_session_t *session, const char *token) {
+    size_t len = token ? strlen(token) : 0;
+    char options[64];
+    mc_auth_format_options(wanted_caps(session), options, sizeof(options));
+    return send_request_prefix(session, MC_CMD_AUTH, options[0] ? options : NULL, len, token, len, NULL);
+}
+
+static int send_trailer(int fd, uint32_t crc) {
+    uint32_t trailer = htonl(crc);
+    return mc_send_all(fd, &trailer, sizeof(trailer)) == (ssize_t)sizeof(trailer) ? 0 : -1;
 }
 
-static int transmit_file_payload(int socket_fd, int file_fd, uint64_t size) {
+/* Sends size bytes of file_fd, then the CRC32C trailer when checksummed. */
+static int transmit_file_payload(const cli_session_t *session, int file_fd, uint64_t size, bool checksummed) {
     uint8_t buffer[MC_CLIENT_READ_CHUNK];
     uint64_t remaining = size;
+    uint32_t crc = 0;
 
     while (remaining > 0) {
         size_t chunk = remaining > sizeof(buffer) ? sizeof(buffer) : (size_t)remaining;
@@ -181,16 +348,106 @@ static int transmit_file_payload(int socket_fd, int file_fd, uint64_t size) {
         if (rd == 0) {
             break;
         }
-        if (mc_send_all(socket_fd, buffer, (size_t)rd) != rd) {
+        if (checksummed) {
+            crc = mc_crc32c_update(crc, buffer, (size_t)rd);
+        }
+        if (mc_send_all(session->fd, buffer, (size_t)rd) != rd) {
             return -1;
         }
         remaining -= (uint64_t)rd;
     }
+    if (remaining != 0) {
+        return -1;
+    }
+    return checksummed ? send_trailer(session->fd, crc) : 0;
+}
+
+/*
+ * Reads size bytes of file_fd into an LZ4 block stream in memory; crc
+ * accumulates the file bytes. Callers keep size to MC_CLIENT_UPLOAD_CHUNK.
+ */
+static int encode_file_payload(int file_fd, uint64_t size, uint8_t **out, size_t *out_len, uint32_t *crc) {
+    size_t blocks = (size_t)((size + MC_LZ4_BLOCK_MAX - 1) / MC_LZ4_BLOCK_MAX);
+    uint8_t *wire = malloc((size_t)size + blocks * MC_LZ4_BLOCK_HEADER + 1);
+    uint8_t *raw = malloc(MC_LZ4_BLOCK_MAX);
+    mc_lz4_encoder_t *enc = malloc(sizeof(*enc));
+    int rc = wire && raw && enc ? 0 : -1;
+    if (rc == 0) {
+        mc_lz4_encoder_init(enc);
+    }
+
+    size_t used = 0;
+    uint64_t remaining = size;
+    while (rc == 0 && remaining > 0) {
+        size_t chunk = remaining > MC_LZ4_BLOCK_MAX ? MC_LZ4_BLOCK_MAX : (size_t)remaining;
+        size_t filled = 0;
+        while (filled < chunk) {
+            ssize_t rd = read(file_fd, raw + filled, chunk - filled); /* read() 시스템 콜로 로컬 파일 읽기 */
+            if (rd < 0 && errno == EINTR) {
+                continue;
+            }
+            if (rd <= 0) {
+                rc = -1;
+                break;
+            }
+            filled += (size_t)rd;
+        }
+        if (rc != 0) {
+            break;
+        }
+        *crc = mc_crc32c_update(*crc, raw, chunk);
+        used += mc_lz4_encode_block(enc, raw, chunk, wire + used);
+        remaining -= chunk;
+    }
+
+    free(raw);
+    free(enc);
+    if (rc != 0) {
+        free(wire);
+        return -1;
+    }
+    *out = wire;
+    *out_len = used;
+    return 0;
+}
 
-    return remaining == 0 ? 0 : -1;
+/*
+ * Sends a request whose payload is size bytes of file_fd, with the
+ * session's AUTH options applied. A compressed payload is encoded up front
+ * because payload_len has to be its length on the wire.
+ */
+static int send_file_request(cli_session_t *session,
+                             mc_command_t cmd,
+                             const char *name,
+                             int file_fd,
+                             uint64_t size,
+                             uint32_t *out_id) {
+    unsigned int applied = mc_request_caps(session->caps, cmd);
+    bool checksummed = (applied & MC_AUTH_CAP_CRC32C) != 0;
+    /* corked, the body chunks and the CRC trailer leave as full segments despite TCP_NODELAY */
+    mc_set_cork(session->fd, true);
+    int rc = -1;
+    if (!(applied & MC_AUTH_CAP_LZ4)) {
+        if (send_header_and_filename(session, cmd, name, size, out_id) == 0) {
+            rc = transmit_file_payload(session, file_fd, size, checksummed);
+        }
+    } else {
+        uint8_t *wire = NULL;
+        size_t wire_len = 0;
+        uint32_t crc = 0;
+        if (encode_file_payload(file_fd, size, &wire, &wire_len, &crc) == 0) {
+            rc = send_request_prefix(session, cmd, name, (uint64_t)wire_len, wire, wire_len, out_id);
+            free(wire);
+        }
+        if (rc == 0 && checksummed) {
+            rc = send_trailer(session->fd, crc);
+        }
+    }
+    mc_set_cork(session->fd, false);
+    return rc;
 }
 
-static int send_upload(int fd, const char *local_path) {
+static int send_upload(cli_session_t *session, const char *local_path, uint32_t *out_id) {
     struct stat st;
     if (stat(local_path, &st) == -1) { /* stat() 시스템 콜로 파일 정보 확인 */
         return -1;
@@ -200,9 +457,8 @@ static int send_upload(int fd, const char *local_path) {
         return -1;
     }
 
-    const char *base = basename_safe(local_path);
-    if (strlen(base) > MC_MAX_FILENAME_LEN) {
-        errno = ENAMETOOLONG;
+    char remote[MC_MAX_FILENAME_LEN + 1];
+    if (upload_name(session, local_path, remote, sizeof(remote)) != 0) {
         return -1;
     }
 
@@ -211,11 +467,7 @@ static int send_upload(int fd, const char *local_path) {
         return -1;
     }
 
-    uint64_t payload_len = (uint64_t)st.st_size;
-    int rc = send_header_and_filename(fd, MC_CMD_UPLOAD, base, payload_len);
-    if (rc == 0) {
-        rc = transmit_file_payload(fd, file_fd, payload_len);
-    }
+    int rc = send_file_request(session, MC_CMD_UPLOAD, remote, file_fd, (uint64_t)st.st_size, out_id);
 
     close(file_fd); /* close() 시스템 콜로 로컬 파일 닫기 */
     return rc;
@@ -264,42 +516,110 @@ static int recv_payload_to_buffer(int fd, uint64_t len, char **out_buf) {
     return 0;
 }
 
-static int recv_payload_to_file(int fd, uint64_t len, const char *path) {
-    int out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644); /* open() 시스템 콜로 다운로드 파일 생성 */
+/*
+ * Writes len payload bytes to path starting at offset (0 truncates), decoding
+ * them from LZ4 blocks when compressed. A failed transfer leaves what arrived
+ * in place so the next DOWNLOAD can resume from it. crc, when given,
+ * accumulates the CRC32C of the file bytes.
+ */
+static int recv_payload_to_file(int fd, uint64_t len, const char *path, uint64_t offset, bool compressed, uint32_t *crc) {
+    int out_fd = open(path, O_WRONLY | O_CREAT | (offset == 0 ? O_TRUNC : 0), 0644); /* open() 시스템 콜로 다운로드 파일 생성 */
     if (out_fd == -1) {
         return -1;
     }
+    if (offset > 0 && (ftruncate(out_fd, (off_t)offset) == -1 || lseek(out_fd, (off_t)offset, SEEK_SET) == -1)) { /* ftruncate()/lseek() 시스템 콜로 이어쓸 위치 맞추기 */
+        close(out_fd);
+        return -1;
+    }
     uint8_t buffer[MC_CLIENT_READ_CHUNK];
+    mc_lz4_decoder_t *dec = NULL;
+    if (compressed) {
+        dec = malloc(sizeof(*dec));
+        if (!dec) {
+            close(out_fd);
+            return -1;
+        }
+        mc_lz4_decoder_init(dec, len); /* blocks past len mean a broken stream */
+    }
     uint64_t remaining = len;
     int rc = 0;
     while (remaining > 0) {
+        const uint8_t *data = buffer;
         size_t chunk = remaining > sizeof(buffer) ? sizeof(buffer) : (size_t)remaining;
-        ssize_t read_bytes = mc_recv_all(fd, buffer, chunk);
-        if (read_bytes != (ssize_t)chunk) {
+        if (dec) {
+            size_t want = 0;
+            uint8_t *dst = mc_lz4_decoder_want(dec, &want);
+            if (mc_recv_all(fd, dst, want) != (ssize_t)want) {
+                rc = -1;
+                break;
+            }
+            int got = mc_lz4_decoder_received(dec, want);
+            if (got < 0) {
+                errno = EPROTO;
+                rc = -1;
+                break;
+            }
+            if (got == 0) {
+                continue;
+            }
+            data = dec->out;
+            chunk = dec->out_len;
+        } else if (mc_recv_all(fd, buffer, chunk) != (ssize_t)chunk) {
             rc = -1;
             break;
         }
-        ssize_t written = write(out_fd, buffer, read_bytes); /* write() 시스템 콜로 다운로드 데이터 기록 */
-        if (written != read_bytes) {
+        if (crc) {
+            *crc = mc_crc32c_update(*crc, data, chunk);
+        }
+        ssize_t written = write(out_fd, data, chunk); /* write() 시스템 콜로 다운로드 데이터 기록 */
+        if (written != (ssize_t)chunk) {
             rc = -1;
             break;
         }
-        remaining -= (uint64_t)read_bytes;
+        remaining -= (uint64_t)chunk;
     }
+    free(dec);
     close(out_fd); /* close() 시스템 콜로 다운로드 파일 닫기 */
-    if (rc != 0) {
-        unlink(path); /* unlink() 시스템 콜로 손상된 파일 제거 */
-    }
     return rc;
 }
 
+/*
+ * Where a download is saved: a nested server name keeps its directories
+ * below the current one when every component is a plain name; anything else
+ * is cut down to its last component, so a reply never writes elsewhere.
+ */
 static void sanitize_download_name(const char *input, char *out, size_t out_len) {
     const char *candidate = (input && *input) ? input : "download.bin";
-    const char *base = basename_safe(candidate);
-    snprintf(out, out_len, "%s", base);
+    bool keep_path = true;
+    const char *component = candidate;
+    for (;;) {
+        size_t len = strcspn(component, "/");
+        if (len == 0 || (len == 1 && component[0] == '.') ||
+            (len == 2 && component[0] == '.' && component[1] == '.')) {
+            keep_path = false;
+            break;
+        }
+        if (component[len] == '\0') {
+            break;
+        }
+        component += len + 1;
+    }
+    snprintf(out, out_len, "%s", keep_path ? candidate : basename_safe(candidate));
 }
 
-static int handle_download_payload(int fd, const mc_packet_info_t *info, const char *requested_name) {
+/* Creates the local directories a nested download's path needs. */
+static void make_parent_dirs(const char *path) {
+    char dir[MC_MAX_FILENAME_LEN + sizeof(MC_CLIENT_PARTIAL_SUFFIX)];
+    snprintf(dir, sizeof(dir), "%s", path);
+    for (char *slash = strchr(dir, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(dir, 0755); /* mkdir() 시스템 콜로 로컬 디렉터리 생성 (있으면 그대로) */
+        *slash = '/';
+    }
+}
+
+static int handle_download_payload(const cli_session_t *session, const mc_packet_info_t *info, const char *requested_name) {
+    int fd = session->fd;
     char local_name[MC_MAX_FILENAME_LEN + 1];
     if (info->filename[0]) {
         sanitize_download_name(info->filename, local_name, sizeof(local_name));
@@ -307,19 +627,97 @@ static int handle_download_payload(int fd, const mc_packet_info_t *info, const c
         sanitize_download_name(requested_name, local_name, sizeof(local_name));
     }
 
-    printf("[CLIENT] 서버에서 %s (%" PRIu64 " bytes) 다운로드\n",
-           local_name,
-           (uint64_t)info->header.payload_len);
+    char part[MC_MAX_FILENAME_LEN + sizeof(MC_CLIENT_PARTIAL_SUFFIX)];
+    partial_path(local_name, part, sizeof(part));
+    make_parent_dirs(part);
+
+    /* DOWNLOAD_RANGE (always asked in the mc_range_if_t form): the body is
+     * preceded by the served offset, the file size and its validator */
+    uint64_t body_len = info->header.payload_len;
+    mc_range_if_t served = {.offset = 0, .length = body_len, .validator = 0};
+    bool ranged = info->header.command == MC_CMD_DOWNLOAD_RANGE;
+    if (ranged) {
+        if (body_len < MC_RANGE_IF_SIZE || mc_recv_all(fd, &served, sizeof(served)) != (ssize_t)sizeof(served)) {
+            errno = EPROTO;
+            return -1;
+        }
+        mc_range_if_network_to_host(&served);
+        body_len -= MC_RANGE_IF_SIZE;
+        struct stat st;
+        if (served.offset == 0 && stat(part, &st) == 0 && st.st_size > 0) { /* stat() 시스템 콜로 버려질 부분 파일 확인 */
+            printf("[CLIENT] %s: 서버의 파일이 바뀌었거나 확인할 수 없어 처음부터 받습니다\n", local_name);
+        }
+        save_validator(local_name, served.validator);
+    }
+    if (served.offset > 0) {
+        printf("[CLIENT] 서버에서 %s 이어받기 (%" PRIu64 "/%" PRIu64 " bytes부터 %" PRIu64 " bytes)\n",
+               local_name,
+               (uint64_t)served.offset,
+               (uint64_t)served.length,
+               body_len);
+    } else {
+        printf("[CLIENT] 서버에서 %s (%" PRIu64 " bytes) 다운로드\n", local_name, body_len);
+    }
+
+    unsigned int applied = mc_reply_caps(session->caps, info->header.command);
+    bool checksummed = (applied & MC_AUTH_CAP_CRC32C) != 0;
+    uint32_t crc = 0;
+    if (recv_payload_to_file(fd, body_len, part, served.offset, (applied & MC_AUTH_CAP_LZ4) != 0, checksummed ? &crc : NULL) !=
+        0) {
+        fprintf(stderr, "다운로드 저장 실패: %s (받은 부분은 %s에 남아 다음 DOWNLOAD에서 이어받습니다)\n",
+                strerror(errno),
+                part);
+        return -1;
+    }
+    if (checksummed) {
+        uint32_t trailer = 0;
+        if (mc_recv_all(fd, &trailer, sizeof(trailer)) != (ssize_t)sizeof(trailer)) {
+            return -1;
+        }
+        if (ntohl(trailer) != crc) {
+            /* which bytes went bad is unknown: start the next DOWNLOAD from scratch */
+            unlink(part); /* unlink() 시스템 콜로 손상된 부분 파일 제거 */
+            drop_validator(local_name);
+            fprintf(stderr, "다운로드 체크섬 불일치: %s (다시 DOWNLOAD 하세요)\n", local_name);
+            return 0;
+        }
+    }
 
-    if (recv_payload_to_file(fd, info->header.payload_len, local_name) != 0) {
+    if (served.offset + body_len < served.length) {
+        printf("[CLIENT] 부분 다운로드 -> %s\n", part);
+        return 0;
+    }
+    if (rename(part, local_name) == -1) { /* rename() 시스템 콜로 완성된 파일 게시 */
         fprintf(stderr, "다운로드 저장 실패: %s\n", strerror(errno));
         return -1;
     }
-
+    if (ranged) {
+        drop_validator(local_name);
+    }
     printf("[CLIENT] 다운로드 완료 -> %s\n", local_name);
     return 0;
 }
 
+static bool parse_list_sort(const char *name, uint8_t *out) {
+    static const struct {
+        const char *name;
+        mc_list_sort_t sort;
+    } sorts[] = {
+        {"name", MC_LIST_SORT_NAME},
+        {"name-desc", MC_LIST_SORT_NAME_DESC},
+        {"size", MC_LIST_SORT_SIZE_DESC},
+        {"size-asc", MC_LIST_SORT_SIZE},
+        {"mtime", MC_LIST_SORT_MTIME_DESC},
+    };
+    for (size_t i = 0; i < sizeof(sorts) / sizeof(sorts[0]); ++i) {
+        if (strcasecmp(name, sorts[i].name) == 0) {
+            *out = (uint8_t)sorts[i].sort;
+            return true;
+        }
+    }
+    return false;
+}
+
 static bool parse_command(const char *line_in, cli_request_t *out) {
     if (!line_in || !out) {
         return false;
@@ -344,7 +742,19 @@ static bool parse_command(const char *line_in, cli_request_t *out) {
         req.action = CLI_ACTION_UPLOAD;
         char *tok = NULL;
         while ((tok = strtok_r(NULL, " \t", &save)) != NULL) {
-            if (!append_request_arg(&req, tok)) {
+            if (strncmp(tok, "--to=", 5) == 0) {
+                /* "--to=docs/" and "--to=docs" mean the same directory */
+                size_t len = strlen(tok + 5);
+                while (len > 0 && tok[5 + len - 1] == '/') {
+                    --len;
+                }
+                if (len == 0 || len > MC_MAX_FILENAME_LEN) {
+                    fprintf(stderr, "--to= 에는 서버 디렉터리 이름이 필요합니다.\n");
+                    free(line);
+                    return false;
+                }
+                snprintf(req.upload_dir, sizeof(req.upload_dir), "%.*s", (int)len, tok + 5);
+            } else if (!append_request_arg(&req, tok)) {
                 free(line);
                 return false;
             }
@@ -362,10 +772,28 @@ static bool parse_command(const char *line_in, cli_request_t *out) {
             return false;
         }
         if (strcasecmp(first, "all") == 0) {
-            if (strtok_r(NULL, " \t", &save) != NULL) {
-                fprintf(stderr, "DOWNLOAD ALL 명령에는 추가 인자를 넣을 수 없습니다.\n");
-                free(line);
-                return false;
+            char *tok = NULL;
+            while ((tok = strtok_r(NULL, " \t", &save)) != NULL) {
+                if (strcmp(tok, "--archive") == 0 && !req.archive) {
+                    req.archive = true;
+                } else if (strncmp(tok, "--archive=", 10) == 0 && !req.archive) {
+                    /* like --to=, a trailing "/" names the same directory */
+                    size_t len = strlen(tok + 10);
+                    while (len > 0 && tok[10 + len - 1] == '/') {
+                        --len;
+                    }
+                    if (len > MC_MAX_FILENAME_LEN) {
+                        fprintf(stderr, "--archive= 의 디렉터리 이름이 너무 깁니다.\n");
+                        free(line);
+                        return false;
+                    }
+                    req.archive = true;
+                    snprintf(req.archive_dir, sizeof(req.archive_dir), "%.*s", (int)len, tok + 10);
+                } else {
+                    fprintf(stderr, "DOWNLOAD ALL 명령에는 --archive[=<dir>] 외의 인자를 넣을 수 없습니다.\n");
+                    free(line);
+                    return false;
+                }
             }
             req.action = CLI_ACTION_DOWNLOAD_ALL;
         } else {
@@ -396,13 +824,36 @@ static bool parse_command(const char *line_in, cli_request_t *out) {
             free(line);
             return false;
         }
-    } else if (strcmp(cmd, "list") == 0) {
-        if (strtok_r(NULL, " \t", &save)) {
-            fprintf(stderr, "LIST 명령에는 추가 인자가 필요 없습니다.\n");
+    } else if (strcmp(cmd, "mkdir") == 0 || strcmp(cmd, "rmdir") == 0) {
+        req.action = cmd[0] == 'm' ? CLI_ACTION_MKDIR : CLI_ACTION_RMDIR;
+        char *tok = NULL;
+        while ((tok = strtok_r(NULL, " \t", &save)) != NULL) {
+            if (!append_request_arg(&req, tok)) {
+                free(line);
+                return false;
+            }
+        }
+        if (req.arg_count == 0) {
+            fprintf(stderr, "%s 명령에는 하나 이상의 디렉터리 이름이 필요합니다.\n", cmd[0] == 'm' ? "MKDIR" : "RMDIR");
             free(line);
             return false;
         }
+    } else if (strcmp(cmd, "list") == 0) {
         req.action = CLI_ACTION_LIST;
+        char *tok = NULL;
+        while ((tok = strtok_r(NULL, " \t", &save)) != NULL) {
+            if (strncmp(tok, "--sort=", 7) == 0) {
+                if (!parse_list_sort(tok + 7, &req.sort)) {
+                    fprintf(stderr, "알 수 없는 정렬: %s (name, name-desc, size, size-asc, mtime)\n", tok + 7);
+                    free(line);
+                    return false;
+                }
+            } else if (req.arg_count > 0 || !append_request_arg(&req, tok)) {
+                fprintf(stderr, "LIST 명령에는 패턴 하나와 --sort=만 쓸 수 있습니다.\n");
+                free(line);
+                return false;
+            }
+        }
     } else if (strcmp(cmd, "quit") == 0 || strcmp(cmd, "exit") == 0) {
         if (strtok_r(NULL, " \t", &save)) {
             fprintf(stderr, "QUIT 명령에는 추가 인자가 필요 없습니다.\n");
@@ -433,101 +884,61 @@ static void print_prompt(void) {
 }
 
 static void print_help(void) {
-    puts("지원 명령: UPLOAD <path...>, DOWNLOAD <filename...>, DOWNLOAD ALL, DELETE <filename...>, LIST, QUIT");
+    puts("지원 명령: UPLOAD <path...> [--to=<dir>], DOWNLOAD <filename...>, DOWNLOAD ALL [--archive[=<dir>]], "
+         "DELETE <filename...>, "
+         "MKDIR <dir...>, RMDIR <dir...>, LIST [pattern] [--sort=name|name-desc|size|size-asc|mtime], QUIT");
 }
 
-static int handle_server_response(int fd, const cli_request_t *req, bool *should_exit);
-
-static int download_all_files(int fd) {
-    printf("[CLIENT] download-all: LIST 요청 전송\n");
-    if (send_list(fd) != 0) {
-        return -1;
-    }
-
-    mc_packet_info_t info;
-    if (recv_packet(fd, &info) != 0) {
-        return -1;
-    }
-
-    char *payload = NULL;
-    if (recv_payload_to_buffer(fd, info.header.payload_len, &payload) != 0) {
-        return -1;
-    }
-
-    if (info.header.command == MC_CMD_ERROR) {
-        fprintf(stderr, "[SERVER ERROR] %s\n", payload ? payload : "(no message)");
-        free(payload);
-        errno = EPROTO;
-        return -1;
+/*
+ * Where a single request goes: its own stream in framed mode, otherwise the
+ * connection itself. Returns NULL when no stream could be opened.
+ */
+static cli_session_t *open_channel(cli_session_t *session, cli_session_t *stream) {
+    if (!session->mux) {
+        return session;
     }
-
-    if (info.header.command != MC_CMD_LIST) {
-        fprintf(stderr, "[CLIENT] LIST 응답이 아닙니다 (cmd=%u)\n", info.header.command);
-        free(payload);
-        errno = EPROTO;
-        return -1;
+    uint32_t id = __atomic_add_fetch(&session->next_stream_id, 1U, __ATOMIC_RELAXED);
+    int fd = mc_mux_open_stream(session->mux, id);
+    if (fd == -1) {
+        return NULL;
     }
+    memset(stream, 0, sizeof(*stream));
+    stream->fd = fd;
+    stream->version = MC_PROTOCOL_VERSION_PIPELINED;
+    stream->depth = 1;
+    stream->is_stream = true;
+    stream->caps = session->caps;
+    stream->config = session->config;
+    stream->upload_dir = session->upload_dir;
+    return stream;
+}
 
-    printf("[CLIENT] 서버 파일 목록:\n%s", payload);
-
-    size_t downloaded = 0;
-    char *saveptr = NULL;
-    char *line = strtok_r(payload, "\n", &saveptr);
-    while (line) {
-        if (line[0] == '\0' || strcmp(line, "(empty)") == 0) {
-            line = strtok_r(NULL, "\n", &saveptr);
-            continue;
-        }
-
-        cli_request_t req = {0};
-        req.action = CLI_ACTION_DOWNLOAD;
-        strncpy(req.arg, line, sizeof(req.arg) - 1);
-
-        printf("[CLIENT] download-all: %s\n", req.arg);
-        if (send_download(fd, req.arg) != 0) {
-            free(payload);
-            return -1;
-        }
-
-        bool exit_after = false;
-        if (handle_server_response(fd, &req, &exit_after) != 0) {
-            free(payload);
-            return -1;
-        }
-        if (exit_after) {
-            free(payload);
-            errno = ECONNRESET;
-            return -1;
-        }
-
-        ++downloaded;
-        line = strtok_r(NULL, "\n", &saveptr);
+/* The request is complete: on a stream this sends FIN once the data is out. */
+static void finish_sending(cli_session_t *channel) {
+    if (channel->is_stream) {
+        shutdown(channel->fd, SHUT_WR); /* shutdown() 시스템 콜로 요청 전송 완료 알림 */
     }
+}
 
-    if (downloaded == 0) {
-        printf("[CLIENT] 다운로드할 파일이 없습니다.\n");
-    } else {
-        printf("[CLIENT] download-all 완료: %zu개 파일\n", downloaded);
+static void close_channel(cli_session_t *session, cli_session_t *channel) {
+    if (channel && channel != session) {
+        close(channel->fd); /* close() 시스템 콜로 스트림 종료 */
     }
-
-    free(payload);
-    return 0;
 }
 
-static int handle_server_response(int fd, const cli_request_t *req, bool *should_exit) {
+static int handle_response_packet(const cli_session_t *session,
+                                  const mc_packet_info_t *info,
+                                  const char *requested_name,
+                                  bool *should_exit) {
+    int fd = session->fd;
     if (should_exit) {
         *should_exit = false;
     }
 
-    mc_packet_info_t info;
-    if (recv_packet(fd, &info) != 0) {
-        return -1;
-    }
-
-    uint64_t payload_len = info.header.payload_len;
+    uint64_t payload_len = info->header.payload_len;
     char *buffer = NULL;
 
-    switch (info.header.command) {
+    switch (info->header.command) {
         case MC_CMD_ERROR:
             if (recv_payload_to_buffer(fd, payload_len, &buffer) != 0) {
                 return -1;
@@ -536,6 +947,8 @@ static int handle_server_response(int fd, const cli_request_t *req, bool *should
             free(buffer);
             return 0;
         case MC_CMD_UPLOAD:
+        case MC_CMD_UPLOAD_COMMIT:
+        case MC_CMD_DELTA:
             if (recv_payload_to_buffer(fd, payload_len, &buffer) != 0) {
                 return -1;
             }
@@ -556,8 +969,17 @@ static int handle_server_response(int fd, const cli_request_t *req, bool *should
             printf("[CLIENT] 삭제 응답: %s\n", buffer);
             free(buffer);
             return 0;
+        case MC_CMD_MKDIR:
+        case MC_CMD_RMDIR:
+            if (recv_payload_to_buffer(fd, payload_len, &buffer) != 0) {
+                return -1;
+            }
+            printf("[CLIENT] 디렉터리 응답: %s\n", buffer);
+            free(buffer);
+            return 0;
         case MC_CMD_DOWNLOAD:
-            return handle_download_payload(fd, &info, req ? req->arg : NULL);
+        case MC_CMD_DOWNLOAD_RANGE:
+            return handle_download_payload(session, info, requested_name);
         case MC_CMD_AUTH:
             if (recv_payload_to_buffer(fd, payload_len, &buffer) != 0) {
                 return -1;
@@ -589,38 +1011,1679 @@ static int handle_server_response(int fd, const cli_request_t *req, bool *should
     }
 }
 
-static int perform_auth_if_needed(int fd, const mc_client_config_t *config) {
-    if (!config || !config->auth_token || !config->auth_token[0]) {
-        return 0;
-    }
-
-    if (send_auth(fd, config->auth_token) != 0) {
+static int handle_server_response(cli_session_t *session, const char *requested_name, bool *should_exit) {
+    mc_packet_info_t info;
+    if (recv_packet(session->fd, &info) != 0) {
         return -1;
     }
+    return handle_response_packet(session, &info, requested_name, should_exit);
+}
 
-    mc_packet_info_t info;
-    if (recv_packet(fd, &info) != 0) {
+/* Files above one chunk go through an upload session when the server has them (v2+). */
+static bool wants_resumable(const cli_session_t *session, const char *local_path) {
+    struct stat st;
+    return session->version >= MC_PROTOCOL_VERSION_PIPELINED && stat(local_path, &st) == 0 &&
+           S_ISREG(st.st_mode) && (uint64_t)st.st_size > MC_CLIENT_UPLOAD_CHUNK;
+}
+
+/*
+ * Reads the reply to one upload session step. Returns 0 with the reported
+ * range, 1 after printing a server error (the connection stays usable) or -1.
+ */
+static int recv_session_reply(cli_session_t *session, mc_command_t expected, mc_packet_info_t *info, mc_range_t *range) {
+    if (recv_packet(session->fd, info) != 0) {
         return -1;
     }
-
-    char *payload = NULL;
-    if (recv_payload_to_buffer(fd, info.header.payload_len, &payload) != 0) {
+    if (info->header.command != expected || info->header.payload_len != MC_RANGE_SIZE) {
+        return handle_response_packet(session, info, NULL, NULL) != 0 ? -1 : 1;
+    }
+    if (mc_recv_all(session->fd, range, sizeof(*range)) != (ssize_t)sizeof(*range)) {
         return -1;
     }
+    mc_range_network_to_host(range);
+    return 0;
+}
 
-    if (info.header.command == MC_CMD_AUTH) {
-        printf("[CLIENT] 서버 인증 응답: %s\n", payload && payload[0] ? payload : "AUTH OK");
-        free(payload);
-        return 0;
+/* SHA-256 and length of what is left to read from fd; 0, or -1 with errno. */
+static int hash_file(int fd, uint8_t digest[MC_SHA256_DIGEST_LEN], uint64_t *size) {
+    mc_sha256_t sha;
+    mc_sha256_init(&sha);
+    uint8_t buffer[64 * 1024];
+    ssize_t rd;
+    *size = 0;
+    while ((rd = read(fd, buffer, sizeof(buffer))) != 0) { /* read() 시스템 콜로 해시할 내용 읽기 */
+        if (rd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        mc_sha256_update(&sha, buffer, (size_t)rd);
+        *size += (uint64_t)rd;
     }
+    mc_sha256_final(&sha, digest);
+    return 0;
+}
 
-    fprintf(stderr, "[CLIENT] 인증 실패: %s\n", payload ? payload : "(no message)");
-    free(payload);
+/*
+ * Uploads local_path in MC_CLIENT_UPLOAD_CHUNK appends. The session key
+ * depends on name, size, mtime and the content's SHA-256, so re-running an
+ * interrupted upload of an unchanged file continues from the server's
+ * committed offset, and the server checks the hash before publishing.
+ */
+static int upload_resumable(cli_session_t *session, const char *local_path) {
+    char remote[MC_MAX_FILENAME_LEN + 1];
+    if (upload_name(session, local_path, remote, sizeof(remote)) != 0) {
+        return -1;
+    }
+    int file_fd = open(local_path, O_RDONLY); /* open() 시스템 콜로 업로드 파일 오픈 */
+    if (file_fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(file_fd, &st) == -1) { /* fstat() 시스템 콜로 크기와 수정 시각 확인 */
+        close(file_fd);
+        return -1;
+    }
+
+    mc_upload_begin_t begin = {
+        .total_size = (uint64_t)st.st_size,
+        .tag = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL + (uint64_t)st.st_mtim.tv_nsec,
+    };
+    uint64_t hashed = 0;
+    if (hash_file(file_fd, begin.sha256, &hashed) != 0 || hashed != begin.total_size) {
+        close(file_fd);
+        fprintf(stderr, "[CLIENT] 업로드 중 파일이 바뀌었습니다: %s\n", local_path);
+        return -1;
+    }
+    mc_upload_begin_t wire = begin;
+    mc_upload_begin_host_to_network(&wire);
+
+    mc_packet_info_t info;
+    mc_range_t progress = {0, 0};
+    char key[MC_MAX_FILENAME_LEN + 1];
+    int rc = send_request_prefix(session, MC_CMD_UPLOAD_BEGIN, remote, sizeof(wire), &wire, sizeof(wire), NULL);
+    if (rc == 0) {
+        rc = recv_session_reply(session, MC_CMD_UPLOAD_BEGIN, &info, &progress);
+    }
+    if (rc == 0) {
+        snprintf(key, sizeof(key), "%s", info.filename);
+        if (progress.offset > 0) {
+            printf("[CLIENT] 이어올리기: %s (%" PRIu64 " bytes부터)\n", remote, progress.offset);
+        }
+    }
+
+    uint64_t committed = progress.offset;
+    while (rc == 0 && committed < begin.total_size) {
+        uint64_t chunk = begin.total_size - committed;
+        if (chunk > MC_CLIENT_UPLOAD_CHUNK) {
+            chunk = MC_CLIENT_UPLOAD_CHUNK;
+        }
+        if (lseek(file_fd, (off_t)committed, SEEK_SET) == -1 || /* lseek() 시스템 콜로 보낼 위치 이동 */
+            send_file_request(session, MC_CMD_UPLOAD_APPEND, key, file_fd, chunk, NULL) != 0) {
+            rc = -1;
+            break;
+        }
+        rc = recv_session_reply(session, MC_CMD_UPLOAD_APPEND, &info, &progress);
+        if (rc == 0 && progress.offset <= committed) {
+            fprintf(stderr, "[CLIENT] 업로드 세션이 진행되지 않습니다: %s\n", remote);
+            rc = 1;
+        }
+        committed = progress.offset;
+    }
+    close(file_fd); /* close() 시스템 콜로 로컬 파일 닫기 */
+
+    if (rc == 0) {
+        rc = send_request_prefix(session, MC_CMD_UPLOAD_COMMIT, remote, sizeof(wire), &wire, sizeof(wire), NULL);
+        if (rc == 0) {
+            rc = handle_server_response(session, remote, NULL);
+        }
+    }
+    return rc < 0 ? -1 : 0;
+}
+
+/* Files of MC_CLIENT_DELTA_MIN or more first try a delta against the server's copy (v2+). */
+static bool wants_delta(const cli_session_t *session, const char *local_path) {
+    struct stat st;
+    return session->config && session->config->delta && session->version >= MC_PROTOCOL_VERSION_PIPELINED &&
+           stat(local_path, &st) == 0 && S_ISREG(st.st_mode) && (uint64_t)st.st_size >= MC_CLIENT_DELTA_MIN;
+}
+
+typedef struct {
+    uint32_t weak;
+    uint32_t block;
+} cli_weak_t;
+
+static int compare_weak(const void *a, const void *b) {
+    const cli_weak_t *lhs = a;
+    const cli_weak_t *rhs = b;
+    if (lhs->weak != rhs->weak) {
+        return lhs->weak < rhs->weak ? -1 : 1;
+    }
+    return lhs->block < rhs->block ? -1 : (lhs->block > rhs->block);
+}
+
+/* Delta ops go to out; consecutive COPYs merge into one run. */
+typedef struct {
+    FILE *out;
+    uint32_t run_first;
+    uint32_t run_count;
+    uint64_t literal_bytes;
+    bool failed;
+} cli_delta_t;
+
+static void delta_op(cli_delta_t *delta, uint8_t type, uint32_t arg, uint32_t count) {
+    mc_delta_op_t op = {.type = type, .arg = htonl(arg), .count = htonl(count)};
+    if (fwrite(&op, sizeof(op), 1, delta->out) != 1) {
+        delta->failed = true;
+    }
+}
+
+static void delta_flush_copy(cli_delta_t *delta) {
+    if (delta->run_count > 0) {
+        delta_op(delta, MC_DELTA_OP_COPY, delta->run_first, delta->run_count);
+        delta->run_count = 0;
+    }
+}
+
+static void delta_copy(cli_delta_t *delta, uint32_t block) {
+    if (delta->run_count > 0 && delta->run_first + delta->run_count == block) {
+        delta->run_count++;
+        return;
+    }
+    delta_flush_copy(delta);
+    delta->run_first = block;
+    delta->run_count = 1;
+}
+
+static void delta_literal(cli_delta_t *delta, const uint8_t *data, uint64_t len) {
+    delta_flush_copy(delta);
+    while (len > 0) {
+        uint32_t piece = len > MC_CLIENT_DELTA_LITERAL_MAX ? MC_CLIENT_DELTA_LITERAL_MAX : (uint32_t)len;
+        delta_op(delta, MC_DELTA_OP_LITERAL, piece, 0);
+        if (fwrite(data, 1, piece, delta->out) != piece) {
+            delta->failed = true;
+        }
+        data += piece;
+        len -= piece;
+        delta->literal_bytes += piece;
+    }
+}
+
+/* Server block whose weak and strong sums match window, or -1. */
+static int64_t match_block(const cli_weak_t *index,
+                           size_t count,
+                           const mc_block_sig_t *blocks,
+                           uint32_t weak,
+                           const uint8_t *window,
+                           size_t len) {
+    size_t lo = 0;
+    size_t hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index[mid].weak < weak) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    bool have_strong = false;
+    uint8_t strong[MC_DELTA_STRONG_LEN];
+    for (; lo < count && index[lo].weak == weak; ++lo) {
+        if (!have_strong) {
+            mc_delta_strong(window, len, strong);
+            have_strong = true;
+        }
+        if (memcmp(blocks[index[lo].block].strong, strong, sizeof(strong)) == 0) {
+            return index[lo].block;
+        }
+    }
+    return -1;
+}
+
+/*
+ * The rsync matching pass: a weak checksum rolls over data one byte at a
+ * time, and wherever it and then the strong hash match a server block, that
+ * block becomes a COPY and the window jumps past it. Everything between
+ * matches is sent as LITERAL bytes.
+ */
+static int build_delta(cli_delta_t *delta,
+                       const uint8_t *data,
+                       uint64_t size,
+                       const mc_signature_header_t *sig,
+                       const mc_block_sig_t *blocks) {
+    size_t len = sig->block_size;
+    uint64_t tail_len = sig->file_size % len;
+    size_t full_blocks = sig->block_count - (tail_len > 0 ? 1U : 0U);
+    cli_weak_t *index = malloc((full_blocks > 0 ? full_blocks : 1U) * sizeof(*index));
+    if (!index) {
+        return -1;
+    }
+    for (size_t i = 0; i < full_blocks; ++i) {
+        index[i].weak = ntohl(blocks[i].weak);
+        index[i].block = (uint32_t)i;
+    }
+    qsort(index, full_blocks, sizeof(*index), compare_weak);
+
+    uint64_t pos = 0;
+    uint64_t literal_start = 0;
+    uint32_t weak = size >= len ? mc_delta_weak(data, len) : 0;
+    while (full_blocks > 0 && pos + len <= size) {
+        int64_t block = match_block(index, full_blocks, blocks, weak, data + pos, len);
+        if (block >= 0) {
+            if (pos > literal_start) {
+                delta_literal(delta, data + literal_start, pos - literal_start);
+            }
+            delta_copy(delta, (uint32_t)block);
+            pos += len;
+            literal_start = pos;
+            if (pos + len <= size) {
+                weak = mc_delta_weak(data + pos, len);
+            }
+            continue;
+        }
+        if (pos + len < size) {
+            weak = mc_delta_roll(weak, data[pos], data[pos + len], len);
+        }
+        ++pos;
+    }
+    free(index);
+
+    /* a short last block can only line up with the end of the file */
+    if (tail_len > 0 && size - literal_start >= tail_len) {
+        uint8_t strong[MC_DELTA_STRONG_LEN];
+        const uint8_t *tail = data + size - tail_len;
+        mc_delta_strong(tail, (size_t)tail_len, strong);
+        if (memcmp(blocks[sig->block_count - 1].strong, strong, sizeof(strong)) == 0) {
+            if (size - tail_len > literal_start) {
+                delta_literal(delta, data + literal_start, size - tail_len - literal_start);
+            }
+            delta_copy(delta, sig->block_count - 1);
+            literal_start = size;
+        }
+    }
+    if (size > literal_start) {
+        delta_literal(delta, data + literal_start, size - literal_start);
+    }
+    delta_flush_copy(delta);
+    return delta->failed ? -1 : 0;
+}
+
+/*
+ * Re-uploads local_path as a delta against the server's copy: SIGNATURES
+ * fetches the block sums, the matching pass writes the ops to a temp file and
+ * DELTA sends them. Returns 0 when done, 1 when the caller should upload the
+ * whole file instead (no server copy, nothing reusable, delta refused) or -1.
+ */
+static int upload_delta(cli_session_t *session, const char *local_path) {
+    char remote[MC_MAX_FILENAME_LEN + 1];
+    if (upload_name(session, local_path, remote, sizeof(remote)) != 0) {
+        return -1;
+    }
+    mc_packet_info_t info;
+    char *reply = NULL;
+    if (send_header_and_filename(session, MC_CMD_SIGNATURES, remote, 0, NULL) != 0 ||
+        recv_packet(session->fd, &info) != 0 ||
+        recv_payload_to_buffer(session->fd, info.header.payload_len, &reply) != 0) {
+        return -1;
+    }
+    mc_signature_header_t sig;
+    uint64_t reply_len = info.header.payload_len;
+    if (info.header.command != MC_CMD_SIGNATURES || reply_len < sizeof(sig)) {
+        free(reply); /* no copy there (or a server without delta sync) */
+        return 1;
+    }
+    memcpy(&sig, reply, sizeof(sig));
+    mc_signature_network_to_host(&sig);
+    if (sig.block_size == 0 || sig.block_count == 0 ||
+        reply_len != sizeof(sig) + (uint64_t)sig.block_count * sizeof(mc_block_sig_t)) {
+        free(reply);
+        return 1;
+    }
+
+    int file_fd = open(local_path, O_RDONLY); /* open() 시스템 콜로 업로드 파일 오픈 */
+    struct stat st;
+    if (file_fd == -1 || fstat(file_fd, &st) == -1 || st.st_size == 0) { /* fstat() 시스템 콜로 크기 확인 */
+        if (file_fd != -1) {
+            close(file_fd);
+        }
+        free(reply);
+        return 1;
+    }
+    uint64_t size = (uint64_t)st.st_size;
+    uint8_t *data = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, file_fd, 0); /* mmap() 시스템 콜로 로컬 파일 매핑 */
+    close(file_fd);
+    FILE *out = tmpfile();
+    if (data == MAP_FAILED || !out) {
+        if (data != MAP_FAILED) {
+            munmap(data, (size_t)size);
+        }
+        if (out) {
+            fclose(out);
+        }
+        free(reply);
+        return 1;
+    }
+
+    mc_delta_header_t header = {
+        .block_size = sig.block_size,
+        .block_count = sig.block_count,
+        .base_size = sig.file_size,
+        .new_size = size,
+    };
+    mc_sha256(data, (size_t)size, header.sha256);
+    mc_delta_host_to_network(&header);
+    cli_delta_t delta = {.out = out};
+    int rc = fwrite(&header, sizeof(header), 1, out) == 1 ? 0 : -1;
+    if (rc == 0) {
+        rc = build_delta(&delta, data, size, &sig, (const mc_block_sig_t *)(reply + sizeof(sig)));
+    }
+    munmap(data, (size_t)size); /* munmap() 시스템 콜로 매핑 해제 */
+    free(reply);
+
+    long delta_len = rc == 0 && fflush(out) == 0 ? ftell(out) : -1;
+    if (delta_len < 0 || delta.literal_bytes == size) {
+        fclose(out); /* nothing to reuse: a plain upload is cheaper */
+        return 1;
+    }
+    printf("[CLIENT] 델타 업로드: %s (%" PRIu64 " bytes 중 %" PRIu64 " bytes 새로 전송, 델타 %ld bytes)\n",
+           remote,
+           size,
+           delta.literal_bytes,
+           delta_len);
+
+    rc = lseek(fileno(out), 0, SEEK_SET) == -1 ? -1 : 0; /* lseek() 시스템 콜로 델타 처음으로 이동 */
+    if (rc == 0) {
+        rc = send_file_request(session, MC_CMD_DELTA, remote, fileno(out), (uint64_t)delta_len, NULL);
+    }
+    fclose(out);
+    if (rc != 0 || recv_packet(session->fd, &info) != 0) {
+        return -1;
+    }
+    if (handle_response_packet(session, &info, NULL, NULL) != 0) {
+        return -1;
+    }
+    return info.header.command == MC_CMD_DELTA ? 0 : 1; /* refused: send the whole file */
+}
+
+/* Files of MC_CLIENT_HAVE_MIN or more are first offered by content hash (v2+). */
+static bool wants_have(const cli_session_t *session, const char *local_path) {
+    struct stat st;
+    return session->config && session->config->check_have && session->version >= MC_PROTOCOL_VERSION_PIPELINED &&
+           stat(local_path, &st) == 0 && S_ISREG(st.st_mode) && (uint64_t)st.st_size >= MC_CLIENT_HAVE_MIN;
+}
+
+/*
+ * Sends HAVE with the file's size and SHA-256. Returns 0 when the server
+ * already holds the content under the file's name, 1 when it has to be
+ * uploaded (including servers without HAVE) or -1.
+ */
+static int upload_have(cli_session_t *session, const char *local_path) {
+    int file_fd = open(local_path, O_RDONLY); /* open() 시스템 콜로 업로드 파일 오픈 */
+    if (file_fd == -1) {
+        return -1;
+    }
+    mc_have_t have = {.size = 0};
+    int rc = hash_file(file_fd, have.sha256, &have.size);
+    close(file_fd); /* close() 시스템 콜로 로컬 파일 닫기 */
+    if (rc != 0) {
+        return -1;
+    }
+    mc_have_host_to_network(&have);
+
+    char remote[MC_MAX_FILENAME_LEN + 1];
+    if (upload_name(session, local_path, remote, sizeof(remote)) != 0) {
+        return -1;
+    }
+    mc_packet_info_t info;
+    char *reply = NULL;
+    if (send_request_prefix(session, MC_CMD_HAVE, remote, sizeof(have), &have, sizeof(have), NULL) != 0 ||
+        recv_packet(session->fd, &info) != 0 ||
+        recv_payload_to_buffer(session->fd, info.header.payload_len, &reply) != 0) {
+        return -1;
+    }
+    bool stored = info.header.command == MC_CMD_HAVE && strcmp(reply, MC_HAVE_STORED) == 0;
+    free(reply);
+    if (!stored) {
+        return 1;
+    }
+    printf("[CLIENT] 서버에 같은 내용이 있어 전송 생략: %s\n", remote);
+    return 0;
+}
+
+/*
+ * Uploads that need several round trips and so run on their own: nothing at
+ * all when the server already has the content, a delta when it has an older
+ * copy, otherwise a session upload for large files, otherwise a plain UPLOAD.
+ */
+static bool wants_sequential_upload(const cli_session_t *session, const char *local_path) {
+    return wants_have(session, local_path) || wants_delta(session, local_path) || wants_resumable(session, local_path);
+}
+
+static int upload_sequential(cli_session_t *session, const char *local_path) {
+    if (wants_have(session, local_path)) {
+        int rc = upload_have(session, local_path);
+        if (rc <= 0) {
+            return rc;
+        }
+    }
+    if (wants_delta(session, local_path)) {
+        int rc = upload_delta(session, local_path);
+        if (rc <= 0) {
+            return rc;
+        }
+    }
+    if (wants_resumable(session, local_path)) {
+        return upload_resumable(session, local_path);
+    }
+    if (send_upload(session, local_path, NULL) != 0) {
+        return -1;
+    }
+    return handle_server_response(session, local_path, NULL);
+}
+
+static int send_batch_request(cli_session_t *session, cli_action_t action, const char *name, uint32_t *out_id) {
+    switch (action) {
+        case CLI_ACTION_UPLOAD:
+            printf("[CLIENT] 업로드 시작: %s\n", name);
+            return send_upload(session, name, out_id);
+        case CLI_ACTION_DOWNLOAD:
+            printf("[CLIENT] 다운로드 요청: %s\n", name);
+            return send_download(session, name, out_id);
+        case CLI_ACTION_DELETE:
+            printf("[CLIENT] 삭제 요청: %s\n", name);
+            return send_delete(session, name, out_id);
+        case CLI_ACTION_MKDIR:
+            printf("[CLIENT] 디렉터리 생성 요청: %s\n", name);
+            return send_header_and_filename(session, MC_CMD_MKDIR, name, 0, out_id);
+        case CLI_ACTION_RMDIR:
+            printf("[CLIENT] 디렉터리 삭제 요청: %s\n", name);
+            return send_header_and_filename(session, MC_CMD_RMDIR, name, 0, out_id);
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+}
+
+typedef struct {
+    cli_session_t *session;
+    cli_action_t action;
+    const char *const *names;
+    size_t count;
+    size_t next;
+    bool failed;
+    int failed_errno;
+    pthread_mutex_t lock;
+} cli_stream_batch_t;
+
+/* Worker for framed mode: takes the next name and runs it on its own stream. */
+static void *stream_batch_worker(void *arg) {
+    cli_stream_batch_t *batch = arg;
+    while (1) {
+        pthread_mutex_lock(&batch->lock);
+        size_t index = batch->next++;
+        pthread_mutex_unlock(&batch->lock);
+        if (index >= batch->count) {
+            break;
+        }
+
+        const char *name = batch->names[index];
+        cli_session_t stream;
+        int rc = -1;
+        if (open_channel(batch->session, &stream) != NULL) {
+            if (batch->action == CLI_ACTION_UPLOAD && wants_sequential_upload(&stream, name)) {
+                printf("[CLIENT] 업로드 시작: %s\n", name);
+                rc = upload_sequential(&stream, name);
+                finish_sending(&stream);
+            } else {
+                rc = send_batch_request(&stream, batch->action, name, NULL);
+                if (rc == 0) {
+                    finish_sending(&stream);
+                    bool exit_after = false;
+                    rc = handle_server_response(&stream, name, &exit_after);
+                }
+            }
+            close_channel(batch->session, &stream);
+        }
+        if (rc != 0) {
+            pthread_mutex_lock(&batch->lock);
+            if (!batch->failed) {
+                batch->failed = true;
+                batch->failed_errno = errno;
+            }
+            pthread_mutex_unlock(&batch->lock);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Framed mode: up to session->depth transfers run at once, each on its own
+ * stream, and the mux interleaves their chunks so small files finish while a
+ * large one is still moving.
+ */
+static int run_stream_batch(cli_session_t *session, cli_action_t action, const char *const *names, size_t count) {
+    cli_stream_batch_t batch = {
+        .session = session,
+        .action = action,
+        .names = names,
+        .count = count,
+    };
+    pthread_mutex_init(&batch.lock, NULL);
+
+    size_t workers = count < session->depth ? count : session->depth;
+    pthread_t threads[MC_CLIENT_MAX_PIPELINE];
+    size_t started = 0;
+    for (; started < workers; ++started) {
+        if (pthread_create(&threads[started], NULL, stream_batch_worker, &batch) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        stream_batch_worker(&batch);
+    }
+    for (size_t i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&batch.lock);
+
+    if (batch.failed) {
+        errno = batch.failed_errno;
+        return -1;
+    }
+    return 0;
+}
+
+typedef struct {
+    bool used;
+    uint32_t request_id;
+    const char *name;
+} cli_inflight_t;
+
+/*
+ * Runs one request per name. A pipelined session keeps up to session->depth
+ * requests in flight and matches replies by request_id, so a batch costs
+ * about one round trip instead of one per file; a v1 session sends the next
+ * request only after the previous reply.
+ */
+static int run_batch(cli_session_t *session,
+                     cli_action_t action,
+                     const char *const *names,
+                     size_t count,
+                     bool *should_exit) {
+    if (session->mux) {
+        *should_exit = false;
+        return run_stream_batch(session, action, names, count);
+    }
+
+    cli_inflight_t inflight[MC_CLIENT_MAX_PIPELINE];
+    memset(inflight, 0, sizeof(inflight));
+    size_t window = session->version >= MC_PROTOCOL_VERSION_PIPELINED ? session->depth : 1U;
+    size_t in_flight = 0;
+    size_t next = 0;
+    bool send_failed = false;
+    int send_errno = 0;
+
+    *should_exit = false;
+    while (in_flight > 0 || (next < count && !send_failed)) {
+        while (!send_failed && next < count && in_flight < window) {
+            if (action == CLI_ACTION_UPLOAD && wants_sequential_upload(session, names[next])) {
+                if (in_flight > 0) {
+                    break; /* a multi-step upload runs alone: collect the replies first */
+                }
+                printf("[CLIENT] 업로드 시작: %s\n", names[next]);
+                if (upload_sequential(session, names[next]) != 0) {
+                    send_failed = true;
+                    send_errno = errno;
+                    break;
+                }
+                ++next;
+                continue;
+            }
+            uint32_t id = 0;
+            if (send_batch_request(session, action, names[next], &id) != 0) {
+                /* collect what is already in flight before reporting */
+                send_failed = true;
+                send_errno = errno;
+                break;
+            }
+            size_t slot = 0;
+            while (inflight[slot].used) {
+                ++slot;
+            }
+            inflight[slot].used = true;
+            inflight[slot].request_id = id;
+            inflight[slot].name = names[next];
+            ++in_flight;
+            ++next;
+        }
+        if (in_flight == 0) {
+            break;
+        }
+
+        mc_packet_info_t info;
+        if (recv_packet(session->fd, &info) != 0) {
+            return -1;
+        }
+        size_t slot = 0;
+        while (slot < window && !(inflight[slot].used && inflight[slot].request_id == info.header.request_id)) {
+            ++slot;
+        }
+        if (slot == window) {
+            fprintf(stderr, "[CLIENT] 알 수 없는 요청 ID의 응답입니다 (id=%u)\n", info.header.request_id);
+            errno = EPROTO;
+            return -1;
+        }
+        inflight[slot].used = false;
+        --in_flight;
+
+        bool exit_after = false;
+        if (handle_response_packet(session, &info, inflight[slot].name, &exit_after) != 0) {
+            return -1;
+        }
+        if (exit_after) {
+            *should_exit = true;
+            return 0;
+        }
+    }
+
+    if (send_failed) {
+        errno = send_errno;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Bundles (v2+, once the server took the "bundle" option): the small files of
+ * a batch travel as one BUNDLE_UPLOAD or BUNDLE_DOWNLOAD instead of a request
+ * and a reply each. Whatever a bundle does not carry is appended to rest, in
+ * order, for the usual per-file requests.
+ */
+static bool uses_bundles(const cli_session_t *session) {
+    return (session->caps & MC_AUTH_CAP_BUNDLE) != 0;
+}
+
+/* Writes one bundle record (header, name, size bytes of data) at dst; returns its length. */
+static size_t put_bundle_entry(uint8_t *dst, const char *name, const void *data, uint64_t size, uint32_t crc) {
+    size_t name_len = strlen(name);
+    mc_bundle_entry_t entry = {.size = size, .crc = crc, .name_len = (uint16_t)name_len, .status = MC_BUNDLE_OK};
+    mc_bundle_entry_host_to_network(&entry);
+    memcpy(dst, &entry, sizeof(entry));
+    memcpy(dst + sizeof(entry), name, name_len);
+    if (size > 0) {
+        memcpy(dst + sizeof(entry) + name_len, data, (size_t)size);
+    }
+    return sizeof(entry) + name_len + (size_t)size;
+}
+
+/* Reads all size bytes of a local file into dst; -1 when it is gone or shorter now. */
+static int read_local_file(const char *path, uint8_t *dst, uint64_t size) {
+    int fd = open(path, O_RDONLY); /* open() 시스템 콜로 번들에 담을 파일 열기 */
+    if (fd == -1) {
+        return -1;
+    }
+    uint64_t done = 0;
+    while (done < size) {
+        ssize_t got = read(fd, dst + done, (size_t)(size - done)); /* read() 시스템 콜로 파일 내용 읽기 */
+        if (got <= 0) {
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        done += (uint64_t)got;
+    }
+    close(fd);
+    return done == size ? 0 : -1;
+}
+
+/*
+ * Uploads the small regular files among paths as one bundle. Files that take
+ * several steps anyway (see wants_sequential_upload) stay out of it, and when
+ * the server refuses the bundle its files are uploaded one by one instead,
+ * which reports each problem against its own file.
+ */
+static int upload_bundle(cli_session_t *session, const char *const *paths, size_t count, const char **rest, size_t *rest_count) {
+    bool *picked = calloc(count, sizeof(*picked));
+    uint64_t *sizes = calloc(count, sizeof(*sizes));
+    if (!picked || !sizes) {
+        free(picked);
+        free(sizes);
+        return -1;
+    }
+    size_t files = 0;
+    uint64_t data = 0;
+    size_t wire_len = 0;
+    char name[MC_MAX_FILENAME_LEN + 1];
+    for (size_t i = 0; i < count; ++i) {
+        struct stat st;
+        if (files == MC_BUNDLE_MAX_FILES || stat(paths[i], &st) != 0 || !S_ISREG(st.st_mode) ||
+            (uint64_t)st.st_size > MC_BUNDLE_FILE_MAX || data + (uint64_t)st.st_size > MC_BUNDLE_DATA_MAX ||
+            upload_name(session, paths[i], name, sizeof(name)) != 0 || wants_sequential_upload(session, paths[i])) {
+            continue;
+        }
+        picked[i] = true;
+        sizes[i] = (uint64_t)st.st_size;
+        data += sizes[i];
+        wire_len += sizeof(mc_bundle_entry_t) + strlen(name) + (size_t)sizes[i];
+        ++files;
+    }
+
+    uint8_t *payload = files > 1 ? malloc(wire_len) : NULL;
+    size_t used = 0;
+    if (payload) {
+        for (size_t i = 0; i < count; ++i) {
+            if (!picked[i]) {
+                continue;
+            }
+            /* the data goes where put_bundle_entry will copy it from: read it in place */
+            upload_name(session, paths[i], name, sizeof(name));
+            uint8_t *slot = payload + used + sizeof(mc_bundle_entry_t) + strlen(name);
+            if (read_local_file(paths[i], slot, sizes[i]) != 0) {
+                picked[i] = false; /* changed since stat: upload it on its own */
+                --files;
+                continue;
+            }
+            used += put_bundle_entry(payload + used, name, slot, sizes[i], mc_crc32c_update(0, slot, (size_t)sizes[i]));
+        }
+    }
+
+    int rc = 0;
+    if (payload && files > 1) {
+        printf("[CLIENT] 번들 업로드: %zu개 파일 (%zu bytes)\n", files, used);
+        cli_session_t stream;
+        cli_session_t *channel = open_channel(session, &stream);
+        mc_packet_info_t info;
+        char *reply = NULL;
+        rc = channel && send_request_prefix(channel, MC_CMD_BUNDLE_UPLOAD, NULL, used, payload, used, NULL) == 0 ? 0 : -1;
+        if (rc == 0) {
+            finish_sending(channel);
+            rc = recv_packet(channel->fd, &info) == 0 &&
+                         recv_payload_to_buffer(channel->fd, info.header.payload_len, &reply) == 0
+                     ? 0
+                     : -1;
+        }
+        close_channel(session, channel);
+        if (rc == 0 && info.header.command == MC_CMD_BUNDLE_UPLOAD) {
+            printf("[CLIENT] 서버 응답: %s\n", reply);
+        } else if (rc == 0) {
+            fprintf(stderr, "[SERVER ERROR] %s (파일별로 다시 업로드합니다)\n", reply);
+            memset(picked, 0, count * sizeof(*picked));
+        }
+        free(reply);
+    } else {
+        memset(picked, 0, count * sizeof(*picked)); /* one file gains nothing from a bundle */
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if (!picked[i]) {
+            rest[(*rest_count)++] = paths[i];
+        }
+    }
+    free(payload);
+    free(sizes);
+    free(picked);
+    return rc;
+}
+
+/* Saves one OK record of a BUNDLE_DOWNLOAD reply like a finished DOWNLOAD; false to fetch it again on its own. */
+static bool save_bundle_file(const char *remote_name, const uint8_t *data, uint64_t size, uint32_t crc) {
+    char local_name[MC_MAX_FILENAME_LEN + 1];
+    char part[MC_MAX_FILENAME_LEN + sizeof(MC_CLIENT_PARTIAL_SUFFIX)];
+    sanitize_download_name(remote_name, local_name, sizeof(local_name));
+    if (mc_crc32c_update(0, data, (size_t)size) != crc) {
+        fprintf(stderr, "다운로드 체크섬 불일치: %s (따로 다시 받습니다)\n", local_name);
+        return false;
+    }
+    partial_path(local_name, part, sizeof(part));
+    make_parent_dirs(part);
+    int out_fd = open(part, O_WRONLY | O_CREAT | O_TRUNC, 0644); /* open() 시스템 콜로 다운로드 파일 생성 */
+    if (out_fd == -1) {
+        fprintf(stderr, "다운로드 저장 실패: %s: %s\n", local_name, strerror(errno));
+        return true;
+    }
+    ssize_t written = size > 0 ? write(out_fd, data, (size_t)size) : 0; /* write() 시스템 콜로 다운로드 데이터 기록 */
+    close(out_fd);
+    if (written != (ssize_t)size || rename(part, local_name) == -1) { /* rename() 시스템 콜로 완성된 파일 게시 */
+        fprintf(stderr, "다운로드 저장 실패: %s: %s\n", local_name, strerror(errno ? errno : EIO));
+        unlink(part);
+        return true;
+    }
+    drop_validator(local_name);
+    printf("[CLIENT] 다운로드 완료 -> %s (%" PRIu64 " bytes)\n", local_name, size);
+    return true;
+}
+
+/*
+ * Downloads names as one bundle. A name with a leftover ".part" resumes with
+ * its own DOWNLOAD_RANGE instead, and so does every file the server skipped
+ * (too large for the bundle) or that arrived damaged.
+ */
+static int download_bundle(cli_session_t *session, const char *const *names, size_t count, const char **rest, size_t *rest_count) {
+    bool *picked = calloc(count, sizeof(*picked));
+    if (!picked) {
+        return -1;
+    }
+    size_t files = 0;
+    size_t wire_len = 0;
+    for (size_t i = 0; i < count && files < MC_BUNDLE_MAX_FILES; ++i) {
+        char local_name[MC_MAX_FILENAME_LEN + 1];
+        char part[MC_MAX_FILENAME_LEN + sizeof(MC_CLIENT_PARTIAL_SUFFIX)];
+        struct stat st;
+        sanitize_download_name(names[i], local_name, sizeof(local_name));
+        partial_path(local_name, part, sizeof(part));
+        if (stat(part, &st) == 0 && st.st_size > 0) { /* stat() 시스템 콜로 이어받을 부분 파일 확인 */
+            continue;
+        }
+        picked[i] = true;
+        wire_len += sizeof(mc_bundle_entry_t) + strlen(names[i]);
+        ++files;
+    }
+
+    uint8_t *request = files > 1 ? malloc(wire_len) : NULL;
+    int rc = 0;
+    if (request) {
+        size_t used = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (picked[i]) {
+                used += put_bundle_entry(request + used, names[i], NULL, 0, 0);
+            }
+        }
+        printf("[CLIENT] 번들 다운로드 요청: %zu개 파일\n", files);
+
+        cli_session_t stream;
+        cli_session_t *channel = open_channel(session, &stream);
+        mc_packet_info_t info;
+        char *reply = NULL;
+        rc = channel && send_request_prefix(channel, MC_CMD_BUNDLE_DOWNLOAD, NULL, used, request, used, NULL) == 0 ? 0 : -1;
+        if (rc == 0) {
+            finish_sending(channel);
+            rc = recv_packet(channel->fd, &info);
+        }
+        if (rc == 0 && info.header.payload_len > MC_BUNDLE_WIRE_MAX) {
+            errno = EPROTO;
+            rc = -1;
+        }
+        if (rc == 0) {
+            rc = recv_payload_to_buffer(channel->fd, info.header.payload_len, &reply);
+        }
+        close_channel(session, channel);
+
+        if (rc == 0 && info.header.command != MC_CMD_BUNDLE_DOWNLOAD) {
+            fprintf(stderr, "[SERVER ERROR] %s (파일별로 다시 받습니다)\n", reply);
+            memset(picked, 0, count * sizeof(*picked));
+        } else if (rc == 0) {
+            /* one record per name, in the order asked */
+            const uint8_t *p = (const uint8_t *)reply;
+            size_t left = (size_t)info.header.payload_len;
+            for (size_t i = 0; i < count && rc == 0; ++i) {
+                if (!picked[i]) {
+                    continue;
+                }
+                mc_bundle_entry_t entry;
+                if (left < sizeof(entry)) {
+                    rc = -1;
+                    break;
+                }
+                memcpy(&entry, p, sizeof(entry));
+                mc_bundle_entry_network_to_host(&entry);
+                if (entry.name_len > left - sizeof(entry) || entry.size > left - sizeof(entry) - entry.name_len) {
+                    rc = -1;
+                    break;
+                }
+                const uint8_t *data = p + sizeof(entry) + entry.name_len;
+                p = data + entry.size;
+                left -= sizeof(entry) + entry.name_len + (size_t)entry.size;
+                if (entry.status == MC_BUNDLE_OK) {
+                    picked[i] = save_bundle_file(names[i], data, entry.size, entry.crc);
+                } else if (entry.status == MC_BUNDLE_ERROR) {
+                    fprintf(stderr, "[SERVER ERROR] %s: %.*s\n", names[i], (int)entry.size, (const char *)data);
+                } else {
+                    picked[i] = false; /* skipped: too large to bundle */
+                }
+            }
+            if (rc != 0) {
+                fprintf(stderr, "[CLIENT] 번들 응답이 올바르지 않습니다\n");
+                errno = EPROTO;
+            }
+        }
+        free(reply);
+    } else {
+        memset(picked, 0, count * sizeof(*picked));
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if (!picked[i]) {
+            rest[(*rest_count)++] = names[i];
+        }
+    }
+    free(request);
+    free(picked);
+    return rc;
+}
+
+/* run_batch, with UPLOAD and DOWNLOAD sending their small files as a bundle first. */
+static int run_bundled(cli_session_t *session,
+                       cli_action_t action,
+                       const char *const *names,
+                       size_t count,
+                       bool *should_exit) {
+    *should_exit = false;
+    if (!uses_bundles(session) || count < 2 || (action != CLI_ACTION_UPLOAD && action != CLI_ACTION_DOWNLOAD)) {
+        return run_batch(session, action, names, count, should_exit);
+    }
+    const char **rest = malloc(count * sizeof(*rest));
+    if (!rest) {
+        return -1;
+    }
+    size_t rest_count = 0;
+    int rc = action == CLI_ACTION_UPLOAD ? upload_bundle(session, names, count, rest, &rest_count)
+                                         : download_bundle(session, names, count, rest, &rest_count);
+    if (rc == 0 && rest_count > 0) {
+        rc = run_batch(session, action, rest, rest_count, should_exit);
+    }
+    free(rest);
+    return rc;
+}
+
+/* Reads the AUTH reply; only a configured token makes a refusal fatal. */
+static int finish_auth(cli_session_t *session, const mc_packet_info_t *info, const mc_client_config_t *config) {
+    char *payload = NULL;
+    if (recv_payload_to_buffer(session->fd, info->header.payload_len, &payload) != 0) {
+        return -1;
+    }
+    session->caps = info->header.command == MC_CMD_AUTH ? mc_auth_parse_options(info->filename) & wanted_caps(session) : 0U;
+
+    bool has_token = config->auth_token && config->auth_token[0];
+    if (!has_token) {
+        free(payload);
+        return 0;
+    }
+
+    if (info->header.command == MC_CMD_AUTH) {
+        printf("[CLIENT] 서버 인증 응답: %s\n", payload && payload[0] ? payload : "AUTH OK");
+        free(payload);
+        return 0;
+    }
+
+    fprintf(stderr, "[CLIENT] 인증 실패: %s\n", payload ? payload : "(no message)");
+    free(payload);
     errno = EACCES;
     return -1;
 }
 
-static int command_loop(int fd) {
+static int perform_auth_if_needed(cli_session_t *session, const mc_client_config_t *config) {
+    if (!config || !config->auth_token || !config->auth_token[0]) {
+        return 0;
+    }
+
+    if (send_auth(session, config->auth_token) != 0) {
+        return -1;
+    }
+
+    mc_packet_info_t info;
+    if (recv_packet(session->fd, &info) != 0) {
+        return -1;
+    }
+    return finish_auth(session, &info, config);
+}
+
+/*
+ * Sends AUTH (empty without a token) with the session's header version. The
+ * server answers with the highest version it agrees to (v3 only after a
+ * successful AUTH); one that predates the version drops the connection.
+ * Returns 0 when done, 1 when the caller should retry one version lower.
+ */
+static int negotiate_version(cli_session_t *session, const mc_client_config_t *config) {
+    if (send_auth(session, config->auth_token) != 0) {
+        return 1;
+    }
+
+    mc_packet_info_t info;
+    if (recv_packet(session->fd, &info) != 0) {
+        return 1;
+    }
+    if (info.header.version < session->version) {
+        session->version = info.header.version < MC_PROTOCOL_VERSION_PIPELINED ? MC_PROTOCOL_VERSION
+                                                                                 : info.header.version;
+    }
+    return finish_auth(session, &info, config);
+}
+
+static int open_session(const mc_client_config_t *config, cli_session_t *session) {
+    memset(session, 0, sizeof(*session));
+    session->config = config;
+    session->depth = config->pipeline_depth ? config->pipeline_depth : MC_CLIENT_DEFAULT_PIPELINE;
+    if (session->depth > MC_CLIENT_MAX_PIPELINE) {
+        session->depth = MC_CLIENT_MAX_PIPELINE;
+    }
+
+    uint8_t version = MC_PROTOCOL_VERSION;
+    if (session->depth > 1) {
+        version = config->multiplex ? MC_PROTOCOL_VERSION_MUX : MC_PROTOCOL_VERSION_PIPELINED;
+    }
+
+    while (version > MC_PROTOCOL_VERSION) {
+        session->version = version;
+        session->fd = connect_to_server(config);
+        if (session->fd == -1) {
+            return -1;
+        }
+        int rc = negotiate_version(session, config);
+        if (rc == 0) {
+            break;
+        }
+        close(session->fd);
+        if (rc < 0) {
+            return -1;
+        }
+        printf("[CLIENT] 서버가 프로토콜 v%u를 지원하지 않아 v%u로 다시 접속합니다.\n", version, version - 1U);
+        --version;
+    }
+
+    if (version == MC_PROTOCOL_VERSION) {
+        session->version = MC_PROTOCOL_VERSION;
+        session->fd = connect_to_server(config);
+        if (session->fd == -1) {
+            return -1;
+        }
+        if (perform_auth_if_needed(session, config) != 0) {
+            close(session->fd);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (session->version >= MC_PROTOCOL_VERSION_MUX) {
+        session->mux = mc_mux_start(session->fd, NULL, NULL);
+        if (!session->mux) {
+            close(session->fd);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void close_session(cli_session_t *session) {
+    if (session->mux) {
+        mc_mux_finish(session->mux);
+        session->mux = NULL;
+    }
+    close(session->fd); /* close() 시스템 콜로 서버 소켓 종료 */
+}
+
+typedef struct {
+    const char *name;
+    uint64_t size;
+} cli_remote_file_t;
+
+static int compare_size_desc(const void *a, const void *b) {
+    const cli_remote_file_t *fa = a;
+    const cli_remote_file_t *fb = b;
+    if (fa->size != fb->size) {
+        return fa->size < fb->size ? 1 : -1;
+    }
+    return strcmp(fa->name, fb->name);
+}
+
+typedef struct {
+    cli_session_t *session; /* the interactive session, used by the first worker */
+    const char *const *names;
+    size_t count;
+    size_t next;
+    size_t chunk;
+    bool failed;
+    int failed_errno;
+    pthread_mutex_t lock;
+} cli_download_pool_t;
+
+typedef struct {
+    cli_download_pool_t *pool;
+    bool own_session;
+} cli_download_worker_t;
+
+/*
+ * One pool worker: pulls the next chunk of names off the shared queue and
+ * runs it as a batch on its connection until the queue is empty. Workers
+ * other than the first open (and authenticate) a connection of their own.
+ */
+static void *download_pool_worker(void *arg) {
+    cli_download_worker_t *worker = arg;
+    cli_download_pool_t *pool = worker->pool;
+    cli_session_t own;
+    cli_session_t *session = pool->session;
+    if (worker->own_session) {
+        if (open_session(pool->session->config, &own) != 0) {
+            perror("download-all: 추가 연결 실패");
+            return NULL; /* the remaining workers take over its share */
+        }
+        session = &own;
+    }
+
+    while (1) {
+        pthread_mutex_lock(&pool->lock);
+        size_t start = pool->next;
+        size_t n = pool->count - start < pool->chunk ? pool->count - start : pool->chunk;
+        pool->next += n;
+        bool stop = pool->failed;
+        pthread_mutex_unlock(&pool->lock);
+        if (n == 0 || stop) {
+            break;
+        }
+
+        bool exit_after = false;
+        if (run_batch(session, CLI_ACTION_DOWNLOAD, pool->names + start, n, &exit_after) != 0 || exit_after) {
+            pthread_mutex_lock(&pool->lock);
+            if (!pool->failed) {
+                pool->failed = true;
+                pool->failed_errno = errno;
+            }
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+    }
+
+    if (worker->own_session) {
+        close_session(&own);
+    }
+    return NULL;
+}
+
+/*
+ * Spreads the downloads over config->connections connections. Names arrive
+ * largest first, so the long transfers start at once and the small files
+ * fill in behind them instead of one big file finishing last on its own.
+ */
+static int run_download_pool(cli_session_t *session, const char *const *names, size_t count) {
+    unsigned int connections = session->config->connections;
+    cli_download_pool_t pool = {
+        .session = session,
+        .names = names,
+        .count = count,
+        .chunk = session->depth,
+    };
+    size_t chunks = (count + pool.chunk - 1) / pool.chunk;
+    if (connections > chunks) {
+        connections = (unsigned int)chunks;
+    }
+    printf("[CLIENT] download-all: 연결 %u개로 병렬 다운로드 (큰 파일부터)\n", connections);
+    pthread_mutex_init(&pool.lock, NULL);
+
+    cli_download_worker_t workers[MC_CLIENT_MAX_CONNECTIONS];
+    pthread_t threads[MC_CLIENT_MAX_CONNECTIONS];
+    bool started[MC_CLIENT_MAX_CONNECTIONS] = {false};
+    for (unsigned int i = 1; i < connections; ++i) {
+        workers[i] = (cli_download_worker_t){.pool = &pool, .own_session = true};
+        started[i] = pthread_create(&threads[i], NULL, download_pool_worker, &workers[i]) == 0;
+    }
+    workers[0] = (cli_download_worker_t){.pool = &pool, .own_session = false};
+    download_pool_worker(&workers[0]);
+    for (unsigned int i = 1; i < connections; ++i) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    pthread_mutex_destroy(&pool.lock);
+
+    if (pool.failed) {
+        errno = pool.failed_errno;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * LIST on a v2+ server: LIST_QUERY pages of MC_CLIENT_LIST_PAGE records,
+ * printed as they arrive, so only one page is ever held in memory.
+ */
+static int list_paged(cli_session_t *session, const char *pattern, uint8_t sort) {
+    mc_list_query_t query;
+    memset(&query, 0, sizeof(query));
+    query.limit = MC_CLIENT_LIST_PAGE;
+    query.sort = sort;
+    uint64_t listed = 0;
+    printf("[CLIENT] 서버 파일 목록:\n");
+    do {
+        cli_session_t stream;
+        cli_session_t *channel = open_channel(session, &stream);
+        if (!channel) {
+            return -1;
+        }
+        mc_list_query_t wire = query;
+        mc_list_query_host_to_network(&wire);
+        mc_packet_info_t info;
+        char *page = NULL;
+        int rc = -1;
+        if (send_request_prefix(channel, MC_CMD_LIST_QUERY, pattern, sizeof(wire), &wire, sizeof(wire), NULL) == 0) {
+            finish_sending(channel);
+            if (recv_packet(channel->fd, &info) == 0) {
+                rc = recv_payload_to_buffer(channel->fd, info.header.payload_len, &page);
+            }
+        }
+        close_channel(session, channel);
+        if (rc != 0) {
+            return -1;
+        }
+        if (info.header.command != MC_CMD_LIST_QUERY) {
+            fprintf(stderr, "[SERVER ERROR] %s\n", info.header.command == MC_CMD_ERROR ? page : "LIST 응답이 아닙니다");
+            free(page);
+            return 0;
+        }
+
+        size_t len = (size_t)info.header.payload_len;
+        size_t off = sizeof(mc_list_page_t);
+        mc_list_page_t head;
+        if (len < off) {
+            free(page);
+            errno = EPROTO;
+            return -1;
+        }
+        memcpy(&head, page, sizeof(head));
+        mc_list_page_network_to_host(&head);
+        if (head.cursor_len > MC_LIST_CURSOR_MAX || len - off < head.cursor_len) {
+            free(page);
+            errno = EPROTO;
+            return -1;
+        }
+        query.cursor_len = head.cursor_len;
+        memcpy(query.cursor, page + off, head.cursor_len);
+        off += head.cursor_len;
+        for (uint32_t i = 0; i < head.count; ++i) {
+            mc_list_record_t record;
+            if (len - off < sizeof(record)) {
+                break;
+            }
+            memcpy(&record, page + off, sizeof(record));
+            mc_list_record_network_to_host(&record);
+            off += sizeof(record);
+            if (len - off < record.name_len) {
+                break;
+            }
+            const char *name = page + off;
+            if (record.name_len > 0 && name[record.name_len - 1] == '/') {
+                printf("%.*s\n", (int)record.name_len, name); /* a directory: no size or time */
+            } else {
+                char when[32] = "-";
+                time_t mtime = (time_t)record.mtime;
+                struct tm tm;
+                if (localtime_r(&mtime, &tm)) {
+                    strftime(when, sizeof(when), "%Y-%m-%d %H:%M", &tm);
+                }
+                printf("%.*s\t%" PRIu64 "\t%s\n", (int)record.name_len, name, record.size, when);
+            }
+            off += record.name_len;
+            ++listed;
+        }
+        free(page);
+    } while (query.cursor_len > 0);
+    if (listed == 0) {
+        printf("(empty)\n");
+    }
+    return 0;
+}
+
+static int download_all_files(cli_session_t *session, bool *should_exit) {
+    printf("[CLIENT] download-all: LIST 요청 전송\n");
+    cli_session_t stream;
+    cli_session_t *channel = open_channel(session, &stream);
+    if (!channel) {
+        return -1;
+    }
+    if (send_list(channel, MC_LIST_OPT_SIZES) != 0) {
+        close_channel(session, channel);
+        return -1;
+    }
+    finish_sending(channel);
+
+    mc_packet_info_t info;
+    char *payload = NULL;
+    int recv_rc = recv_packet(channel->fd, &info);
+    if (recv_rc == 0) {
+        recv_rc = recv_payload_to_buffer(channel->fd, info.header.payload_len, &payload);
+    }
+    close_channel(session, channel);
+    if (recv_rc != 0) {
+        return -1;
+    }
+
+    if (info.header.command == MC_CMD_ERROR) {
+        fprintf(stderr, "[SERVER ERROR] %s\n", payload ? payload : "(no message)");
+        free(payload);
+        errno = EPROTO;
+        return -1;
+    }
+
+    if (info.header.command != MC_CMD_LIST) {
+        fprintf(stderr, "[CLIENT] LIST 응답이 아닙니다 (cmd=%u)\n", info.header.command);
+        free(payload);
+        errno = EPROTO;
+        return -1;
+    }
+
+    printf("[CLIENT] 서버 파일 목록:\n%s", payload);
+
+    /* "name\tsize" lines; a server without size support sends bare names */
+    size_t count = 0;
+    size_t cap = 0;
+    cli_remote_file_t *files = NULL;
+    char *saveptr = NULL;
+    char *line = strtok_r(payload, "\n", &saveptr);
+    while (line) {
+        uint64_t size = 0;
+        char *tab = strchr(line, '\t');
+        if (tab) {
+            *tab = '\0';
+            size = strtoull(tab + 1, NULL, 10);
+        }
+        /* directories ("name/") come along with the files inside them */
+        size_t len = strlen(line);
+        if (len > 0 && line[len - 1] != '/' && strcmp(line, "(empty)") != 0 && len <= MC_MAX_FILENAME_LEN) {
+            if (count == cap) {
+                cap = cap ? cap * 2 : 64;
+                cli_remote_file_t *tmp = realloc(files, cap * sizeof(*files));
+                if (!tmp) {
+                    free(files);
+                    free(payload);
+                    return -1;
+                }
+                files = tmp;
+            }
+            files[count++] = (cli_remote_file_t){.name = line, .size = size};
+        }
+        line = strtok_r(NULL, "\n", &saveptr);
+    }
+
+    const char **names = count ? malloc(count * sizeof(*names)) : NULL;
+    if (count && !names) {
+        free(files);
+        free(payload);
+        return -1;
+    }
+    qsort(files, count, sizeof(*files), compare_size_desc);
+    for (size_t i = 0; i < count; ++i) {
+        names[i] = files[i].name;
+    }
+
+    int rc = 0;
+    size_t pending = count;
+    if (count > 1 && uses_bundles(session)) {
+        /* the small files (the tail, by size) go as bundles first, the rest as before */
+        size_t large = 0;
+        while (large < count && files[large].size > MC_BUNDLE_FILE_MAX) {
+            ++large;
+        }
+        pending = large;
+        for (size_t start = large; start < count && rc == 0;) {
+            size_t end = start;
+            uint64_t data = 0;
+            while (end < count && end - start < MC_BUNDLE_MAX_FILES && data + files[end].size <= MC_BUNDLE_DATA_MAX) {
+                data += files[end].size;
+                ++end;
+            }
+            rc = download_bundle(session, names + start, end - start, names + pending, &pending);
+            start = end;
+        }
+    }
+
+    if (count == 0) {
+        printf("[CLIENT] 다운로드할 파일이 없습니다.\n");
+    } else {
+        if (rc == 0 && pending > 0 && session->config->connections > 1 && pending > session->depth) {
+            rc = run_download_pool(session, names, pending);
+        } else if (rc == 0 && pending > 0) {
+            rc = run_batch(session, CLI_ACTION_DOWNLOAD, names, pending, should_exit);
+        }
+        if (rc == 0 && !*should_exit) {
+            printf("[CLIENT] download-all 완료: %zu개 파일\n", count);
+        }
+    }
+
+    free(names);
+    free(files);
+    free(payload);
+    return rc;
+}
+
+/* Reply body of an ARCHIVE: handed out in pieces, decoded and hashed as it arrives. */
+typedef struct {
+    int fd;
+    mc_lz4_decoder_t *dec; /* NULL unless the body is LZ4 blocks */
+    uint8_t *raw;          /* MC_LZ4_BLOCK_MAX bytes, for a plain body */
+    const uint8_t *data;   /* received bytes not handed out yet */
+    size_t avail;
+    uint64_t unread;       /* body bytes still to come off the connection */
+    uint32_t crc;
+} cli_body_reader_t;
+
+/* Copies the next len body bytes to dst, or skips them when dst is NULL. */
+static int read_body(cli_body_reader_t *reader, uint8_t *dst, uint64_t len) {
+    while (len > 0) {
+        if (reader->avail == 0) {
+            if (reader->unread == 0) {
+                errno = EPROTO;
+                return -1;
+            }
+            if (reader->dec) {
+                int got = 0;
+                while (got == 0) {
+                    size_t want = 0;
+                    uint8_t *at = mc_lz4_decoder_want(reader->dec, &want);
+                    if (mc_recv_all(reader->fd, at, want) != (ssize_t)want) {
+                        return -1;
+                    }
+                    got = mc_lz4_decoder_received(reader->dec, want);
+                }
+                if (got < 0 || reader->dec->out_len > reader->unread) {
+                    errno = EPROTO;
+                    return -1;
+                }
+                reader->data = reader->dec->out;
+                reader->avail = reader->dec->out_len;
+            } else {
+                size_t chunk = reader->unread > MC_LZ4_BLOCK_MAX ? MC_LZ4_BLOCK_MAX : (size_t)reader->unread;
+                if (mc_recv_all(reader->fd, reader->raw, chunk) != (ssize_t)chunk) {
+                    return -1;
+                }
+                reader->data = reader->raw;
+                reader->avail = chunk;
+            }
+            reader->unread -= reader->avail;
+            reader->crc = mc_crc32c_update(reader->crc, reader->data, reader->avail);
+        }
+        size_t n = len < reader->avail ? (size_t)len : reader->avail;
+        if (dst) {
+            memcpy(dst, reader->data, n);
+            dst += n;
+        }
+        reader->data += n;
+        reader->avail -= n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * One regular file of the archive: its size bytes go to "<name>.part", then
+ * the padding is skipped and the file renamed into place. A file that cannot
+ * be written is still read past, so the rest of the stream stays usable.
+ */
+static int extract_archive_file(cli_body_reader_t *reader, const char *name, uint64_t size, bool *saved) {
+    char local_name[MC_MAX_FILENAME_LEN + 1];
+    char part[MC_MAX_FILENAME_LEN + sizeof(MC_CLIENT_PARTIAL_SUFFIX)];
+    sanitize_download_name(name, local_name, sizeof(local_name));
+    partial_path(local_name, part, sizeof(part));
+    make_parent_dirs(part);
+    int out_fd = open(part, O_WRONLY | O_CREAT | O_TRUNC, 0644); /* open() 시스템 콜로 풀어낼 파일 생성 */
+    if (out_fd == -1) {
+        fprintf(stderr, "아카이브 파일 저장 실패: %s (%s)\n", local_name, strerror(errno));
+    }
+
+    uint8_t buffer[MC_CLIENT_READ_CHUNK];
+    uint64_t remaining = size;
+    bool ok = out_fd != -1;
+    while (remaining > 0) {
+        size_t chunk = remaining > sizeof(buffer) ? sizeof(buffer) : (size_t)remaining;
+        if (read_body(reader, buffer, chunk) != 0) {
+            if (out_fd != -1) {
+                close(out_fd);
+            }
+            return -1;
+        }
+        if (ok && write(out_fd, buffer, chunk) != (ssize_t)chunk) { /* write() 시스템 콜로 파일 내용 기록 */
+            fprintf(stderr, "아카이브 파일 저장 실패: %s (%s)\n", local_name, strerror(errno));
+            ok = false;
+        }
+        remaining -= chunk;
+    }
+    if (out_fd != -1) {
+        close(out_fd); /* close() 시스템 콜로 풀어낸 파일 닫기 */
+    }
+    if (ok && rename(part, local_name) == -1) { /* rename() 시스템 콜로 완성된 파일 게시 */
+        fprintf(stderr, "아카이브 파일 저장 실패: %s (%s)\n", local_name, strerror(errno));
+        ok = false;
+    }
+    if (!ok && out_fd != -1) {
+        unlink(part); /* unlink() 시스템 콜로 쓰다 만 파일 제거 */
+    }
+    *saved = ok;
+    return read_body(reader, NULL, mc_tar_padding(size));
+}
+
+/* Unpacks the tar stream (see mc_tar.h) up to its end blocks; the rest of the body is skipped. */
+static int extract_archive(cli_body_reader_t *reader, size_t *files, size_t *dirs, size_t *failed) {
+    char long_name[MC_TAR_BLOCK];
+    bool has_long_name = false;
+    uint8_t block[MC_TAR_BLOCK];
+    for (;;) {
+        mc_tar_entry_t entry;
+        if (read_body(reader, block, sizeof(block)) != 0) {
+            return -1;
+        }
+        int parsed = mc_tar_parse(block, &entry);
+        if (parsed == 0) {
+            break;
+        }
+        if (parsed < 0) {
+            errno = EPROTO;
+            return -1;
+        }
+        uint64_t padded = entry.size + mc_tar_padding(entry.size);
+        if (entry.type == MC_TAR_TYPE_LONGNAME) {
+            /* the name of the next entry, NUL included */
+            if (entry.size == 0 || entry.size > sizeof(long_name) ||
+                read_body(reader, (uint8_t *)long_name, MC_TAR_BLOCK) != 0) {
+                errno = EPROTO;
+                return -1;
+            }
+            long_name[entry.size - 1] = '\0';
+            has_long_name = true;
+            continue;
+        }
+        char name[MC_TAR_BLOCK];
+        snprintf(name, sizeof(name), "%s", has_long_name ? long_name : entry.name);
+        has_long_name = false;
+        size_t len = strlen(name);
+        while (len > 0 && name[len - 1] == '/') {
+            name[--len] = '\0';
+        }
+
+        if (entry.type == MC_TAR_TYPE_DIR && len > 0) {
+            char local_name[MC_MAX_FILENAME_LEN + 2];
+            sanitize_download_name(name, local_name, MC_MAX_FILENAME_LEN + 1);
+            strcat(local_name, "/");
+            make_parent_dirs(local_name);
+            ++*dirs;
+        } else if (entry.type == MC_TAR_TYPE_FILE && len > 0 && len <= MC_MAX_FILENAME_LEN) {
+            bool saved = false;
+            if (extract_archive_file(reader, name, entry.size, &saved) != 0) {
+                return -1;
+            }
+            if (saved) {
+                ++*files;
+            } else {
+                ++*failed;
+            }
+            continue;
+        }
+        /* links, devices and the like are not something a server sends: skip them */
+        if (read_body(reader, NULL, padded) != 0) {
+            return -1;
+        }
+    }
+    return read_body(reader, NULL, reader->avail + reader->unread);
+}
+
+/*
+ * DOWNLOAD ALL --archive: one ARCHIVE request for the whole tree below dir
+ * (everything when empty), unpacked under the current directory as the tar
+ * stream arrives, with no archive file in between.
+ */
+static int download_archive(cli_session_t *session, const char *dir, bool *should_exit) {
+    printf("[CLIENT] download-all: ARCHIVE 요청 전송 (%s)\n", dir[0] ? dir : "전체");
+    cli_session_t stream;
+    cli_session_t *channel = open_channel(session, &stream);
+    if (!channel) {
+        return -1;
+    }
+    if (send_header_and_filename(channel, MC_CMD_ARCHIVE, dir, 0, NULL) != 0) {
+        close_channel(session, channel);
+        return -1;
+    }
+    finish_sending(channel);
+
+    mc_packet_info_t info;
+    if (recv_packet(channel->fd, &info) != 0) {
+        close_channel(session, channel);
+        return -1;
+    }
+    if (info.header.command != MC_CMD_ARCHIVE) {
+        int rc = handle_response_packet(channel, &info, NULL, NULL);
+        close_channel(session, channel);
+        return rc;
+    }
+
+    unsigned int applied = mc_reply_caps(channel->caps, MC_CMD_ARCHIVE);
+    cli_body_reader_t reader = {.fd = channel->fd, .unread = info.header.payload_len};
+    if (applied & MC_AUTH_CAP_LZ4) {
+        reader.dec = malloc(sizeof(*reader.dec));
+        if (reader.dec) {
+            mc_lz4_decoder_init(reader.dec, info.header.payload_len);
+        }
+    } else {
+        reader.raw = malloc(MC_LZ4_BLOCK_MAX);
+    }
+    size_t files = 0;
+    size_t dirs = 0;
+    size_t failed = 0;
+    int rc = reader.dec || reader.raw ? extract_archive(&reader, &files, &dirs, &failed) : -1;
+    uint32_t trailer = 0;
+    if (rc == 0 && (applied & MC_AUTH_CAP_CRC32C) &&
+        mc_recv_all(channel->fd, &trailer, sizeof(trailer)) != (ssize_t)sizeof(trailer)) {
+        rc = -1;
+    }
+    free(reader.dec);
+    free(reader.raw);
+    close_channel(session, channel);
+    if (rc != 0) {
+        /* the rest of the reply is still on the way: the connection is out of step */
+        fprintf(stderr, "아카이브 수신 실패: %s (풀어낸 파일: %zu개)\n", strerror(errno), files);
+        *should_exit = channel == session;
+        return -1;
+    }
+    if ((applied & MC_AUTH_CAP_CRC32C) && ntohl(trailer) != reader.crc) {
+        fprintf(stderr, "아카이브 체크섬 불일치: 풀어낸 파일을 믿을 수 없습니다 (다시 DOWNLOAD ALL 하세요)\n");
+        return 0;
+    }
+    printf("[CLIENT] download-all 완료: %zu개 파일, %zu개 디렉터리 (%" PRIu64 " bytes)%s\n",
+           files,
+           dirs,
+           (uint64_t)info.header.payload_len,
+           failed ? ", 저장 실패 있음" : "");
+    return 0;
+}
+
+static int command_loop(cli_session_t *session) {
     signal(SIGPIPE, SIG_IGN);
 
     print_help();
@@ -632,8 +2695,12 @@ static int command_loop(int fd) {
         print_prompt();
         len = getline(&line, &cap, stdin); /* getline()으로 사용자 입력 */
         if (len == -1) {
-            if (feof(stdin)) {
-                (void)send_quit(fd);
+            cli_session_t stream;
+            cli_session_t *channel = feof(stdin) ? open_channel(session, &stream) : NULL;
+            if (channel) {
+                (void)send_quit(channel);
+                finish_sending(channel);
+                close_channel(session, channel);
             }
             break;
         }
@@ -645,102 +2712,68 @@ static int command_loop(int fd) {
 
         int rc = 0;
         bool response_handled = false;
+        cli_session_t stream;
+        cli_session_t *channel = session;
         bool exit_main = false;
+        const char *names[MC_CLIENT_MAX_BATCH];
+        for (size_t i = 0; i < req.arg_count; ++i) {
+            names[i] = req.args[i];
+        }
+
         switch (req.action) {
             case CLI_ACTION_UPLOAD:
-                response_handled = true;
-                if (req.arg_count == 0) {
-                    fprintf(stderr, "업로드할 파일이 지정되지 않았습니다.\n");
-                    rc = -1;
-                    break;
-                }
-                for (size_t i = 0; i < req.arg_count; ++i) {
-                    const char *path = req.args[i];
-                    printf("[CLIENT] 업로드 시작: %s\n", path);
-                    if (send_upload(fd, path) != 0) {
-                        rc = -1;
-                        break;
-                    }
-                    bool exit_after = false;
-                    if (handle_server_response(fd, &req, &exit_after) != 0) {
-                        rc = -1;
-                        break;
-                    }
-                    if (exit_after) {
-                        exit_main = true;
-                        break;
-                    }
-                }
-                break;
             case CLI_ACTION_DOWNLOAD:
+            case CLI_ACTION_DELETE:
+            case CLI_ACTION_MKDIR:
+            case CLI_ACTION_RMDIR:
                 response_handled = true;
                 if (req.arg_count == 0) {
-                    fprintf(stderr, "다운로드할 파일이 지정되지 않았습니다.\n");
+                    fprintf(stderr, "처리할 파일이 지정되지 않았습니다.\n");
                     rc = -1;
                     break;
                 }
-                for (size_t i = 0; i < req.arg_count; ++i) {
-                    const char *name = req.args[i];
-                    printf("[CLIENT] 다운로드 요청: %s\n", name);
-                    snprintf(req.arg, sizeof(req.arg), "%s", name);
-                    if (send_download(fd, name) != 0) {
-                        rc = -1;
-                        break;
-                    }
-                    bool exit_after = false;
-                    if (handle_server_response(fd, &req, &exit_after) != 0) {
-                        rc = -1;
-                        break;
-                    }
-                    if (exit_after) {
-                        exit_main = true;
-                        break;
-                    }
-                }
+                session->upload_dir = req.upload_dir[0] ? req.upload_dir : NULL;
+                rc = run_bundled(session, req.action, names, req.arg_count, &exit_main);
+                session->upload_dir = NULL;
                 break;
             case CLI_ACTION_DOWNLOAD_ALL:
-                rc = download_all_files(fd);
                 response_handled = true;
+                rc = req.archive ? download_archive(session, req.archive_dir, &exit_main)
+                                 : download_all_files(session, &exit_main);
                 break;
-            case CLI_ACTION_DELETE:
-                response_handled = true;
-                if (req.arg_count == 0) {
-                    fprintf(stderr, "삭제할 파일이 지정되지 않았습니다.\n");
-                    rc = -1;
+            case CLI_ACTION_LIST:
+                if (session->version >= MC_PROTOCOL_VERSION_PIPELINED) {
+                    response_handled = true;
+                    printf("[CLIENT] LIST 요청 전송\n");
+                    rc = list_paged(session, req.arg_count ? req.arg : NULL, req.sort);
                     break;
                 }
-                for (size_t i = 0; i < req.arg_count; ++i) {
-                    const char *name = req.args[i];
-                    printf("[CLIENT] 삭제 요청: %s\n", name);
-                    snprintf(req.arg, sizeof(req.arg), "%s", name);
-                    if (send_delete(fd, name) != 0) {
-                        rc = -1;
-                        break;
-                    }
-                    bool exit_after = false;
-                    if (handle_server_response(fd, &req, &exit_after) != 0) {
-                        rc = -1;
-                        break;
-                    }
-                    if (exit_after) {
-                        exit_main = true;
-                        break;
-                    }
+                if (req.arg_count > 0 || req.sort != MC_LIST_SORT_NAME) {
+                    printf("[CLIENT] 서버가 LIST 필터를 지원하지 않아 전체 목록을 요청합니다.\n");
                 }
-                break;
-            case CLI_ACTION_LIST:
-                printf("[CLIENT] LIST 요청 전송\n");
-                rc = send_list(fd);
-                break;
+                /* fall through */
             case CLI_ACTION_QUIT:
-                printf("[CLIENT] 종료 요청 전송\n");
-                rc = send_quit(fd);
+                channel = open_channel(session, &stream);
+                if (!channel) {
+                    channel = session;
+                    rc = -1;
+                    break;
+                }
+                if (req.action == CLI_ACTION_LIST) {
+                    printf("[CLIENT] LIST 요청 전송\n");
+                    rc = send_list(channel, NULL);
+                } else {
+                    printf("[CLIENT] 종료 요청 전송\n");
+                    rc = send_quit(channel);
+                }
+                finish_sending(channel);
                 break;
             default:
                 rc = -1;
         }
 
         if (rc != 0) {
+            close_channel(session, channel);
             if (errno != 0) {
                 perror("client-command");
             }
@@ -753,7 +2786,9 @@ static int command_loop(int fd) {
 
         if (!response_handled) {
             bool exit_after = false;
-            if (handle_server_response(fd, &req, &exit_after) != 0) {
+            int response_rc = handle_server_response(channel, req.arg, &exit_after);
+            close_channel(session, channel);
+            if (response_rc != 0) {
                 perror("client-response");
                 break;
             }
@@ -775,17 +2810,12 @@ int mc_client_run(const mc_client_config_t *config) {
         return -1;
     }
 
-    int fd = connect_to_server(config);
-    if (fd == -1) {
-        return -1;
-    }
-
-    if (perform_auth_if_needed(fd, config) != 0) {
-        close(fd);
+    cli_session_t session;
+    if (open_session(config, &session) != 0) {
         return -1;
     }
 
-    int rc = command_loop(fd);
-    close(fd); /* close() 시스템 콜로 서버 소켓 종료 */
+    int rc = command_loop(&session);
+    close_session(&session);
     return rc;
 }
@@ -0,0 +1,140 @@
+#include "mc_crc32c.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define MC_CRC32C_X86 1
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1UL << 7)
+#endif
+#define MC_CRC32C_ARM 1
+#endif
+
+#define MC_CRC32C_POLY 0x82f63b78U /* reflected Castagnoli polynomial */
+
+typedef uint32_t (*crc32c_fn)(uint32_t crc, const uint8_t *p, size_t len);
+
+static uint32_t g_table[8][256];
+static crc32c_fn g_kernel;
+static const char *g_impl = "portable";
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+
+static uint32_t load_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Slicing-by-8: eight table lookups per 8 input bytes instead of one per byte. */
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *p, size_t len) {
+    while (len >= 8) {
+        uint32_t lo = crc ^ load_le32(p);
+        uint32_t hi = load_le32(p + 4);
+        crc = g_table[7][lo & 0xff] ^ g_table[6][(lo >> 8) & 0xff] ^ g_table[5][(lo >> 16) & 0xff] ^
+              g_table[4][lo >> 24] ^ g_table[3][hi & 0xff] ^ g_table[2][(hi >> 8) & 0xff] ^
+              g_table[1][(hi >> 16) & 0xff] ^ g_table[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) {
+        crc = g_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(MC_CRC32C_X86)
+/* The SSE4.2 crc32 instruction implements exactly this polynomial. */
+__attribute__((target("sse4.2"))) static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *p, size_t len) {
+    while (len > 0 && ((uintptr_t)p & 7U) != 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+        --len;
+    }
+#if defined(__x86_64__)
+    uint64_t wide = crc;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        wide = _mm_crc32_u64(wide, word);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)wide;
+#endif
+    while (len >= 4) {
+        uint32_t word;
+        memcpy(&word, p, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+        p += 4;
+        len -= 4;
+    }
+    while (len-- > 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+#elif defined(MC_CRC32C_ARM)
+__attribute__((target("+crc"))) static uint32_t crc32c_armv8(uint32_t crc, const uint8_t *p, size_t len) {
+    while (len > 0 && ((uintptr_t)p & 7U) != 0) {
+        crc = __crc32cb(crc, *p++);
+        --len;
+    }
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc = __crc32cd(crc, word);
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) {
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+static void crc32c_init(void) {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (MC_CRC32C_POLY & (0U - (crc & 1U)));
+        }
+        g_table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (int k = 1; k < 8; ++k) {
+            g_table[k][i] = (g_table[k - 1][i] >> 8) ^ g_table[0][g_table[k - 1][i] & 0xff];
+        }
+    }
+
+    g_kernel = crc32c_sw;
+#if defined(MC_CRC32C_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        g_kernel = crc32c_sse42;
+        g_impl = "sse4.2";
+    }
+#elif defined(MC_CRC32C_ARM)
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        g_kernel = crc32c_armv8;
+        g_impl = "armv8";
+    }
+#endif
+}
+
+uint32_t mc_crc32c_update(uint32_t crc, const void *data, size_t len) {
+    pthread_once(&g_once, crc32c_init);
+    return ~g_kernel(~crc, data, len);
+}
+
+uint32_t mc_crc32c_portable(uint32_t crc, const void *data, size_t len) {
+    pthread_once(&g_once, crc32c_init);
+    return ~crc32c_sw(~crc, data, len);
+}
+
+const char *mc_crc32c_impl(void) {
+    pthread_once(&g_once, crc32c_init);
+    return g_impl;
+}
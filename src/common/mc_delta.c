@@ -0,0 +1,57 @@
+#include "mc_delta.h"
+#include "mc_sha256.h"
+
+#include <string.h>
+
+uint32_t mc_delta_block_size(uint64_t file_size) {
+    uint64_t root = 0;
+    uint64_t bit = 1ULL << 62;
+    uint64_t rest = file_size;
+
+    /* integer square root, bit by bit */
+    while (bit > rest) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (rest >= root + bit) {
+            rest -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    root = (root + 1023U) & ~(uint64_t)1023U;
+    if (root < MC_DELTA_MIN_BLOCK) {
+        return MC_DELTA_MIN_BLOCK;
+    }
+    if (root > MC_DELTA_MAX_BLOCK) {
+        return MC_DELTA_MAX_BLOCK;
+    }
+    return (uint32_t)root;
+}
+
+uint32_t mc_delta_weak(const uint8_t *data, size_t len) {
+    uint32_t a = 0;
+    uint32_t b = 0;
+    for (size_t i = 0; i < len; ++i) {
+        a += data[i];
+        b += (uint32_t)(len - i) * data[i];
+    }
+    return ((b & 0xFFFFU) << 16) | (a & 0xFFFFU);
+}
+
+uint32_t mc_delta_roll(uint32_t weak, uint8_t out, uint8_t in, size_t len) {
+    uint32_t a = weak & 0xFFFFU;
+    uint32_t b = weak >> 16;
+    a = (a - out + in) & 0xFFFFU;
+    b = (b - (uint32_t)len * out + a) & 0xFFFFU;
+    return (b << 16) | a;
+}
+
+void mc_delta_strong(const uint8_t *data, size_t len, uint8_t out[MC_DELTA_STRONG_LEN]) {
+    uint8_t digest[MC_SHA256_DIGEST_LEN];
+    mc_sha256(data, len, digest);
+    memcpy(out, digest, MC_DELTA_STRONG_LEN);
+}
@@ -0,0 +1,297 @@
+#include "mc_lz4.h"
+
+#include <errno.h>
+#include <string.h>
+
+#define LZ4_MINMATCH      4U
+#define LZ4_LAST_LITERALS 5U  /* the block always ends with this many literals */
+#define LZ4_MFLIMIT       12U /* and the last match starts at least this far from the end */
+#define LZ4_SKIP_MAX      32U
+
+static uint32_t load32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t load_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static void store_be32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static size_t hash4(uint32_t v) {
+    return (size_t)((v * 2654435761U) >> (32 - MC_LZ4_HASH_LOG));
+}
+
+static size_t put_length(uint8_t *dst, size_t len) {
+    size_t n = 0;
+    while (len >= 255) {
+        dst[n++] = 255;
+        len -= 255;
+    }
+    dst[n++] = (uint8_t)len;
+    return n;
+}
+
+void mc_lz4_encoder_init(mc_lz4_encoder_t *enc) {
+    memset(enc->table, 0, sizeof(enc->table));
+    enc->skip = 0;
+    enc->backoff = 1;
+}
+
+/*
+ * Greedy single-probe matcher, as in LZ4's fast mode. The hash table keeps
+ * block offsets from earlier blocks too; a stale entry is only used when its
+ * bytes really match, so it never needs clearing.
+ */
+size_t mc_lz4_compress(mc_lz4_encoder_t *enc, const uint8_t *src, size_t len, uint8_t *dst, size_t cap) {
+    size_t ip = 0;
+    size_t anchor = 0;
+    size_t op = 0;
+
+    if (len > MC_LZ4_BLOCK_MAX) {
+        return 0;
+    }
+    if (len > LZ4_MFLIMIT) {
+        size_t mflimit = len - LZ4_MFLIMIT;
+        size_t matchlimit = len - LZ4_LAST_LITERALS;
+        unsigned int misses = 0;
+
+        while (ip < mflimit) {
+            uint32_t seq = load32(src + ip);
+            size_t h = hash4(seq);
+            size_t ref = enc->table[h];
+            enc->table[h] = (uint16_t)ip;
+            if (ref >= ip || load32(src + ref) != seq) {
+                /* Step faster through data that keeps missing. */
+                ip += 1 + (misses++ >> 5);
+                continue;
+            }
+            misses = 0;
+            while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+                --ip;
+                --ref;
+            }
+            size_t mlen = LZ4_MINMATCH;
+            while (ip + mlen < matchlimit && src[ip + mlen] == src[ref + mlen]) {
+                ++mlen;
+            }
+
+            size_t lit = ip - anchor;
+            if (op + 1 + lit / 255 + 1 + lit + 2 + mlen / 255 + 1 > cap) {
+                return 0;
+            }
+            size_t token = op++;
+            dst[token] = (uint8_t)((lit >= 15 ? 15 : lit) << 4);
+            if (lit >= 15) {
+                op += put_length(dst + op, lit - 15);
+            }
+            memcpy(dst + op, src + anchor, lit);
+            op += lit;
+            size_t offset = ip - ref;
+            dst[op++] = (uint8_t)offset;
+            dst[op++] = (uint8_t)(offset >> 8);
+            size_t ml = mlen - LZ4_MINMATCH;
+            dst[token] |= (uint8_t)(ml >= 15 ? 15 : ml);
+            if (ml >= 15) {
+                op += put_length(dst + op, ml - 15);
+            }
+
+            ip += mlen;
+            anchor = ip;
+            enc->table[hash4(load32(src + ip - 2))] = (uint16_t)(ip - 2);
+        }
+    }
+
+    size_t lit = len - anchor;
+    if (op + 1 + lit / 255 + 1 + lit > cap) {
+        return 0;
+    }
+    dst[op] = (uint8_t)((lit >= 15 ? 15 : lit) << 4);
+    ++op;
+    if (lit >= 15) {
+        op += put_length(dst + op, lit - 15);
+    }
+    memcpy(dst + op, src + anchor, lit);
+    return op + lit;
+}
+
+long mc_lz4_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t cap) {
+    size_t ip = 0;
+    size_t op = 0;
+
+    while (ip < len) {
+        uint8_t token = src[ip++];
+        size_t lit = token >> 4;
+        if (lit == 15) {
+            uint8_t b;
+            do {
+                if (ip >= len) {
+                    return -1;
+                }
+                b = src[ip++];
+                lit += b;
+            } while (b == 255);
+        }
+        if (lit > len - ip || lit > cap - op) {
+            return -1;
+        }
+        memcpy(dst + op, src + ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == len) {
+            break; /* the last sequence has no match */
+        }
+
+        if (len - ip < 2) {
+            return -1;
+        }
+        size_t offset = (size_t)src[ip] | ((size_t)src[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op) {
+            return -1;
+        }
+        size_t mlen = token & 15U;
+        if (mlen == 15) {
+            uint8_t b;
+            do {
+                if (ip >= len) {
+                    return -1;
+                }
+                b = src[ip++];
+                mlen += b;
+            } while (b == 255);
+        }
+        mlen += LZ4_MINMATCH;
+        if (mlen > cap - op) {
+            return -1;
+        }
+        if (offset >= mlen) {
+            memcpy(dst + op, dst + op - offset, mlen);
+        } else {
+            /* Overlapping copy repeats the last offset bytes. */
+            for (size_t i = 0; i < mlen; ++i) {
+                dst[op + i] = dst[op - offset + i];
+            }
+        }
+        op += mlen;
+    }
+    return (long)op;
+}
+
+size_t mc_lz4_encode_block(mc_lz4_encoder_t *enc, const uint8_t *src, size_t len, uint8_t *out) {
+    size_t n = 0;
+
+    if (enc->skip > 0) {
+        --enc->skip;
+    } else {
+        /* Worth it only when the block shrinks by at least 1/16. */
+        n = mc_lz4_compress(enc, src, len, out + MC_LZ4_BLOCK_HEADER, len - len / 16);
+        if (n == 0) {
+            enc->skip = enc->backoff;
+            enc->backoff = enc->backoff < LZ4_SKIP_MAX ? enc->backoff * 2 : LZ4_SKIP_MAX;
+        } else {
+            enc->backoff = 1;
+        }
+    }
+
+    store_be32(out, (uint32_t)len);
+    if (n == 0) {
+        store_be32(out + 4, (uint32_t)len | MC_LZ4_STORED);
+        memcpy(out + MC_LZ4_BLOCK_HEADER, src, len);
+        return MC_LZ4_BLOCK_HEADER + len;
+    }
+    store_be32(out + 4, (uint32_t)n);
+    return MC_LZ4_BLOCK_HEADER + n;
+}
+
+void mc_lz4_decoder_init(mc_lz4_decoder_t *dec, uint64_t limit) {
+    dec->have = 0;
+    dec->in_block = false;
+    dec->raw_len = 0;
+    dec->wire_len = 0;
+    dec->stored = false;
+    dec->limit = limit;
+    dec->total = 0;
+    dec->out = NULL;
+    dec->out_len = 0;
+}
+
+uint8_t *mc_lz4_decoder_want(mc_lz4_decoder_t *dec, size_t *want) {
+    if (!dec->in_block) {
+        *want = MC_LZ4_BLOCK_HEADER - dec->have;
+        return dec->header + dec->have;
+    }
+    *want = dec->wire_len - dec->have;
+    return dec->block + dec->have;
+}
+
+int mc_lz4_decoder_received(mc_lz4_decoder_t *dec, size_t n) {
+    dec->have += n;
+    if (!dec->in_block) {
+        if (dec->have < MC_LZ4_BLOCK_HEADER) {
+            return 0;
+        }
+        uint32_t wire = load_be32(dec->header + 4);
+        dec->raw_len = load_be32(dec->header);
+        dec->stored = (wire & MC_LZ4_STORED) != 0;
+        dec->wire_len = wire & ~MC_LZ4_STORED;
+        if (dec->raw_len == 0 || dec->raw_len > MC_LZ4_BLOCK_MAX || dec->wire_len == 0 ||
+            dec->wire_len > MC_LZ4_BLOCK_MAX || (dec->stored && dec->wire_len != dec->raw_len)) {
+            errno = EPROTO;
+            return -1;
+        }
+        if (dec->raw_len > dec->limit - dec->total) {
+            errno = EFBIG;
+            return -1;
+        }
+        dec->in_block = true;
+        dec->have = 0;
+        return 0;
+    }
+    if (dec->have < dec->wire_len) {
+        return 0;
+    }
+
+    if (dec->stored) {
+        dec->out = dec->block;
+    } else {
+        long n = mc_lz4_decompress(dec->block, dec->wire_len, dec->raw, dec->raw_len);
+        if (n != (long)dec->raw_len) {
+            errno = EPROTO;
+            return -1;
+        }
+        dec->out = dec->raw;
+    }
+    dec->out_len = dec->raw_len;
+    dec->total += dec->raw_len;
+    dec->in_block = false;
+    dec->have = 0;
+    return 1;
+}
+
+int mc_lz4_decoder_push(mc_lz4_decoder_t *dec, const uint8_t **data, size_t *len) {
+    while (*len > 0) {
+        size_t want = 0;
+        uint8_t *dst = mc_lz4_decoder_want(dec, &want);
+        size_t n = want < *len ? want : *len;
+        memcpy(dst, *data, n);
+        *data += n;
+        *len -= n;
+        int rc = mc_lz4_decoder_received(dec, n);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+    return 0;
+}
+
+bool mc_lz4_decoder_idle(const mc_lz4_decoder_t *dec) {
+    return !dec->in_block && dec->have == 0;
+}
@@ -0,0 +1,334 @@
+#define _GNU_SOURCE
+
+#include "mc_mux.h"
+#include "mc_protocol.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+typedef struct mc_mux_stream {
+    struct mc_mux_stream *next;
+    uint32_t id;
+    int fd;          /* mux end of the socketpair */
+    bool rx_done;    /* peer sent FIN (or the connection is gone) */
+    bool tx_done;    /* local end hit EOF and our FIN went out */
+    bool rx_discard; /* local end stopped reading: drop the rest */
+} mc_mux_stream_t;
+
+struct mc_mux {
+    int sock_fd;
+    mc_mux_accept_fn accept_fn;
+    void *ctx;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    mc_mux_stream_t *streams;
+    size_t stream_count;
+    int wake_fds[2];
+    bool peer_done;
+    bool finishing;
+    bool broken;
+    pthread_t reader;
+    pthread_t writer;
+};
+
+static void mux_wake(mc_mux_t *mux) {
+    uint8_t byte = 1;
+    ssize_t rc = write(mux->wake_fds[1], &byte, 1); /* write() 시스템 콜로 writer 스레드 깨우기 */
+    (void)rc; /* a full pipe already means a pending wakeup */
+}
+
+static mc_mux_stream_t *find_stream(mc_mux_t *mux, uint32_t id) {
+    for (mc_mux_stream_t *s = mux->streams; s; s = s->next) {
+        if (s->id == id) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+/* Caller holds the lock. Frees the stream once both directions ended. */
+static void release_if_done(mc_mux_t *mux, mc_mux_stream_t *stream) {
+    if (!stream->rx_done || !stream->tx_done) {
+        return;
+    }
+    mc_mux_stream_t **link = &mux->streams;
+    while (*link && *link != stream) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = stream->next;
+    }
+    close(stream->fd); /* close() 시스템 콜로 스트림 소켓 정리 */
+    free(stream);
+    mux->stream_count--;
+    pthread_cond_broadcast(&mux->cond);
+    mux_wake(mux); /* the writer may be waiting only for the last stream to go */
+}
+
+/* Returns the caller's end of a new stream, or -1. */
+static int add_stream(mc_mux_t *mux, uint32_t id) {
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) == -1) { /* socketpair() 시스템 콜로 스트림 채널 생성 */
+        return -1;
+    }
+    mc_mux_stream_t *stream = calloc(1, sizeof(*stream));
+    if (!stream) {
+        close(pair[0]);
+        close(pair[1]);
+        return -1;
+    }
+    stream->id = id;
+    stream->fd = pair[0];
+
+    pthread_mutex_lock(&mux->lock);
+    if (mux->stream_count >= MC_MUX_MAX_STREAMS || find_stream(mux, id) || mux->peer_done || mux->broken) {
+        pthread_mutex_unlock(&mux->lock);
+        close(pair[0]);
+        close(pair[1]);
+        free(stream);
+        errno = mux->stream_count >= MC_MUX_MAX_STREAMS ? EMFILE : EPIPE;
+        return -1;
+    }
+    stream->next = mux->streams;
+    mux->streams = stream;
+    mux->stream_count++;
+    pthread_mutex_unlock(&mux->lock);
+
+    mux_wake(mux);
+    return pair[1];
+}
+
+static int deliver(int fd, const uint8_t *buf, size_t len) {
+    while (len > 0) {
+        ssize_t sent = send(fd, buf, len, MSG_NOSIGNAL); /* send() 시스템 콜로 스트림에 전달 */
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += sent;
+        len -= (size_t)sent;
+    }
+    return 0;
+}
+
+/* Demultiplexes frames from the socket into the stream socketpairs. */
+static void *reader_main(void *arg) {
+    mc_mux_t *mux = arg;
+    uint8_t *buf = malloc(MC_FRAME_MAX_PAYLOAD);
+
+    while (buf) {
+        mc_frame_header_t frame;
+        if (mc_recv_frame_header(mux->sock_fd, &frame) != 0) {
+            break;
+        }
+        if (frame.length > 0 && mc_recv_all(mux->sock_fd, buf, frame.length) != (ssize_t)frame.length) {
+            break;
+        }
+
+        pthread_mutex_lock(&mux->lock);
+        mc_mux_stream_t *stream = find_stream(mux, frame.stream_id);
+        pthread_mutex_unlock(&mux->lock);
+
+        if (!stream) {
+            if (!mux->accept_fn) {
+                continue; /* nothing of ours: stale frame, ignore */
+            }
+            int app_fd = add_stream(mux, frame.stream_id);
+            if (app_fd == -1) {
+                break;
+            }
+            if (mux->accept_fn(mux->ctx, frame.stream_id, app_fd) != 0) {
+                close(app_fd);
+            }
+            pthread_mutex_lock(&mux->lock);
+            stream = find_stream(mux, frame.stream_id);
+            pthread_mutex_unlock(&mux->lock);
+        }
+
+        /* only this thread sets rx_done, so the stream outlives this block */
+        if (frame.length > 0) {
+            if (!stream->rx_discard && deliver(stream->fd, buf, frame.length) != 0) {
+                stream->rx_discard = true;
+            }
+            continue;
+        }
+        shutdown(stream->fd, SHUT_WR); /* shutdown() 시스템 콜로 스트림 수신 종료 알림 */
+        pthread_mutex_lock(&mux->lock);
+        stream->rx_done = true;
+        release_if_done(mux, stream);
+        pthread_mutex_unlock(&mux->lock);
+    }
+    free(buf);
+
+    /* peer is done (or gone): every open stream sees EOF on its end */
+    pthread_mutex_lock(&mux->lock);
+    mux->peer_done = true;
+    mc_mux_stream_t *stream = mux->streams;
+    while (stream) {
+        mc_mux_stream_t *next = stream->next;
+        if (!stream->rx_done) {
+            shutdown(stream->fd, SHUT_WR);
+            stream->rx_done = true;
+            release_if_done(mux, stream);
+        }
+        stream = next;
+    }
+    pthread_cond_broadcast(&mux->cond);
+    pthread_mutex_unlock(&mux->lock);
+    mux_wake(mux);
+    return NULL;
+}
+
+/*
+ * Multiplexes the streams onto the socket: each pass sends at most one frame
+ * per readable stream, which is what keeps a bulk transfer from starving the
+ * small requests sharing the connection.
+ */
+static void *writer_main(void *arg) {
+    mc_mux_t *mux = arg;
+    uint8_t *frame = malloc(MC_FRAME_HEADER_SIZE + MC_FRAME_MAX_PAYLOAD);
+    struct pollfd pfds[MC_MUX_MAX_STREAMS + 1];
+    mc_mux_stream_t *polled[MC_MUX_MAX_STREAMS + 1];
+
+    while (frame) {
+        pthread_mutex_lock(&mux->lock);
+        if ((mux->peer_done || mux->finishing) && mux->stream_count == 0) {
+            pthread_mutex_unlock(&mux->lock);
+            break;
+        }
+        nfds_t count = 1;
+        pfds[0].fd = mux->wake_fds[0];
+        pfds[0].events = POLLIN;
+        for (mc_mux_stream_t *s = mux->streams; s; s = s->next) {
+            if (!s->tx_done) {
+                pfds[count].fd = s->fd;
+                pfds[count].events = POLLIN;
+                polled[count] = s; /* only this thread sets tx_done */
+                ++count;
+            }
+        }
+        pthread_mutex_unlock(&mux->lock);
+
+        if (poll(pfds, count, -1) < 0) { /* poll() 시스템 콜로 전송할 스트림 대기 */
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (pfds[0].revents) {
+            uint8_t drain[64];
+            while (read(mux->wake_fds[0], drain, sizeof(drain)) > 0) {
+            }
+        }
+
+        for (nfds_t i = 1; i < count; ++i) {
+            if (!(pfds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            mc_mux_stream_t *stream = polled[i];
+            ssize_t got;
+            do {
+                got = read(stream->fd, frame + MC_FRAME_HEADER_SIZE, MC_FRAME_MAX_PAYLOAD); /* read() 시스템 콜로 스트림 데이터 수집 */
+            } while (got < 0 && errno == EINTR);
+            if (got < 0) {
+                got = 0;
+            }
+
+            mc_frame_header_t header = {.stream_id = stream->id, .length = (uint32_t)got};
+            mc_frame_host_to_network(&header);
+            memcpy(frame, &header, sizeof(header));
+            size_t total = MC_FRAME_HEADER_SIZE + (size_t)got;
+            if (!mux->broken && mc_send_all(mux->sock_fd, frame, total) != (ssize_t)total) {
+                /* keep draining the streams so their writers never block */
+                pthread_mutex_lock(&mux->lock);
+                mux->broken = true;
+                pthread_mutex_unlock(&mux->lock);
+                shutdown(mux->sock_fd, SHUT_RDWR);
+            }
+
+            if (got == 0) {
+                pthread_mutex_lock(&mux->lock);
+                stream->tx_done = true;
+                release_if_done(mux, stream);
+                pthread_mutex_unlock(&mux->lock);
+            }
+        }
+    }
+    free(frame);
+
+    if (!mux->broken) {
+        shutdown(mux->sock_fd, SHUT_WR); /* shutdown() 시스템 콜로 송신 종료 알림 */
+    }
+    return NULL;
+}
+
+mc_mux_t *mc_mux_start(int sock_fd, mc_mux_accept_fn accept_fn, void *ctx) {
+    mc_mux_t *mux = calloc(1, sizeof(*mux));
+    if (!mux) {
+        return NULL;
+    }
+    mux->sock_fd = sock_fd;
+    mux->accept_fn = accept_fn;
+    mux->ctx = ctx;
+    if (pipe2(mux->wake_fds, O_CLOEXEC | O_NONBLOCK) == -1) { /* pipe2() 시스템 콜로 깨우기 파이프 생성 */
+        free(mux);
+        return NULL;
+    }
+    pthread_mutex_init(&mux->lock, NULL);
+    pthread_cond_init(&mux->cond, NULL);
+
+    if (pthread_create(&mux->reader, NULL, reader_main, mux) != 0) {
+        goto fail;
+    }
+    if (pthread_create(&mux->writer, NULL, writer_main, mux) != 0) {
+        shutdown(sock_fd, SHUT_RDWR);
+        pthread_join(mux->reader, NULL);
+        goto fail;
+    }
+    return mux;
+
+fail:
+    pthread_cond_destroy(&mux->cond);
+    pthread_mutex_destroy(&mux->lock);
+    close(mux->wake_fds[0]);
+    close(mux->wake_fds[1]);
+    free(mux);
+    return NULL;
+}
+
+int mc_mux_open_stream(mc_mux_t *mux, uint32_t stream_id) {
+    return add_stream(mux, stream_id);
+}
+
+void mc_mux_wait_peer(mc_mux_t *mux) {
+    pthread_mutex_lock(&mux->lock);
+    while (!mux->peer_done) {
+        pthread_cond_wait(&mux->cond, &mux->lock);
+    }
+    pthread_mutex_unlock(&mux->lock);
+}
+
+void mc_mux_finish(mc_mux_t *mux) {
+    pthread_mutex_lock(&mux->lock);
+    mux->finishing = true;
+    pthread_mutex_unlock(&mux->lock);
+    mux_wake(mux);
+
+    pthread_join(mux->writer, NULL);
+    pthread_join(mux->reader, NULL);
+
+    pthread_cond_destroy(&mux->cond);
+    pthread_mutex_destroy(&mux->lock);
+    close(mux->wake_fds[0]);
+    close(mux->wake_fds[1]);
+    free(mux);
+}
@@ -1,10 +1,16 @@
+#define _GNU_SOURCE
+
 #include "mc_protocol.h"
 
 #include <arpa/inet.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 static uint64_t mc_htonll(uint64_t value) {
@@ -26,7 +32,7 @@ static uint64_t mc_ntohll(uint64_t value) {
 }
 
 static int mc_is_valid_command(mc_command_t command) {
-    return command >= MC_CMD_ERROR && command <= MC_CMD_DELETE;
+    return command >= MC_CMD_ERROR && command <= MC_CMD_ARCHIVE;
 }
 
 int mc_build_header(mc_packet_header_t *out,
@@ -54,6 +60,22 @@ int mc_build_header(mc_packet_header_t *out,
     out->command = (uint8_t)command;
     out->filename_len = (uint32_t)filename_len;
     out->payload_len = payload_len;
+    out->request_id = 0;
+    return 0;
+}
+
+int mc_build_reply_header(mc_packet_header_t *out,
+                          const mc_packet_header_t *request,
+                          mc_command_t command,
+                          const char *filename,
+                          uint64_t payload_len) {
+    if (mc_build_header(out, command, filename, payload_len) != 0) {
+        return -1;
+    }
+    if (request && request->version >= MC_PROTOCOL_VERSION_PIPELINED) {
+        out->version = request->version;
+        out->request_id = request->request_id;
+    }
     return 0;
 }
 
@@ -66,7 +88,7 @@ int mc_validate_header(const mc_packet_header_t *header) {
         return -2;
     }
 
-    if (header->version != MC_PROTOCOL_VERSION) {
+    if (header->version < MC_PROTOCOL_VERSION || header->version > MC_PROTOCOL_VERSION_MAX) {
         return -3;
     }
 
@@ -81,6 +103,13 @@ int mc_validate_header(const mc_packet_header_t *header) {
     return 0;
 }
 
+size_t mc_header_wire_size(const mc_packet_header_t *header) {
+    if (header && header->version >= MC_PROTOCOL_VERSION_PIPELINED) {
+        return MC_HEADER_V2_SIZE;
+    }
+    return MC_HEADER_V1_SIZE;
+}
+
 void mc_header_host_to_network(mc_packet_header_t *header) {
     if (!header) {
         return;
@@ -89,6 +118,7 @@ void mc_header_host_to_network(mc_packet_header_t *header) {
     header->magic = htonl(header->magic);
     header->filename_len = htonl(header->filename_len);
     header->payload_len = mc_htonll(header->payload_len);
+    header->request_id = htonl(header->request_id);
 }
 
 void mc_header_network_to_host(mc_packet_header_t *header) {
@@ -99,6 +129,299 @@ void mc_header_network_to_host(mc_packet_header_t *header) {
     header->magic = ntohl(header->magic);
     header->filename_len = ntohl(header->filename_len);
     header->payload_len = mc_ntohll(header->payload_len);
+    header->request_id = ntohl(header->request_id);
+}
+
+void mc_range_host_to_network(mc_range_t *range) {
+    if (!range) {
+        return;
+    }
+
+    range->offset = mc_htonll(range->offset);
+    range->length = mc_htonll(range->length);
+}
+
+void mc_range_network_to_host(mc_range_t *range) {
+    if (!range) {
+        return;
+    }
+
+    range->offset = mc_ntohll(range->offset);
+    range->length = mc_ntohll(range->length);
+}
+
+void mc_range_if_host_to_network(mc_range_if_t *range) {
+    if (!range) {
+        return;
+    }
+
+    range->offset = mc_htonll(range->offset);
+    range->length = mc_htonll(range->length);
+    range->validator = mc_htonll(range->validator);
+}
+
+void mc_range_if_network_to_host(mc_range_if_t *range) {
+    if (!range) {
+        return;
+    }
+
+    range->offset = mc_ntohll(range->offset);
+    range->length = mc_ntohll(range->length);
+    range->validator = mc_ntohll(range->validator);
+}
+
+void mc_upload_begin_host_to_network(mc_upload_begin_t *begin) {
+    if (!begin) {
+        return;
+    }
+
+    begin->total_size = mc_htonll(begin->total_size);
+    begin->tag = mc_htonll(begin->tag);
+}
+
+void mc_upload_begin_network_to_host(mc_upload_begin_t *begin) {
+    if (!begin) {
+        return;
+    }
+
+    begin->total_size = mc_ntohll(begin->total_size);
+    begin->tag = mc_ntohll(begin->tag);
+}
+
+void mc_signature_host_to_network(mc_signature_header_t *sig) {
+    if (!sig) {
+        return;
+    }
+
+    sig->block_size = htonl(sig->block_size);
+    sig->block_count = htonl(sig->block_count);
+    sig->file_size = mc_htonll(sig->file_size);
+}
+
+void mc_signature_network_to_host(mc_signature_header_t *sig) {
+    if (!sig) {
+        return;
+    }
+
+    sig->block_size = ntohl(sig->block_size);
+    sig->block_count = ntohl(sig->block_count);
+    sig->file_size = mc_ntohll(sig->file_size);
+}
+
+void mc_delta_host_to_network(mc_delta_header_t *delta) {
+    if (!delta) {
+        return;
+    }
+
+    delta->block_size = htonl(delta->block_size);
+    delta->block_count = htonl(delta->block_count);
+    delta->base_size = mc_htonll(delta->base_size);
+    delta->new_size = mc_htonll(delta->new_size);
+}
+
+void mc_delta_network_to_host(mc_delta_header_t *delta) {
+    if (!delta) {
+        return;
+    }
+
+    delta->block_size = ntohl(delta->block_size);
+    delta->block_count = ntohl(delta->block_count);
+    delta->base_size = mc_ntohll(delta->base_size);
+    delta->new_size = mc_ntohll(delta->new_size);
+}
+
+void mc_have_host_to_network(mc_have_t *have) {
+    if (!have) {
+        return;
+    }
+
+    have->size = mc_htonll(have->size);
+}
+
+void mc_have_network_to_host(mc_have_t *have) {
+    if (!have) {
+        return;
+    }
+
+    have->size = mc_ntohll(have->size);
+}
+
+void mc_list_query_host_to_network(mc_list_query_t *query) {
+    if (!query) {
+        return;
+    }
+
+    query->limit = htonl(query->limit);
+    query->cursor_len = htons(query->cursor_len);
+}
+
+void mc_list_query_network_to_host(mc_list_query_t *query) {
+    if (!query) {
+        return;
+    }
+
+    query->limit = ntohl(query->limit);
+    query->cursor_len = ntohs(query->cursor_len);
+}
+
+void mc_list_page_host_to_network(mc_list_page_t *page) {
+    if (!page) {
+        return;
+    }
+
+    page->count = htonl(page->count);
+    page->cursor_len = htons(page->cursor_len);
+}
+
+void mc_list_page_network_to_host(mc_list_page_t *page) {
+    if (!page) {
+        return;
+    }
+
+    page->count = ntohl(page->count);
+    page->cursor_len = ntohs(page->cursor_len);
+}
+
+void mc_list_record_host_to_network(mc_list_record_t *record) {
+    if (!record) {
+        return;
+    }
+
+    record->size = mc_htonll(record->size);
+    record->mtime = (int64_t)mc_htonll((uint64_t)record->mtime);
+    record->name_len = htons(record->name_len);
+}
+
+void mc_list_record_network_to_host(mc_list_record_t *record) {
+    if (!record) {
+        return;
+    }
+
+    record->size = mc_ntohll(record->size);
+    record->mtime = (int64_t)mc_ntohll((uint64_t)record->mtime);
+    record->name_len = ntohs(record->name_len);
+}
+
+void mc_bundle_entry_host_to_network(mc_bundle_entry_t *entry) {
+    if (!entry) {
+        return;
+    }
+
+    entry->size = mc_htonll(entry->size);
+    entry->crc = htonl(entry->crc);
+    entry->name_len = htons(entry->name_len);
+}
+
+void mc_bundle_entry_network_to_host(mc_bundle_entry_t *entry) {
+    if (!entry) {
+        return;
+    }
+
+    entry->size = mc_ntohll(entry->size);
+    entry->crc = ntohl(entry->crc);
+    entry->name_len = ntohs(entry->name_len);
+}
+
+int mc_request_has_checksum(uint8_t command) {
+    return command == MC_CMD_UPLOAD || command == MC_CMD_UPLOAD_APPEND || command == MC_CMD_DELTA;
+}
+
+int mc_reply_has_checksum(uint8_t command) {
+    return command == MC_CMD_DOWNLOAD || command == MC_CMD_DOWNLOAD_RANGE || command == MC_CMD_ARCHIVE;
+}
+
+int mc_request_is_compressed(uint8_t command) {
+    return command == MC_CMD_UPLOAD || command == MC_CMD_UPLOAD_APPEND;
+}
+
+int mc_reply_is_compressed(uint8_t command) {
+    return command == MC_CMD_DOWNLOAD || command == MC_CMD_DOWNLOAD_RANGE || command == MC_CMD_ARCHIVE;
+}
+
+unsigned int mc_request_caps(unsigned int caps, uint8_t command) {
+    unsigned int applied = 0;
+    if ((caps & MC_AUTH_CAP_CRC32C) && mc_request_has_checksum(command)) {
+        applied |= MC_AUTH_CAP_CRC32C;
+    }
+    if ((caps & MC_AUTH_CAP_LZ4) && mc_request_is_compressed(command)) {
+        applied |= MC_AUTH_CAP_LZ4;
+    }
+    return applied;
+}
+
+unsigned int mc_reply_caps(unsigned int caps, uint8_t command) {
+    unsigned int applied = 0;
+    if ((caps & MC_AUTH_CAP_CRC32C) && mc_reply_has_checksum(command)) {
+        applied |= MC_AUTH_CAP_CRC32C;
+    }
+    if ((caps & MC_AUTH_CAP_LZ4) && mc_reply_is_compressed(command)) {
+        applied |= MC_AUTH_CAP_LZ4;
+    }
+    return applied;
+}
+
+static const struct {
+    const char *name;
+    unsigned int cap;
+} g_auth_options[] = {
+    {MC_AUTH_OPT_CRC32C, MC_AUTH_CAP_CRC32C},
+    {MC_AUTH_OPT_LZ4, MC_AUTH_CAP_LZ4},
+    {MC_AUTH_OPT_BUNDLE, MC_AUTH_CAP_BUNDLE},
+};
+
+unsigned int mc_auth_parse_options(const char *options) {
+    unsigned int caps = 0;
+    const char *p = options ? options : "";
+    while (*p) {
+        size_t len = strcspn(p, ",");
+        for (size_t i = 0; i < sizeof(g_auth_options) / sizeof(g_auth_options[0]); ++i) {
+            if (strlen(g_auth_options[i].name) == len && strncmp(p, g_auth_options[i].name, len) == 0) {
+                caps |= g_auth_options[i].cap;
+            }
+        }
+        p += len;
+        if (*p == ',') {
+            ++p;
+        }
+    }
+    return caps;
+}
+
+void mc_auth_format_options(unsigned int caps, char *out, size_t out_len) {
+    size_t used = 0;
+    if (out_len == 0) {
+        return;
+    }
+    out[0] = '\0';
+    for (size_t i = 0; i < sizeof(g_auth_options) / sizeof(g_auth_options[0]); ++i) {
+        if (!(caps & g_auth_options[i].cap)) {
+            continue;
+        }
+        int n = snprintf(out + used, out_len - used, "%s%s", used > 0 ? "," : "", g_auth_options[i].name);
+        if (n < 0 || (size_t)n >= out_len - used) {
+            out[used] = '\0'; /* never leave half a name */
+            return;
+        }
+        used += (size_t)n;
+    }
+}
+
+void mc_frame_host_to_network(mc_frame_header_t *frame) {
+    if (!frame) {
+        return;
+    }
+
+    frame->stream_id = htonl(frame->stream_id);
+    frame->length = htonl(frame->length);
+}
+
+void mc_frame_network_to_host(mc_frame_header_t *frame) {
+    if (!frame) {
+        return;
+    }
+
+    frame->stream_id = ntohl(frame->stream_id);
+    frame->length = ntohl(frame->length);
 }
 
 ssize_t mc_send_all(int fd, const void *buf, size_t len) {
@@ -148,9 +471,73 @@ int mc_send_header(int fd, const mc_packet_header_t *header) {
         return -1;
     }
 
+    size_t wire_len = mc_header_wire_size(header);
     mc_packet_header_t tmp = *header;
     mc_header_host_to_network(&tmp);
-    return mc_send_all(fd, &tmp, sizeof(tmp)) == (ssize_t)sizeof(tmp) ? 0 : -1;
+    return mc_send_all(fd, &tmp, wire_len) == (ssize_t)wire_len ? 0 : -1;
+}
+
+int mc_send_iov_all(int fd, struct iovec *iov, int count, bool more) {
+    bool is_socket = true;
+    while (count > 0) {
+        ssize_t written;
+        if (is_socket) {
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = (size_t)count;
+            written = sendmsg(fd, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0)); /* sendmsg() 시스템 콜로 여러 조각을 한 번에 전송 */
+            if (written < 0 && errno == ENOTSOCK) {
+                is_socket = false;
+                continue;
+            }
+        } else {
+            written = writev(fd, iov, count); /* writev() 시스템 콜로 여러 조각을 한 번에 전송 */
+        }
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        size_t left = (size_t)written;
+        while (count > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + left;
+            iov->iov_len -= left;
+        }
+    }
+    return 0;
+}
+
+int mc_send_packet(int fd,
+                   const mc_packet_header_t *header,
+                   const char *filename,
+                   const void *payload,
+                   size_t payload_len,
+                   bool more) {
+    if (!header) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    mc_packet_header_t tmp = *header;
+    mc_header_host_to_network(&tmp);
+    struct iovec iov[3] = {
+        {.iov_base = &tmp, .iov_len = mc_header_wire_size(header)},
+        {.iov_base = (void *)filename, .iov_len = filename ? header->filename_len : 0},
+        {.iov_base = (void *)payload, .iov_len = payload ? payload_len : 0},
+    };
+    return mc_send_iov_all(fd, iov, 3, more);
+}
+
+void mc_set_cork(int fd, bool on) {
+    int value = on ? 1 : 0;
+    (void)setsockopt(fd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value)); /* setsockopt() 시스템 콜로 TCP_CORK 설정 */
 }
 
 int mc_recv_header(int fd, mc_packet_header_t *out) {
@@ -159,11 +546,38 @@ int mc_recv_header(int fd, mc_packet_header_t *out) {
         return -1;
     }
 
-    ssize_t received = mc_recv_all(fd, out, sizeof(*out));
-    if (received != (ssize_t)sizeof(*out)) {
+    memset(out, 0, sizeof(*out));
+    ssize_t received = mc_recv_all(fd, out, MC_HEADER_V1_SIZE);
+    if (received != (ssize_t)MC_HEADER_V1_SIZE) {
         return -1;
     }
+    /* the version byte decides whether a request_id follows */
+    size_t wire_len = mc_header_wire_size(out);
+    if (wire_len > MC_HEADER_V1_SIZE && out->version <= MC_PROTOCOL_VERSION_MAX) {
+        size_t extra = wire_len - MC_HEADER_V1_SIZE;
+        if (mc_recv_all(fd, (uint8_t *)out + MC_HEADER_V1_SIZE, extra) != (ssize_t)extra) {
+            return -1;
+        }
+    }
 
     mc_header_network_to_host(out);
     return mc_validate_header(out);
 }
+
+int mc_recv_frame_header(int fd, mc_frame_header_t *out) {
+    if (!out) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ssize_t received = mc_recv_all(fd, out, sizeof(*out));
+    if (received != (ssize_t)sizeof(*out)) {
+        return -1;
+    }
+
+    mc_frame_network_to_host(out);
+    if (out->length > MC_FRAME_MAX_PAYLOAD) {
+        return -2;
+    }
+    return 0;
+}
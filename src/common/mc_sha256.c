@@ -0,0 +1,157 @@
+#include "mc_sha256.h"
+
+#include <string.h>
+
+static const uint32_t k_round[64] = {
+    0x428a2f98U, 0x71374491U, 0xb5c0fbcfU, 0xe9b5dba5U, 0x3956c25bU, 0x59f111f1U, 0x923f82a4U, 0xab1c5ed5U,
+    0xd807aa98U, 0x12835b01U, 0x243185beU, 0x550c7dc3U, 0x72be5d74U, 0x80deb1feU, 0x9bdc06a7U, 0xc19bf174U,
+    0xe49b69c1U, 0xefbe4786U, 0x0fc19dc6U, 0x240ca1ccU, 0x2de92c6fU, 0x4a7484aaU, 0x5cb0a9dcU, 0x76f988daU,
+    0x983e5152U, 0xa831c66dU, 0xb00327c8U, 0xbf597fc7U, 0xc6e00bf3U, 0xd5a79147U, 0x06ca6351U, 0x14292967U,
+    0x27b70a85U, 0x2e1b2138U, 0x4d2c6dfcU, 0x53380d13U, 0x650a7354U, 0x766a0abbU, 0x81c2c92eU, 0x92722c85U,
+    0xa2bfe8a1U, 0xa81a664bU, 0xc24b8b70U, 0xc76c51a3U, 0xd192e819U, 0xd6990624U, 0xf40e3585U, 0x106aa070U,
+    0x19a4c116U, 0x1e376c08U, 0x2748774cU, 0x34b0bcb5U, 0x391c0cb3U, 0x4ed8aa4aU, 0x5b9cca4fU, 0x682e6ff3U,
+    0x748f82eeU, 0x78a5636fU, 0x84c87814U, 0x8cc70208U, 0x90befffaU, 0xa4506cebU, 0xbef9a3f7U, 0xc67178f2U,
+};
+
+static uint32_t rotr(uint32_t x, unsigned int n) {
+    return (x >> n) | (x << (32U - n));
+}
+
+static void compress(uint32_t state[8], const uint8_t block[64]) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) {
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) |
+               ((uint32_t)block[i * 4 + 2] << 8) | (uint32_t)block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; ++i) {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + k_round[i] + w[i];
+        uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+void mc_sha256_init(mc_sha256_t *ctx) {
+    static const uint32_t initial[8] = {
+        0x6a09e667U, 0xbb67ae85U, 0x3c6ef372U, 0xa54ff53aU, 0x510e527fU, 0x9b05688cU, 0x1f83d9abU, 0x5be0cd19U,
+    };
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->total_len = 0;
+    ctx->block_len = 0;
+}
+
+void mc_sha256_update(mc_sha256_t *ctx, const void *data, size_t len) {
+    const uint8_t *p = data;
+    ctx->total_len += len;
+    if (ctx->block_len > 0) {
+        size_t take = sizeof(ctx->block) - ctx->block_len;
+        if (take > len) {
+            take = len;
+        }
+        memcpy(ctx->block + ctx->block_len, p, take);
+        ctx->block_len += take;
+        p += take;
+        len -= take;
+        if (ctx->block_len < sizeof(ctx->block)) {
+            return;
+        }
+        compress(ctx->state, ctx->block);
+        ctx->block_len = 0;
+    }
+    while (len >= sizeof(ctx->block)) {
+        compress(ctx->state, p);
+        p += sizeof(ctx->block);
+        len -= sizeof(ctx->block);
+    }
+    memcpy(ctx->block, p, len);
+    ctx->block_len = len;
+}
+
+void mc_sha256_final(mc_sha256_t *ctx, uint8_t digest[MC_SHA256_DIGEST_LEN]) {
+    uint64_t bit_len = ctx->total_len * 8U;
+    ctx->block[ctx->block_len++] = 0x80;
+    if (ctx->block_len > 56) {
+        memset(ctx->block + ctx->block_len, 0, sizeof(ctx->block) - ctx->block_len);
+        compress(ctx->state, ctx->block);
+        ctx->block_len = 0;
+    }
+    memset(ctx->block + ctx->block_len, 0, 56 - ctx->block_len);
+    for (int i = 0; i < 8; ++i) {
+        ctx->block[56 + i] = (uint8_t)(bit_len >> (56 - 8 * i));
+    }
+    compress(ctx->state, ctx->block);
+
+    for (int i = 0; i < 8; ++i) {
+        digest[i * 4] = (uint8_t)(ctx->state[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t)(ctx->state[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(ctx->state[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t)ctx->state[i];
+    }
+}
+
+void mc_sha256(const void *data, size_t len, uint8_t digest[MC_SHA256_DIGEST_LEN]) {
+    mc_sha256_t ctx;
+    mc_sha256_init(&ctx);
+    mc_sha256_update(&ctx, data, len);
+    mc_sha256_final(&ctx, digest);
+}
+
+void mc_sha256_to_hex(const uint8_t digest[MC_SHA256_DIGEST_LEN], char *out) {
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < MC_SHA256_DIGEST_LEN; ++i) {
+        out[i * 2] = digits[digest[i] >> 4];
+        out[i * 2 + 1] = digits[digest[i] & 0x0F];
+    }
+    out[MC_SHA256_HEX_LEN] = '\0';
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+int mc_sha256_from_hex(const char *hex, uint8_t digest[MC_SHA256_DIGEST_LEN]) {
+    if (strlen(hex) != MC_SHA256_HEX_LEN) {
+        return -1;
+    }
+    for (size_t i = 0; i < MC_SHA256_DIGEST_LEN; ++i) {
+        int hi = hex_value(hex[i * 2]);
+        int lo = hex_value(hex[i * 2 + 1]);
+        if (hi < 0 || lo < 0) {
+            return -1;
+        }
+        digest[i] = (uint8_t)((hi << 4) | lo);
+    }
+    return 0;
+}
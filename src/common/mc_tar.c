@@ -0,0 +1,173 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mc_tar.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define MC_TAR_LONGLINK "././@LongLink"
+
+/* Field offsets and widths of a ustar header. */
+enum {
+    TAR_NAME = 0,
+    TAR_MODE = 100,
+    TAR_UID = 108,
+    TAR_GID = 116,
+    TAR_SIZE = 124,
+    TAR_MTIME = 136,
+    TAR_CHKSUM = 148,
+    TAR_TYPE = 156,
+    TAR_MAGIC = 257,
+    TAR_VERSION = 263,
+    TAR_PREFIX = 345,
+    TAR_NAME_LEN = 100,
+    TAR_PREFIX_LEN = 155,
+    TAR_NUMBER_LEN = 12
+};
+
+/* value as width - 1 octal digits and a NUL, or GNU base-256 when it does not fit. */
+static void put_number(uint8_t *field, size_t width, uint64_t value) {
+    if (value < (1ULL << (3 * (width - 1)))) {
+        snprintf((char *)field, width, "%0*llo", (int)(width - 1), (unsigned long long)value);
+        return;
+    }
+    memset(field, 0, width);
+    field[0] = 0x80;
+    for (size_t i = width - 1; i > 0 && value > 0; --i, value >>= 8) {
+        field[i] = (uint8_t)(value & 0xFF);
+    }
+}
+
+static int get_number(const uint8_t *field, size_t width, uint64_t *out) {
+    uint64_t value = 0;
+    if (field[0] & 0x80) {
+        for (size_t i = 1; i < width; ++i) {
+            if (value >> 56) {
+                return -1;
+            }
+            value = (value << 8) | field[i];
+        }
+        *out = value;
+        return 0;
+    }
+    size_t i = 0;
+    while (i < width && field[i] == ' ') {
+        ++i;
+    }
+    for (; i < width && field[i] >= '0' && field[i] <= '7'; ++i) {
+        if (value >> 61) {
+            return -1;
+        }
+        value = (value << 3) | (uint64_t)(field[i] - '0');
+    }
+    if (i < width && field[i] != '\0' && field[i] != ' ') {
+        return -1;
+    }
+    *out = value;
+    return 0;
+}
+
+static unsigned int header_sum(const uint8_t block[MC_TAR_BLOCK]) {
+    unsigned int sum = 0;
+    for (size_t i = 0; i < MC_TAR_BLOCK; ++i) {
+        sum += (i >= TAR_CHKSUM && i < TAR_CHKSUM + 8) ? (unsigned int)' ' : block[i];
+    }
+    return sum;
+}
+
+static void fill_header(uint8_t block[MC_TAR_BLOCK], char type, uint64_t size, int64_t mtime) {
+    put_number(block + TAR_MODE, 8, type == MC_TAR_TYPE_DIR ? 0755 : 0644);
+    put_number(block + TAR_UID, 8, 0);
+    put_number(block + TAR_GID, 8, 0);
+    put_number(block + TAR_SIZE, TAR_NUMBER_LEN, size);
+    put_number(block + TAR_MTIME, TAR_NUMBER_LEN, mtime > 0 ? (uint64_t)mtime : 0);
+    block[TAR_TYPE] = (uint8_t)type;
+    memcpy(block + TAR_MAGIC, "ustar", 6);
+    memcpy(block + TAR_VERSION, "00", 2);
+    snprintf((char *)block + TAR_CHKSUM, 8, "%06o", header_sum(block));
+    block[TAR_CHKSUM + 7] = ' ';
+}
+
+/* Where name splits into a ustar prefix and name: the '/' to cut at, or NULL. */
+static const char *split_point(const char *name, size_t len) {
+    if (len <= TAR_NAME_LEN) {
+        return NULL;
+    }
+    for (const char *slash = strchr(name, '/'); slash; slash = strchr(slash + 1, '/')) {
+        size_t prefix = (size_t)(slash - name);
+        size_t rest = len - prefix - 1;
+        if (prefix <= TAR_PREFIX_LEN && rest > 0 && rest <= TAR_NAME_LEN) {
+            return slash;
+        }
+    }
+    return NULL;
+}
+
+static bool needs_longlink(const char *name, size_t len) {
+    return len > TAR_NAME_LEN && !split_point(name, len);
+}
+
+size_t mc_tar_header(const char *name, bool is_dir, uint64_t size, int64_t mtime, uint8_t out[MC_TAR_HEADER_MAX]) {
+    size_t len = strlen(name);
+    size_t used = 0;
+    memset(out, 0, MC_TAR_HEADER_MAX);
+    if (needs_longlink(name, len)) {
+        /* the name (with its NUL) is the data of an 'L' entry; names are shorter than a block */
+        memcpy(out, MC_TAR_LONGLINK, sizeof(MC_TAR_LONGLINK));
+        fill_header(out, MC_TAR_TYPE_LONGNAME, (uint64_t)len + 1, 0);
+        memcpy(out + MC_TAR_BLOCK, name, len);
+        used = 2 * MC_TAR_BLOCK;
+        memcpy(out + used, name, TAR_NAME_LEN);
+    } else {
+        const char *slash = split_point(name, len);
+        if (slash) {
+            memcpy(out + used + TAR_PREFIX, name, (size_t)(slash - name));
+            memcpy(out + used, slash + 1, len - (size_t)(slash - name) - 1);
+        } else {
+            memcpy(out + used, name, len);
+        }
+    }
+    fill_header(out + used, is_dir ? MC_TAR_TYPE_DIR : MC_TAR_TYPE_FILE, is_dir ? 0 : size, mtime);
+    return used + MC_TAR_BLOCK;
+}
+
+uint64_t mc_tar_padding(uint64_t size) {
+    return (MC_TAR_BLOCK - size % MC_TAR_BLOCK) % MC_TAR_BLOCK;
+}
+
+uint64_t mc_tar_entry_size(const char *name, bool is_dir, uint64_t size) {
+    uint64_t header = needs_longlink(name, strlen(name)) ? 3U * MC_TAR_BLOCK : MC_TAR_BLOCK;
+    return is_dir ? header : header + size + mc_tar_padding(size);
+}
+
+int mc_tar_parse(const uint8_t block[MC_TAR_BLOCK], mc_tar_entry_t *out) {
+    bool zero = true;
+    for (size_t i = 0; i < MC_TAR_BLOCK && zero; ++i) {
+        zero = block[i] == 0;
+    }
+    if (zero) {
+        return 0;
+    }
+
+    uint64_t sum = 0;
+    uint64_t mtime = 0;
+    if (get_number(block + TAR_CHKSUM, 8, &sum) != 0 || sum != header_sum(block) ||
+        get_number(block + TAR_SIZE, TAR_NUMBER_LEN, &out->size) != 0 ||
+        get_number(block + TAR_MTIME, TAR_NUMBER_LEN, &mtime) != 0) {
+        return -1;
+    }
+    out->mtime = (int64_t)mtime;
+    out->type = block[TAR_TYPE] == '\0' ? MC_TAR_TYPE_FILE : (char)block[TAR_TYPE];
+
+    size_t prefix_len = memcmp(block + TAR_MAGIC, "ustar", 5) == 0 ? strnlen((const char *)block + TAR_PREFIX, TAR_PREFIX_LEN) : 0;
+    size_t name_len = strnlen((const char *)block + TAR_NAME, TAR_NAME_LEN);
+    size_t at = 0;
+    if (prefix_len > 0) {
+        memcpy(out->name, block + TAR_PREFIX, prefix_len);
+        out->name[prefix_len] = '/';
+        at = prefix_len + 1;
+    }
+    memcpy(out->name + at, block + TAR_NAME, name_len);
+    out->name[at + name_len] = '\0';
+    return 1;
+}
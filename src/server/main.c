@@ -139,12 +139,128 @@ int main(int argc, char **argv) {
         max_upload_bytes = (uint64_t)parsed;
     }
 
+    mc_server_engine_t engine = MC_SERVER_ENGINE_FORK;
+    const char *engine_env = getenv("MC_SERVER_ENGINE");
+    if (engine_env && *engine_env) {
+        if (strcmp(engine_env, "fork") == 0) {
+            engine = MC_SERVER_ENGINE_FORK;
+        } else if (strcmp(engine_env, "epoll") == 0) {
+            engine = MC_SERVER_ENGINE_EPOLL;
+        } else if (strcmp(engine_env, "uring") == 0) {
+            engine = MC_SERVER_ENGINE_URING;
+        } else {
+            fprintf(stderr, "Invalid MC_SERVER_ENGINE: %s (expected fork, epoll or uring)\n", engine_env);
+            free(token_from_file);
+            return EXIT_FAILURE;
+        }
+    }
+
+    int workers = 0;
+    const char *workers_env = getenv("MC_SERVER_WORKERS");
+    if (workers_env && *workers_env) {
+        if (strcmp(workers_env, "auto") == 0) {
+            long cores = sysconf(_SC_NPROCESSORS_ONLN); /* sysconf()로 온라인 코어 수 확인 */
+            workers = cores > 0 ? (int)cores : 1;
+        } else {
+            errno = 0;
+            char *endptr = NULL;
+            long parsed = strtol(workers_env, &endptr, 10);
+            if (errno != 0 || !endptr || *endptr != '\0' || parsed < 0 || parsed > 256) {
+                fprintf(stderr, "Invalid MC_SERVER_WORKERS: %s (expected 0-256 or auto)\n", workers_env);
+                free(token_from_file);
+                return EXIT_FAILURE;
+            }
+            workers = (int)parsed;
+        }
+    }
+
+    mc_storage_mode_t storage_mode = MC_STORAGE_MODE_PLAIN;
+    const char *mode_env = getenv("MC_STORAGE_MODE");
+    if (mode_env && *mode_env) {
+        if (strcmp(mode_env, "plain") == 0) {
+            storage_mode = MC_STORAGE_MODE_PLAIN;
+        } else if (strcmp(mode_env, "chunked") == 0) {
+            storage_mode = MC_STORAGE_MODE_CHUNKED;
+        } else if (strcmp(mode_env, "compressed") == 0) {
+            storage_mode = MC_STORAGE_MODE_COMPRESSED;
+        } else {
+            fprintf(stderr, "Invalid MC_STORAGE_MODE: %s (expected plain, chunked or compressed)\n", mode_env);
+            free(token_from_file);
+            return EXIT_FAILURE;
+        }
+    }
+
+    mc_meta_mode_t meta_mode = MC_META_INDEX_MEMORY;
+    const char *meta_env = getenv("MC_META_INDEX");
+    if (meta_env && *meta_env) {
+        if (strcmp(meta_env, "memory") == 0) {
+            meta_mode = MC_META_INDEX_MEMORY;
+        } else if (strcmp(meta_env, "persist") == 0) {
+            meta_mode = MC_META_INDEX_PERSIST;
+        } else if (strcmp(meta_env, "off") == 0) {
+            meta_mode = MC_META_INDEX_OFF;
+        } else {
+            fprintf(stderr, "Invalid MC_META_INDEX: %s (expected memory, persist or off)\n", meta_env);
+            free(token_from_file);
+            return EXIT_FAILURE;
+        }
+    }
+
+    mc_storage_layout_t storage_layout = MC_STORAGE_LAYOUT_FLAT;
+    const char *layout_env = getenv("MC_STORAGE_LAYOUT");
+    if (layout_env && *layout_env) {
+        if (strcmp(layout_env, "flat") == 0) {
+            storage_layout = MC_STORAGE_LAYOUT_FLAT;
+        } else if (strcmp(layout_env, "sharded") == 0) {
+            storage_layout = MC_STORAGE_LAYOUT_SHARDED;
+        } else {
+            fprintf(stderr, "Invalid MC_STORAGE_LAYOUT: %s (expected flat or sharded)\n", layout_env);
+            free(token_from_file);
+            return EXIT_FAILURE;
+        }
+    }
+
+    uint64_t file_cache_bytes = 64ULL << 20;
+    const char *cache_env = getenv("MC_FILE_CACHE_BYTES");
+    if (cache_env && *cache_env) {
+        errno = 0;
+        char *endptr = NULL;
+        unsigned long long parsed = strtoull(cache_env, &endptr, 10);
+        if (errno != 0 || !endptr || *endptr != '\0') {
+            fprintf(stderr, "Invalid MC_FILE_CACHE_BYTES: %s\n", cache_env);
+            free(token_from_file);
+            return EXIT_FAILURE;
+        }
+        file_cache_bytes = (uint64_t)parsed;
+    }
+
+    mc_download_io_t download_io = MC_DOWNLOAD_IO_SENDFILE;
+    const char *io_env = getenv("MC_DOWNLOAD_IO");
+    if (io_env && *io_env) {
+        if (strcmp(io_env, "sendfile") == 0) {
+            download_io = MC_DOWNLOAD_IO_SENDFILE;
+        } else if (strcmp(io_env, "mmap") == 0) {
+            download_io = MC_DOWNLOAD_IO_MMAP;
+        } else {
+            fprintf(stderr, "Invalid MC_DOWNLOAD_IO: %s (expected sendfile or mmap)\n", io_env);
+            free(token_from_file);
+            return EXIT_FAILURE;
+        }
+    }
+
     mc_server_config_t config = {
         .port = (uint16_t)port_long,
         .backlog = backlog,
         .storage_dir = storage_dir,
         .auth_token = auth_token,
         .max_upload_bytes = max_upload_bytes,
+        .engine = engine,
+        .workers = workers,
+        .storage_mode = storage_mode,
+        .meta_mode = meta_mode,
+        .storage_layout = storage_layout,
+        .file_cache_bytes = file_cache_bytes,
+        .download_io = download_io,
     };
 
     if (mc_server_run(&config) != 0) {
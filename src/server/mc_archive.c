@@ -0,0 +1,153 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mc_archive.h"
+#include "mc_storage.h"
+#include "mc_tar.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef enum {
+    PART_HEADER,
+    PART_DATA,
+    PART_PADDING,
+    PART_END
+} archive_part_t;
+
+struct mc_archive {
+    const mc_server_config_t *config;
+    mc_meta_item_t *items;
+    size_t count;
+    size_t next;          /* item whose header comes up after the current entry */
+    archive_part_t part;
+    uint64_t part_len;
+    uint64_t at;          /* bytes of the current part handed out */
+    uint64_t size;        /* listed size of the current file */
+    mc_download_t body;   /* body.fd is -1 while no file is open */
+    uint8_t header[MC_TAR_HEADER_MAX];
+};
+
+static bool is_dir_item(const mc_meta_item_t *item) {
+    size_t len = strlen(item->name);
+    return len > 0 && item->name[len - 1] == '/';
+}
+
+static void close_body(mc_archive_t *archive) {
+    if (archive->body.fd != -1) {
+        close(archive->body.fd);
+        archive->body.fd = -1;
+    }
+}
+
+/* Moves on to the next part that has bytes in it (or to the end). */
+static void next_part(mc_archive_t *archive) {
+    do {
+        archive->at = 0;
+        if (archive->part == PART_HEADER && archive->size > 0) {
+            const mc_meta_item_t *item = &archive->items[archive->next - 1];
+            char err[128];
+            /* a file that cannot be opened any more goes out as zeros */
+            if (mc_storage_open_reply(archive->config, item->name, NULL, 0, &archive->body, err, sizeof(err)) != 0) {
+                archive->body.fd = -1;
+            }
+            archive->part = PART_DATA;
+            archive->part_len = archive->size;
+        } else if (archive->part == PART_HEADER || archive->part == PART_DATA) {
+            close_body(archive);
+            archive->part = PART_PADDING;
+            archive->part_len = mc_tar_padding(archive->size);
+        } else if (archive->next < archive->count) {
+            const mc_meta_item_t *item = &archive->items[archive->next++];
+            bool is_dir = is_dir_item(item);
+            archive->size = is_dir ? 0 : item->info.size;
+            archive->part = PART_HEADER;
+            archive->part_len = mc_tar_header(item->name, is_dir, archive->size, item->info.mtime, archive->header);
+        } else {
+            archive->part = PART_END;
+            archive->part_len = 2U * MC_TAR_BLOCK;
+        }
+    } while (archive->part_len == 0);
+}
+
+/* Up to len bytes of the current file's data; zeros past whatever it still holds. */
+static void read_data(mc_archive_t *archive, uint8_t *buf, size_t len) {
+    size_t got = 0;
+    mc_download_t *body = &archive->body;
+    if (body->fd != -1 && archive->at < body->length) {
+        size_t want = body->length - archive->at < len ? (size_t)(body->length - archive->at) : len;
+        while (got < want) {
+            ssize_t n = pread(body->fd, buf + got, want - got, (off_t)(body->offset + archive->at + got)); /* pread() 시스템 콜로 파일 내용 읽기 */
+            if (n <= 0) {
+                close_body(archive);
+                break;
+            }
+            got += (size_t)n;
+        }
+    }
+    memset(buf + got, 0, len - got);
+}
+
+int mc_archive_open(const mc_server_config_t *config,
+                    const char *dir,
+                    mc_archive_t **out,
+                    uint64_t *total,
+                    char *err,
+                    size_t err_len) {
+    mc_archive_t *archive = calloc(1, sizeof(*archive));
+    if (!archive) {
+        snprintf(err, err_len, "Out of memory");
+        return -1;
+    }
+    if (mc_storage_list_tree(config, dir, &archive->items, &archive->count, err, err_len) != 0) {
+        free(archive);
+        return -1;
+    }
+    archive->config = config;
+    archive->body.fd = -1;
+
+    *total = 2U * MC_TAR_BLOCK;
+    for (size_t i = 0; i < archive->count; ++i) {
+        const mc_meta_item_t *item = &archive->items[i];
+        *total += mc_tar_entry_size(item->name, is_dir_item(item), item->info.size);
+    }
+    archive->part = PART_PADDING;
+    next_part(archive);
+    *out = archive;
+    return 0;
+}
+
+size_t mc_archive_read(mc_archive_t *archive, uint8_t *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        if (archive->at == archive->part_len) {
+            if (archive->part == PART_END) {
+                break;
+            }
+            next_part(archive);
+        }
+        uint64_t left = archive->part_len - archive->at;
+        size_t n = left < len - done ? (size_t)left : len - done;
+        if (archive->part == PART_HEADER) {
+            memcpy(buf + done, archive->header + archive->at, n);
+        } else if (archive->part == PART_DATA) {
+            read_data(archive, buf + done, n);
+        } else {
+            memset(buf + done, 0, n);
+        }
+        archive->at += n;
+        done += n;
+    }
+    return done;
+}
+
+void mc_archive_close(mc_archive_t *archive) {
+    if (!archive) {
+        return;
+    }
+    close_body(archive);
+    mc_storage_free_items(archive->items, archive->count);
+    free(archive);
+}
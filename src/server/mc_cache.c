@@ -0,0 +1,433 @@
+#define _GNU_SOURCE
+
+#include "mc_cache.h"
+#include "mc_protocol.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define MC_CACHE_ALIGN       64U
+#define MC_CACHE_MIN_SLOT    512U
+#define MC_CACHE_CLASSES     32
+#define MC_CACHE_MAX_PAGES   65535U
+#define MC_CACHE_AVG_FILE    4096U /* sizes the hash table and the sketch */
+#define MC_CACHE_SKETCH_ROWS 4
+#define MC_CACHE_COUNTER_MAX 15U
+
+/* A slot is named by 1 + its offset into the arena in MC_CACHE_ALIGN units; 0 is none. */
+typedef uint32_t slot_ref_t;
+
+/* Slot header; the name and then the content follow it. */
+typedef struct {
+    slot_ref_t prev;  /* class LRU list while used, class free list otherwise */
+    slot_ref_t next;
+    slot_ref_t chain; /* hash bucket chain */
+    uint8_t cls;
+    uint8_t used;
+    uint16_t name_len;
+    uint32_t len;
+    uint32_t crc;
+    uint64_t hash;
+    mc_cache_stamp_t stamp;
+} slot_t;
+
+typedef struct {
+    slot_ref_t head; /* most recently used end of an LRU list */
+    slot_ref_t tail;
+} slot_list_t;
+
+typedef struct {
+    uint32_t slot_size;
+    uint32_t pages;
+    slot_list_t lru;
+    slot_list_t free;
+} cache_class_t;
+
+/*
+ * Start of the shared mapping. After it come the hash buckets, the
+ * count-min sketch (MC_CACHE_SKETCH_ROWS rows of 4-bit counters kept in
+ * bytes) and the page arena.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    uint32_t page_count;
+    uint32_t pages_used; /* handed out in order; once all are, classes take them from each other */
+    uint32_t class_count;
+    cache_class_t classes[MC_CACHE_CLASSES];
+    uint64_t bucket_mask;
+    uint64_t sketch_mask;
+    uint64_t additions; /* sketch increments since the counters were last halved */
+    uint64_t sample;    /* ... which happens when additions reach this */
+} cache_t;
+
+/* Process-local pointers into the mapping; fork keeps it at the same address. */
+static struct {
+    cache_t *shared;
+    slot_ref_t *buckets;
+    uint8_t *sketch;
+    uint8_t *arena;
+} g_cache;
+
+static size_t round_up(size_t n, size_t to) {
+    return (n + to - 1) / to * to;
+}
+
+static uint64_t hash_name(const char *name, size_t len) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (uint8_t)name[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static slot_t *slot_at(slot_ref_t ref) {
+    return (slot_t *)(g_cache.arena + (size_t)(ref - 1) * MC_CACHE_ALIGN);
+}
+
+static char *slot_name(slot_t *slot) {
+    return (char *)(slot + 1);
+}
+
+static slot_ref_t slot_ref(uint32_t page, uint32_t index, uint32_t slot_size) {
+    return (slot_ref_t)(((size_t)page * MC_CACHE_PAGE + (size_t)index * slot_size) / MC_CACHE_ALIGN + 1);
+}
+
+static uint32_t slot_page(slot_ref_t ref) {
+    return (uint32_t)((size_t)(ref - 1) * MC_CACHE_ALIGN / MC_CACHE_PAGE);
+}
+
+static void list_remove(slot_list_t *list, slot_ref_t ref) {
+    slot_t *slot = slot_at(ref);
+    if (slot->prev) {
+        slot_at(slot->prev)->next = slot->next;
+    } else {
+        list->head = slot->next;
+    }
+    if (slot->next) {
+        slot_at(slot->next)->prev = slot->prev;
+    } else {
+        list->tail = slot->prev;
+    }
+    slot->prev = 0;
+    slot->next = 0;
+}
+
+static void list_push(slot_list_t *list, slot_ref_t ref) {
+    slot_t *slot = slot_at(ref);
+    slot->prev = 0;
+    slot->next = list->head;
+    if (list->head) {
+        slot_at(list->head)->prev = ref;
+    } else {
+        list->tail = ref;
+    }
+    list->head = ref;
+}
+
+static size_t sketch_index(uint64_t hash, int row) {
+    static const uint64_t seeds[MC_CACHE_SKETCH_ROWS] = {
+        0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL, 0xd6e8feb86659fd93ULL};
+    uint64_t mixed = (hash ^ (hash >> 29)) * seeds[row];
+    return (size_t)(row * (g_cache.shared->sketch_mask + 1) + ((mixed >> 32) & g_cache.shared->sketch_mask));
+}
+
+/* TinyLFU: counts are halved every sample accesses, so old popularity fades. */
+static void sketch_add(uint64_t hash) {
+    for (int row = 0; row < MC_CACHE_SKETCH_ROWS; ++row) {
+        uint8_t *counter = &g_cache.sketch[sketch_index(hash, row)];
+        if (*counter < MC_CACHE_COUNTER_MAX) {
+            ++*counter;
+        }
+    }
+    if (++g_cache.shared->additions >= g_cache.shared->sample) {
+        size_t total = MC_CACHE_SKETCH_ROWS * (g_cache.shared->sketch_mask + 1);
+        for (size_t i = 0; i < total; ++i) {
+            g_cache.sketch[i] >>= 1;
+        }
+        g_cache.shared->additions /= 2;
+    }
+}
+
+static unsigned int sketch_estimate(uint64_t hash) {
+    unsigned int estimate = MC_CACHE_COUNTER_MAX;
+    for (int row = 0; row < MC_CACHE_SKETCH_ROWS; ++row) {
+        unsigned int count = g_cache.sketch[sketch_index(hash, row)];
+        if (count < estimate) {
+            estimate = count;
+        }
+    }
+    return estimate;
+}
+
+/* The bucket link that holds name's slot, or the empty link at the end of its chain. */
+static slot_ref_t *find_link(const char *name, size_t len, uint64_t hash) {
+    slot_ref_t *link = &g_cache.buckets[hash & g_cache.shared->bucket_mask];
+    while (*link) {
+        slot_t *slot = slot_at(*link);
+        if (slot->hash == hash && slot->name_len == len && memcmp(slot_name(slot), name, len) == 0) {
+            break;
+        }
+        link = &slot->chain;
+    }
+    return link;
+}
+
+static void drop_entry(slot_ref_t *link) {
+    slot_ref_t ref = *link;
+    slot_t *slot = slot_at(ref);
+    cache_class_t *cls = &g_cache.shared->classes[slot->cls];
+    *link = slot->chain;
+    slot->chain = 0;
+    slot->used = 0;
+    list_remove(&cls->lru, ref);
+    list_push(&cls->free, ref);
+}
+
+static void drop_slot(slot_ref_t ref) {
+    slot_t *slot = slot_at(ref);
+    drop_entry(find_link(slot_name(slot), slot->name_len, slot->hash));
+}
+
+static void carve_page(uint32_t page, uint32_t c) {
+    cache_class_t *cls = &g_cache.shared->classes[c];
+    uint32_t slots = MC_CACHE_PAGE / cls->slot_size;
+    cls->pages++;
+    for (uint32_t i = 0; i < slots; ++i) {
+        slot_ref_t ref = slot_ref(page, i, cls->slot_size);
+        slot_t *slot = slot_at(ref);
+        slot->cls = (uint8_t)c;
+        slot->used = 0;
+        slot->chain = 0;
+        list_push(&cls->free, ref);
+    }
+}
+
+/*
+ * Every page is handed out and class c has none of its own to evict from:
+ * empties a page of the class holding the most, if the newcomer (hash) is
+ * wanted more than that class's least recently used file. Returns the page,
+ * or UINT32_MAX.
+ */
+static uint32_t reclaim_page(uint32_t c, uint64_t hash) {
+    cache_t *cache = g_cache.shared;
+    uint32_t donor = c;
+    for (uint32_t d = 0; d < cache->class_count; ++d) {
+        if (d != c && cache->classes[d].pages > 0 &&
+            (donor == c || cache->classes[d].pages > cache->classes[donor].pages)) {
+            donor = d;
+        }
+    }
+    if (donor == c) {
+        return UINT32_MAX;
+    }
+    cache_class_t *cls = &cache->classes[donor];
+    slot_ref_t victim = cls->lru.tail ? cls->lru.tail : cls->free.head;
+    if (cls->lru.tail && sketch_estimate(hash) <= sketch_estimate(slot_at(cls->lru.tail)->hash)) {
+        return UINT32_MAX;
+    }
+    uint32_t page = slot_page(victim);
+    uint32_t slots = MC_CACHE_PAGE / cls->slot_size;
+    for (uint32_t i = 0; i < slots; ++i) {
+        slot_ref_t ref = slot_ref(page, i, cls->slot_size);
+        if (slot_at(ref)->used) {
+            drop_slot(ref);
+        }
+        list_remove(&cls->free, ref);
+    }
+    cls->pages--;
+    return page;
+}
+
+/* A free slot of class c for a newcomer, evicting if admission allows; 0 when it is turned away. */
+static slot_ref_t take_slot(uint32_t c, uint64_t hash) {
+    cache_t *cache = g_cache.shared;
+    cache_class_t *cls = &cache->classes[c];
+    if (!cls->free.head) {
+        if (cache->pages_used < cache->page_count) {
+            carve_page(cache->pages_used++, c);
+        } else if (cls->lru.tail) {
+            if (sketch_estimate(hash) <= sketch_estimate(slot_at(cls->lru.tail)->hash)) {
+                return 0;
+            }
+            drop_slot(cls->lru.tail);
+        } else {
+            uint32_t page = reclaim_page(c, hash);
+            if (page == UINT32_MAX) {
+                return 0;
+            }
+            carve_page(page, c);
+        }
+    }
+    slot_ref_t ref = cls->free.head;
+    list_remove(&cls->free, ref);
+    return ref;
+}
+
+static void reset_locked(void) {
+    cache_t *cache = g_cache.shared;
+    cache->pages_used = 0;
+    for (uint32_t c = 0; c < cache->class_count; ++c) {
+        cache->classes[c].pages = 0;
+        memset(&cache->classes[c].lru, 0, sizeof(cache->classes[c].lru));
+        memset(&cache->classes[c].free, 0, sizeof(cache->classes[c].free));
+    }
+    memset(g_cache.buckets, 0, (cache->bucket_mask + 1) * sizeof(*g_cache.buckets));
+}
+
+static int cache_lock(void) {
+    int rc = pthread_mutex_lock(&g_cache.shared->lock);
+    if (rc == EOWNERDEAD) {
+        /* a process died holding the lock, maybe halfway through an update: start over empty */
+        reset_locked();
+        rc = pthread_mutex_consistent(&g_cache.shared->lock);
+    }
+    return rc;
+}
+
+long mc_cache_open(uint64_t bytes) {
+    uint64_t pages = bytes / MC_CACHE_PAGE;
+    if (pages == 0) {
+        return 0;
+    }
+    if (pages > MC_CACHE_MAX_PAGES) {
+        pages = MC_CACHE_MAX_PAGES;
+    }
+    size_t width = 1024;
+    while (width < pages * (MC_CACHE_PAGE / MC_CACHE_AVG_FILE)) {
+        width *= 2;
+    }
+
+    size_t buckets_at = round_up(sizeof(cache_t), MC_CACHE_ALIGN);
+    size_t sketch_at = buckets_at + width * sizeof(slot_ref_t);
+    size_t arena_at = round_up(sketch_at + MC_CACHE_SKETCH_ROWS * width, (size_t)sysconf(_SC_PAGESIZE));
+    size_t total = arena_at + (size_t)pages * MC_CACHE_PAGE;
+    /* mmap() 시스템 콜로 fork 이후에도 공유되는 캐시 영역 매핑 (처음 쓸 때 채워짐) */
+    uint8_t *base = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+
+    cache_t *cache = (cache_t *)base;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    int rc = pthread_mutex_init(&cache->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (rc != 0) {
+        munmap(base, total);
+        errno = rc;
+        return -1;
+    }
+    cache->page_count = (uint32_t)pages;
+    cache->bucket_mask = width - 1;
+    cache->sketch_mask = width - 1;
+    cache->sample = 10 * (uint64_t)width;
+
+    /* size classes 1.25x apart, the last one just big enough for the largest file */
+    size_t largest = round_up(sizeof(slot_t) + MC_MAX_FILENAME_LEN + MC_CACHE_MAX_FILE, MC_CACHE_ALIGN);
+    size_t size = MC_CACHE_MIN_SLOT;
+    while (size < largest && cache->class_count < MC_CACHE_CLASSES - 1) {
+        cache->classes[cache->class_count++].slot_size = (uint32_t)size;
+        size = round_up(size * 5 / 4, MC_CACHE_ALIGN);
+    }
+    cache->classes[cache->class_count++].slot_size = (uint32_t)largest;
+
+    g_cache.shared = cache;
+    g_cache.buckets = (slot_ref_t *)(base + buckets_at);
+    g_cache.sketch = base + sketch_at;
+    g_cache.arena = base + arena_at;
+    return (long)pages;
+}
+
+bool mc_cache_enabled(void) {
+    return g_cache.shared != NULL;
+}
+
+long mc_cache_get(const char *name, const mc_cache_stamp_t *stamp, uint8_t *data, uint32_t *crc) {
+    if (!g_cache.shared) {
+        return -1;
+    }
+    size_t name_len = strlen(name);
+    uint64_t hash = hash_name(name, name_len);
+    if (cache_lock() != 0) {
+        return -1;
+    }
+    sketch_add(hash);
+    long len = -1;
+    slot_ref_t *link = find_link(name, name_len, hash);
+    if (*link) {
+        slot_ref_t ref = *link;
+        slot_t *slot = slot_at(ref);
+        if (memcmp(&slot->stamp, stamp, sizeof(*stamp)) != 0) {
+            drop_entry(link); /* the file was replaced since */
+        } else {
+            memcpy(data, slot_name(slot) + name_len, slot->len);
+            *crc = slot->crc;
+            len = (long)slot->len;
+            cache_class_t *cls = &g_cache.shared->classes[slot->cls];
+            list_remove(&cls->lru, ref);
+            list_push(&cls->lru, ref);
+        }
+    }
+    pthread_mutex_unlock(&g_cache.shared->lock);
+    return len;
+}
+
+void mc_cache_put(const char *name, const mc_cache_stamp_t *stamp, const uint8_t *data, size_t len, uint32_t crc) {
+    if (!g_cache.shared || len > MC_CACHE_MAX_FILE) {
+        return;
+    }
+    size_t name_len = strlen(name);
+    size_t need = sizeof(slot_t) + name_len + len;
+    uint32_t c = 0;
+    while (g_cache.shared->classes[c].slot_size < need) {
+        ++c;
+    }
+    uint64_t hash = hash_name(name, name_len);
+    if (cache_lock() != 0) {
+        return;
+    }
+    slot_ref_t *link = find_link(name, name_len, hash);
+    if (*link) {
+        drop_entry(link);
+    }
+    slot_ref_t ref = take_slot(c, hash);
+    if (ref) {
+        slot_t *slot = slot_at(ref);
+        slot->used = 1;
+        slot->name_len = (uint16_t)name_len;
+        slot->len = (uint32_t)len;
+        slot->crc = crc;
+        slot->hash = hash;
+        slot->stamp = *stamp;
+        memcpy(slot_name(slot), name, name_len);
+        memcpy(slot_name(slot) + name_len, data, len);
+        /* eviction may have relinked the chain: look the end up again */
+        link = find_link(name, name_len, hash);
+        slot->chain = 0;
+        *link = ref;
+        list_push(&g_cache.shared->classes[c].lru, ref);
+    }
+    pthread_mutex_unlock(&g_cache.shared->lock);
+}
+
+void mc_cache_invalidate(const char *name) {
+    if (!g_cache.shared) {
+        return;
+    }
+    size_t name_len = strlen(name);
+    uint64_t hash = hash_name(name, name_len);
+    if (cache_lock() != 0) {
+        return;
+    }
+    slot_ref_t *link = find_link(name, name_len, hash);
+    if (*link) {
+        drop_entry(link);
+    }
+    pthread_mutex_unlock(&g_cache.shared->lock);
+}
@@ -0,0 +1,516 @@
+#define _GNU_SOURCE
+
+#include "mc_chunkstore.h"
+#include "mc_storage.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* Below the average size a cut needs more zero bits than above it: chunk
+ * sizes bunch around MC_CHUNK_AVG (FastCDC's normalized chunking). */
+#define MC_CDC_MASK_SMALL (((1ULL << 18) - 1) << 46)
+#define MC_CDC_MASK_LARGE (((1ULL << 14) - 1) << 50)
+
+static uint64_t g_gear[256];
+static pthread_once_t g_gear_once = PTHREAD_ONCE_INIT;
+static unsigned int g_chunk_seq = 0;
+
+/* splitmix64: a fixed table, so every server cuts the same data the same way */
+static void init_gear(void) {
+    uint64_t x = 0x4D434C4443444300ULL;
+    for (size_t i = 0; i < 256; ++i) {
+        uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        g_gear[i] = z ^ (z >> 31);
+    }
+}
+
+static int set_error(char *err, size_t err_len, const char *fmt, ...) {
+    if (err && err_len > 0) {
+        va_list ap;
+        va_start(ap, fmt);
+        vsnprintf(err, err_len, fmt, ap);
+        va_end(ap);
+    }
+    return -1;
+}
+
+size_t mc_cdc_cut(const uint8_t *data, size_t len) {
+    if (len <= MC_CHUNK_MIN) {
+        return len;
+    }
+    pthread_once(&g_gear_once, init_gear);
+
+    size_t normal = len < MC_CHUNK_AVG ? len : MC_CHUNK_AVG;
+    size_t limit = len < MC_CHUNK_MAX ? len : MC_CHUNK_MAX;
+    uint64_t hash = 0;
+    size_t i = MC_CHUNK_MIN;
+    for (; i < normal; ++i) {
+        hash = (hash << 1) + g_gear[data[i]];
+        if (!(hash & MC_CDC_MASK_SMALL)) {
+            return i + 1;
+        }
+    }
+    for (; i < limit; ++i) {
+        hash = (hash << 1) + g_gear[data[i]];
+        if (!(hash & MC_CDC_MASK_LARGE)) {
+            return i + 1;
+        }
+    }
+    return limit;
+}
+
+static int chunk_path(const char *storage_dir, const uint8_t hash[MC_SHA256_DIGEST_LEN], char *out, size_t out_len) {
+    char hex[MC_SHA256_HEX_LEN + 1];
+    mc_sha256_to_hex(hash, hex);
+    int written = snprintf(out, out_len, "%s/%s/%.2s/%s", storage_dir, MC_CHUNKSTORE_DIR, hex, hex);
+    if (written < 0 || (size_t)written >= out_len) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    const uint8_t *p = data;
+    while (len > 0) {
+        ssize_t written = write(fd, p, len); /* write() 시스템 콜로 청크 저장 */
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += written;
+        len -= (size_t)written;
+    }
+    return 0;
+}
+
+/* Stores one chunk unless an identical one is already there (the dedup hit). */
+static int store_chunk(const char *storage_dir, const uint8_t *data, size_t len, mc_chunk_ref_t *ref) {
+    mc_sha256(data, len, ref->hash);
+    ref->length = (uint32_t)len;
+
+    char path[MC_STORAGE_PATH_MAX];
+    if (chunk_path(storage_dir, ref->hash, path, sizeof(path)) != 0) {
+        return -1;
+    }
+    struct stat st;
+    if (stat(path, &st) == 0) { /* stat() 시스템 콜로 기존 청크 확인 */
+        return 0;
+    }
+
+    /* .chunks/xx/ is created on first use */
+    char *slash = strrchr(path, '/');
+    *slash = '\0';
+    if (mkdir(path, 0755) == -1 && errno == ENOENT) { /* mkdir() 시스템 콜로 청크 디렉터리 생성 */
+        char *parent = strrchr(path, '/');
+        *parent = '\0';
+        if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+            return -1;
+        }
+        *parent = '/';
+        if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+            return -1;
+        }
+    }
+    *slash = '/';
+
+    /* write under a private name and rename: a concurrent writer of the same
+     * chunk produces identical bytes, so whichever rename lands last is fine */
+    char tmp[MC_STORAGE_PATH_MAX];
+    int written = snprintf(tmp,
+                           sizeof(tmp),
+                           "%.*s/.%s.%ld.%u",
+                           (int)(slash - path),
+                           path,
+                           slash + 1,
+                           (long)getpid(),
+                           __atomic_fetch_add(&g_chunk_seq, 1U, __ATOMIC_RELAXED));
+    if (written < 0 || (size_t)written >= sizeof(tmp)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644); /* open() 시스템 콜로 청크 임시 파일 생성 */
+    if (fd == -1) {
+        return -1;
+    }
+    int rc = write_all(fd, data, len);
+    if (close(fd) == -1) {
+        rc = -1;
+    }
+    if (rc == 0 && rename(tmp, path) == -1) { /* rename() 시스템 콜로 청크 게시 */
+        rc = -1;
+    }
+    if (rc != 0) {
+        int saved = errno;
+        unlink(tmp);
+        errno = saved;
+    }
+    return rc;
+}
+
+int mc_chunkstore_ingest(const char *storage_dir,
+                         int src_fd,
+                         int dir_fd,
+                         const char *tmp_name,
+                         const char *final_name,
+                         char *err,
+                         size_t err_len) {
+    if (lseek(src_fd, 0, SEEK_SET) == -1) { /* lseek() 시스템 콜로 처음부터 읽기 */
+        return set_error(err, err_len, "Failed to read upload: %s", strerror(errno));
+    }
+
+    uint8_t *buf = malloc(MC_CHUNK_MAX);
+    size_t cap = 64;
+    mc_chunk_ref_t *refs = malloc(cap * sizeof(*refs));
+    if (!buf || !refs) {
+        free(buf);
+        free(refs);
+        return set_error(err, err_len, "Out of memory");
+    }
+
+    size_t count = 0;
+    size_t have = 0;
+    uint64_t total = 0;
+    bool eof = false;
+    int rc = 0;
+    while (rc == 0 && (have > 0 || !eof)) {
+        while (!eof && have < MC_CHUNK_MAX) {
+            ssize_t got = read(src_fd, buf + have, MC_CHUNK_MAX - have); /* read() 시스템 콜로 업로드 데이터 읽기 */
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got < 0) {
+                rc = set_error(err, err_len, "Failed to read upload: %s", strerror(errno));
+                break;
+            }
+            if (got == 0) {
+                eof = true;
+            }
+            have += (size_t)got;
+        }
+        if (rc != 0 || have == 0) {
+            break;
+        }
+
+        size_t cut = mc_cdc_cut(buf, have);
+        if (count == cap) {
+            cap *= 2;
+            mc_chunk_ref_t *grown = realloc(refs, cap * sizeof(*refs));
+            if (!grown) {
+                rc = set_error(err, err_len, "Out of memory");
+                break;
+            }
+            refs = grown;
+        }
+        if (store_chunk(storage_dir, buf, cut, &refs[count]) != 0) {
+            rc = set_error(err, err_len, "Failed to store chunk: %s", strerror(errno));
+            break;
+        }
+        ++count;
+        total += cut;
+        memmove(buf, buf + cut, have - cut);
+        have -= cut;
+    }
+    free(buf);
+
+    if (rc == 0) {
+        mc_manifest_header_t header;
+        memcpy(header.magic, MC_MANIFEST_MAGIC, sizeof(header.magic));
+        header.total_size = total;
+        header.chunk_count = count;
+        int fd = openat(dir_fd, tmp_name, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0644); /* openat() 시스템 콜로 매니페스트 작성 */
+        if (fd == -1) {
+            rc = set_error(err, err_len, "Failed to write manifest: %s", strerror(errno));
+        } else {
+            if (write_all(fd, &header, sizeof(header)) != 0 || write_all(fd, refs, count * sizeof(*refs)) != 0 ||
+                mc_storage_mark_format(fd, MC_MANIFEST_FORMAT) != 0) {
+                rc = set_error(err, err_len, "Failed to write manifest: %s", strerror(errno));
+            }
+            close(fd);
+            if (rc == 0 && renameat(dir_fd, tmp_name, dir_fd, final_name) == -1) { /* renameat() 시스템 콜로 매니페스트 교체 */
+                rc = set_error(err, err_len, "Failed to store file: %s", strerror(errno));
+            }
+            if (rc != 0) {
+                unlinkat(dir_fd, tmp_name, 0);
+            }
+        }
+    }
+    free(refs);
+    return rc;
+}
+
+static int read_header(int fd, mc_manifest_header_t *header) {
+    if (!mc_storage_has_format(fd, MC_MANIFEST_FORMAT)) {
+        return 0;
+    }
+    ssize_t got = pread(fd, header, sizeof(*header), 0); /* pread() 시스템 콜로 매니페스트 헤더 확인 */
+    if (got < 0) {
+        return -1;
+    }
+    if ((size_t)got < sizeof(*header) || memcmp(header->magic, MC_MANIFEST_MAGIC, sizeof(header->magic)) != 0) {
+        return 0;
+    }
+    return 1;
+}
+
+int mc_chunkstore_probe(int fd, uint64_t *total_size) {
+    mc_manifest_header_t header;
+    int rc = read_header(fd, &header);
+    if (rc == 1) {
+        *total_size = header.total_size;
+    }
+    return rc;
+}
+
+int mc_chunkstore_read_manifest(int fd, mc_manifest_t *out) {
+    mc_manifest_header_t header;
+    int rc = read_header(fd, &header);
+    if (rc != 1) {
+        return rc;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return -1;
+    }
+    if (header.chunk_count > SIZE_MAX / sizeof(mc_chunk_ref_t) ||
+        (uint64_t)st.st_size != sizeof(header) + header.chunk_count * sizeof(mc_chunk_ref_t)) {
+        errno = EBADMSG;
+        return -1;
+    }
+
+    size_t bytes = (size_t)header.chunk_count * sizeof(mc_chunk_ref_t);
+    out->total_size = header.total_size;
+    out->count = (size_t)header.chunk_count;
+    out->chunks = malloc(bytes > 0 ? bytes : 1);
+    if (!out->chunks) {
+        return -1;
+    }
+    if (pread(fd, out->chunks, bytes, sizeof(header)) != (ssize_t)bytes) { /* pread() 시스템 콜로 청크 목록 읽기 */
+        free(out->chunks);
+        out->chunks = NULL;
+        errno = EBADMSG;
+        return -1;
+    }
+    return 1;
+}
+
+void mc_chunkstore_free_manifest(mc_manifest_t *manifest) {
+    free(manifest->chunks);
+    manifest->chunks = NULL;
+    manifest->count = 0;
+}
+
+static int copy_chunk(int dst_fd, int src_fd, uint64_t len) {
+    uint64_t remaining = len;
+    bool use_copy_range = true;
+    uint8_t buffer[16384];
+    while (remaining > 0) {
+        size_t want = remaining > (1U << 30) ? (1U << 30) : (size_t)remaining;
+        ssize_t moved;
+        if (use_copy_range) {
+            moved = copy_file_range(src_fd, NULL, dst_fd, NULL, want, 0); /* copy_file_range() 시스템 콜로 커널 내 복사 */
+            if (moved < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+                use_copy_range = false;
+                continue;
+            }
+        } else {
+            moved = read(src_fd, buffer, want < sizeof(buffer) ? want : sizeof(buffer));
+            if (moved > 0 && write_all(dst_fd, buffer, (size_t)moved) != 0) {
+                return -1;
+            }
+        }
+        if (moved < 0 && errno == EINTR) {
+            continue;
+        }
+        if (moved <= 0) {
+            return -1; /* chunk shorter than the manifest says */
+        }
+        remaining -= (uint64_t)moved;
+    }
+    return 0;
+}
+
+int mc_chunkstore_materialize(const char *storage_dir, const mc_manifest_t *manifest, char *err, size_t err_len) {
+    int fd = open(storage_dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600); /* open(O_TMPFILE)으로 이름 없는 임시 파일 생성 */
+    if (fd == -1) {
+        char tmp[MC_STORAGE_PATH_MAX];
+        snprintf(tmp, sizeof(tmp), "%s/.materialize.%ld.%u", storage_dir, (long)getpid(),
+                 __atomic_fetch_add(&g_chunk_seq, 1U, __ATOMIC_RELAXED));
+        fd = open(tmp, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (fd != -1) {
+            unlink(tmp); /* unlink() 시스템 콜로 이름 제거 (열린 동안만 유지) */
+        }
+    }
+    if (fd == -1) {
+        return set_error(err, err_len, "Failed to create temp file: %s", strerror(errno));
+    }
+
+    for (size_t i = 0; i < manifest->count; ++i) {
+        char path[MC_STORAGE_PATH_MAX];
+        int chunk_fd = -1;
+        if (chunk_path(storage_dir, manifest->chunks[i].hash, path, sizeof(path)) == 0) {
+            chunk_fd = open(path, O_RDONLY | O_CLOEXEC); /* open() 시스템 콜로 청크 열기 */
+        }
+        int rc = chunk_fd == -1 ? -1 : copy_chunk(fd, chunk_fd, manifest->chunks[i].length);
+        if (chunk_fd != -1) {
+            close(chunk_fd);
+        }
+        if (rc != 0) {
+            close(fd);
+            return set_error(err, err_len, "Chunk %zu of %zu is missing or damaged", i + 1, manifest->count);
+        }
+    }
+    if (lseek(fd, 0, SEEK_SET) == -1) {
+        close(fd);
+        return set_error(err, err_len, "Failed to rewind temp file");
+    }
+    return fd;
+}
+
+static int compare_hash(const void *a, const void *b) {
+    return memcmp(a, b, MC_SHA256_DIGEST_LEN);
+}
+
+typedef struct {
+    uint8_t (*hashes)[MC_SHA256_DIGEST_LEN];
+    size_t count;
+    size_t cap;
+} hash_set_t;
+
+static int collect_manifest(hash_set_t *set, int fd) {
+    mc_manifest_t manifest;
+    int rc = mc_chunkstore_read_manifest(fd, &manifest);
+    if (rc != 1) {
+        return rc == 0 ? 0 : -1;
+    }
+    if (set->count + manifest.count > set->cap) {
+        size_t cap = set->cap ? set->cap : 1024;
+        while (cap < set->count + manifest.count) {
+            cap *= 2;
+        }
+        void *grown = realloc(set->hashes, cap * MC_SHA256_DIGEST_LEN);
+        if (!grown) {
+            mc_chunkstore_free_manifest(&manifest);
+            return -1;
+        }
+        set->hashes = grown;
+        set->cap = cap;
+    }
+    for (size_t i = 0; i < manifest.count; ++i) {
+        memcpy(set->hashes[set->count++], manifest.chunks[i].hash, MC_SHA256_DIGEST_LEN);
+    }
+    mc_chunkstore_free_manifest(&manifest);
+    return 0;
+}
+
+/*
+ * Marks the chunks of every manifest in dir and, recursively, its
+ * subdirectories; the server's own directories in the root hold none that
+ * a live name does not.
+ */
+static int mark_dir(DIR *dir, bool root, hash_set_t *live) {
+    struct dirent *entry;
+    int rc = 0;
+    while (rc == 0 && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+            (root && (strcmp(entry->d_name, MC_CHUNKSTORE_DIR) == 0 || strcmp(entry->d_name, MC_STORAGE_BLOB_DIR) == 0 ||
+                      strcmp(entry->d_name, MC_STORAGE_SESSION_DIR) == 0))) {
+            continue;
+        }
+        int fd = openat(dirfd(dir), entry->d_name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW); /* openat() 시스템 콜로 매니페스트 후보 열기 */
+        if (fd == -1) {
+            continue;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            close(fd);
+        } else if (S_ISREG(st.st_mode)) {
+            rc = collect_manifest(live, fd);
+            close(fd);
+        } else if (S_ISDIR(st.st_mode)) {
+            DIR *sub = fdopendir(fd);
+            if (!sub) {
+                close(fd);
+                continue;
+            }
+            rc = mark_dir(sub, false, live);
+            closedir(sub);
+        } else {
+            close(fd);
+        }
+    }
+    return rc;
+}
+
+long mc_chunkstore_gc(const char *storage_dir) {
+    /* mark: every chunk named by a manifest anywhere in the storage dir */
+    DIR *dir = opendir(storage_dir); /* opendir() 시스템 콜로 저장소 열기 */
+    if (!dir) {
+        return -1;
+    }
+    hash_set_t live = {0};
+    int rc = mark_dir(dir, true, &live);
+    closedir(dir);
+    if (rc != 0) {
+        free(live.hashes);
+        return -1; /* an unreadable manifest: sweeping now could lose data */
+    }
+    if (live.count > 0) {
+        qsort(live.hashes, live.count, MC_SHA256_DIGEST_LEN, compare_hash);
+    }
+
+    /* sweep: unreferenced chunks and temp files left by a crash */
+    char root[MC_STORAGE_PATH_MAX];
+    snprintf(root, sizeof(root), "%s/%s", storage_dir, MC_CHUNKSTORE_DIR);
+    DIR *chunks = opendir(root);
+    long removed = 0;
+    if (!chunks) {
+        free(live.hashes);
+        return errno == ENOENT ? 0 : -1;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(chunks)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        int sub_fd = openat(dirfd(chunks), entry->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        DIR *sub = sub_fd == -1 ? NULL : fdopendir(sub_fd);
+        if (!sub) {
+            if (sub_fd != -1) {
+                close(sub_fd);
+            }
+            continue;
+        }
+        struct dirent *chunk;
+        while ((chunk = readdir(sub)) != NULL) {
+            if (strcmp(chunk->d_name, ".") == 0 || strcmp(chunk->d_name, "..") == 0) {
+                continue;
+            }
+            uint8_t hash[MC_SHA256_DIGEST_LEN];
+            bool referenced = chunk->d_name[0] != '.' && mc_sha256_from_hex(chunk->d_name, hash) == 0 &&
+                              live.count > 0 &&
+                              bsearch(hash, live.hashes, live.count, MC_SHA256_DIGEST_LEN, compare_hash) != NULL;
+            if (!referenced && unlinkat(dirfd(sub), chunk->d_name, 0) == 0) { /* unlinkat() 시스템 콜로 고아 청크 제거 */
+                ++removed;
+            }
+        }
+        closedir(sub);
+    }
+    closedir(chunks);
+    free(live.hashes);
+    return removed;
+}
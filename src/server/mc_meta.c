@@ -0,0 +1,939 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mc_meta.h"
+#include "mc_protocol.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define MC_META_READ_CHUNK (1U << 20)
+
+/*
+ * Lookups go through a chained hash table. Name order comes from a sorted
+ * array plus the names added since it was last sorted; LIST sorts those few
+ * and merges them in, dropping removed entries, instead of re-sorting all.
+ */
+typedef struct mc_meta_entry {
+    struct mc_meta_entry *next; /* hash chain */
+    bool removed;               /* still in the order arrays until the next merge */
+    mc_meta_info_t info;
+    char name[];
+} mc_meta_entry_t;
+
+static struct {
+    pthread_mutex_t lock;
+    bool enabled;
+    int fd;              /* journal, O_APPEND */
+    uint64_t applied;    /* journal bytes already applied */
+    uint64_t records;    /* records applied from this journal */
+    uint64_t generation; /* named by the journal's first record */
+    bool retired;        /* a later GENERATION record: the path holds a newer journal */
+    char path[PATH_MAX];
+    mc_meta_entry_t **buckets;
+    size_t bucket_count; /* power of two */
+    size_t count;        /* live entries */
+    mc_meta_entry_t **sorted;
+    size_t sorted_count;
+    mc_meta_entry_t **pending;
+    size_t pending_count;
+    size_t pending_cap;
+    size_t removed;      /* removed entries not yet merged out */
+} g_meta = {.lock = PTHREAD_MUTEX_INITIALIZER, .fd = -1};
+
+static uint64_t hash_name(const char *name, size_t len) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (uint8_t)name[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static mc_meta_entry_t **find_slot(const char *name, size_t len) {
+    mc_meta_entry_t **slot = &g_meta.buckets[hash_name(name, len) & (g_meta.bucket_count - 1)];
+    while (*slot && (strncmp((*slot)->name, name, len) != 0 || (*slot)->name[len] != '\0')) {
+        slot = &(*slot)->next;
+    }
+    return slot;
+}
+
+static int grow_buckets(void) {
+    size_t count = g_meta.bucket_count ? g_meta.bucket_count * 2 : 1024;
+    mc_meta_entry_t **buckets = calloc(count, sizeof(*buckets));
+    if (!buckets) {
+        return -1;
+    }
+    for (size_t i = 0; i < g_meta.bucket_count; ++i) {
+        mc_meta_entry_t *entry = g_meta.buckets[i];
+        while (entry) {
+            mc_meta_entry_t *next = entry->next;
+            size_t b = hash_name(entry->name, strlen(entry->name)) & (count - 1);
+            entry->next = buckets[b];
+            buckets[b] = entry;
+            entry = next;
+        }
+    }
+    free(g_meta.buckets);
+    g_meta.buckets = buckets;
+    g_meta.bucket_count = count;
+    return 0;
+}
+
+static int apply_put(const char *name, size_t len, const mc_meta_info_t *info) {
+    if (g_meta.count >= g_meta.bucket_count && grow_buckets() != 0) {
+        return -1;
+    }
+    mc_meta_entry_t **slot = find_slot(name, len);
+    if (*slot) {
+        (*slot)->info = *info;
+        return 0;
+    }
+    if (g_meta.pending_count == g_meta.pending_cap) {
+        size_t cap = g_meta.pending_cap ? g_meta.pending_cap * 2 : 256;
+        mc_meta_entry_t **grown = realloc(g_meta.pending, cap * sizeof(*grown));
+        if (!grown) {
+            return -1;
+        }
+        g_meta.pending = grown;
+        g_meta.pending_cap = cap;
+    }
+    mc_meta_entry_t *entry = malloc(sizeof(*entry) + len + 1);
+    if (!entry) {
+        return -1;
+    }
+    entry->next = NULL;
+    entry->removed = false;
+    entry->info = *info;
+    memcpy(entry->name, name, len);
+    entry->name[len] = '\0';
+    *slot = entry;
+    g_meta.pending[g_meta.pending_count++] = entry;
+    ++g_meta.count;
+    return 0;
+}
+
+static void apply_delete(const char *name, size_t len) {
+    if (g_meta.bucket_count == 0) {
+        return;
+    }
+    mc_meta_entry_t **slot = find_slot(name, len);
+    if (*slot) {
+        mc_meta_entry_t *entry = *slot;
+        *slot = entry->next;
+        entry->removed = true;
+        --g_meta.count;
+        ++g_meta.removed;
+    }
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp((*(mc_meta_entry_t *const *)a)->name, (*(mc_meta_entry_t *const *)b)->name);
+}
+
+/* Folds the pending names into the sorted array and frees removed entries. */
+static int merge_locked(void) {
+    if (g_meta.pending_count == 0 && g_meta.removed == 0) {
+        return 0;
+    }
+    size_t cap = g_meta.sorted_count + g_meta.pending_count;
+    mc_meta_entry_t **merged = malloc((cap > 0 ? cap : 1) * sizeof(*merged));
+    if (!merged) {
+        return -1;
+    }
+    qsort(g_meta.pending, g_meta.pending_count, sizeof(*g_meta.pending), compare_entries);
+
+    size_t i = 0;
+    size_t j = 0;
+    size_t n = 0;
+    while (i < g_meta.sorted_count || j < g_meta.pending_count) {
+        mc_meta_entry_t *entry;
+        if (j == g_meta.pending_count ||
+            (i < g_meta.sorted_count && strcmp(g_meta.sorted[i]->name, g_meta.pending[j]->name) < 0)) {
+            entry = g_meta.sorted[i++];
+        } else {
+            entry = g_meta.pending[j++];
+        }
+        if (entry->removed) {
+            free(entry);
+        } else {
+            merged[n++] = entry;
+        }
+    }
+    free(g_meta.sorted);
+    g_meta.sorted = merged;
+    g_meta.sorted_count = n;
+    g_meta.pending_count = 0;
+    g_meta.removed = 0;
+    return 0;
+}
+
+static void apply_record(const mc_meta_record_t *record, const char *name) {
+    if (record->op == MC_META_OP_GENERATION) {
+        if (g_meta.records == 0) {
+            g_meta.generation = record->size;
+        } else {
+            g_meta.retired = true;
+        }
+        return;
+    }
+    if (record->name_len == 0 || record->name_len > MC_MAX_FILENAME_LEN) {
+        return;
+    }
+    if (record->op == MC_META_OP_PUT) {
+        mc_meta_info_t info = {.size = record->size, .mtime = record->mtime, .has_digest = record->has_digest != 0};
+        memcpy(info.digest, record->digest, sizeof(info.digest));
+        (void)apply_put(name, record->name_len, &info);
+    } else if (record->op == MC_META_OP_DELETE) {
+        apply_delete(name, record->name_len);
+    }
+}
+
+/*
+ * Applies complete records past g_meta.applied, stopping after a retire
+ * record; one still being appended waits for the next call.
+ */
+static void read_records_locked(void) {
+    struct stat st;
+    if (g_meta.fd == -1 || fstat(g_meta.fd, &st) == -1) { /* fstat() 시스템 콜로 새 기록 확인 */
+        return;
+    }
+    if (st.st_nlink == 0) {
+        g_meta.retired = true; /* replaced even if its retire record could not be written */
+    }
+    if ((uint64_t)st.st_size <= g_meta.applied) {
+        return;
+    }
+    uint64_t end = (uint64_t)st.st_size;
+    uint8_t *buf = malloc(MC_META_READ_CHUNK);
+    if (!buf) {
+        return;
+    }
+    while (g_meta.applied < end && !g_meta.retired) {
+        size_t want = end - g_meta.applied < MC_META_READ_CHUNK ? (size_t)(end - g_meta.applied) : MC_META_READ_CHUNK;
+        ssize_t got = pread(g_meta.fd, buf, want, (off_t)g_meta.applied); /* pread() 시스템 콜로 저널 읽기 */
+        if (got <= 0) {
+            break;
+        }
+        size_t off = 0;
+        while (off + sizeof(mc_meta_record_t) <= (size_t)got) {
+            mc_meta_record_t record;
+            memcpy(&record, buf + off, sizeof(record));
+            size_t len = sizeof(record) + record.name_len;
+            if (off + len > (size_t)got) {
+                break;
+            }
+            apply_record(&record, (const char *)buf + off + sizeof(record));
+            ++g_meta.records;
+            off += len;
+            if (g_meta.retired) {
+                break;
+            }
+        }
+        if (off == 0) {
+            break;
+        }
+        g_meta.applied += off;
+    }
+    free(buf);
+}
+
+/* Frees every entry, leaving an empty index on the same journal. */
+static void clear_entries_locked(void) {
+    /* removed entries are only reachable from the order arrays; checked before the live ones go */
+    for (size_t i = 0; i < g_meta.sorted_count; ++i) {
+        if (g_meta.sorted[i]->removed) {
+            free(g_meta.sorted[i]);
+        }
+    }
+    for (size_t i = 0; i < g_meta.pending_count; ++i) {
+        if (g_meta.pending[i]->removed) {
+            free(g_meta.pending[i]);
+        }
+    }
+    for (size_t i = 0; i < g_meta.bucket_count; ++i) {
+        mc_meta_entry_t *entry = g_meta.buckets[i];
+        while (entry) {
+            mc_meta_entry_t *next = entry->next;
+            free(entry);
+            entry = next;
+        }
+    }
+    free(g_meta.buckets);
+    free(g_meta.sorted);
+    free(g_meta.pending);
+    g_meta.buckets = NULL;
+    g_meta.bucket_count = 0;
+    g_meta.count = 0;
+    g_meta.sorted = NULL;
+    g_meta.sorted_count = 0;
+    g_meta.pending = NULL;
+    g_meta.pending_count = 0;
+    g_meta.pending_cap = 0;
+    g_meta.removed = 0;
+}
+
+static void reset_locked(void) {
+    clear_entries_locked();
+    if (g_meta.fd != -1) {
+        close(g_meta.fd);
+    }
+    g_meta.enabled = false;
+    g_meta.fd = -1;
+    g_meta.applied = 0;
+    g_meta.records = 0;
+    g_meta.generation = 0;
+    g_meta.retired = false;
+}
+
+/*
+ * The journal was rewritten by another process: drop the index and replay
+ * the new journal from the start. Closing the retired descriptor also drops
+ * any fcntl() lock this process held on it. On failure the index is off.
+ */
+static void reload_locked(void) {
+    char magic[sizeof(MC_META_MAGIC) - 1];
+    int fd = open(g_meta.path, O_RDWR | O_APPEND | O_CLOEXEC); /* open() 시스템 콜로 새 세대의 저널 열기 */
+    if (fd == -1 || pread(fd, magic, sizeof(magic), 0) != (ssize_t)sizeof(magic) ||
+        memcmp(magic, MC_META_MAGIC, sizeof(magic)) != 0) {
+        if (fd != -1) {
+            close(fd);
+        }
+        reset_locked();
+        return;
+    }
+    clear_entries_locked();
+    close(g_meta.fd);
+    g_meta.fd = fd;
+    g_meta.applied = sizeof(magic);
+    g_meta.records = 0;
+    g_meta.retired = false;
+    if (grow_buckets() != 0) {
+        reset_locked();
+    }
+}
+
+/* Applies what other processes appended, following the journal across rewrites. */
+static void catch_up_locked(void) {
+    read_records_locked();
+    while (g_meta.retired && g_meta.fd != -1) {
+        reload_locked();
+        read_records_locked();
+    }
+}
+
+int mc_meta_open(const char *journal_path, bool replay) {
+    pthread_mutex_lock(&g_meta.lock);
+    reset_locked();
+    int written = snprintf(g_meta.path, sizeof(g_meta.path), "%s", journal_path);
+    if (written < 0 || (size_t)written >= sizeof(g_meta.path) || grow_buckets() != 0) {
+        pthread_mutex_unlock(&g_meta.lock);
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    int rc = 0;
+    if (replay) {
+        char magic[sizeof(MC_META_MAGIC) - 1];
+        g_meta.fd = open(journal_path, O_RDONLY | O_CLOEXEC); /* open() 시스템 콜로 저장된 저널 열기 */
+        if (g_meta.fd != -1 && pread(g_meta.fd, magic, sizeof(magic), 0) == (ssize_t)sizeof(magic) &&
+            memcmp(magic, MC_META_MAGIC, sizeof(magic)) == 0) {
+            g_meta.applied = sizeof(magic);
+            catch_up_locked();
+            rc = 1;
+        }
+        if (g_meta.fd != -1) {
+            close(g_meta.fd);
+            g_meta.fd = -1;
+        }
+    }
+    pthread_mutex_unlock(&g_meta.lock);
+    return rc;
+}
+
+int mc_meta_seed(const char *name, const mc_meta_info_t *info) {
+    pthread_mutex_lock(&g_meta.lock);
+    int rc = apply_put(name, strlen(name), info);
+    pthread_mutex_unlock(&g_meta.lock);
+    return rc;
+}
+
+static void fill_record(mc_meta_record_t *record, uint8_t op, const char *name, const mc_meta_info_t *info) {
+    memset(record, 0, sizeof(*record));
+    record->op = op;
+    record->name_len = (uint16_t)strlen(name);
+    if (info) {
+        record->size = info->size;
+        record->mtime = info->mtime;
+        record->has_digest = info->has_digest ? 1 : 0;
+        memcpy(record->digest, info->digest, sizeof(record->digest));
+    }
+}
+
+static void fill_generation(mc_meta_record_t *record, uint64_t generation) {
+    memset(record, 0, sizeof(*record));
+    record->op = MC_META_OP_GENERATION;
+    record->size = generation;
+}
+
+/*
+ * Writes the index as journal generation to a temporary file and renames it
+ * over the journal; *length is the snapshot's size. -1 with errno.
+ */
+static int write_snapshot_locked(uint64_t generation, uint64_t *length) {
+    char tmp[PATH_MAX + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", g_meta.path);
+    FILE *out = NULL;
+    mc_meta_record_t record;
+    int rc = merge_locked();
+    if (rc == 0) {
+        out = fopen(tmp, "we"); /* fopen()으로 새 저널 작성 (버퍼링된 write()) */
+        rc = out ? 0 : -1;
+    }
+    fill_generation(&record, generation);
+    if (rc == 0 && (fwrite(MC_META_MAGIC, 1, sizeof(MC_META_MAGIC) - 1, out) != sizeof(MC_META_MAGIC) - 1 ||
+                    fwrite(&record, sizeof(record), 1, out) != 1)) {
+        rc = -1;
+    }
+    for (size_t i = 0; rc == 0 && i < g_meta.sorted_count; ++i) {
+        fill_record(&record, MC_META_OP_PUT, g_meta.sorted[i]->name, &g_meta.sorted[i]->info);
+        if (fwrite(&record, sizeof(record), 1, out) != 1 ||
+            fwrite(g_meta.sorted[i]->name, 1, record.name_len, out) != record.name_len) {
+            rc = -1;
+        }
+    }
+    long written = out ? ftell(out) : -1;
+    if (out && fclose(out) != 0) {
+        rc = -1;
+    }
+    if (rc == 0 && rename(tmp, g_meta.path) == -1) { /* rename() 시스템 콜로 저널 교체 */
+        rc = -1;
+    }
+    if (rc != 0) {
+        int saved = errno;
+        unlink(tmp);
+        errno = saved;
+        return -1;
+    }
+    *length = (uint64_t)written;
+    return 0;
+}
+
+int mc_meta_commit(void) {
+    pthread_mutex_lock(&g_meta.lock);
+    uint64_t length = 0;
+    int rc = write_snapshot_locked(g_meta.generation + 1, &length);
+    if (rc == 0) {
+        g_meta.fd = open(g_meta.path, O_RDWR | O_APPEND | O_CLOEXEC); /* open() 시스템 콜로 저널 열기 (추가 전용) */
+        rc = g_meta.fd == -1 ? -1 : 0;
+    }
+    if (rc == 0) {
+        g_meta.generation++;
+        g_meta.applied = length;
+        g_meta.records = 1 + g_meta.count;
+        g_meta.enabled = true;
+    } else {
+        int saved = errno;
+        reset_locked();
+        errno = saved;
+    }
+    pthread_mutex_unlock(&g_meta.lock);
+    return rc;
+}
+
+bool mc_meta_enabled(void) {
+    pthread_mutex_lock(&g_meta.lock);
+    bool enabled = g_meta.enabled;
+    pthread_mutex_unlock(&g_meta.lock);
+    return enabled;
+}
+
+size_t mc_meta_count(void) {
+    pthread_mutex_lock(&g_meta.lock);
+    size_t count = g_meta.count;
+    pthread_mutex_unlock(&g_meta.lock);
+    return count;
+}
+
+void mc_meta_refresh(void) {
+    pthread_mutex_lock(&g_meta.lock);
+    if (g_meta.enabled) {
+        catch_up_locked();
+    }
+    pthread_mutex_unlock(&g_meta.lock);
+}
+
+/* fcntl() record lock over the whole journal: per process, so forked children never share one. */
+static int lock_journal(int fd, short type, bool wait) {
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+    int rc;
+    do {
+        rc = fcntl(fd, wait ? F_SETLKW : F_SETLK, &lock); /* fcntl() 시스템 콜로 저널 잠금 */
+    } while (rc == -1 && errno == EINTR);
+    return rc;
+}
+
+/*
+ * Rewrites the journal as a snapshot of the index, under an exclusive lock
+ * that fails at once while anyone is appending (a later write tries again).
+ * Other processes pick the new journal up from the retire record.
+ */
+static void compact_locked(void) {
+    int old_fd = g_meta.fd;
+    if (lock_journal(old_fd, F_WRLCK, false) == -1) {
+        return;
+    }
+    catch_up_locked();
+    if (!g_meta.enabled || g_meta.fd != old_fd) {
+        return; /* rewritten by someone else meanwhile; closing the old journal released the lock */
+    }
+    uint64_t generation = g_meta.generation + 1;
+    uint64_t length = 0;
+    if (write_snapshot_locked(generation, &length) != 0) {
+        lock_journal(old_fd, F_UNLCK, false);
+        return;
+    }
+    /* readers of the old journal reload on this record (or, should it fail, on the journal having no link) */
+    mc_meta_record_t record;
+    fill_generation(&record, generation);
+    ssize_t retired = write(old_fd, &record, sizeof(record)); /* write() 시스템 콜로 옛 저널에 세대 교체 기록 */
+    (void)retired;
+
+    int fd = open(g_meta.path, O_RDWR | O_APPEND | O_CLOEXEC); /* open() 시스템 콜로 새 저널 열기 (추가 전용) */
+    if (fd == -1) {
+        g_meta.retired = true; /* the next catch-up reloads, or turns the index off */
+        lock_journal(old_fd, F_UNLCK, false);
+        return;
+    }
+    close(old_fd); /* close() 시스템 콜로 옛 저널 닫기 (잠금도 풀림) */
+    g_meta.fd = fd;
+    g_meta.generation = generation;
+    /* records appended since the snapshot (by processes already on it) are read next */
+    g_meta.applied = length;
+    g_meta.records = 1 + g_meta.count;
+    catch_up_locked();
+}
+
+/*
+ * One write() per record: O_APPEND keeps concurrent writers' records whole
+ * and ordered. The shared lock keeps a rewrite from snapshotting mid-append;
+ * a writer that was waiting on a journal that got rewritten retries on the
+ * new one.
+ */
+static int journal(uint8_t op, const char *name, const mc_meta_info_t *info) {
+    uint8_t buf[sizeof(mc_meta_record_t) + MC_MAX_FILENAME_LEN];
+    mc_meta_record_t record;
+    size_t name_len = strlen(name);
+    if (name_len == 0 || name_len > MC_MAX_FILENAME_LEN) {
+        errno = EINVAL;
+        return -1;
+    }
+    fill_record(&record, op, name, info);
+    memcpy(buf, &record, sizeof(record));
+    memcpy(buf + sizeof(record), name, name_len);
+
+    pthread_mutex_lock(&g_meta.lock);
+    int rc = 0;
+    while (g_meta.enabled) {
+        int fd = g_meta.fd;
+        if (lock_journal(fd, F_RDLCK, true) == -1) {
+            rc = -1;
+            break;
+        }
+        catch_up_locked();
+        if (g_meta.fd != fd) {
+            continue; /* rewritten while waiting (or turned off) */
+        }
+        ssize_t written = write(fd, buf, sizeof(record) + name_len); /* write() 시스템 콜로 저널에 추가 */
+        rc = written == (ssize_t)(sizeof(record) + name_len) ? 0 : -1;
+        lock_journal(fd, F_UNLCK, false);
+        catch_up_locked();
+        if (g_meta.enabled && g_meta.records > MC_META_COMPACT_MIN &&
+            g_meta.records > MC_META_COMPACT_FACTOR * (uint64_t)g_meta.count) {
+            compact_locked();
+        }
+        break;
+    }
+    pthread_mutex_unlock(&g_meta.lock);
+    return rc;
+}
+
+int mc_meta_put(const char *name, const mc_meta_info_t *info) {
+    return journal(MC_META_OP_PUT, name, info);
+}
+
+int mc_meta_remove(const char *name) {
+    return journal(MC_META_OP_DELETE, name, NULL);
+}
+
+int mc_meta_get(const char *name, mc_meta_info_t *out) {
+    pthread_mutex_lock(&g_meta.lock);
+    int rc = 0;
+    if (g_meta.enabled) {
+        catch_up_locked();
+        mc_meta_entry_t **slot = find_slot(name, strlen(name));
+        if (*slot) {
+            *out = (*slot)->info;
+            rc = 1;
+        }
+    }
+    pthread_mutex_unlock(&g_meta.lock);
+    return rc;
+}
+
+static size_t format_u64(char *out, uint64_t value) {
+    char digits[20];
+    size_t n = 0;
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = digits[n - 1 - i];
+    }
+    return n;
+}
+
+int mc_meta_list(bool with_sizes, char **out, size_t *out_len) {
+    pthread_mutex_lock(&g_meta.lock);
+    catch_up_locked();
+    if (merge_locked() != 0) {
+        pthread_mutex_unlock(&g_meta.lock);
+        return -1;
+    }
+
+    /* sized once up front: one allocation however many names there are */
+    size_t cap = sizeof("(empty)\n");
+    for (size_t i = 0; i < g_meta.sorted_count; ++i) {
+        cap += strlen(g_meta.sorted[i]->name) + 1 + (with_sizes ? 21 : 0);
+    }
+    char *buf = malloc(cap);
+    if (!buf) {
+        pthread_mutex_unlock(&g_meta.lock);
+        return -1;
+    }
+    size_t used = 0;
+    for (size_t i = 0; i < g_meta.sorted_count; ++i) {
+        const mc_meta_entry_t *entry = g_meta.sorted[i];
+        size_t len = strlen(entry->name);
+        memcpy(buf + used, entry->name, len);
+        used += len;
+        if (with_sizes) {
+            buf[used++] = '\t';
+            used += format_u64(buf + used, entry->info.size);
+        }
+        buf[used++] = '\n';
+    }
+    pthread_mutex_unlock(&g_meta.lock);
+
+    if (used == 0) {
+        memcpy(buf, "(empty)\n", sizeof("(empty)\n"));
+        used = sizeof("(empty)\n") - 1;
+    }
+    *out = buf;
+    *out_len = used;
+    return 0;
+}
+
+/*
+ * LIST_QUERY. Every order is total (ties go by name), so a cursor is just
+ * the sort key of the last record sent and a page is whatever sorts after it.
+ */
+typedef struct {
+    mc_list_sort_t sort;
+    const char *pattern; /* NULL: every name */
+    size_t prefix_len;   /* the pattern's leading literal part */
+    size_t limit;
+    bool has_cursor;
+    mc_meta_item_t cursor;
+    char cursor_name[MC_MAX_FILENAME_LEN + 1];
+} page_plan_t;
+
+static int compare_name(const mc_meta_item_t *a, const mc_meta_item_t *b) {
+    return strcmp(a->name, b->name);
+}
+
+static int compare_name_desc(const mc_meta_item_t *a, const mc_meta_item_t *b) {
+    return strcmp(b->name, a->name);
+}
+
+static int compare_size_desc(const mc_meta_item_t *a, const mc_meta_item_t *b) {
+    if (a->info.size != b->info.size) {
+        return a->info.size > b->info.size ? -1 : 1;
+    }
+    return strcmp(a->name, b->name);
+}
+
+static int compare_size(const mc_meta_item_t *a, const mc_meta_item_t *b) {
+    if (a->info.size != b->info.size) {
+        return a->info.size < b->info.size ? -1 : 1;
+    }
+    return strcmp(a->name, b->name);
+}
+
+static int compare_mtime_desc(const mc_meta_item_t *a, const mc_meta_item_t *b) {
+    if (a->info.mtime != b->info.mtime) {
+        return a->info.mtime > b->info.mtime ? -1 : 1;
+    }
+    return strcmp(a->name, b->name);
+}
+
+typedef int (*item_compare_fn)(const mc_meta_item_t *a, const mc_meta_item_t *b);
+
+/* indexed by mc_list_sort_t */
+static const item_compare_fn g_item_compare[] = {
+    compare_name, compare_name_desc, compare_size_desc, compare_size, compare_mtime_desc,
+};
+
+#define MC_LIST_SORT_COUNT (sizeof(g_item_compare) / sizeof(g_item_compare[0]))
+
+static int qsort_name(const void *a, const void *b) {
+    return compare_name(a, b);
+}
+
+static int qsort_name_desc(const void *a, const void *b) {
+    return compare_name_desc(a, b);
+}
+
+static int qsort_size_desc(const void *a, const void *b) {
+    return compare_size_desc(a, b);
+}
+
+static int qsort_size(const void *a, const void *b) {
+    return compare_size(a, b);
+}
+
+static int qsort_mtime_desc(const void *a, const void *b) {
+    return compare_mtime_desc(a, b);
+}
+
+static int (*const g_item_qsort[])(const void *, const void *) = {
+    qsort_name, qsort_name_desc, qsort_size_desc, qsort_size, qsort_mtime_desc,
+};
+
+static bool sorts_by_name(mc_list_sort_t sort) {
+    return sort == MC_LIST_SORT_NAME || sort == MC_LIST_SORT_NAME_DESC;
+}
+
+static int plan_page(const char *pattern, const mc_list_query_t *query, page_plan_t *plan) {
+    memset(plan, 0, sizeof(*plan));
+    if (query->sort >= MC_LIST_SORT_COUNT || query->cursor_len > MC_LIST_CURSOR_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    plan->sort = (mc_list_sort_t)query->sort;
+    plan->limit = query->limit == 0 ? MC_LIST_PAGE_DEFAULT
+                  : query->limit > MC_LIST_PAGE_MAX ? MC_LIST_PAGE_MAX
+                                                    : query->limit;
+    if (pattern && *pattern) {
+        plan->pattern = pattern;
+        plan->prefix_len = strcspn(pattern, "*?[\\");
+    }
+    if (query->cursor_len == 0) {
+        return 0;
+    }
+
+    /* name sorts: the name itself; the others: "<key>/<name>" */
+    char text[MC_LIST_CURSOR_MAX + 1];
+    memcpy(text, query->cursor, query->cursor_len);
+    text[query->cursor_len] = '\0';
+    const char *name = text;
+    if (!sorts_by_name(plan->sort)) {
+        char *end = NULL;
+        errno = 0;
+        if (plan->sort == MC_LIST_SORT_MTIME_DESC) {
+            plan->cursor.info.mtime = (int64_t)strtoll(text, &end, 10);
+        } else {
+            plan->cursor.info.size = (uint64_t)strtoull(text, &end, 10);
+        }
+        if (errno != 0 || end == text || *end != '/') {
+            errno = EINVAL;
+            return -1;
+        }
+        name = end + 1;
+    }
+    size_t len = strlen(name);
+    if (len == 0 || len > MC_MAX_FILENAME_LEN) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(plan->cursor_name, name, len + 1);
+    plan->cursor.name = plan->cursor_name;
+    plan->has_cursor = true;
+    return 0;
+}
+
+static bool plan_matches(const page_plan_t *plan, const mc_meta_item_t *item) {
+    if (plan->pattern && fnmatch(plan->pattern, item->name, 0) != 0) {
+        return false;
+    }
+    return !plan->has_cursor || g_item_compare[plan->sort](item, &plan->cursor) > 0;
+}
+
+/* Encodes the first plan->limit of count matching items, already in order. */
+static int encode_page(const page_plan_t *plan, const mc_meta_item_t *items, size_t count, uint8_t **out, size_t *out_len) {
+    size_t take = count < plan->limit ? count : plan->limit;
+    char cursor[MC_LIST_CURSOR_MAX + 1] = "";
+    int cursor_len = 0;
+    if (count > take) {
+        const mc_meta_item_t *last = &items[take - 1];
+        if (sorts_by_name(plan->sort)) {
+            cursor_len = snprintf(cursor, sizeof(cursor), "%s", last->name);
+        } else if (plan->sort == MC_LIST_SORT_MTIME_DESC) {
+            cursor_len = snprintf(cursor, sizeof(cursor), "%" PRId64 "/%s", last->info.mtime, last->name);
+        } else {
+            cursor_len = snprintf(cursor, sizeof(cursor), "%" PRIu64 "/%s", last->info.size, last->name);
+        }
+    }
+
+    size_t bytes = sizeof(mc_list_page_t) + (size_t)cursor_len;
+    for (size_t i = 0; i < take; ++i) {
+        bytes += sizeof(mc_list_record_t) + strlen(items[i].name);
+    }
+    uint8_t *buf = malloc(bytes);
+    if (!buf) {
+        return -1;
+    }
+    mc_list_page_t page = {.count = (uint32_t)take, .cursor_len = (uint16_t)cursor_len};
+    mc_list_page_host_to_network(&page);
+    memcpy(buf, &page, sizeof(page));
+    memcpy(buf + sizeof(page), cursor, (size_t)cursor_len);
+    size_t used = sizeof(page) + (size_t)cursor_len;
+    for (size_t i = 0; i < take; ++i) {
+        mc_list_record_t record;
+        size_t name_len = strlen(items[i].name);
+        memset(&record, 0, sizeof(record));
+        record.size = items[i].info.size;
+        record.mtime = items[i].info.mtime;
+        record.name_len = (uint16_t)name_len;
+        if (items[i].info.has_digest) {
+            record.flags = MC_LIST_HAS_DIGEST;
+            memcpy(record.sha256, items[i].info.digest, sizeof(record.sha256));
+        }
+        mc_list_record_host_to_network(&record);
+        memcpy(buf + used, &record, sizeof(record));
+        memcpy(buf + used + sizeof(record), items[i].name, name_len);
+        used += sizeof(record) + name_len;
+    }
+    *out = buf;
+    *out_len = used;
+    return 0;
+}
+
+/* Moves the matching items to the front (swapping, so none is lost), orders them and encodes the page. */
+static int select_page(const page_plan_t *plan, mc_meta_item_t *items, size_t count, uint8_t **out, size_t *out_len) {
+    size_t kept = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (plan_matches(plan, &items[i])) {
+            mc_meta_item_t tmp = items[kept];
+            items[kept++] = items[i];
+            items[i] = tmp;
+        }
+    }
+    qsort(items, kept, sizeof(*items), g_item_qsort[plan->sort]);
+    return encode_page(plan, items, kept, out, out_len);
+}
+
+int mc_meta_page(mc_meta_item_t *items,
+                 size_t count,
+                 const char *pattern,
+                 const mc_list_query_t *query,
+                 uint8_t **out,
+                 size_t *out_len) {
+    page_plan_t plan;
+    if (plan_page(pattern, query, &plan) != 0) {
+        return -1;
+    }
+    return select_page(&plan, items, count, out, out_len);
+}
+
+/* First sorted position whose name compares above key (or equal, with inclusive) over len bytes. */
+static size_t bound_locked(const char *key, size_t len, bool inclusive) {
+    size_t lo = 0;
+    size_t hi = g_meta.sorted_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strncmp(g_meta.sorted[mid]->name, key, len);
+        if (cmp > 0 || (inclusive && cmp == 0)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+static void item_from_entry(mc_meta_item_t *item, const mc_meta_entry_t *entry) {
+    item->name = entry->name;
+    item->info = entry->info;
+}
+
+int mc_meta_query(const char *pattern, const mc_list_query_t *query, uint8_t **out, size_t *out_len) {
+    page_plan_t plan;
+    if (plan_page(pattern, query, &plan) != 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_meta.lock);
+    catch_up_locked();
+    if (merge_locked() != 0) {
+        pthread_mutex_unlock(&g_meta.lock);
+        return -1;
+    }
+    /* names sharing the pattern's literal prefix sit together in sorted order */
+    size_t lo = 0;
+    size_t hi = g_meta.sorted_count;
+    if (plan.prefix_len > 0) {
+        lo = bound_locked(plan.pattern, plan.prefix_len, true);
+        hi = bound_locked(plan.pattern, plan.prefix_len, false);
+    }
+
+    int rc;
+    if (sorts_by_name(plan.sort)) {
+        /* already in order: seek to the cursor and stop one past the page */
+        bool desc = plan.sort == MC_LIST_SORT_NAME_DESC;
+        if (plan.has_cursor && !desc) {
+            size_t after = bound_locked(plan.cursor_name, SIZE_MAX, false);
+            lo = after > lo ? after : lo;
+        } else if (plan.has_cursor) {
+            size_t before = bound_locked(plan.cursor_name, SIZE_MAX, true);
+            hi = before < hi ? before : hi;
+        }
+        /* a cursor outside the prefix range leaves nothing to list, not a negative span */
+        if (hi < lo) {
+            hi = lo;
+        }
+        mc_meta_item_t *items = malloc((plan.limit + 1) * sizeof(*items));
+        size_t count = 0;
+        for (size_t i = 0; items && i < hi - lo && count <= plan.limit; ++i) {
+            const mc_meta_entry_t *entry = g_meta.sorted[desc ? hi - 1 - i : lo + i];
+            if (!plan.pattern || fnmatch(plan.pattern, entry->name, 0) == 0) {
+                item_from_entry(&items[count++], entry);
+            }
+        }
+        rc = items ? encode_page(&plan, items, count, out, out_len) : -1;
+        free(items);
+    } else {
+        mc_meta_item_t *items = malloc((hi - lo + 1) * sizeof(*items));
+        for (size_t i = lo; items && i < hi; ++i) {
+            item_from_entry(&items[i - lo], g_meta.sorted[i]);
+        }
+        rc = items ? select_page(&plan, items, hi - lo, out, out_len) : -1;
+        free(items);
+    }
+    pthread_mutex_unlock(&g_meta.lock);
+    return rc;
+}
@@ -1,15 +1,24 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 
 #include "mc_server.h"
+#include "mc_archive.h"
+#include "mc_cache.h"
+#include "mc_chunkstore.h"
+#include "mc_crc32c.h"
+#include "mc_meta.h"
+#include "mc_lz4.h"
+#include "mc_mux.h"
 #include "mc_protocol.h"
+#include "mc_server_internal.h"
+#include "mc_storage.h"
 
 #include <arpa/inet.h>
-#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <limits.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdarg.h>
@@ -17,81 +26,53 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
-#define MC_STORAGE_PATH_MAX PATH_MAX
-#define MC_MAX_AUTH_TOKEN_LEN 256
+/* Upper bound per sendfile() call so a huge file still yields to EINTR checks. */
+#define MC_SENDFILE_CHUNK (1U << 20)
 
-static volatile sig_atomic_t g_should_terminate = 0;
-
-static int is_safe_filename(const char *name) {
-    if (!name || !*name) {
-        return 0;
-    }
-    if (strstr(name, "..")) {
-        return 0;
-    }
-    if (strchr(name, '/')) {
-        return 0;
-    }
-    return 1;
-}
+/* Read/send buffer for payloads that pass through user space (checksummed, compressed or no splice). */
+#define MC_COPY_CHUNK (64 * 1024)
 
-static int build_storage_path(const mc_server_config_t *config,
-                              const char *filename,
-                              char *out,
-                              size_t out_len) {
-    if (!config || !filename || !out) {
-        errno = EINVAL;
-        return -1;
-    }
+/* Exit status a worker uses when its SO_REUSEPORT listener cannot be bound. */
+#define MC_WORKER_EXIT_LISTEN 3
 
-    int written = snprintf(out, out_len, "%s/%s", config->storage_dir, filename);
-    if (written < 0 || (size_t)written >= out_len) {
-        errno = ENAMETOOLONG;
-        return -1;
-    }
-    return 0;
-}
+static volatile sig_atomic_t g_should_terminate = 0;
 
-static int send_message(int fd, mc_command_t cmd, const char *filename, const char *payload) {
+static int send_message(int fd,
+                        const mc_packet_header_t *request,
+                        mc_command_t cmd,
+                        const char *filename,
+                        const char *payload) {
     const char *msg = payload ? payload : "";
     size_t len = strlen(msg);
     mc_packet_header_t header;
-    if (mc_build_header(&header, cmd, filename, (uint64_t)len) != 0) {
-        return -1;
-    }
-    if (mc_send_header(fd, &header) != 0) {
+    if (mc_build_reply_header(&header, request, cmd, filename, (uint64_t)len) != 0) {
         return -1;
     }
-    if (filename && filename[0]) {
-        if (mc_send_all(fd, filename, strlen(filename)) != (ssize_t)strlen(filename)) {
-            return -1;
-        }
-    }
-    if (len > 0) {
-        if (mc_send_all(fd, msg, len) != (ssize_t)len) {
-            return -1;
-        }
-    }
-    return 0;
+    return mc_send_packet(fd, &header, filename, msg, len, false);
 }
 
-static int send_errorf(int fd, const char *fmt, ...) {
+static int send_errorf(int fd, const mc_packet_header_t *request, const char *fmt, ...) {
     char buffer[512];
     va_list ap;
     va_start(ap, fmt);
     vsnprintf(buffer, sizeof(buffer), fmt, ap);
     va_end(ap);
-    return send_message(fd, MC_CMD_ERROR, NULL, buffer);
+    return send_message(fd, request, MC_CMD_ERROR, NULL, buffer);
 }
 
-static int receive_payload_to_fd(int src_fd, uint64_t total_bytes, int dest_fd) {
-    uint8_t buffer[4096];
+/* Copies the payload through user space; crc, when given, accumulates its CRC32C. */
+static int receive_payload_buffered(int src_fd, uint64_t total_bytes, int dest_fd, uint32_t *crc) {
+    uint8_t buffer[MC_COPY_CHUNK];
     uint64_t remaining = total_bytes;
     while (remaining > 0) {
         size_t chunk = remaining > sizeof(buffer) ? sizeof(buffer) : (size_t)remaining;
@@ -99,6 +80,9 @@ static int receive_payload_to_fd(int src_fd, uint64_t total_bytes, int dest_fd)
         if (read_bytes != (ssize_t)chunk) {
             return -1;
         }
+        if (crc) {
+            *crc = mc_crc32c_update(*crc, buffer, chunk);
+        }
         ssize_t written = write(dest_fd, buffer, read_bytes); /* write() 시스템 콜로 파일 저장 */
         if (written != read_bytes) {
             return -1;
@@ -108,8 +92,109 @@ static int receive_payload_to_fd(int src_fd, uint64_t total_bytes, int dest_fd)
     return 0;
 }
 
-static int send_file_contents(int fd, int file_fd, uint64_t total_bytes) {
-    uint8_t buffer[4096];
+int mc_server_open_splice_pipe(int pipe_fds[2]) {
+    if (pipe2(pipe_fds, O_CLOEXEC) == -1) { /* pipe2() 시스템 콜로 splice 중계 파이프 생성 */
+        pipe_fds[0] = -1;
+        pipe_fds[1] = -1;
+        return -1;
+    }
+    /* best effort: a larger pipe means fewer splice round trips */
+    (void)fcntl(pipe_fds[1], F_SETPIPE_SZ, MC_SPLICE_PIPE_SIZE); /* fcntl() 시스템 콜로 파이프 용량 확장 */
+    return 0;
+}
+
+void mc_server_close_splice_pipe(int pipe_fds[2]) {
+    for (int i = 0; i < 2; ++i) {
+        if (pipe_fds[i] != -1) {
+            close(pipe_fds[i]);
+            pipe_fds[i] = -1;
+        }
+    }
+}
+
+ssize_t mc_server_splice_to_file(int sock_fd,
+                                 const int pipe_fds[2],
+                                 int file_fd,
+                                 size_t len,
+                                 bool nonblock,
+                                 bool *file_failed) {
+    unsigned int flags = SPLICE_F_MOVE | SPLICE_F_MORE | (nonblock ? SPLICE_F_NONBLOCK : 0U);
+    ssize_t moved;
+    do {
+        moved = splice(sock_fd, NULL, pipe_fds[1], NULL, len, flags); /* splice() 시스템 콜로 소켓 -> 파이프 */
+    } while (moved < 0 && errno == EINTR);
+    if (moved <= 0) {
+        return moved;
+    }
+
+    size_t pending = (size_t)moved;
+    while (pending > 0 && !*file_failed) {
+        ssize_t out = splice(pipe_fds[0], NULL, file_fd, NULL, pending, SPLICE_F_MOVE); /* splice() 시스템 콜로 파이프 -> 파일 */
+        if (out < 0 && errno == EINTR) {
+            continue;
+        }
+        if (out <= 0) {
+            *file_failed = true;
+            break;
+        }
+        pending -= (size_t)out;
+    }
+
+    /* The socket bytes are consumed either way; empty the pipe so the next
+     * request does not see stale payload. */
+    uint8_t scratch[4096];
+    while (pending > 0) {
+        size_t chunk = pending > sizeof(scratch) ? sizeof(scratch) : pending;
+        ssize_t dropped = read(pipe_fds[0], scratch, chunk);
+        if (dropped < 0 && errno == EINTR) {
+            continue;
+        }
+        if (dropped <= 0) {
+            return -1;
+        }
+        pending -= (size_t)dropped;
+    }
+    return moved;
+}
+
+/*
+ * Moves the upload payload from the socket into the temp file with splice()
+ * through a pipe, so the bytes never enter user space. Falls back to the
+ * buffered loop when splice() is unavailable for this socket/file pair.
+ */
+static int receive_payload_to_fd(int src_fd, uint64_t total_bytes, int dest_fd) {
+    if (total_bytes == 0) {
+        return 0;
+    }
+
+    int pipe_fds[2];
+    if (mc_server_open_splice_pipe(pipe_fds) != 0) {
+        return receive_payload_buffered(src_fd, total_bytes, dest_fd, NULL);
+    }
+
+    uint64_t remaining = total_bytes;
+    bool file_failed = false;
+    int rc = 0;
+    while (remaining > 0) {
+        size_t chunk = remaining > MC_SPLICE_PIPE_SIZE ? MC_SPLICE_PIPE_SIZE : (size_t)remaining;
+        ssize_t moved = mc_server_splice_to_file(src_fd, pipe_fds, dest_fd, chunk, false, &file_failed);
+        if (moved < 0 && (errno == EINVAL || errno == ENOSYS) && remaining == total_bytes) {
+            mc_server_close_splice_pipe(pipe_fds);
+            return receive_payload_buffered(src_fd, total_bytes, dest_fd, NULL);
+        }
+        if (moved <= 0 || file_failed) {
+            rc = -1;
+            break;
+        }
+        remaining -= (uint64_t)moved;
+    }
+
+    mc_server_close_splice_pipe(pipe_fds);
+    return rc;
+}
+
+static int send_file_buffered(int fd, int file_fd, uint64_t total_bytes, uint32_t *crc) {
+    uint8_t buffer[MC_COPY_CHUNK];
     uint64_t remaining = total_bytes;
     while (remaining > 0) {
         size_t chunk = remaining > sizeof(buffer) ? sizeof(buffer) : (size_t)remaining;
@@ -123,6 +208,9 @@ static int send_file_contents(int fd, int file_fd, uint64_t total_bytes) {
         if (read_bytes == 0) {
             break;
         }
+        if (crc) {
+            *crc = mc_crc32c_update(*crc, buffer, (size_t)read_bytes);
+        }
         if (mc_send_all(fd, buffer, (size_t)read_bytes) != read_bytes) {
             return -1;
         }
@@ -131,6 +219,421 @@ static int send_file_contents(int fd, int file_fd, uint64_t total_bytes) {
     return remaining == 0 ? 0 : -1;
 }
 
+/*
+ * Streams the file with sendfile() so the bytes go from the page cache to the
+ * socket without a trip through user space. Falls back to the buffered loop
+ * when the kernel or file system cannot sendfile from this descriptor.
+ */
+static int send_file_contents(int fd, int file_fd, uint64_t total_bytes) {
+    uint64_t remaining = total_bytes;
+    while (remaining > 0) {
+        size_t chunk = remaining > MC_SENDFILE_CHUNK ? MC_SENDFILE_CHUNK : (size_t)remaining;
+        ssize_t sent = sendfile(fd, file_fd, NULL, chunk); /* sendfile() 시스템 콜로 커널 내 복사 전송 */
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno == EINVAL || errno == ENOSYS) && remaining == total_bytes) {
+                return send_file_buffered(fd, file_fd, total_bytes, NULL);
+            }
+            return -1;
+        }
+        if (sent == 0) {
+            break;
+        }
+        remaining -= (uint64_t)sent;
+    }
+    return remaining == 0 ? 0 : -1;
+}
+
+static int drain_payload(int fd, uint64_t remaining);
+
+/*
+ * Decodes an LZ4 block stream of wire_bytes into dest_fd. A stream that is
+ * malformed or decodes past limit sets *problem and is drained to its end.
+ */
+static int receive_payload_decoded(int src_fd,
+                                   uint64_t wire_bytes,
+                                   int dest_fd,
+                                   uint64_t limit,
+                                   uint32_t *crc,
+                                   int *problem) {
+    mc_lz4_decoder_t *dec = malloc(sizeof(*dec));
+    if (!dec) {
+        return -1;
+    }
+    mc_lz4_decoder_init(dec, limit);
+
+    uint64_t remaining = wire_bytes;
+    int rc = 0;
+    while (remaining > 0) {
+        size_t want = 0;
+        uint8_t *dst = mc_lz4_decoder_want(dec, &want);
+        if (want > remaining) {
+            want = (size_t)remaining;
+        }
+        if (mc_recv_all(src_fd, dst, want) != (ssize_t)want) {
+            rc = -1;
+            break;
+        }
+        remaining -= want;
+        int got = mc_lz4_decoder_received(dec, want);
+        if (got < 0) {
+            *problem = errno;
+            rc = drain_payload(src_fd, remaining);
+            break;
+        }
+        if (got == 1) {
+            *crc = mc_crc32c_update(*crc, dec->out, dec->out_len);
+            ssize_t written = write(dest_fd, dec->out, dec->out_len); /* write() 시스템 콜로 복원한 블록 저장 */
+            if (written != (ssize_t)dec->out_len) {
+                rc = -1;
+                break;
+            }
+        }
+    }
+    if (rc == 0 && *problem == 0 && !mc_lz4_decoder_idle(dec)) {
+        *problem = EPROTO; /* ended inside a block */
+    }
+    free(dec);
+    return rc;
+}
+
+/*
+ * Upload payload with checksums and/or compression on for the request
+ * (caps): the bytes have to be seen, so no splice. Reads the trailer too;
+ * *problem (see mc_server_body_error) reports a payload that arrived in
+ * full but is bad, with the stream still in step.
+ */
+static int receive_payload_checked(int src_fd,
+                                   uint64_t wire_bytes,
+                                   int dest_fd,
+                                   unsigned int caps,
+                                   uint64_t limit,
+                                   int *problem) {
+    uint32_t crc = 0;
+    uint32_t trailer = 0;
+    *problem = 0;
+    int rc = (caps & MC_AUTH_CAP_LZ4) ? receive_payload_decoded(src_fd, wire_bytes, dest_fd, limit, &crc, problem)
+                                      : receive_payload_buffered(src_fd, wire_bytes, dest_fd, &crc);
+    if (rc != 0) {
+        return -1;
+    }
+    if (caps & MC_AUTH_CAP_CRC32C) {
+        if (mc_recv_all(src_fd, &trailer, sizeof(trailer)) != (ssize_t)sizeof(trailer)) {
+            return -1;
+        }
+        if (*problem == 0 && ntohl(trailer) != crc) {
+            *problem = EBADMSG;
+        }
+    }
+    return 0;
+}
+
+/* Download body as LZ4 blocks of up to MC_LZ4_BLOCK_MAX file bytes each. */
+static int send_file_compressed(int fd, int file_fd, uint64_t total_bytes, uint32_t *crc) {
+    uint8_t buffer[MC_COPY_CHUNK];
+    mc_lz4_encoder_t *enc = malloc(sizeof(*enc));
+    uint8_t *wire = malloc(MC_LZ4_BLOCK_BOUND);
+    if (!enc || !wire) {
+        free(enc);
+        free(wire);
+        return -1;
+    }
+    mc_lz4_encoder_init(enc);
+
+    uint64_t remaining = total_bytes;
+    while (remaining > 0) {
+        size_t chunk = remaining > MC_LZ4_BLOCK_MAX ? MC_LZ4_BLOCK_MAX : (size_t)remaining;
+        ssize_t read_bytes = read(file_fd, buffer, chunk); /* read() 시스템 콜로 파일 읽기 */
+        if (read_bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (read_bytes <= 0) {
+            break;
+        }
+        *crc = mc_crc32c_update(*crc, buffer, (size_t)read_bytes);
+        size_t wire_len = mc_lz4_encode_block(enc, buffer, (size_t)read_bytes, wire);
+        if (mc_send_all(fd, wire, wire_len) != (ssize_t)wire_len) {
+            break;
+        }
+        remaining -= (uint64_t)read_bytes;
+    }
+    free(enc);
+    free(wire);
+    return remaining == 0 ? 0 : -1;
+}
+
+/* Download body with the reply's caps applied: compressed and/or hashed on the way out, trailer last. */
+static int send_file_checked(int fd, int file_fd, uint64_t total_bytes, unsigned int caps) {
+    uint32_t crc = 0;
+    int rc = (caps & MC_AUTH_CAP_LZ4) ? send_file_compressed(fd, file_fd, total_bytes, &crc)
+                                      : send_file_buffered(fd, file_fd, total_bytes, &crc);
+    if (rc != 0) {
+        return -1;
+    }
+    if (!(caps & MC_AUTH_CAP_CRC32C)) {
+        return 0;
+    }
+    uint32_t trailer = htonl(crc);
+    return mc_send_all(fd, &trailer, sizeof(trailer)) == (ssize_t)sizeof(trailer) ? 0 : -1;
+}
+
+size_t mc_server_range_prefix(const mc_packet_header_t *request, const mc_download_t *body, mc_range_if_t *out) {
+    if (request->command != MC_CMD_DOWNLOAD_RANGE) {
+        return 0;
+    }
+    out->offset = body->offset;
+    out->length = body->file_size;
+    out->validator = body->validator;
+    mc_range_if_host_to_network(out);
+    /* an mc_range_t is the first MC_RANGE_SIZE bytes of an mc_range_if_t */
+    return request->payload_len == MC_RANGE_IF_SIZE ? MC_RANGE_IF_SIZE : MC_RANGE_SIZE;
+}
+
+int mc_server_cached_body(const uint8_t *data,
+                          const mc_download_t *body,
+                          unsigned int caps,
+                          uint8_t *scratch,
+                          uint32_t *trailer,
+                          struct iovec iov[2]) {
+    const uint8_t *bytes = data + body->offset;
+    size_t len = (size_t)body->length;
+    int count = 0;
+    if ((caps & MC_AUTH_CAP_LZ4) && len > 0) {
+        mc_lz4_encoder_t *enc = malloc(sizeof(*enc));
+        if (!enc) {
+            return -1;
+        }
+        mc_lz4_encoder_init(enc);
+        iov[count++] = (struct iovec){.iov_base = scratch, .iov_len = mc_lz4_encode_block(enc, bytes, len, scratch)};
+        free(enc);
+    } else if (len > 0) {
+        iov[count++] = (struct iovec){.iov_base = (void *)bytes, .iov_len = len};
+    }
+    if (caps & MC_AUTH_CAP_CRC32C) {
+        *trailer = htonl(body->crc);
+        iov[count++] = (struct iovec){.iov_base = trailer, .iov_len = sizeof(*trailer)};
+    }
+    return count;
+}
+
+bool mc_server_map_body(const mc_server_config_t *config,
+                        int fd,
+                        uint64_t offset,
+                        uint64_t length,
+                        mc_mapped_body_t *map) {
+    memset(map, 0, sizeof(*map));
+    if (config->download_io != MC_DOWNLOAD_IO_MMAP || length < MC_MMAP_MIN_BODY || length > SIZE_MAX / 2) {
+        return false;
+    }
+    uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t head = offset % page;
+    size_t map_len = (size_t)(head + length);
+    /* mmap() 시스템 콜로 본문 구간을 페이지 캐시에 직접 매핑 (같은 파일의 다운로드끼리 페이지 공유) */
+    void *base = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, (off_t)(offset - head));
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    (void)madvise(base, map_len, MADV_SEQUENTIAL); /* madvise() 시스템 콜로 순차 접근 힌트: 미리 읽기 확대, 지난 페이지 우선 회수 */
+    map->base = base;
+    map->map_len = map_len;
+    map->data = (const uint8_t *)base + head;
+    map->offset = offset;
+    map->length = length;
+    (void)mc_server_mapped_at(map, offset);
+    return true;
+}
+
+const uint8_t *mc_server_mapped_at(mc_mapped_body_t *map, uint64_t at) {
+    uint64_t pos = at - map->offset;
+    if (map->advised < map->length && pos + MC_MMAP_WINDOW / 2 >= map->advised) {
+        uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+        uint64_t head = (uint64_t)(map->data - (const uint8_t *)map->base);
+        uint64_t from = head + (map->advised > pos ? map->advised : pos);
+        uint64_t to = head + (pos + MC_MMAP_WINDOW < map->length ? pos + MC_MMAP_WINDOW : map->length);
+        from -= from % page;
+        /* madvise() 시스템 콜로 다음 구간을 미리 읽도록 요청 (MADV_WILLNEED) */
+        (void)madvise((uint8_t *)map->base + from, (size_t)(to - from), MADV_WILLNEED);
+        map->advised = to - head;
+    }
+    return map->data + pos;
+}
+
+void mc_server_unmap_body(mc_mapped_body_t *map) {
+    if (map->base) {
+        munmap(map->base, map->map_len); /* munmap() 시스템 콜로 매핑 해제 */
+    }
+    memset(map, 0, sizeof(*map));
+}
+
+struct mc_offload {
+    const mc_server_config_t *config;
+    int event_fd;
+    pthread_mutex_t lock;      /* guards the fields below, which job threads touch too */
+    mc_offload_job_t *done;
+    unsigned int running;
+    bool closed;               /* the engine is gone: the last job out frees this */
+};
+
+mc_offload_t *mc_offload_create(const mc_server_config_t *config) {
+    mc_offload_t *offload = calloc(1, sizeof(*offload));
+    if (!offload) {
+        return NULL;
+    }
+    offload->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC); /* eventfd() 시스템 콜로 작업 완료 알림 채널 생성 */
+    if (offload->event_fd == -1) {
+        free(offload);
+        return NULL;
+    }
+    offload->config = config;
+    pthread_mutex_init(&offload->lock, NULL);
+    return offload;
+}
+
+int mc_offload_fd(const mc_offload_t *offload) {
+    return offload->event_fd;
+}
+
+static void offload_release(mc_offload_t *offload) {
+    close(offload->event_fd);
+    pthread_mutex_destroy(&offload->lock);
+    free(offload);
+}
+
+void mc_offload_run(const mc_server_config_t *config, mc_offload_job_t *job) {
+    job->rc = -1;
+    if (job->command == MC_CMD_SIGNATURES) {
+        job->rc = mc_storage_build_signatures(config, job->filename, &job->payload, &job->payload_len, job->err,
+                                              sizeof(job->err));
+    } else if (job->command == MC_CMD_HAVE) {
+        job->rc = mc_storage_have(config, job->filename, &job->have, &job->stored, job->err, sizeof(job->err));
+    }
+}
+
+static void *offload_main(void *arg) {
+    mc_offload_job_t *job = arg;
+    mc_offload_t *offload = job->offload;
+    mc_offload_run(offload->config, job);
+
+    pthread_mutex_lock(&offload->lock);
+    bool closed = offload->closed;
+    if (!closed) {
+        job->next = offload->done;
+        offload->done = job;
+        uint64_t one = 1;
+        (void)write(offload->event_fd, &one, sizeof(one)); /* write() 시스템 콜로 이벤트 루프 깨우기 */
+    }
+    bool last = --offload->running == 0 && closed;
+    pthread_mutex_unlock(&offload->lock);
+    if (closed) {
+        mc_offload_free_job(job);
+    }
+    if (last) {
+        offload_release(offload);
+    }
+    return NULL;
+}
+
+int mc_offload_submit(mc_offload_t *offload, mc_offload_job_t *job) {
+    job->offload = offload;
+    pthread_mutex_lock(&offload->lock);
+    offload->running++;
+    pthread_mutex_unlock(&offload->lock);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int rc = pthread_create(&(pthread_t){0}, &attr, offload_main, job);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        pthread_mutex_lock(&offload->lock);
+        offload->running--;
+        pthread_mutex_unlock(&offload->lock);
+        return -1;
+    }
+    return 0;
+}
+
+mc_offload_job_t *mc_offload_reap(mc_offload_t *offload) {
+    uint64_t count;
+    (void)read(offload->event_fd, &count, sizeof(count)); /* read() 시스템 콜로 알림 카운터 비우기 */
+    pthread_mutex_lock(&offload->lock);
+    mc_offload_job_t *done = offload->done;
+    offload->done = NULL;
+    pthread_mutex_unlock(&offload->lock);
+    return done;
+}
+
+void mc_offload_free_job(mc_offload_job_t *job) {
+    free(job->payload);
+    free(job);
+}
+
+void mc_offload_destroy(mc_offload_t *offload) {
+    if (!offload) {
+        return;
+    }
+    pthread_mutex_lock(&offload->lock);
+    offload->closed = true;
+    mc_offload_job_t *done = offload->done;
+    offload->done = NULL;
+    bool last = offload->running == 0;
+    pthread_mutex_unlock(&offload->lock);
+    while (done) {
+        mc_offload_job_t *next = done->next;
+        mc_offload_free_job(done);
+        done = next;
+    }
+    if (last) {
+        offload_release(offload);
+    }
+}
+
+/*
+ * Download body straight from its mapping: as LZ4 blocks and/or hashed into
+ * *crc per caps, otherwise written as it is.
+ */
+static int send_file_mapped(int fd, mc_mapped_body_t *map, unsigned int caps, uint32_t *crc) {
+    mc_lz4_encoder_t *enc = NULL;
+    uint8_t *wire = NULL;
+    if (caps & MC_AUTH_CAP_LZ4) {
+        enc = malloc(sizeof(*enc));
+        wire = malloc(MC_LZ4_BLOCK_BOUND);
+        if (!enc || !wire) {
+            free(enc);
+            free(wire);
+            return -1;
+        }
+        mc_lz4_encoder_init(enc);
+    }
+
+    size_t max = enc ? MC_LZ4_BLOCK_MAX : MC_SENDFILE_CHUNK;
+    uint64_t sent = 0;
+    int rc = 0;
+    while (sent < map->length) {
+        size_t chunk = map->length - sent > max ? max : (size_t)(map->length - sent);
+        const uint8_t *src = mc_server_mapped_at(map, map->offset + sent);
+        if (caps & MC_AUTH_CAP_CRC32C) {
+            *crc = mc_crc32c_update(*crc, src, chunk);
+        }
+        if (enc) {
+            size_t wire_len = mc_lz4_encode_block(enc, src, chunk, wire);
+            if (mc_send_all(fd, wire, wire_len) != (ssize_t)wire_len) {
+                rc = -1;
+                break;
+            }
+        } else if (mc_send_all(fd, src, chunk) != (ssize_t)chunk) {
+            rc = -1;
+            break;
+        }
+        sent += chunk;
+    }
+    free(enc);
+    free(wire);
+    return rc;
+}
+
 static void sigchld_handler(int signo) {
     (void)signo;
     int saved_errno = errno;
@@ -144,6 +647,10 @@ static void sigchld_handler(int signo) {
     errno = saved_errno;
 }
 
+int mc_server_should_terminate(void) {
+    return g_should_terminate != 0;
+}
+
 static void sigterm_handler(int signo) {
     (void)signo;
     g_should_terminate = 1;
@@ -182,7 +689,7 @@ static int install_signal_handlers(void) {
     return 0;
 }
 
-static int setup_listener(uint16_t port, int backlog) {
+static int setup_listener(uint16_t port, int backlog, bool reuse_port) {
     int fd = socket(AF_INET, SOCK_STREAM, 0); /* socket() 시스템 콜로 리스닝 소켓 생성 */
     if (fd == -1) {
         return -1;
@@ -193,6 +700,11 @@ static int setup_listener(uint16_t port, int backlog) {
         close(fd);
         return -1;
     }
+    if (reuse_port &&
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) { /* setsockopt() 시스템 콜로 포트 공유 설정 */
+        close(fd);
+        return -1;
+    }
 
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
@@ -245,7 +757,7 @@ static int drain_payload(int fd, uint64_t remaining) {
     return 0;
 }
 
-static void log_client_command(const struct sockaddr_in *addr, const mc_packet_info_t *info) {
+void mc_server_log_command(const struct sockaddr_in *addr, const mc_packet_info_t *info) {
     char ip[INET_ADDRSTRLEN] = {0};
     inet_ntop(AF_INET, &addr->sin_addr, ip, sizeof(ip));
     fprintf(stdout,
@@ -259,110 +771,319 @@ static void log_client_command(const struct sockaddr_in *addr, const mc_packet_i
     fflush(stdout);
 }
 
+unsigned int mc_server_auth_options(const mc_packet_info_t *info, char *echo, size_t echo_len) {
+    unsigned int caps = 0;
+    if (info->header.version >= MC_PROTOCOL_VERSION_PIPELINED) {
+        caps = mc_auth_parse_options(info->filename);
+    }
+    mc_auth_format_options(caps, echo, echo_len);
+    return caps;
+}
+
+void mc_server_body_error(const mc_server_config_t *config, int problem, char *err, size_t err_len) {
+    if (problem == EFBIG) {
+        snprintf(err, err_len, "Upload exceeds limit (%" PRIu64 " bytes)", (uint64_t)config->max_upload_bytes);
+    } else if (problem == EPROTO) {
+        snprintf(err, err_len, "Invalid compressed data");
+    } else {
+        snprintf(err, err_len, "Checksum mismatch");
+    }
+}
+
+/* Serves UPLOAD and DELTA; a DELTA payload is received like a file, then applied. */
 static int handle_upload_request(int client_fd,
                                  const mc_server_config_t *config,
-                                 const mc_packet_info_t *info) {
-    if (!info->filename[0]) {
-        drain_payload(client_fd, info->header.payload_len);
-        return send_errorf(client_fd, "UPLOAD requires filename");
+                                 const mc_packet_info_t *info,
+                                 unsigned int caps) {
+    char err[256];
+    mc_upload_t upload;
+    unsigned int applied = mc_request_caps(caps, info->header.command);
+    /* a compressed payload is held to the limit as it decodes instead */
+    if (mc_storage_begin_upload(config,
+                                info->filename,
+                                (applied & MC_AUTH_CAP_LZ4) ? 0 : info->header.payload_len,
+                                &upload,
+                                err,
+                                sizeof(err)) != 0) {
+        drain_payload(client_fd, info->header.payload_len + ((applied & MC_AUTH_CAP_CRC32C) ? MC_CHECKSUM_SIZE : 0U));
+        return send_errorf(client_fd, &info->header, "%s", err);
+    }
+
+    int problem = 0;
+    int received = applied ? receive_payload_checked(client_fd,
+                                                     info->header.payload_len,
+                                                     upload.fd,
+                                                     applied,
+                                                     mc_storage_upload_room(config, &upload),
+                                                     &problem)
+                           : receive_payload_to_fd(client_fd, info->header.payload_len, upload.fd);
+    if (received != 0) {
+        mc_storage_abort_upload(&upload);
+        return send_errorf(client_fd, &info->header, "Failed to receive file data");
+    }
+    if (problem != 0) {
+        mc_storage_reject_upload(&upload);
+        mc_server_body_error(config, problem, err, sizeof(err));
+        return send_errorf(client_fd, &info->header, "%s", err);
+    }
+
+    if (info->header.command == MC_CMD_DELTA) {
+        if (mc_storage_apply_delta(config, info->filename, &upload, err, sizeof(err)) != 0) {
+            return send_errorf(client_fd, &info->header, "%s", err);
+        }
+        return send_message(client_fd, &info->header, MC_CMD_DELTA, info->filename, "UPLOAD OK");
     }
-    if (!is_safe_filename(info->filename)) {
-        drain_payload(client_fd, info->header.payload_len);
-        return send_errorf(client_fd, "Invalid filename");
+    if (mc_storage_commit_upload(&upload, err, sizeof(err)) != 0) {
+        return send_errorf(client_fd, &info->header, "%s", err);
     }
 
-    if (config->max_upload_bytes > 0 && info->header.payload_len > config->max_upload_bytes) {
-        drain_payload(client_fd, info->header.payload_len);
-        return send_errorf(client_fd,
-                           "Upload exceeds limit (%" PRIu64 " bytes)",
-                           (uint64_t)config->max_upload_bytes);
+    return send_message(client_fd, &info->header, MC_CMD_UPLOAD, info->filename, "UPLOAD OK");
+}
+
+/* Replies with cmd, filename and an mc_range_t payload (upload session progress). */
+static int send_range_reply(int fd,
+                            const mc_packet_header_t *request,
+                            mc_command_t cmd,
+                            const char *filename,
+                            uint64_t offset,
+                            uint64_t length) {
+    mc_packet_header_t header;
+    if (mc_build_reply_header(&header, request, cmd, filename, MC_RANGE_SIZE) != 0) {
+        return -1;
     }
+    size_t name_len = header.filename_len;
+    size_t header_len = mc_header_wire_size(&header);
+    uint8_t reply[sizeof(mc_packet_header_t) + MC_MAX_FILENAME_LEN + MC_RANGE_SIZE];
+    mc_range_t range = {.offset = offset, .length = length};
+    mc_header_host_to_network(&header);
+    mc_range_host_to_network(&range);
+    memcpy(reply, &header, header_len);
+    memcpy(reply + header_len, filename, name_len);
+    memcpy(reply + header_len + name_len, &range, sizeof(range));
+    size_t reply_len = header_len + name_len + sizeof(range);
+    return mc_send_all(fd, reply, reply_len) == (ssize_t)reply_len ? 0 : -1;
+}
 
-    char final_path[MC_STORAGE_PATH_MAX];
-    if (build_storage_path(config, info->filename, final_path, sizeof(final_path)) != 0) {
+/* Serves UPLOAD_BEGIN and UPLOAD_COMMIT, which both carry an mc_upload_begin_t. */
+static int handle_upload_session_request(int client_fd,
+                                         const mc_server_config_t *config,
+                                         const mc_packet_info_t *info) {
+    mc_upload_begin_t begin;
+    if (info->header.payload_len != sizeof(begin)) {
         drain_payload(client_fd, info->header.payload_len);
-        return send_errorf(client_fd, "Path too long");
+        return send_errorf(client_fd, &info->header, "Invalid upload request");
+    }
+    if (mc_recv_all(client_fd, &begin, sizeof(begin)) != (ssize_t)sizeof(begin)) {
+        return -1;
+    }
+    mc_upload_begin_network_to_host(&begin);
+
+    char err[256];
+    if (info->header.command == MC_CMD_UPLOAD_COMMIT) {
+        if (mc_storage_commit_session(config, info->filename, &begin, err, sizeof(err)) != 0) {
+            return send_errorf(client_fd, &info->header, "%s", err);
+        }
+        return send_message(client_fd, &info->header, MC_CMD_UPLOAD_COMMIT, info->filename, "UPLOAD OK");
     }
 
-    char tmp_path[MC_STORAGE_PATH_MAX];
-    snprintf(tmp_path,
-             sizeof(tmp_path),
-             "%s/.%s.%ld.tmp",
-             config->storage_dir,
-             info->filename,
-             (long)getpid());
+    char key[MC_UPLOAD_KEY_LEN + 1];
+    uint64_t committed = 0;
+    if (mc_storage_begin_session(config, info->filename, &begin, key, &committed, err, sizeof(err)) != 0) {
+        return send_errorf(client_fd, &info->header, "%s", err);
+    }
+    return send_range_reply(client_fd, &info->header, MC_CMD_UPLOAD_BEGIN, key, committed, begin.total_size);
+}
 
-    int file_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644); /* open() 시스템 콜로 임시 파일 생성 */
-    if (file_fd == -1) {
+static int handle_have_request(int client_fd,
+                               const mc_server_config_t *config,
+                               const mc_packet_info_t *info) {
+    mc_have_t have;
+    if (info->header.payload_len != sizeof(have)) {
         drain_payload(client_fd, info->header.payload_len);
-        return send_errorf(client_fd, "Failed to open temp file: %s", strerror(errno));
+        return send_errorf(client_fd, &info->header, "Invalid have request");
+    }
+    if (mc_recv_all(client_fd, &have, sizeof(have)) != (ssize_t)sizeof(have)) {
+        return -1;
     }
+    mc_have_network_to_host(&have);
 
-    int rc = receive_payload_to_fd(client_fd, info->header.payload_len, file_fd);
-    close(file_fd); /* close() 시스템 콜로 임시 파일 닫기 */
-    if (rc != 0) {
-        unlink(tmp_path); /* unlink() 시스템 콜로 임시 파일 제거 */
-        return send_errorf(client_fd, "Failed to receive file data");
+    char err[256];
+    bool stored = false;
+    if (mc_storage_have(config, info->filename, &have, &stored, err, sizeof(err)) != 0) {
+        return send_errorf(client_fd, &info->header, "%s", err);
     }
+    return send_message(client_fd, &info->header, MC_CMD_HAVE, info->filename, stored ? MC_HAVE_STORED : MC_HAVE_MISSING);
+}
 
-    if (rename(tmp_path, final_path) == -1) { /* rename() 시스템 콜로 원자적 교체 */
-        unlink(tmp_path);
-        return send_errorf(client_fd, "Failed to store file: %s", strerror(errno));
+static int handle_upload_append_request(int client_fd,
+                                        const mc_server_config_t *config,
+                                        const mc_packet_info_t *info,
+                                        unsigned int caps) {
+    char err[256];
+    mc_upload_t upload;
+    unsigned int applied = mc_request_caps(caps, info->header.command);
+    uint64_t checked_len = (applied & MC_AUTH_CAP_LZ4) ? 0 : info->header.payload_len;
+    if (mc_storage_begin_append(config, info->filename, checked_len, &upload, err, sizeof(err)) != 0) {
+        drain_payload(client_fd, info->header.payload_len + ((applied & MC_AUTH_CAP_CRC32C) ? MC_CHECKSUM_SIZE : 0U));
+        return send_errorf(client_fd, &info->header, "%s", err);
+    }
+
+    int problem = 0;
+    int received = applied ? receive_payload_checked(client_fd,
+                                                     info->header.payload_len,
+                                                     upload.fd,
+                                                     applied,
+                                                     mc_storage_upload_room(config, &upload),
+                                                     &problem)
+                           : receive_payload_to_fd(client_fd, info->header.payload_len, upload.fd);
+    if (received != 0) {
+        mc_storage_abort_upload(&upload); /* keeps what arrived for the next attempt */
+        return send_errorf(client_fd, &info->header, "Failed to receive file data");
+    }
+    if (problem != 0) {
+        mc_storage_reject_upload(&upload);
+        mc_server_body_error(config, problem, err, sizeof(err));
+        return send_errorf(client_fd, &info->header, "%s", err);
+    }
+
+    uint64_t committed = 0;
+    if (mc_storage_finish_append(&upload, &committed, err, sizeof(err)) != 0) {
+        return send_errorf(client_fd, &info->header, "%s", err);
+    }
+    return send_range_reply(client_fd, &info->header, MC_CMD_UPLOAD_APPEND, info->filename, committed, 0);
+}
+
+/* A DOWNLOAD(_RANGE) reply from the hot-file cache: header, filename, range and body in one writev(). */
+static int send_cached_reply(int client_fd,
+                             const mc_packet_info_t *info,
+                             const uint8_t *data,
+                             const mc_download_t *body,
+                             unsigned int caps) {
+    mc_range_if_t served;
+    size_t served_len = mc_server_range_prefix(&info->header, body, &served);
+    mc_packet_header_t header;
+    if (mc_build_reply_header(&header,
+                              &info->header,
+                              (mc_command_t)info->header.command,
+                              info->filename,
+                              served_len + body->length) != 0) {
+        return -1;
     }
+    size_t name_len = header.filename_len;
+    size_t header_len = mc_header_wire_size(&header);
+    mc_header_host_to_network(&header);
 
-    return send_message(client_fd, MC_CMD_UPLOAD, info->filename, "UPLOAD OK");
+    uint8_t *scratch = NULL;
+    if ((caps & MC_AUTH_CAP_LZ4) && !(scratch = malloc(MC_LZ4_BLOCK_BOUND))) {
+        return -1;
+    }
+    uint32_t trailer;
+    struct iovec iov[5];
+    int count = 0;
+    iov[count++] = (struct iovec){.iov_base = &header, .iov_len = header_len};
+    iov[count++] = (struct iovec){.iov_base = (void *)info->filename, .iov_len = name_len};
+    if (served_len > 0) {
+        iov[count++] = (struct iovec){.iov_base = &served, .iov_len = served_len};
+    }
+    int pieces = mc_server_cached_body(data, body, caps, scratch, &trailer, iov + count);
+    int rc = pieces < 0 ? -1 : mc_send_iov_all(client_fd, iov, count + pieces, false);
+    free(scratch);
+    return rc;
 }
 
+/* Serves DOWNLOAD and DOWNLOAD_RANGE; the latter sends only the requested span. */
 static int handle_download_request(int client_fd,
                                    const mc_server_config_t *config,
-                                   const mc_packet_info_t *info) {
-    if (!info->filename[0]) {
-        drain_payload(client_fd, info->header.payload_len);
-        return send_errorf(client_fd, "DOWNLOAD requires filename");
-    }
-    if (!is_safe_filename(info->filename)) {
+                                   const mc_packet_info_t *info,
+                                   unsigned int caps) {
+    bool ranged = info->header.command == MC_CMD_DOWNLOAD_RANGE;
+    bool range_ok = info->header.payload_len == MC_RANGE_SIZE || info->header.payload_len == MC_RANGE_IF_SIZE;
+    mc_range_if_t range = {0, 0, 0};
+    if (ranged && range_ok) {
+        /* an mc_range_t request fills only the part before the validator */
+        size_t len = (size_t)info->header.payload_len;
+        if (mc_recv_all(client_fd, &range, len) != (ssize_t)len) {
+            return -1;
+        }
+        mc_range_if_network_to_host(&range);
+    } else if (info->header.payload_len > 0) {
         drain_payload(client_fd, info->header.payload_len);
-        return send_errorf(client_fd, "Invalid filename");
     }
-    if (info->header.payload_len > 0) {
-        drain_payload(client_fd, info->header.payload_len);
+    if (ranged && !range_ok) {
+        return send_errorf(client_fd, &info->header, "Invalid range request");
     }
 
-    char path[MC_STORAGE_PATH_MAX];
-    if (build_storage_path(config, info->filename, path, sizeof(path)) != 0) {
-        return send_errorf(client_fd, "Path too long");
+    char err[256];
+    unsigned int applied = mc_reply_caps(caps, info->header.command);
+    mc_download_t body;
+    uint8_t cached[MC_CACHE_MAX_FILE];
+    int hit = mc_storage_cached_reply(config, info->filename, ranged ? &range : NULL, cached, &body, err, sizeof(err));
+    if (hit < 0) {
+        return send_errorf(client_fd, &info->header, "%s", err);
     }
-
-    int file_fd = open(path, O_RDONLY); /* open() 시스템 콜로 다운로드 파일 오픈 */
-    if (file_fd == -1) {
-        return send_errorf(client_fd, "File not found");
+    if (hit == 1) {
+        return send_cached_reply(client_fd, info, cached, &body, applied);
     }
-
-    struct stat st;
-    if (fstat(file_fd, &st) == -1) { /* fstat() 시스템 콜로 파일 크기 확인 */
-        close(file_fd);
-        return send_errorf(client_fd, "Failed to stat file");
+    if (mc_storage_open_reply(config, info->filename, ranged ? &range : NULL, applied, &body, err, sizeof(err)) != 0) {
+        return send_errorf(client_fd, &info->header, "%s", err);
     }
-    if (!S_ISREG(st.st_mode)) {
+    int file_fd = body.fd;
+    uint64_t start = body.stored_blocks ? body.wire_offset : body.offset;
+    if (start > 0 && lseek(file_fd, (off_t)start, SEEK_SET) == -1) { /* lseek() 시스템 콜로 시작 위치 이동 */
         close(file_fd);
-        return send_errorf(client_fd, "Not a regular file");
+        return send_errorf(client_fd, &info->header, "Failed to seek: %s", strerror(errno));
     }
+    mc_range_if_t served;
+    size_t served_len = mc_server_range_prefix(&info->header, &body, &served);
+    uint64_t payload_len = served_len + body.length;
 
+    /*
+     * header, filename and range prefix leave in one sendmsg() flagged
+     * MSG_MORE so they share a segment with the body; a CRC trailer is
+     * corked in behind the body instead of trailing as a 4-byte segment.
+     */
     mc_packet_header_t header;
-    if (mc_build_header(&header, MC_CMD_DOWNLOAD, info->filename, (uint64_t)st.st_size) != 0) {
+    if (mc_build_reply_header(&header, &info->header, (mc_command_t)info->header.command, info->filename, payload_len) != 0) {
         close(file_fd);
         return -1;
     }
-    if (mc_send_header(client_fd, &header) != 0) {
-        close(file_fd);
-        return -1;
+    bool trailer_follows = (applied & MC_AUTH_CAP_CRC32C) != 0;
+    bool body_follows = (body.stored_blocks ? body.wire_len : body.length) > 0;
+    if (trailer_follows) {
+        mc_set_cork(client_fd, true);
     }
-    if (mc_send_all(client_fd, info->filename, strlen(info->filename)) != (ssize_t)strlen(info->filename)) {
+    if (mc_send_packet(client_fd, &header, info->filename, &served, served_len, body_follows) != 0) {
         close(file_fd);
         return -1;
     }
 
-    int rc = send_file_contents(client_fd, file_fd, (uint64_t)st.st_size);
+    int rc;
+    mc_mapped_body_t map;
+    if (mc_server_map_body(config, file_fd, start, body.stored_blocks ? body.wire_len : body.length, &map)) {
+        /* stored blocks go out as they are; otherwise the caps apply as below */
+        uint32_t crc = body.stored_blocks ? body.crc : 0;
+        rc = send_file_mapped(client_fd, &map, body.stored_blocks ? 0 : applied, &crc);
+        mc_server_unmap_body(&map);
+        uint32_t trailer = htonl(crc);
+        if (rc == 0 && (applied & MC_AUTH_CAP_CRC32C) &&
+            mc_send_all(client_fd, &trailer, sizeof(trailer)) != (ssize_t)sizeof(trailer)) {
+            rc = -1;
+        }
+    } else if (body.stored_blocks) {
+        /* the container's blocks are already the wire form: no re-encode */
+        rc = send_file_contents(client_fd, file_fd, body.wire_len);
+        uint32_t trailer = htonl(body.crc);
+        if (rc == 0 && (applied & MC_AUTH_CAP_CRC32C) &&
+            mc_send_all(client_fd, &trailer, sizeof(trailer)) != (ssize_t)sizeof(trailer)) {
+            rc = -1;
+        }
+    } else {
+        rc = applied ? send_file_checked(client_fd, file_fd, body.length, applied)
+                     : send_file_contents(client_fd, file_fd, body.length);
+    }
+    if (trailer_follows) {
+        mc_set_cork(client_fd, false);
+    }
     close(file_fd);
     return rc;
 }
@@ -374,26 +1095,31 @@ static int handle_delete_request(int client_fd,
         drain_payload(client_fd, info->header.payload_len);
     }
 
-    if (!info->filename[0]) {
-        return send_errorf(client_fd, "DELETE requires filename");
-    }
-    if (!is_safe_filename(info->filename)) {
-        return send_errorf(client_fd, "Invalid filename");
+    char err[256];
+    if (mc_storage_delete(config, info->filename, err, sizeof(err)) != 0) {
+        return send_errorf(client_fd, &info->header, "%s", err);
     }
 
-    char target_path[MC_STORAGE_PATH_MAX];
-    if (build_storage_path(config, info->filename, target_path, sizeof(target_path)) != 0) {
-        return send_errorf(client_fd, "Path too long");
+    return send_message(client_fd, &info->header, MC_CMD_DELETE, info->filename, "DELETE OK");
+}
+
+static int handle_directory_request(int client_fd,
+                                    const mc_server_config_t *config,
+                                    const mc_packet_info_t *info) {
+    if (info->header.payload_len > 0) {
+        drain_payload(client_fd, info->header.payload_len);
     }
 
-    if (unlink(target_path) == -1) {
-        if (errno == ENOENT) {
-            return send_errorf(client_fd, "File not found");
-        }
-        return send_errorf(client_fd, "Failed to delete file: %s", strerror(errno));
+    char err[256];
+    bool make = info->header.command == MC_CMD_MKDIR;
+    int rc = make ? mc_storage_mkdir(config, info->filename, err, sizeof(err))
+                  : mc_storage_rmdir(config, info->filename, err, sizeof(err));
+    if (rc != 0) {
+        return send_errorf(client_fd, &info->header, "%s", err);
     }
 
-    return send_message(client_fd, MC_CMD_DELETE, info->filename, "DELETE OK");
+    return send_message(client_fd, &info->header, (mc_command_t)info->header.command, info->filename,
+                        make ? "MKDIR OK" : "RMDIR OK");
 }
 
 static int handle_list_request(int client_fd, const mc_server_config_t *config, const mc_packet_info_t *info) {
@@ -401,81 +1127,220 @@ static int handle_list_request(int client_fd, const mc_server_config_t *config,
         drain_payload(client_fd, info->header.payload_len);
     }
 
-    DIR *dir = opendir(config->storage_dir); /* opendir() 시스템 콜로 저장소 열기 */
-    if (!dir) {
-        return send_errorf(client_fd, "Failed to open storage dir");
+    char err[256];
+    char *list_buf = NULL;
+    size_t used = 0;
+    if (mc_storage_build_listing(config, info->filename, &list_buf, &used, err, sizeof(err)) != 0) {
+        return send_errorf(client_fd, &info->header, "%s", err);
     }
 
-    size_t cap = 1024;
-    size_t used = 0;
-    char *list_buf = malloc(cap);
-    if (!list_buf) {
-        closedir(dir);
-        return send_errorf(client_fd, "Out of memory");
+    mc_packet_header_t header;
+    if (mc_build_reply_header(&header, &info->header, MC_CMD_LIST, NULL, (uint64_t)used) != 0) {
+        free(list_buf);
+        return -1;
     }
-    list_buf[0] = '\0';
+    int rc = mc_send_packet(client_fd, &header, NULL, list_buf, used, false);
+    free(list_buf);
+    return rc;
+}
 
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) { /* readdir() 시스템 콜로 항목 열람 */
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
+static int handle_list_query_request(int client_fd, const mc_server_config_t *config, const mc_packet_info_t *info) {
+    mc_list_query_t query;
+    if (info->header.payload_len != sizeof(query)) {
+        drain_payload(client_fd, info->header.payload_len);
+        return send_errorf(client_fd, &info->header, "Invalid list query");
+    }
+    if (mc_recv_all(client_fd, &query, sizeof(query)) != (ssize_t)sizeof(query)) {
+        return -1;
+    }
+    mc_list_query_network_to_host(&query);
+
+    char err[256];
+    uint8_t *page = NULL;
+    size_t len = 0;
+    if (mc_storage_query_listing(config, info->filename, &query, &page, &len, err, sizeof(err)) != 0) {
+        return send_errorf(client_fd, &info->header, "%s", err);
+    }
+    mc_packet_header_t header;
+    int rc = -1;
+    if (mc_build_reply_header(&header, &info->header, MC_CMD_LIST_QUERY, NULL, (uint64_t)len) == 0 &&
+        mc_send_packet(client_fd, &header, NULL, page, len, false) == 0) {
+        rc = 0;
+    }
+    free(page);
+    return rc;
+}
+
+/* BUNDLE_UPLOAD / BUNDLE_DOWNLOAD: the payload is read whole, then stored or answered. */
+static int handle_bundle_request(int client_fd, const mc_server_config_t *config, const mc_packet_info_t *info) {
+    if (info->header.payload_len > MC_BUNDLE_WIRE_MAX) {
+        drain_payload(client_fd, info->header.payload_len);
+        return send_errorf(client_fd, &info->header, "Bundle too large");
+    }
+    size_t len = (size_t)info->header.payload_len;
+    uint8_t *payload = malloc(len ? len : 1);
+    if (!payload) {
+        drain_payload(client_fd, info->header.payload_len);
+        return send_errorf(client_fd, &info->header, "Out of memory");
+    }
+    if (mc_recv_all(client_fd, payload, len) != (ssize_t)len) {
+        free(payload);
+        return -1;
+    }
+
+    char err[256];
+    int rc;
+    if (info->header.command == MC_CMD_BUNDLE_UPLOAD) {
+        long stored = 0;
+        if (mc_storage_store_bundle(config, payload, len, &stored, err, sizeof(err)) != 0) {
+            rc = send_errorf(client_fd, &info->header, "%s", err);
+        } else {
+            char text[64];
+            snprintf(text, sizeof(text), "UPLOAD OK: %ld files", stored);
+            rc = send_message(client_fd, &info->header, MC_CMD_BUNDLE_UPLOAD, NULL, text);
         }
-        if (!is_safe_filename(entry->d_name)) {
-            continue;
+        free(payload);
+        return rc;
+    }
+
+    uint8_t *reply = NULL;
+    size_t reply_len = 0;
+    rc = mc_storage_build_bundle(config, payload, len, &reply, &reply_len, err, sizeof(err));
+    free(payload);
+    if (rc != 0) {
+        return send_errorf(client_fd, &info->header, "%s", err);
+    }
+    mc_packet_header_t header;
+    rc = -1;
+    if (mc_build_reply_header(&header, &info->header, MC_CMD_BUNDLE_DOWNLOAD, NULL, (uint64_t)reply_len) == 0 &&
+        mc_send_packet(client_fd, &header, NULL, reply, reply_len, false) == 0) {
+        rc = 0;
+    }
+    free(reply);
+    return rc;
+}
+
+/* ARCHIVE body: the tar stream a block at a time, compressed and/or hashed per caps, trailer last. */
+static int send_archive_body(int fd, mc_archive_t *archive, unsigned int caps) {
+    uint8_t buffer[MC_LZ4_BLOCK_MAX];
+    mc_lz4_encoder_t *enc = NULL;
+    uint8_t *wire = NULL;
+    if (caps & MC_AUTH_CAP_LZ4) {
+        enc = malloc(sizeof(*enc));
+        wire = malloc(MC_LZ4_BLOCK_BOUND);
+        if (!enc || !wire) {
+            free(enc);
+            free(wire);
+            return -1;
         }
-        size_t len = strlen(entry->d_name) + 1;
-        if (used + len + 1 >= cap) {
-            cap *= 2;
-            char *tmp = realloc(list_buf, cap);
-            if (!tmp) {
-                free(list_buf);
-                closedir(dir);
-                return send_errorf(client_fd, "Out of memory");
-            }
-            list_buf = tmp;
+        mc_lz4_encoder_init(enc);
+    }
+
+    int rc = 0;
+    uint32_t crc = 0;
+    size_t got;
+    while (rc == 0 && (got = mc_archive_read(archive, buffer, sizeof(buffer))) > 0) {
+        crc = mc_crc32c_update(crc, buffer, got);
+        if (enc) {
+            size_t wire_len = mc_lz4_encode_block(enc, buffer, got, wire);
+            rc = mc_send_all(fd, wire, wire_len) == (ssize_t)wire_len ? 0 : -1;
+        } else {
+            rc = mc_send_all(fd, buffer, got) == (ssize_t)got ? 0 : -1;
         }
-        used += (size_t)snprintf(list_buf + used, cap - used, "%s\n", entry->d_name);
     }
-    closedir(dir);
+    free(enc);
+    free(wire);
+    uint32_t trailer = htonl(crc);
+    if (rc == 0 && (caps & MC_AUTH_CAP_CRC32C) &&
+        mc_send_all(fd, &trailer, sizeof(trailer)) != (ssize_t)sizeof(trailer)) {
+        rc = -1;
+    }
+    return rc;
+}
 
-    if (used == 0) {
-        strcpy(list_buf, "(empty)\n");
-        used = strlen(list_buf);
+static int handle_archive_request(int client_fd,
+                                  const mc_server_config_t *config,
+                                  const mc_packet_info_t *info,
+                                  unsigned int caps) {
+    if (info->header.payload_len > 0) {
+        drain_payload(client_fd, info->header.payload_len);
     }
 
+    char err[256];
+    mc_archive_t *archive = NULL;
+    uint64_t total = 0;
+    if (mc_archive_open(config, info->filename, &archive, &total, err, sizeof(err)) != 0) {
+        return send_errorf(client_fd, &info->header, "%s", err);
+    }
+    /* the header rides with the first tar block; a CRC trailer is corked in behind the last */
+    unsigned int applied = mc_reply_caps(caps, info->header.command);
+    bool trailer_follows = (applied & MC_AUTH_CAP_CRC32C) != 0;
     mc_packet_header_t header;
-    if (mc_build_header(&header, MC_CMD_LIST, NULL, (uint64_t)used) != 0) {
-        free(list_buf);
-        return -1;
+    int rc = -1;
+    if (trailer_follows) {
+        mc_set_cork(client_fd, true);
     }
-    if (mc_send_header(client_fd, &header) != 0) {
-        free(list_buf);
-        return -1;
+    if (mc_build_reply_header(&header, &info->header, MC_CMD_ARCHIVE, info->filename, total) == 0 &&
+        mc_send_packet(client_fd, &header, info->filename, NULL, 0, total > 0) == 0) {
+        rc = send_archive_body(client_fd, archive, applied);
     }
-    int rc = 0;
-    if (mc_send_all(client_fd, list_buf, used) != (ssize_t)used) {
-        rc = -1;
+    if (trailer_follows) {
+        mc_set_cork(client_fd, false);
     }
-    free(list_buf);
+    mc_archive_close(archive);
+    return rc;
+}
+
+static int handle_signatures_request(int client_fd,
+                                     const mc_server_config_t *config,
+                                     const mc_packet_info_t *info) {
+    if (info->header.payload_len > 0) {
+        drain_payload(client_fd, info->header.payload_len);
+    }
+
+    char err[256];
+    uint8_t *sigs = NULL;
+    size_t sigs_len = 0;
+    if (mc_storage_build_signatures(config, info->filename, &sigs, &sigs_len, err, sizeof(err)) != 0) {
+        return send_errorf(client_fd, &info->header, "%s", err);
+    }
+
+    mc_packet_header_t header;
+    int rc = -1;
+    if (mc_build_reply_header(&header, &info->header, MC_CMD_SIGNATURES, info->filename, (uint64_t)sigs_len) == 0 &&
+        mc_send_packet(client_fd, &header, info->filename, sigs, sigs_len, false) == 0) {
+        rc = 0;
+    }
+    free(sigs);
     return rc;
 }
 
 static int handle_auth_request(int client_fd,
                                const mc_server_config_t *config,
                                const mc_packet_info_t *info,
-                               bool *authenticated) {
+                               bool *authenticated,
+                               unsigned int *caps) {
+    /* a v3 AUTH asks for framed mode, which only an authenticated connection gets */
+    mc_packet_header_t refusal = info->header;
+    if (refusal.version > MC_PROTOCOL_VERSION_PIPELINED) {
+        refusal.version = MC_PROTOCOL_VERSION_PIPELINED;
+    }
+    char options[MC_AUTH_ECHO_MAX];
+    unsigned int accepted = mc_server_auth_options(info, options, sizeof(options));
+
     if (!authenticated) {
         if (info->header.payload_len > 0) {
             drain_payload(client_fd, info->header.payload_len);
         }
-        return send_errorf(client_fd, "Authentication state unavailable");
+        return send_errorf(client_fd, &refusal, "Authentication state unavailable");
     }
 
     if (*authenticated) {
         if (info->header.payload_len > 0) {
             drain_payload(client_fd, info->header.payload_len);
         }
-        return send_message(client_fd, MC_CMD_AUTH, NULL, "Already authenticated");
+        *caps = accepted;
+        return send_message(client_fd, &info->header, MC_CMD_AUTH, options, "Already authenticated");
     }
 
     if (!config->auth_token || !config->auth_token[0]) {
@@ -483,12 +1348,13 @@ static int handle_auth_request(int client_fd,
             drain_payload(client_fd, info->header.payload_len);
         }
         *authenticated = true;
-        return send_message(client_fd, MC_CMD_AUTH, NULL, "AUTH not required");
+        *caps = accepted;
+        return send_message(client_fd, &info->header, MC_CMD_AUTH, options, "AUTH not required");
     }
 
     if (info->header.payload_len == 0 || info->header.payload_len > MC_MAX_AUTH_TOKEN_LEN) {
         drain_payload(client_fd, info->header.payload_len);
-        return send_errorf(client_fd, "Invalid auth token length");
+        return send_errorf(client_fd, &refusal, "Invalid auth token length");
     }
 
     char token[MC_MAX_AUTH_TOKEN_LEN + 1];
@@ -499,17 +1365,32 @@ static int handle_auth_request(int client_fd,
     token[info->header.payload_len] = '\0';
 
     if (strcmp(token, config->auth_token) != 0) {
-        send_errorf(client_fd, "Invalid auth token");
+        send_errorf(client_fd, &refusal, "Invalid auth token");
         return -1;
     }
 
     *authenticated = true;
-    return send_message(client_fd, MC_CMD_AUTH, NULL, "AUTH OK");
+    *caps = accepted;
+    return send_message(client_fd, &info->header, MC_CMD_AUTH, options, "AUTH OK");
 }
 
-static void handle_client(int client_fd, const struct sockaddr_in *addr, const mc_server_config_t *config) {
+static void serve_multiplexed(int client_fd,
+                              const struct sockaddr_in *addr,
+                              const mc_server_config_t *config,
+                              unsigned int caps);
+
+/*
+ * Request loop for one connection, or for one stream of a multiplexed
+ * connection (in_stream: already authenticated, no further upgrade, and
+ * the AUTH options agreed on the connection).
+ */
+static void handle_client(int client_fd,
+                          const struct sockaddr_in *addr,
+                          const mc_server_config_t *config,
+                          bool in_stream,
+                          unsigned int caps) {
     bool require_auth = config->auth_token && config->auth_token[0];
-    bool authenticated = !require_auth;
+    bool authenticated = in_stream || !require_auth;
     mc_packet_info_t info;
     while (1) {
         mc_packet_header_t header;
@@ -520,18 +1401,22 @@ static void handle_client(int client_fd, const struct sockaddr_in *addr, const m
             }
             break;
         }
+        /* v3 is only meaningful on an AUTH sent over the connection itself */
+        if (header.version > MC_PROTOCOL_VERSION_PIPELINED && (in_stream || header.command != MC_CMD_AUTH)) {
+            header.version = MC_PROTOCOL_VERSION_PIPELINED;
+        }
         info.header = header;
         if (recv_filename(client_fd, &info) != 0) {
             break;
         }
 
-        log_client_command(addr, &info);
+        mc_server_log_command(addr, &info);
 
         if (!authenticated && info.header.command != MC_CMD_AUTH) {
             if (info.header.payload_len > 0) {
                 drain_payload(client_fd, info.header.payload_len);
             }
-            if (send_errorf(client_fd, "Authentication required") != 0) {
+            if (send_errorf(client_fd, &info.header, "Authentication required") != 0) {
                 break;
             }
             continue;
@@ -540,32 +1425,66 @@ static void handle_client(int client_fd, const struct sockaddr_in *addr, const m
         int handler_rc = 0;
         switch (info.header.command) {
             case MC_CMD_UPLOAD:
-                handler_rc = handle_upload_request(client_fd, config, &info);
+            case MC_CMD_DELTA:
+                handler_rc = handle_upload_request(client_fd, config, &info, caps);
+                break;
+            case MC_CMD_SIGNATURES:
+                handler_rc = handle_signatures_request(client_fd, config, &info);
+                break;
+            case MC_CMD_HAVE:
+                handler_rc = handle_have_request(client_fd, config, &info);
                 break;
             case MC_CMD_DOWNLOAD:
-                handler_rc = handle_download_request(client_fd, config, &info);
+            case MC_CMD_DOWNLOAD_RANGE:
+                handler_rc = handle_download_request(client_fd, config, &info, caps);
+                break;
+            case MC_CMD_UPLOAD_BEGIN:
+            case MC_CMD_UPLOAD_COMMIT:
+                handler_rc = handle_upload_session_request(client_fd, config, &info);
+                break;
+            case MC_CMD_UPLOAD_APPEND:
+                handler_rc = handle_upload_append_request(client_fd, config, &info, caps);
                 break;
             case MC_CMD_LIST:
                 handler_rc = handle_list_request(client_fd, config, &info);
                 break;
+            case MC_CMD_LIST_QUERY:
+                handler_rc = handle_list_query_request(client_fd, config, &info);
+                break;
+            case MC_CMD_BUNDLE_UPLOAD:
+            case MC_CMD_BUNDLE_DOWNLOAD:
+                handler_rc = handle_bundle_request(client_fd, config, &info);
+                break;
+            case MC_CMD_ARCHIVE:
+                handler_rc = handle_archive_request(client_fd, config, &info, caps);
+                break;
             case MC_CMD_DELETE:
                 handler_rc = handle_delete_request(client_fd, config, &info);
                 break;
+            case MC_CMD_MKDIR:
+            case MC_CMD_RMDIR:
+                handler_rc = handle_directory_request(client_fd, config, &info);
+                break;
             case MC_CMD_AUTH:
-                handler_rc = handle_auth_request(client_fd, config, &info, &authenticated);
+                handler_rc = handle_auth_request(client_fd, config, &info, &authenticated, &caps);
+                if (handler_rc == 0 && authenticated && info.header.version >= MC_PROTOCOL_VERSION_MUX) {
+                    /* the v3 reply is out; from here on the connection is framed */
+                    serve_multiplexed(client_fd, addr, config, caps);
+                    return;
+                }
                 break;
             case MC_CMD_QUIT:
                 if (info.header.payload_len > 0) {
                     drain_payload(client_fd, info.header.payload_len);
                 }
-                send_message(client_fd, MC_CMD_QUIT, NULL, "Goodbye");
+                send_message(client_fd, &info.header, MC_CMD_QUIT, NULL, "Goodbye");
                 return;
             case MC_CMD_ERROR:
             default:
                 if (info.header.payload_len > 0) {
                     drain_payload(client_fd, info.header.payload_len);
                 }
-                handler_rc = send_errorf(client_fd, "Unsupported command");
+                handler_rc = send_errorf(client_fd, &info.header, "Unsupported command");
                 break;
         }
 
@@ -575,39 +1494,63 @@ static void handle_client(int client_fd, const struct sockaddr_in *addr, const m
     }
 }
 
-int mc_server_run(const mc_server_config_t *config) {
-    if (!config) {
-        errno = EINVAL;
-        return -1;
-    }
+typedef struct {
+    int fd;
+    struct sockaddr_in addr;
+    const mc_server_config_t *config;
+    unsigned int caps;
+} mc_stream_job_t;
+
+static void *stream_thread_main(void *arg) {
+    mc_stream_job_t *job = arg;
+    int fd = job->fd;
+    handle_client(fd, &job->addr, job->config, true, job->caps);
+    free(job);
+    close(fd); /* close() 시스템 콜로 스트림 종료 (FIN 프레임 전송 트리거) */
+    return NULL;
+}
 
-    if (install_signal_handlers() != 0) {
+static int accept_stream(void *ctx, uint32_t stream_id, int stream_fd) {
+    (void)stream_id;
+    mc_stream_job_t *job = malloc(sizeof(*job));
+    if (!job) {
         return -1;
     }
+    *job = *(const mc_stream_job_t *)ctx;
+    job->fd = stream_fd;
 
-    int listen_fd = setup_listener(config->port, config->backlog);
-    if (listen_fd == -1) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int rc = pthread_create(&(pthread_t){0}, &attr, stream_thread_main, job);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        free(job);
         return -1;
     }
+    return 0;
+}
 
-    const char *auth_mode = (config->auth_token && config->auth_token[0]) ? "required" : "disabled";
-    char limit_buf[64];
-    if (config->max_upload_bytes > 0) {
-        snprintf(limit_buf,
-                 sizeof(limit_buf),
-                 "%llu bytes",
-                 (unsigned long long)config->max_upload_bytes);
-    } else {
-        snprintf(limit_buf, sizeof(limit_buf), "unlimited");
-    }
-
-    printf("Mini Cloud server listening on port %u (storage=%s, auth=%s, max_upload=%s)\n",
-           config->port,
-           config->storage_dir,
-           auth_mode,
-           limit_buf);
-    fflush(stdout);
+/*
+ * Framed mode (v3): each stream the client opens runs the ordinary request
+ * loop on its own thread, and the mux interleaves their replies, so a long
+ * transfer no longer holds up a LIST sent on the same connection.
+ */
+static void serve_multiplexed(int client_fd,
+                              const struct sockaddr_in *addr,
+                              const mc_server_config_t *config,
+                              unsigned int caps) {
+    mc_stream_job_t conn = {.fd = -1, .addr = *addr, .config = config, .caps = caps};
+    mc_mux_t *mux = mc_mux_start(client_fd, accept_stream, &conn);
+    if (!mux) {
+        perror("mc_mux_start");
+        return;
+    }
+    mc_mux_wait_peer(mux);
+    mc_mux_finish(mux);
+}
 
+static int serve_forking(const mc_server_config_t *config, int listen_fd) {
     while (!g_should_terminate) {
         struct sockaddr_in client_addr;
         socklen_t addr_len = sizeof(client_addr);
@@ -620,23 +1563,263 @@ int mc_server_run(const mc_server_config_t *config) {
             continue;
         }
 
+        /* children start from the parent's copy of the index: keep it recent */
+        mc_meta_refresh();
         pid_t pid = fork(); /* fork() 시스템 콜로 자식 프로세스 생성 */
         if (pid == 0) {
             close(listen_fd); /* close() 시스템 콜로 부모 리스너 fd 정리 */
-            handle_client(client_fd, &client_addr, config);
-            close(client_fd); /* close() 시스템 콜로 클라이언트 소켓 정리 */
-        }
-
-        if (pid == 0) {
-            close(listen_fd); /* close() 시스템 콜로 부모 리스너 fd 정리 */
-            handle_client(client_fd, &client_addr, config);
+            handle_client(client_fd, &client_addr, config, false, 0);
             close(client_fd); /* close() 시스템 콜로 클라이언트 소켓 정리 */
             _exit(EXIT_SUCCESS); /* _exit() 시스템 콜로 자식 종료 */
         }
 
         close(client_fd); /* close() 시스템 콜로 부모에서 클라이언트 fd 해제 */
     }
+    return 0;
+}
+
+static const char *engine_name(mc_server_engine_t engine) {
+    switch (engine) {
+        case MC_SERVER_ENGINE_EPOLL:
+            return "epoll";
+        case MC_SERVER_ENGINE_URING:
+            return "uring";
+        case MC_SERVER_ENGINE_FORK:
+        default:
+            return "fork";
+    }
+}
+
+static int serve_listener(const mc_server_config_t *config, int listen_fd) {
+    switch (config->engine) {
+        case MC_SERVER_ENGINE_EPOLL:
+            return mc_server_run_epoll(config, listen_fd);
+        case MC_SERVER_ENGINE_URING:
+            if (mc_server_run_uring(config, listen_fd) == 0) {
+                return 0;
+            }
+            if (errno != ENOSYS && errno != EPERM && errno != ENOMEM) {
+                perror("io_uring");
+                return -1;
+            }
+            /* kernel without (usable) io_uring: same protocol, readiness-based */
+            fprintf(stderr, "io_uring unavailable (%s), falling back to epoll\n", strerror(errno));
+            return mc_server_run_epoll(config, listen_fd);
+        case MC_SERVER_ENGINE_FORK:
+        default:
+            return serve_forking(config, listen_fd);
+    }
+}
+
+/*
+ * Worker process body: owns a private SO_REUSEPORT listener so the kernel
+ * balances new connections across workers without a shared accept queue.
+ */
+static void run_worker(const mc_server_config_t *config) {
+    if (install_signal_handlers() != 0) {
+        _exit(EXIT_FAILURE);
+    }
+    int listen_fd = setup_listener(config->port, config->backlog, true);
+    if (listen_fd == -1) {
+        perror("worker listener");
+        _exit(MC_WORKER_EXIT_LISTEN);
+    }
+    int rc = serve_listener(config, listen_fd);
+    close(listen_fd); /* close() 시스템 콜로 워커 리스너 종료 */
+    _exit(rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+static pid_t spawn_worker(const mc_server_config_t *config) {
+    pid_t pid = fork(); /* fork() 시스템 콜로 워커 프로세스 생성 */
+    if (pid == 0) {
+        run_worker(config);
+    }
+    return pid;
+}
+
+static void stop_workers(pid_t *workers, int count) {
+    for (int i = 0; i < count; ++i) {
+        if (workers[i] > 0) {
+            kill(workers[i], SIGTERM); /* kill() 시스템 콜로 워커 종료 요청 */
+        }
+    }
+    for (int i = 0; i < count; ++i) {
+        if (workers[i] > 0) {
+            while (waitpid(workers[i], NULL, 0) == -1 && errno == EINTR) { /* waitpid() 시스템 콜로 워커 회수 */
+            }
+            workers[i] = 0;
+        }
+    }
+}
+
+/*
+ * Supervisor for the pre-forked pool. The parent never accepts; it only
+ * restarts workers that die and tears the pool down on SIGINT/SIGTERM.
+ */
+static int run_worker_pool(const mc_server_config_t *config) {
+    int count = config->workers;
+    pid_t *workers = calloc((size_t)count, sizeof(*workers));
+    if (!workers) {
+        return -1;
+    }
+
+    /* The parent reaps its workers explicitly, so the generic SIGCHLD reaper
+     * must not steal their exit status. */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_DFL;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+
+    for (int i = 0; i < count; ++i) {
+        workers[i] = spawn_worker(config);
+        if (workers[i] == -1) {
+            int saved = errno;
+            stop_workers(workers, i);
+            free(workers);
+            errno = saved;
+            return -1;
+        }
+    }
+
+    int rc = 0;
+    while (!g_should_terminate) {
+        int status = 0;
+        pid_t pid = waitpid(-1, &status, 0); /* waitpid() 시스템 콜로 워커 종료 감시 */
+        if (pid == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            rc = -1;
+            break;
+        }
+
+        int slot = -1;
+        for (int i = 0; i < count; ++i) {
+            if (workers[i] == pid) {
+                slot = i;
+                break;
+            }
+        }
+        if (slot == -1) {
+            continue;
+        }
+        workers[slot] = 0;
+
+        if (WIFEXITED(status) && WEXITSTATUS(status) == MC_WORKER_EXIT_LISTEN) {
+            /* Binding will not get better by retrying; give up like the
+             * single-listener path does. */
+            errno = EADDRINUSE;
+            rc = -1;
+            break;
+        }
+        if (g_should_terminate) {
+            break;
+        }
+
+        fprintf(stderr, "[supervisor] worker %ld exited, restarting\n", (long)pid);
+        workers[slot] = spawn_worker(config);
+        if (workers[slot] == -1) {
+            workers[slot] = 0;
+            rc = -1;
+            break;
+        }
+    }
+
+    int saved = errno;
+    stop_workers(workers, count);
+    free(workers);
+    errno = saved;
+    return rc;
+}
+
+int mc_server_run(const mc_server_config_t *config) {
+    if (!config) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (install_signal_handlers() != 0) {
+        return -1;
+    }
+
+    int listen_fd = -1;
+    if (config->workers <= 0) {
+        listen_fd = setup_listener(config->port, config->backlog, false);
+        if (listen_fd == -1) {
+            return -1;
+        }
+    }
 
+    const char *auth_mode = (config->auth_token && config->auth_token[0]) ? "required" : "disabled";
+    char limit_buf[64];
+    if (config->max_upload_bytes > 0) {
+        snprintf(limit_buf,
+                 sizeof(limit_buf),
+                 "%llu bytes",
+                 (unsigned long long)config->max_upload_bytes);
+    } else {
+        snprintf(limit_buf, sizeof(limit_buf), "unlimited");
+    }
+
+    char layout_err[256];
+    if (mc_storage_check_layout(config, layout_err, sizeof(layout_err)) != 0) {
+        fprintf(stderr, "[layout] %s\n", layout_err);
+        if (listen_fd != -1) {
+            close(listen_fd);
+        }
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* before any worker runs: nothing can be mid-upload. Blobs go first, so
+     * the chunk sweep no longer sees the manifests they kept alive. */
+    long blobs_removed = mc_storage_gc_blobs(config);
+    if (blobs_removed < 0) {
+        fprintf(stderr, "[blobs] garbage collection skipped: %s\n", strerror(errno));
+    } else if (blobs_removed > 0) {
+        printf("[blobs] removed %ld unreferenced blobs\n", blobs_removed);
+    }
+    if (config->storage_mode == MC_STORAGE_MODE_CHUNKED) {
+        long removed = mc_chunkstore_gc(config->storage_dir);
+        if (removed < 0) {
+            fprintf(stderr, "[chunks] garbage collection skipped: %s\n", strerror(errno));
+        } else if (removed > 0) {
+            printf("[chunks] removed %ld unreferenced chunks\n", removed);
+        }
+    }
+    long indexed = mc_storage_open_index(config);
+    if (indexed < 0) {
+        fprintf(stderr, "[meta] index disabled, LIST reads the directory: %s\n", strerror(errno));
+    } else if (config->meta_mode != MC_META_INDEX_OFF) {
+        printf("[meta] indexed %ld files\n", indexed);
+    }
+    /* shared by every process forked from here on */
+    long cache_pages = mc_cache_open(config->file_cache_bytes);
+    if (cache_pages < 0) {
+        fprintf(stderr, "[cache] hot-file cache disabled: %s\n", strerror(errno));
+    } else if (cache_pages > 0) {
+        printf("[cache] %ld MiB for files up to %u KiB\n", cache_pages * (long)(MC_CACHE_PAGE >> 20), MC_CACHE_MAX_FILE >> 10);
+    }
+
+    printf("Mini Cloud server listening on port %u (storage=%s%s%s, auth=%s, max_upload=%s, engine=%s, workers=%d)\n",
+           config->port,
+           config->storage_dir,
+           config->storage_mode == MC_STORAGE_MODE_CHUNKED      ? " chunked"
+           : config->storage_mode == MC_STORAGE_MODE_COMPRESSED ? " compressed"
+                                                                : "",
+           config->storage_layout == MC_STORAGE_LAYOUT_SHARDED ? " sharded" : "",
+           auth_mode,
+           limit_buf,
+           engine_name(config->engine),
+           config->workers > 0 ? config->workers : 1);
+    fflush(stdout);
+
+    if (config->workers > 0) {
+        return run_worker_pool(config);
+    }
+
+    int rc = serve_listener(config, listen_fd);
     close(listen_fd); /* close() 시스템 콜로 리스너 종료 */
-    return 0;
+    return rc;
 }
@@ -0,0 +1,1306 @@
+#define _GNU_SOURCE
+
+#include "mc_archive.h"
+#include "mc_cache.h"
+#include "mc_crc32c.h"
+#include "mc_lz4.h"
+#include "mc_protocol.h"
+#include "mc_server_internal.h"
+#include "mc_storage.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define MC_EPOLL_MAX_EVENTS 256
+#define MC_EPOLL_IO_CHUNK (64 * 1024)
+/* Upper bound on payload bytes consumed per readiness event so one fast
+ * uploader cannot starve the rest of the loop. */
+#define MC_EPOLL_READ_BUDGET (256 * 1024)
+#define MC_EPOLL_SENDFILE_CHUNK (1U << 20)
+
+/*
+ * Each connection walks header -> filename -> payload -> response. Only the
+ * fields needed for the current step are allocated, so an idle connection
+ * costs a few hundred bytes and one fd.
+ */
+typedef enum {
+    CONN_READ_HEADER = 0,
+    CONN_READ_FILENAME,
+    CONN_READ_PAYLOAD,
+    CONN_WRITE,
+    CONN_WAIT /* an offloaded job is producing the response */
+} conn_state_t;
+
+typedef enum {
+    SINK_DISCARD = 0,
+    SINK_UPLOAD,
+    SINK_TOKEN,
+    SINK_RANGE,
+    SINK_BEGIN,
+    SINK_HAVE,
+    SINK_QUERY,
+    SINK_BUNDLE
+} payload_sink_t;
+
+typedef struct mc_conn {
+    struct mc_conn *prev;
+    struct mc_conn *next;
+    int fd;
+    uint32_t events;
+    struct sockaddr_in addr;
+    conn_state_t state;
+    bool authenticated;
+    bool close_after_write;
+    unsigned int caps;         /* MC_AUTH_CAP_* agreed at AUTH */
+
+    mc_packet_info_t info;
+    size_t have;               /* header or filename bytes collected so far */
+    uint64_t payload_remaining; /* includes the checksum trailer, if any */
+    size_t trailer_len;        /* MC_CHECKSUM_SIZE when the payload carries one */
+    uint32_t trailer;          /* received trailer, network order */
+    uint32_t crc;              /* CRC32C of the upload or download body so far */
+    payload_sink_t sink;
+    bool sink_failed;
+    int problem;               /* decoder error for the upload, see mc_server_body_error */
+    mc_upload_t *upload;       /* only while an UPLOAD payload is arriving */
+    mc_lz4_decoder_t *decoder; /* only while a compressed UPLOAD payload is arriving */
+    int pipe_fds[2];           /* splice() relay for the upload, -1 if unused */
+    char *token;               /* only while an AUTH token is arriving */
+    mc_list_query_t *query;    /* only while a LIST_QUERY is arriving */
+    uint8_t *bundle;           /* only while a BUNDLE_* payload is arriving */
+    mc_range_if_t range;       /* DOWNLOAD_RANGE request, network order until used */
+    mc_upload_begin_t begin;   /* UPLOAD_BEGIN/COMMIT request, likewise */
+    mc_have_t digest;          /* HAVE request, likewise */
+
+    char *out;                 /* queued response bytes */
+    size_t out_len;
+    size_t out_off;
+    int file_fd;               /* DOWNLOAD body sent after out, -1 if none */
+    bool no_sendfile;          /* file_fd cannot be sendfile()d, use pread+write */
+    mc_mapped_body_t map;      /* MC_DOWNLOAD_IO=mmap: the body is written from here instead */
+    bool checksum_pending;     /* DOWNLOAD body is hashed; its trailer goes last */
+    bool crc_known;            /* stored LZ4 blocks: crc came with them */
+    uint64_t file_off;
+    uint64_t file_remaining;
+    mc_lz4_encoder_t *encoder; /* compressed DOWNLOAD body: blocks go out one at a time */
+    mc_archive_t *archive;     /* ARCHIVE body: the tar stream, produced a block at a time */
+    uint8_t *block;            /* the encoded block being sent (MC_LZ4_BLOCK_BOUND bytes) */
+    size_t block_len;
+    size_t block_off;
+    mc_offload_job_t *job;     /* only while CONN_WAIT */
+} mc_conn_t;
+
+typedef struct {
+    const mc_server_config_t *config;
+    int epoll_fd;
+    int listen_fd;
+    int spare_fd;
+    mc_offload_t *offload;     /* NULL: offloadable work runs inline */
+    mc_conn_t *conns;
+    size_t conn_count;
+} mc_loop_t;
+
+static uint8_t g_scratch[MC_EPOLL_IO_CHUNK];
+static uint8_t g_cached[MC_CACHE_MAX_FILE];
+static uint8_t g_cached_block[MC_LZ4_BLOCK_BOUND];
+
+static void raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) { /* getrlimit() 시스템 콜로 fd 한도 확인 */
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl); /* setrlimit() 시스템 콜로 fd 한도 상향 */
+    }
+}
+
+static int conn_set_events(mc_loop_t *loop, mc_conn_t *conn, uint32_t events) {
+    if (conn->events == events) {
+        return 0;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = conn;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev) == -1) { /* epoll_ctl() 시스템 콜로 관심 이벤트 변경 */
+        return -1;
+    }
+    conn->events = events;
+    return 0;
+}
+
+static void conn_clear_response(mc_conn_t *conn) {
+    free(conn->out);
+    conn->out = NULL;
+    conn->out_len = 0;
+    conn->out_off = 0;
+    if (conn->file_fd != -1) {
+        close(conn->file_fd);
+        conn->file_fd = -1;
+    }
+    mc_server_unmap_body(&conn->map);
+    conn->file_off = 0;
+    conn->file_remaining = 0;
+    conn->no_sendfile = false;
+    conn->checksum_pending = false;
+    conn->crc_known = false;
+    free(conn->encoder);
+    conn->encoder = NULL;
+    mc_archive_close(conn->archive);
+    conn->archive = NULL;
+    free(conn->block);
+    conn->block = NULL;
+    conn->block_len = 0;
+    conn->block_off = 0;
+}
+
+static void conn_clear_payload(mc_conn_t *conn) {
+    if (conn->upload) {
+        mc_storage_abort_upload(conn->upload);
+        free(conn->upload);
+        conn->upload = NULL;
+    }
+    free(conn->decoder);
+    conn->decoder = NULL;
+    mc_server_close_splice_pipe(conn->pipe_fds);
+    free(conn->token);
+    conn->token = NULL;
+    free(conn->query);
+    conn->query = NULL;
+    free(conn->bundle);
+    conn->bundle = NULL;
+    conn->sink = SINK_DISCARD;
+    conn->sink_failed = false;
+    conn->problem = 0;
+}
+
+static void conn_close(mc_loop_t *loop, mc_conn_t *conn) {
+    if (conn->job) {
+        conn->job->owner = NULL; /* freed when it comes back */
+    }
+    conn_clear_payload(conn);
+    conn_clear_response(conn);
+    close(conn->fd); /* close() 시스템 콜로 클라이언트 소켓 정리 (epoll 등록도 함께 해제) */
+
+    if (conn->prev) {
+        conn->prev->next = conn->next;
+    } else {
+        loop->conns = conn->next;
+    }
+    if (conn->next) {
+        conn->next->prev = conn->prev;
+    }
+    loop->conn_count--;
+    free(conn);
+}
+
+/* Queues the reply header, filename and the body pieces as one buffer. */
+static int conn_queue_iov(mc_conn_t *conn,
+                          mc_command_t cmd,
+                          const char *filename,
+                          uint64_t payload_len,
+                          const struct iovec *body,
+                          int count) {
+    mc_packet_header_t header;
+    if (mc_build_reply_header(&header, &conn->info.header, cmd, filename, payload_len) != 0) {
+        return -1;
+    }
+    size_t name_len = header.filename_len;
+    size_t header_len = mc_header_wire_size(&header);
+    mc_header_host_to_network(&header);
+
+    size_t body_len = 0;
+    for (int i = 0; i < count; ++i) {
+        body_len += body[i].iov_len;
+    }
+    char *buf = malloc(header_len + name_len + body_len);
+    if (!buf) {
+        return -1;
+    }
+    memcpy(buf, &header, header_len);
+    if (name_len > 0) {
+        memcpy(buf + header_len, filename, name_len);
+    }
+    size_t at = header_len + name_len;
+    for (int i = 0; i < count; ++i) {
+        if (body[i].iov_len > 0) {
+            memcpy(buf + at, body[i].iov_base, body[i].iov_len);
+            at += body[i].iov_len;
+        }
+    }
+
+    free(conn->out);
+    conn->out = buf;
+    conn->out_len = at;
+    conn->out_off = 0;
+    return 0;
+}
+
+static int conn_queue(mc_conn_t *conn,
+                      mc_command_t cmd,
+                      const char *filename,
+                      uint64_t payload_len,
+                      const void *body,
+                      size_t body_len) {
+    struct iovec piece = {.iov_base = (void *)body, .iov_len = body_len};
+    return conn_queue_iov(conn, cmd, filename, payload_len, &piece, 1);
+}
+
+static int conn_queue_message(mc_conn_t *conn, mc_command_t cmd, const char *filename, const char *text) {
+    size_t len = strlen(text);
+    return conn_queue(conn, cmd, filename, (uint64_t)len, text, len);
+}
+
+static int conn_queue_errorf(mc_conn_t *conn, const char *fmt, ...) {
+    char buffer[512];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buffer, sizeof(buffer), fmt, ap);
+    va_end(ap);
+    return conn_queue_message(conn, MC_CMD_ERROR, NULL, buffer);
+}
+
+/* A hot-file cache hit (in g_cached): the whole reply is queued from memory. */
+static int queue_cached(mc_conn_t *conn, bool ranged, const mc_download_t *body, unsigned int applied) {
+    mc_range_if_t served;
+    size_t served_len = mc_server_range_prefix(&conn->info.header, body, &served);
+    uint32_t trailer;
+    struct iovec iov[3];
+    int count = 0;
+    if (served_len > 0) {
+        iov[count++] = (struct iovec){.iov_base = &served, .iov_len = served_len};
+    }
+    int pieces = mc_server_cached_body(g_cached, body, applied, g_cached_block, &trailer, iov + count);
+    if (pieces < 0) {
+        return -1;
+    }
+    return conn_queue_iov(conn,
+                          ranged ? MC_CMD_DOWNLOAD_RANGE : MC_CMD_DOWNLOAD,
+                          conn->info.filename,
+                          served_len + body->length,
+                          iov,
+                          count + pieces);
+}
+
+/* DOWNLOAD, or DOWNLOAD_RANGE once conn->range has arrived. */
+static int queue_download(mc_loop_t *loop, mc_conn_t *conn, bool ranged) {
+    char err[256];
+    unsigned int applied = mc_reply_caps(conn->caps, conn->info.header.command);
+    mc_download_t body;
+    if (ranged) {
+        mc_range_if_network_to_host(&conn->range);
+    }
+    int hit = mc_storage_cached_reply(loop->config, conn->info.filename, ranged ? &conn->range : NULL, g_cached, &body, err,
+                                      sizeof(err));
+    if (hit != 0) {
+        return hit < 0 ? conn_queue_errorf(conn, "%s", err) : queue_cached(conn, ranged, &body, applied);
+    }
+    if (mc_storage_open_reply(loop->config, conn->info.filename, ranged ? &conn->range : NULL, applied, &body, err, sizeof(err)) !=
+        0) {
+        return conn_queue_errorf(conn, "%s", err);
+    }
+
+    int rc;
+    if (ranged) {
+        mc_range_if_t served;
+        size_t served_len = mc_server_range_prefix(&conn->info.header, &body, &served);
+        rc = conn_queue(conn, MC_CMD_DOWNLOAD_RANGE, conn->info.filename, served_len + body.length, &served, served_len);
+    } else {
+        rc = conn_queue(conn, MC_CMD_DOWNLOAD, conn->info.filename, body.length, NULL, 0);
+    }
+    if (rc != 0) {
+        close(body.fd);
+        return -1;
+    }
+    conn->file_fd = body.fd;
+    conn->file_off = body.offset;
+    conn->file_remaining = body.length;
+
+    if (body.stored_blocks) {
+        /* the container's blocks are already the wire form: sendfile them as they are */
+        conn->file_off = body.wire_offset;
+        conn->file_remaining = body.wire_len;
+        conn->checksum_pending = (applied & MC_AUTH_CAP_CRC32C) != 0;
+        conn->crc = body.crc;
+        conn->crc_known = true;
+        (void)mc_server_map_body(loop->config, conn->file_fd, conn->file_off, conn->file_remaining, &conn->map);
+        return 0;
+    }
+    if (applied != 0) {
+        /* the body has to pass through user space to be hashed or compressed */
+        conn->no_sendfile = true;
+        conn->checksum_pending = (applied & MC_AUTH_CAP_CRC32C) != 0;
+        conn->crc = 0;
+    }
+    if (applied & MC_AUTH_CAP_LZ4) {
+        conn->encoder = malloc(sizeof(*conn->encoder));
+        conn->block = malloc(MC_LZ4_BLOCK_BOUND);
+        if (!conn->encoder || !conn->block) {
+            return -1;
+        }
+        mc_lz4_encoder_init(conn->encoder);
+    }
+    (void)mc_server_map_body(loop->config, conn->file_fd, conn->file_off, conn->file_remaining, &conn->map);
+    return 0;
+}
+
+/* ARCHIVE: only the header is queued; the tar stream follows a block at a time. */
+static int queue_archive(mc_loop_t *loop, mc_conn_t *conn) {
+    char err[256];
+    uint64_t total = 0;
+    if (mc_archive_open(loop->config, conn->info.filename, &conn->archive, &total, err, sizeof(err)) != 0) {
+        return conn_queue_errorf(conn, "%s", err);
+    }
+    if (conn_queue(conn, MC_CMD_ARCHIVE, conn->info.filename, total, NULL, 0) != 0) {
+        return -1;
+    }
+    unsigned int applied = mc_reply_caps(conn->caps, conn->info.header.command);
+    conn->file_remaining = total;
+    conn->checksum_pending = (applied & MC_AUTH_CAP_CRC32C) != 0;
+    conn->crc = 0;
+    conn->block = malloc(MC_LZ4_BLOCK_BOUND);
+    if (!conn->block) {
+        return -1;
+    }
+    if (applied & MC_AUTH_CAP_LZ4) {
+        conn->encoder = malloc(sizeof(*conn->encoder));
+        if (!conn->encoder) {
+            return -1;
+        }
+        mc_lz4_encoder_init(conn->encoder);
+    }
+    return 0;
+}
+
+static int queue_list(mc_loop_t *loop, mc_conn_t *conn) {
+    char err[256];
+    char *listing = NULL;
+    size_t len = 0;
+    if (mc_storage_build_listing(loop->config, conn->info.filename, &listing, &len, err, sizeof(err)) != 0) {
+        return conn_queue_errorf(conn, "%s", err);
+    }
+    int rc = conn_queue(conn, MC_CMD_LIST, NULL, (uint64_t)len, listing, len);
+    free(listing);
+    return rc;
+}
+
+static int queue_delete(mc_loop_t *loop, mc_conn_t *conn) {
+    char err[256];
+    if (mc_storage_delete(loop->config, conn->info.filename, err, sizeof(err)) != 0) {
+        return conn_queue_errorf(conn, "%s", err);
+    }
+    return conn_queue_message(conn, MC_CMD_DELETE, conn->info.filename, "DELETE OK");
+}
+
+static int queue_directory(mc_loop_t *loop, mc_conn_t *conn) {
+    char err[256];
+    bool make = conn->info.header.command == MC_CMD_MKDIR;
+    int rc = make ? mc_storage_mkdir(loop->config, conn->info.filename, err, sizeof(err))
+                  : mc_storage_rmdir(loop->config, conn->info.filename, err, sizeof(err));
+    if (rc != 0) {
+        return conn_queue_errorf(conn, "%s", err);
+    }
+    return conn_queue_message(conn, (mc_command_t)conn->info.header.command, conn->info.filename,
+                              make ? "MKDIR OK" : "RMDIR OK");
+}
+
+/* The response to a job that has run, offloaded or not. */
+static int queue_offloaded(mc_conn_t *conn, const mc_offload_job_t *job) {
+    if (job->rc != 0) {
+        return conn_queue_errorf(conn, "%s", job->err);
+    }
+    if (job->command == MC_CMD_HAVE) {
+        return conn_queue_message(conn, MC_CMD_HAVE, conn->info.filename, job->stored ? MC_HAVE_STORED : MC_HAVE_MISSING);
+    }
+    return conn_queue(conn, MC_CMD_SIGNATURES, conn->info.filename, (uint64_t)job->payload_len, job->payload,
+                      job->payload_len);
+}
+
+/*
+ * Runs job on a thread, leaving conn in CONN_WAIT with no events of its own
+ * until it comes back (see reap_offloaded), or inline when that cannot be.
+ */
+static int conn_offload(mc_loop_t *loop, mc_conn_t *conn, mc_offload_job_t *job) {
+    snprintf(job->filename, sizeof(job->filename), "%s", conn->info.filename);
+    job->owner = conn;
+    if (loop->offload && mc_offload_submit(loop->offload, job) == 0) {
+        conn->job = job;
+        return 0;
+    }
+    mc_offload_run(loop->config, job);
+    int rc = queue_offloaded(conn, job);
+    mc_offload_free_job(job);
+    return rc;
+}
+
+/* SIGNATURES reads the whole file: offloaded. */
+static int queue_signatures(mc_loop_t *loop, mc_conn_t *conn) {
+    mc_offload_job_t *job = calloc(1, sizeof(*job));
+    if (!job) {
+        return -1;
+    }
+    job->command = MC_CMD_SIGNATURES;
+    return conn_offload(loop, conn, job);
+}
+
+/* HAVE once conn->digest has arrived; hashing an unindexed copy is offloaded. */
+static int queue_have(mc_loop_t *loop, mc_conn_t *conn) {
+    char err[256];
+    bool stored = false;
+    mc_have_network_to_host(&conn->digest);
+    int rc = mc_storage_have_unhashed(loop->config, conn->info.filename, &conn->digest, &stored, err, sizeof(err));
+    if (rc < 0) {
+        return conn_queue_errorf(conn, "%s", err);
+    }
+    if (rc == 0) {
+        return conn_queue_message(conn, MC_CMD_HAVE, conn->info.filename, stored ? MC_HAVE_STORED : MC_HAVE_MISSING);
+    }
+    mc_offload_job_t *job = calloc(1, sizeof(*job));
+    if (!job) {
+        return -1;
+    }
+    job->command = MC_CMD_HAVE;
+    job->have = conn->digest;
+    return conn_offload(loop, conn, job);
+}
+
+/* LIST_QUERY once conn->query has arrived. */
+static int queue_list_query(mc_loop_t *loop, mc_conn_t *conn) {
+    char err[256];
+    uint8_t *page = NULL;
+    size_t len = 0;
+    mc_list_query_network_to_host(conn->query);
+    if (mc_storage_query_listing(loop->config, conn->info.filename, conn->query, &page, &len, err, sizeof(err)) != 0) {
+        return conn_queue_errorf(conn, "%s", err);
+    }
+    int rc = conn_queue(conn, MC_CMD_LIST_QUERY, NULL, (uint64_t)len, page, len);
+    free(page);
+    return rc;
+}
+
+/* BUNDLE_UPLOAD or BUNDLE_DOWNLOAD once conn->bundle has arrived. */
+static int queue_bundle(mc_loop_t *loop, mc_conn_t *conn) {
+    char err[256];
+    size_t len = (size_t)conn->info.header.payload_len;
+    if (conn->info.header.command == MC_CMD_BUNDLE_UPLOAD) {
+        long stored = 0;
+        if (mc_storage_store_bundle(loop->config, conn->bundle, len, &stored, err, sizeof(err)) != 0) {
+            return conn_queue_errorf(conn, "%s", err);
+        }
+        char text[64];
+        snprintf(text, sizeof(text), "UPLOAD OK: %ld files", stored);
+        return conn_queue_message(conn, MC_CMD_BUNDLE_UPLOAD, NULL, text);
+    }
+
+    uint8_t *reply = NULL;
+    size_t reply_len = 0;
+    if (mc_storage_build_bundle(loop->config, conn->bundle, len, &reply, &reply_len, err, sizeof(err)) != 0) {
+        return conn_queue_errorf(conn, "%s", err);
+    }
+    int rc = conn_queue(conn, MC_CMD_BUNDLE_DOWNLOAD, NULL, (uint64_t)reply_len, reply, reply_len);
+    free(reply);
+    return rc;
+}
+
+/* UPLOAD_BEGIN or UPLOAD_COMMIT once conn->begin has arrived. */
+static int queue_upload_session(mc_loop_t *loop, mc_conn_t *conn) {
+    char err[256];
+    mc_upload_begin_network_to_host(&conn->begin);
+    if (conn->info.header.command == MC_CMD_UPLOAD_COMMIT) {
+        if (mc_storage_commit_session(loop->config, conn->info.filename, &conn->begin, err, sizeof(err)) != 0) {
+            return conn_queue_errorf(conn, "%s", err);
+        }
+        return conn_queue_message(conn, MC_CMD_UPLOAD_COMMIT, conn->info.filename, "UPLOAD OK");
+    }
+
+    char key[MC_UPLOAD_KEY_LEN + 1];
+    uint64_t committed = 0;
+    if (mc_storage_begin_session(loop->config, conn->info.filename, &conn->begin, key, &committed, err, sizeof(err)) != 0) {
+        return conn_queue_errorf(conn, "%s", err);
+    }
+    mc_range_t progress = {.offset = committed, .length = conn->begin.total_size};
+    mc_range_host_to_network(&progress);
+    return conn_queue(conn, MC_CMD_UPLOAD_BEGIN, key, MC_RANGE_SIZE, &progress, sizeof(progress));
+}
+
+/* Called once the whole payload has been consumed; produces the response. */
+static int finish_request(mc_loop_t *loop, mc_conn_t *conn) {
+    const mc_server_config_t *config = loop->config;
+    char err[256];
+    int rc = 0;
+
+    if (conn->sink == SINK_UPLOAD) {
+        mc_upload_t *upload = conn->upload;
+        conn->upload = NULL;
+        uint64_t committed = 0;
+        if (conn->problem == 0 && conn->decoder && !mc_lz4_decoder_idle(conn->decoder)) {
+            conn->problem = EPROTO; /* ended inside a block */
+        }
+        if (conn->problem == 0 && conn->trailer_len > 0 && ntohl(conn->trailer) != conn->crc) {
+            conn->problem = EBADMSG;
+        }
+        if (conn->sink_failed) {
+            mc_storage_abort_upload(upload);
+            rc = conn_queue_errorf(conn, "Failed to receive file data");
+        } else if (conn->problem != 0) {
+            mc_storage_reject_upload(upload);
+            mc_server_body_error(config, conn->problem, err, sizeof(err));
+            rc = conn_queue_errorf(conn, "%s", err);
+        } else if (upload->keep_partial) {
+            if (mc_storage_finish_append(upload, &committed, err, sizeof(err)) != 0) {
+                rc = conn_queue_errorf(conn, "%s", err);
+            } else {
+                mc_range_t progress = {.offset = committed, .length = 0};
+                mc_range_host_to_network(&progress);
+                rc = conn_queue(conn, MC_CMD_UPLOAD_APPEND, conn->info.filename, MC_RANGE_SIZE, &progress, sizeof(progress));
+            }
+        } else if (conn->info.header.command == MC_CMD_DELTA) {
+            if (mc_storage_apply_delta(config, conn->info.filename, upload, err, sizeof(err)) != 0) {
+                rc = conn_queue_errorf(conn, "%s", err);
+            } else {
+                rc = conn_queue_message(conn, MC_CMD_DELTA, conn->info.filename, "UPLOAD OK");
+            }
+        } else if (mc_storage_commit_upload(upload, err, sizeof(err)) != 0) {
+            rc = conn_queue_errorf(conn, "%s", err);
+        } else {
+            rc = conn_queue_message(conn, MC_CMD_UPLOAD, conn->info.filename, "UPLOAD OK");
+        }
+        free(upload);
+    } else if (conn->sink == SINK_TOKEN) {
+        conn->token[conn->info.header.payload_len] = '\0';
+        if (strcmp(conn->token, config->auth_token) != 0) {
+            rc = conn_queue_errorf(conn, "Invalid auth token");
+            conn->close_after_write = true;
+        } else {
+            char options[MC_AUTH_ECHO_MAX];
+            conn->caps = mc_server_auth_options(&conn->info, options, sizeof(options));
+            conn->authenticated = true;
+            rc = conn_queue_message(conn, MC_CMD_AUTH, options, "AUTH OK");
+        }
+    } else if (conn->sink == SINK_RANGE) {
+        rc = queue_download(loop, conn, true);
+    } else if (conn->sink == SINK_BEGIN) {
+        rc = queue_upload_session(loop, conn);
+    } else if (conn->sink == SINK_HAVE) {
+        rc = queue_have(loop, conn);
+    } else if (conn->sink == SINK_QUERY) {
+        rc = queue_list_query(loop, conn);
+    } else if (conn->sink == SINK_BUNDLE) {
+        rc = queue_bundle(loop, conn);
+    } else if (!conn->out) {
+        switch (conn->info.header.command) {
+            case MC_CMD_DOWNLOAD:
+                rc = queue_download(loop, conn, false);
+                break;
+            case MC_CMD_ARCHIVE:
+                rc = queue_archive(loop, conn);
+                break;
+            case MC_CMD_LIST:
+                rc = queue_list(loop, conn);
+                break;
+            case MC_CMD_SIGNATURES:
+                rc = queue_signatures(loop, conn);
+                break;
+            case MC_CMD_DELETE:
+                rc = queue_delete(loop, conn);
+                break;
+            case MC_CMD_MKDIR:
+            case MC_CMD_RMDIR:
+                rc = queue_directory(loop, conn);
+                break;
+            case MC_CMD_QUIT:
+                rc = conn_queue_message(conn, MC_CMD_QUIT, NULL, "Goodbye");
+                conn->close_after_write = true;
+                break;
+            case MC_CMD_ERROR:
+            default:
+                rc = conn_queue_errorf(conn, "Unsupported command");
+                break;
+        }
+    }
+
+    conn_clear_payload(conn);
+    if (conn->job) {
+        conn->state = CONN_WAIT;
+        return rc != 0 ? rc : conn_set_events(loop, conn, 0);
+    }
+    conn->state = CONN_WRITE;
+    return rc;
+}
+
+/*
+ * Decides where the payload goes once header and filename are known. Requests
+ * rejected up front get their error queued now and the payload discarded.
+ */
+static int start_payload(mc_loop_t *loop, mc_conn_t *conn) {
+    const mc_server_config_t *config = loop->config;
+    const mc_packet_header_t *header = &conn->info.header;
+    char err[256];
+    int rc = 0;
+
+    mc_server_log_command(&conn->addr, &conn->info);
+
+    unsigned int applied = mc_request_caps(conn->caps, header->command);
+    conn->trailer_len = (applied & MC_AUTH_CAP_CRC32C) ? MC_CHECKSUM_SIZE : 0U;
+    conn->payload_remaining = header->payload_len + conn->trailer_len;
+    conn->crc = 0;
+    conn->sink = SINK_DISCARD;
+    conn->state = CONN_READ_PAYLOAD;
+
+    if (!conn->authenticated && header->command != MC_CMD_AUTH) {
+        rc = conn_queue_errorf(conn, "Authentication required");
+    } else if (header->command == MC_CMD_UPLOAD || header->command == MC_CMD_UPLOAD_APPEND ||
+               header->command == MC_CMD_DELTA) {
+        /* a DELTA payload lands in a temp file like an upload and is applied at the end */
+        mc_upload_t *upload = malloc(sizeof(*upload));
+        /* a compressed payload is held to the limit as it decodes instead */
+        uint64_t checked_len = (applied & MC_AUTH_CAP_LZ4) ? 0 : header->payload_len;
+        int begun = -1;
+        if (upload && header->command != MC_CMD_UPLOAD_APPEND) {
+            begun = mc_storage_begin_upload(config, conn->info.filename, checked_len, upload, err, sizeof(err));
+        } else if (upload) {
+            begun = mc_storage_begin_append(config, conn->info.filename, checked_len, upload, err, sizeof(err));
+        }
+        if (!upload) {
+            rc = conn_queue_errorf(conn, "Out of memory");
+        } else if (begun != 0) {
+            free(upload);
+            rc = conn_queue_errorf(conn, "%s", err);
+        } else {
+            conn->upload = upload;
+            conn->sink = SINK_UPLOAD;
+            if (applied & MC_AUTH_CAP_LZ4) {
+                conn->decoder = malloc(sizeof(*conn->decoder));
+                if (!conn->decoder) {
+                    return -1;
+                }
+                mc_lz4_decoder_init(conn->decoder, mc_storage_upload_room(config, upload));
+            } else if (header->payload_len > 0 && applied == 0) {
+                /* without a pipe the payload is simply read and written (and
+                 * a checksummed one has to be read to be hashed) */
+                (void)mc_server_open_splice_pipe(conn->pipe_fds);
+            }
+        }
+    } else if (header->command == MC_CMD_DOWNLOAD_RANGE) {
+        if (header->payload_len != MC_RANGE_SIZE && header->payload_len != MC_RANGE_IF_SIZE) {
+            rc = conn_queue_errorf(conn, "Invalid range request");
+        } else {
+            memset(&conn->range, 0, sizeof(conn->range)); /* an mc_range_t request leaves no validator */
+            conn->sink = SINK_RANGE;
+        }
+    } else if (header->command == MC_CMD_UPLOAD_BEGIN || header->command == MC_CMD_UPLOAD_COMMIT) {
+        if (header->payload_len != sizeof(mc_upload_begin_t)) {
+            rc = conn_queue_errorf(conn, "Invalid upload request");
+        } else {
+            conn->sink = SINK_BEGIN;
+        }
+    } else if (header->command == MC_CMD_HAVE) {
+        if (header->payload_len != sizeof(mc_have_t)) {
+            rc = conn_queue_errorf(conn, "Invalid have request");
+        } else {
+            conn->sink = SINK_HAVE;
+        }
+    } else if (header->command == MC_CMD_LIST_QUERY) {
+        if (header->payload_len != sizeof(mc_list_query_t)) {
+            rc = conn_queue_errorf(conn, "Invalid list query");
+        } else {
+            conn->query = malloc(sizeof(*conn->query));
+            if (!conn->query) {
+                return -1;
+            }
+            conn->sink = SINK_QUERY;
+        }
+    } else if (header->command == MC_CMD_BUNDLE_UPLOAD || header->command == MC_CMD_BUNDLE_DOWNLOAD) {
+        if (header->payload_len > MC_BUNDLE_WIRE_MAX) {
+            rc = conn_queue_errorf(conn, "Bundle too large");
+        } else {
+            conn->bundle = malloc(header->payload_len ? (size_t)header->payload_len : 1U);
+            if (!conn->bundle) {
+                return -1;
+            }
+            conn->sink = SINK_BUNDLE;
+        }
+    } else if (header->command == MC_CMD_AUTH) {
+        char options[MC_AUTH_ECHO_MAX];
+        unsigned int accepted = mc_server_auth_options(&conn->info, options, sizeof(options));
+        if (conn->authenticated) {
+            conn->caps = accepted;
+            rc = conn_queue_message(conn, MC_CMD_AUTH, options, "Already authenticated");
+        } else if (!config->auth_token || !config->auth_token[0]) {
+            conn->authenticated = true;
+            conn->caps = accepted;
+            rc = conn_queue_message(conn, MC_CMD_AUTH, options, "AUTH not required");
+        } else if (header->payload_len == 0 || header->payload_len > MC_MAX_AUTH_TOKEN_LEN) {
+            rc = conn_queue_errorf(conn, "Invalid auth token length");
+        } else {
+            conn->token = malloc((size_t)header->payload_len + 1);
+            if (!conn->token) {
+                return -1;
+            }
+            conn->sink = SINK_TOKEN;
+        }
+    }
+
+    if (rc != 0) {
+        return -1;
+    }
+    if (conn->payload_remaining == 0) {
+        return finish_request(loop, conn);
+    }
+    return 0;
+}
+
+static void upload_write(mc_conn_t *conn, const uint8_t *data, size_t len) {
+    while (len > 0 && !conn->sink_failed) {
+        ssize_t written = write(conn->upload->fd, data, len); /* write() 시스템 콜로 파일 저장 */
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            /* keep draining so the client still gets an answer */
+            conn->sink_failed = true;
+            break;
+        }
+        data += written;
+        len -= (size_t)written;
+    }
+}
+
+/* Compressed upload: decodes what arrived and writes out each finished block. */
+static void upload_decode(mc_conn_t *conn, const uint8_t *data, size_t len) {
+    while (len > 0 && !conn->sink_failed && conn->problem == 0) {
+        int got = mc_lz4_decoder_push(conn->decoder, &data, &len);
+        if (got < 0) {
+            conn->problem = errno; /* the rest is drained, then rejected */
+        } else if (got == 1) {
+            if (conn->trailer_len > 0) {
+                conn->crc = mc_crc32c_update(conn->crc, conn->decoder->out, conn->decoder->out_len);
+            }
+            upload_write(conn, conn->decoder->out, conn->decoder->out_len);
+        }
+    }
+}
+
+static void consume_payload(mc_conn_t *conn, const uint8_t *data, size_t len) {
+    uint64_t payload_len = conn->info.header.payload_len;
+    uint64_t offset = payload_len + conn->trailer_len - conn->payload_remaining;
+    conn->payload_remaining -= (uint64_t)len;
+
+    if (offset + len > payload_len) {
+        /* the last trailer_len bytes are the checksum, not payload */
+        size_t body = offset < payload_len ? (size_t)(payload_len - offset) : 0U;
+        memcpy((uint8_t *)&conn->trailer + (offset + body - payload_len), data + body, len - body);
+        len = body;
+    }
+
+    switch (conn->sink) {
+        case SINK_UPLOAD:
+            if (conn->decoder) {
+                upload_decode(conn, data, len);
+                break;
+            }
+            if (conn->trailer_len > 0) {
+                conn->crc = mc_crc32c_update(conn->crc, data, len);
+            }
+            upload_write(conn, data, len);
+            break;
+        case SINK_TOKEN:
+            memcpy(conn->token + offset, data, len);
+            break;
+        case SINK_RANGE:
+            memcpy((uint8_t *)&conn->range + offset, data, len);
+            break;
+        case SINK_BEGIN:
+            memcpy((uint8_t *)&conn->begin + offset, data, len);
+            break;
+        case SINK_HAVE:
+            memcpy((uint8_t *)&conn->digest + offset, data, len);
+            break;
+        case SINK_QUERY:
+            memcpy((uint8_t *)conn->query + offset, data, len);
+            break;
+        case SINK_BUNDLE:
+            memcpy(conn->bundle + offset, data, len);
+            break;
+        case SINK_DISCARD:
+        default:
+            break;
+    }
+}
+
+/*
+ * Bodies sent a block at a time: a compressed DOWNLOAD, read and encoded one
+ * block at a time, and an ARCHIVE stream, produced block by block (and
+ * encoded too when compressed). A partly sent block is kept across EAGAIN.
+ * Same returns as conn_flush().
+ */
+static int flush_blocks(mc_conn_t *conn) {
+    while (conn->file_remaining > 0 || conn->block_off < conn->block_len) {
+        if (conn->block_off == conn->block_len) {
+            size_t chunk = conn->file_remaining > MC_LZ4_BLOCK_MAX ? MC_LZ4_BLOCK_MAX : (size_t)conn->file_remaining;
+            const uint8_t *src = g_scratch;
+            ssize_t read_bytes = (ssize_t)chunk;
+            if (conn->archive) {
+                /* uncompressed, the stream is produced straight into the block being sent */
+                uint8_t *dst = conn->encoder ? g_scratch : conn->block;
+                read_bytes = (ssize_t)mc_archive_read(conn->archive, dst, chunk);
+                src = dst;
+            } else if (conn->map.base) {
+                src = mc_server_mapped_at(&conn->map, conn->file_off);
+            } else {
+                read_bytes = pread(conn->file_fd, g_scratch, chunk, (off_t)conn->file_off); /* pread() 시스템 콜로 파일 읽기 */
+            }
+            if (read_bytes < 0 && errno == EINTR) {
+                continue;
+            }
+            if (read_bytes <= 0) {
+                return -1; /* file shrank underneath us; the length is already on the wire */
+            }
+            if (conn->checksum_pending) {
+                conn->crc = mc_crc32c_update(conn->crc, src, (size_t)read_bytes);
+            }
+            conn->block_len = conn->encoder ? mc_lz4_encode_block(conn->encoder, src, (size_t)read_bytes, conn->block)
+                                            : (size_t)read_bytes;
+            conn->block_off = 0;
+            conn->file_off += (uint64_t)read_bytes;
+            conn->file_remaining -= (uint64_t)read_bytes;
+        }
+        /* MSG_MORE while more blocks or the trailer follow, so a short block does not leave alone */
+        int flags = MSG_NOSIGNAL | (conn->file_remaining > 0 || conn->checksum_pending ? MSG_MORE : 0);
+        ssize_t written = send(conn->fd, conn->block + conn->block_off, conn->block_len - conn->block_off, flags); /* send() 시스템 콜로 블록 전송 */
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            return -1;
+        }
+        conn->block_off += (size_t)written;
+    }
+    return 1;
+}
+
+/* Returns 1 when the response is fully sent, 0 when the socket is full. */
+static int conn_flush(mc_conn_t *conn) {
+again:
+    while (conn->out_off < conn->out_len) {
+        /* the header shares its segment with the body behind it (MSG_MORE) */
+        int flags = MSG_NOSIGNAL | (conn->file_remaining > 0 ? MSG_MORE : 0);
+        ssize_t written = send(conn->fd, conn->out + conn->out_off, conn->out_len - conn->out_off, flags); /* send() 시스템 콜로 응답 전송 */
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            return -1;
+        }
+        conn->out_off += (size_t)written;
+    }
+
+    if (conn->encoder || conn->archive) {
+        int rc = flush_blocks(conn);
+        if (rc <= 0) {
+            return rc;
+        }
+    }
+    while (conn->file_remaining > 0) {
+        size_t chunk = conn->file_remaining > MC_EPOLL_SENDFILE_CHUNK ? MC_EPOLL_SENDFILE_CHUNK
+                                                                      : (size_t)conn->file_remaining;
+        ssize_t written = -1;
+        const uint8_t *src = g_scratch;
+        int flags = MSG_NOSIGNAL | (chunk < conn->file_remaining || conn->checksum_pending ? MSG_MORE : 0);
+        if (conn->map.base) {
+            src = mc_server_mapped_at(&conn->map, conn->file_off);
+            written = send(conn->fd, src, chunk, flags); /* send() 시스템 콜로 매핑된 페이지를 그대로 전송 */
+        } else if (!conn->no_sendfile) {
+            off_t offset = (off_t)conn->file_off;
+            written = sendfile(conn->fd, conn->file_fd, &offset, chunk); /* sendfile() 시스템 콜로 커널 내 복사 전송 */
+            if (written < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                conn->no_sendfile = true;
+                continue;
+            }
+        } else {
+            if (chunk > sizeof(g_scratch)) {
+                chunk = sizeof(g_scratch);
+            }
+            ssize_t read_bytes = pread(conn->file_fd, g_scratch, chunk, (off_t)conn->file_off); /* pread() 시스템 콜로 파일 읽기 */
+            if (read_bytes < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+            if (read_bytes == 0) {
+                return -1;
+            }
+            if ((uint64_t)read_bytes < conn->file_remaining) {
+                flags |= MSG_MORE;
+            }
+            written = send(conn->fd, g_scratch, (size_t)read_bytes, flags); /* send() 시스템 콜로 전송 */
+        }
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            return -1;
+        }
+        if (written == 0) {
+            return -1; /* file shrank underneath us; the length is already on the wire */
+        }
+        if (conn->checksum_pending && !conn->crc_known) {
+            conn->crc = mc_crc32c_update(conn->crc, src, (size_t)written);
+        }
+        conn->file_off += (uint64_t)written;
+        conn->file_remaining -= (uint64_t)written;
+    }
+
+    if (conn->checksum_pending) {
+        /* body done: the trailer reuses the (always larger) header buffer */
+        uint32_t trailer = htonl(conn->crc);
+        memcpy(conn->out, &trailer, sizeof(trailer));
+        conn->out_len = sizeof(trailer);
+        conn->out_off = 0;
+        conn->checksum_pending = false;
+        goto again;
+    }
+
+    conn_clear_response(conn);
+    return 1;
+}
+
+/* Returns -1 when the connection should be closed. */
+static int conn_on_writable(mc_loop_t *loop, mc_conn_t *conn) {
+    int rc = conn_flush(conn);
+    if (rc < 0) {
+        return -1;
+    }
+    if (rc == 0) {
+        return conn_set_events(loop, conn, EPOLLOUT);
+    }
+    if (conn->close_after_write) {
+        return -1;
+    }
+    conn->state = CONN_READ_HEADER;
+    conn->have = 0;
+    return conn_set_events(loop, conn, EPOLLIN);
+}
+
+static int conn_on_readable(mc_loop_t *loop, mc_conn_t *conn) {
+    size_t budget = MC_EPOLL_READ_BUDGET;
+
+    while (conn->state < CONN_WRITE && budget > 0) {
+        ssize_t count = 0;
+        switch (conn->state) {
+            case CONN_READ_HEADER: {
+                uint8_t *dst = (uint8_t *)&conn->info.header;
+                if (conn->have == 0) {
+                    conn->info.header.request_id = 0;
+                }
+                /* read the v1 part first; its version byte sizes the rest */
+                size_t want = conn->have < MC_HEADER_V1_SIZE ? MC_HEADER_V1_SIZE
+                                                             : mc_header_wire_size(&conn->info.header);
+                count = read(conn->fd, dst + conn->have, want - conn->have); /* read() 시스템 콜로 헤더 수신 */
+                if (count > 0) {
+                    conn->have += (size_t)count;
+                    if (conn->have == MC_HEADER_V1_SIZE &&
+                        conn->info.header.version > MC_PROTOCOL_VERSION_MAX) {
+                        return -1;
+                    }
+                    if (conn->have >= MC_HEADER_V1_SIZE &&
+                        conn->have == mc_header_wire_size(&conn->info.header)) {
+                        mc_header_network_to_host(&conn->info.header);
+                        if (mc_validate_header(&conn->info.header) != 0) {
+                            return -1;
+                        }
+                        /* framed mode (v3) is fork-engine only: answer as v2 */
+                        if (conn->info.header.version > MC_PROTOCOL_VERSION_PIPELINED) {
+                            conn->info.header.version = MC_PROTOCOL_VERSION_PIPELINED;
+                        }
+                        conn->have = 0;
+                        if (conn->info.header.filename_len == 0) {
+                            conn->info.filename[0] = '\0';
+                            if (start_payload(loop, conn) != 0) {
+                                return -1;
+                            }
+                        } else {
+                            conn->state = CONN_READ_FILENAME;
+                        }
+                    }
+                }
+                break;
+            }
+            case CONN_READ_FILENAME: {
+                size_t want = conn->info.header.filename_len - conn->have;
+                count = read(conn->fd, conn->info.filename + conn->have, want); /* read() 시스템 콜로 파일명 수신 */
+                if (count > 0) {
+                    conn->have += (size_t)count;
+                    if (conn->have == conn->info.header.filename_len) {
+                        conn->info.filename[conn->have] = '\0';
+                        conn->have = 0;
+                        if (start_payload(loop, conn) != 0) {
+                            return -1;
+                        }
+                    }
+                }
+                break;
+            }
+            case CONN_READ_PAYLOAD: {
+                size_t chunk = sizeof(g_scratch);
+                if (chunk > budget) {
+                    chunk = budget;
+                }
+                if ((uint64_t)chunk > conn->payload_remaining) {
+                    chunk = (size_t)conn->payload_remaining;
+                }
+                if (conn->sink == SINK_UPLOAD && conn->pipe_fds[0] != -1) {
+                    count = mc_server_splice_to_file(conn->fd,
+                                                     conn->pipe_fds,
+                                                     conn->upload->fd,
+                                                     chunk,
+                                                     true,
+                                                     &conn->sink_failed);
+                    if (count < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                        mc_server_close_splice_pipe(conn->pipe_fds);
+                        continue;
+                    }
+                    if (count > 0) {
+                        budget -= (size_t)count;
+                        conn->payload_remaining -= (uint64_t)count;
+                        if (conn->payload_remaining == 0 && finish_request(loop, conn) != 0) {
+                            return -1;
+                        }
+                    }
+                    break;
+                }
+                count = read(conn->fd, g_scratch, chunk); /* read() 시스템 콜로 페이로드 수신 */
+                if (count > 0) {
+                    budget -= (size_t)count;
+                    consume_payload(conn, g_scratch, (size_t)count);
+                    if (conn->payload_remaining == 0 && finish_request(loop, conn) != 0) {
+                        return -1;
+                    }
+                }
+                break;
+            }
+            case CONN_WRITE:
+            default:
+                break;
+        }
+
+        if (count == 0) {
+            return -1; /* peer closed the connection */
+        }
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            return -1;
+        }
+    }
+
+    if (conn->state == CONN_WRITE) {
+        return conn_on_writable(loop, conn);
+    }
+    return 0;
+}
+
+/* Queues the responses of the jobs that came back and starts sending them. */
+static void reap_offloaded(mc_loop_t *loop) {
+    mc_offload_job_t *job = mc_offload_reap(loop->offload);
+    while (job) {
+        mc_offload_job_t *next = job->next;
+        mc_conn_t *conn = job->owner;
+        if (conn) {
+            conn->job = NULL;
+            conn->state = CONN_WRITE;
+            if (queue_offloaded(conn, job) != 0 || conn_on_writable(loop, conn) != 0) {
+                conn_close(loop, conn);
+            }
+        }
+        mc_offload_free_job(job);
+        job = next;
+    }
+}
+
+static void accept_connections(mc_loop_t *loop) {
+    while (1) {
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+        int fd = accept4(loop->listen_fd,
+                         (struct sockaddr *)&addr,
+                         &addr_len,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC); /* accept4() 시스템 콜로 논블로킹 소켓 수락 */
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if ((errno == EMFILE || errno == ENFILE) && loop->spare_fd != -1) {
+                /* Out of descriptors: use the reserved one to accept and drop the
+                 * pending connection, otherwise level-triggered epoll spins. */
+                close(loop->spare_fd);
+                loop->spare_fd = -1;
+                int victim = accept(loop->listen_fd, NULL, NULL);
+                if (victim != -1) {
+                    close(victim);
+                }
+                loop->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                fprintf(stderr, "[epoll] descriptor limit reached, dropping connection\n");
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept4");
+            }
+            return;
+        }
+
+        mc_conn_t *conn = calloc(1, sizeof(*conn));
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->addr = addr;
+        conn->file_fd = -1;
+        conn->pipe_fds[0] = -1;
+        conn->pipe_fds[1] = -1;
+        conn->events = EPOLLIN;
+        conn->authenticated = !(loop->config->auth_token && loop->config->auth_token[0]);
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = conn;
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) { /* epoll_ctl() 시스템 콜로 소켓 등록 */
+            close(fd);
+            free(conn);
+            continue;
+        }
+
+        conn->next = loop->conns;
+        if (loop->conns) {
+            loop->conns->prev = conn;
+        }
+        loop->conns = conn;
+        loop->conn_count++;
+    }
+}
+
+int mc_server_run_epoll(const mc_server_config_t *config, int listen_fd) {
+    raise_fd_limit();
+
+    int flags = fcntl(listen_fd, F_GETFL, 0);
+    if (flags == -1 || fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK) == -1) { /* fcntl() 시스템 콜로 리스너 논블로킹 설정 */
+        return -1;
+    }
+
+    mc_loop_t loop;
+    memset(&loop, 0, sizeof(loop));
+    loop.config = config;
+    loop.listen_fd = listen_fd;
+    loop.spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    loop.epoll_fd = epoll_create1(EPOLL_CLOEXEC); /* epoll_create1() 시스템 콜로 이벤트 큐 생성 */
+    if (loop.epoll_fd == -1) {
+        if (loop.spare_fd != -1) {
+            close(loop.spare_fd);
+        }
+        return -1;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; /* NULL marks the listener */
+    if (epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) == -1) {
+        close(loop.epoll_fd);
+        if (loop.spare_fd != -1) {
+            close(loop.spare_fd);
+        }
+        return -1;
+    }
+
+    loop.offload = mc_offload_create(config);
+    if (loop.offload) {
+        ev.data.ptr = loop.offload; /* never a connection */
+        if (epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, mc_offload_fd(loop.offload), &ev) == -1) {
+            mc_offload_destroy(loop.offload);
+            loop.offload = NULL;
+        }
+    }
+
+    int rc = 0;
+    struct epoll_event events[MC_EPOLL_MAX_EVENTS];
+    while (!mc_server_should_terminate()) {
+        bool reap = false;
+        int ready = epoll_wait(loop.epoll_fd, events, MC_EPOLL_MAX_EVENTS, -1); /* epoll_wait() 시스템 콜로 이벤트 대기 */
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            rc = -1;
+            break;
+        }
+
+        for (int i = 0; i < ready; ++i) {
+            mc_conn_t *conn = events[i].data.ptr;
+            if (!conn) {
+                accept_connections(&loop);
+                continue;
+            }
+            if ((void *)conn == (void *)loop.offload) {
+                reap = true; /* after this batch, whose connections it may close */
+                continue;
+            }
+
+            int conn_rc = 0;
+            if (conn->state == CONN_WAIT) {
+                conn_rc = events[i].events & (EPOLLERR | EPOLLHUP) ? -1 : 0; /* gone before its job came back */
+            } else if (events[i].events & EPOLLERR) {
+                conn_rc = -1;
+            } else if (conn->state == CONN_WRITE) {
+                conn_rc = conn_on_writable(&loop, conn);
+            } else {
+                conn_rc = conn_on_readable(&loop, conn);
+            }
+            if (conn_rc != 0) {
+                conn_close(&loop, conn);
+            }
+        }
+        if (reap) {
+            reap_offloaded(&loop);
+        }
+    }
+
+    while (loop.conns) {
+        conn_close(&loop, loop.conns);
+    }
+    mc_offload_destroy(loop.offload);
+    close(loop.epoll_fd);
+    if (loop.spare_fd != -1) {
+        close(loop.spare_fd);
+    }
+    return rc;
+}
@@ -0,0 +1,1621 @@
+#define _GNU_SOURCE
+
+#include "mc_archive.h"
+#include "mc_cache.h"
+#include "mc_crc32c.h"
+#include "mc_lz4.h"
+#include "mc_protocol.h"
+#include "mc_server_internal.h"
+#include "mc_storage.h"
+
+#include <errno.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && !defined(MC_NO_IO_URING)
+#define MC_HAVE_IO_URING 1
+#endif
+#endif
+
+#ifndef MC_HAVE_IO_URING
+
+int mc_server_run_uring(const mc_server_config_t *config, int listen_fd) {
+    (void)config;
+    (void)listen_fd;
+    errno = ENOSYS;
+    return -1;
+}
+
+#else
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define MC_URING_ENTRIES 4096
+#define MC_URING_IO_CHUNK (64 * 1024)
+#define MC_URING_MAPPED_CHUNK (1024 * 1024) /* a mapped body needs no buffer, so sends can be larger */
+
+/*
+ * Minimal io_uring wrapper over the raw syscalls (liburing is not a build
+ * dependency). Only what the engine needs: one SQ/CQ pair, no SQPOLL.
+ */
+typedef struct {
+    int fd;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int sq_entries;
+    unsigned int sq_local_tail;
+    struct io_uring_sqe *sqes;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_len;
+    void *cq_ring;
+    size_t cq_ring_len;
+    size_t sqes_len;
+    unsigned int pending;
+} mc_ring_t;
+
+static int ring_setup(mc_ring_t *ring, unsigned int entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params); /* io_uring_setup() 시스템 콜로 링 생성 */
+    if (ring->fd < 0) {
+        return -1;
+    }
+
+    ring->sq_ring_len = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_len > ring->sq_ring_len) {
+            ring->sq_ring_len = ring->cq_ring_len;
+        }
+        ring->cq_ring_len = ring->sq_ring_len;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_SQ_RING); /* mmap() 시스템 콜로 SQ 링 매핑 */
+    if (ring->sq_ring == MAP_FAILED) {
+        close(ring->fd);
+        return -1;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            munmap(ring->sq_ring, ring->sq_ring_len);
+            close(ring->fd);
+            return -1;
+        }
+    }
+
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (ring->cq_ring != ring->sq_ring) {
+            munmap(ring->cq_ring, ring->cq_ring_len);
+        }
+        munmap(ring->sq_ring, ring->sq_ring_len);
+        close(ring->fd);
+        return -1;
+    }
+
+    uint8_t *sq = ring->sq_ring;
+    uint8_t *cq = ring->cq_ring;
+    ring->sq_head = (unsigned int *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned int *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *)(sq + params.sq_off.array);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_local_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned int *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned int *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+static void ring_teardown(mc_ring_t *ring) {
+    munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_len);
+    }
+    munmap(ring->sq_ring, ring->sq_ring_len);
+    close(ring->fd);
+}
+
+/* Returns 0 when every opcode the engine issues is supported by the kernel. */
+static int ring_probe(const mc_ring_t *ring) {
+    static const uint8_t required[] = {
+        IORING_OP_ACCEPT, IORING_OP_RECV,   IORING_OP_SEND,     IORING_OP_READ,     IORING_OP_WRITE,
+        IORING_OP_OPENAT, IORING_OP_STATX,  IORING_OP_RENAMEAT, IORING_OP_UNLINKAT, IORING_OP_POLL_ADD,
+    };
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, len);
+    if (!probe) {
+        return -1;
+    }
+    int rc = (int)syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256); /* io_uring_register() 로 지원 연산 확인 */
+    if (rc == 0) {
+        for (size_t i = 0; i < sizeof(required); ++i) {
+            if (required[i] > probe->last_op || !(probe->ops[required[i]].flags & IO_URING_OP_SUPPORTED)) {
+                rc = -1;
+                break;
+            }
+        }
+    }
+    free(probe);
+    return rc;
+}
+
+static int ring_enter(mc_ring_t *ring, unsigned int wait_nr) {
+    unsigned int flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0U;
+    int rc = (int)syscall(__NR_io_uring_enter, ring->fd, ring->pending, wait_nr, flags, NULL, 0); /* io_uring_enter() 시스템 콜로 일괄 제출/대기 */
+    if (rc >= 0) {
+        ring->pending -= (unsigned int)rc > ring->pending ? ring->pending : (unsigned int)rc;
+    }
+    return rc;
+}
+
+static struct io_uring_sqe *ring_get_sqe(mc_ring_t *ring) {
+    unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_local_tail - head >= ring->sq_entries) {
+        /* submission queue full: hand what we have to the kernel first */
+        if (ring_enter(ring, 0) < 0) {
+            return NULL;
+        }
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (ring->sq_local_tail - head >= ring->sq_entries) {
+            return NULL;
+        }
+    }
+    unsigned int index = ring->sq_local_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sq_local_tail++;
+    ring->pending++;
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+/*
+ * Connection state machine. Every connection has at most one operation in
+ * flight, so a completion can always release or re-arm the connection.
+ */
+typedef enum {
+    OP_RECV_HEADER = 1,
+    OP_RECV_FILENAME,
+    OP_OPEN_UPLOAD,
+    OP_RECV_PAYLOAD,
+    OP_WRITE_FILE,
+    OP_RENAME,
+    OP_OPEN_DOWNLOAD,
+    OP_STATX,
+    OP_UNLINK,
+    OP_SEND_OUT,
+    OP_READ_FILE,
+    OP_SEND_FILE
+} op_t;
+
+typedef enum {
+    SINK_DISCARD = 0,
+    SINK_UPLOAD,
+    SINK_TOKEN,
+    SINK_RANGE,
+    SINK_BEGIN,
+    SINK_HAVE,
+    SINK_QUERY,
+    SINK_BUNDLE
+} payload_sink_t;
+
+typedef struct mc_uconn {
+    struct mc_uconn *prev;
+    struct mc_uconn *next;
+    int fd;
+    struct sockaddr_in addr;
+    op_t op;
+    bool authenticated;
+    bool close_after_write;
+    unsigned int caps;       /* MC_AUTH_CAP_* agreed at AUTH */
+
+    mc_packet_info_t info;
+    size_t have;
+    uint64_t payload_remaining; /* includes the checksum trailer, if any */
+    size_t trailer_len;      /* MC_CHECKSUM_SIZE when the payload carries one */
+    uint32_t trailer;        /* received trailer, network order */
+    uint32_t crc;            /* CRC32C of the upload or download body so far */
+    bool checksum_pending;   /* DOWNLOAD body is hashed; its trailer goes last */
+    bool crc_known;          /* stored LZ4 blocks: crc came with them */
+    payload_sink_t sink;
+    bool sink_failed;
+    int problem;             /* decoder error for the upload, see mc_server_body_error */
+    mc_upload_t *upload;
+    mc_lz4_decoder_t *decoder; /* compressed UPLOAD: its output is what gets written */
+    char *token;
+    mc_range_if_t range;     /* DOWNLOAD_RANGE request, network order until statx */
+    mc_upload_begin_t begin; /* UPLOAD_BEGIN/COMMIT request, network order until used */
+    mc_have_t digest;        /* HAVE request, likewise */
+    mc_list_query_t *query;  /* LIST_QUERY request, likewise */
+    uint8_t *bundle;         /* BUNDLE_* request payload */
+    char *path;              /* DOWNLOAD/DELETE target's leaf while the op runs */
+    int dir_fd;              /* ...and the checked directory it is opened against */
+    struct statx *stx;
+
+    uint8_t *buf;            /* payload / file staging, only while streaming */
+    size_t buf_len;
+    size_t buf_off;
+    uint64_t file_off;
+
+    char *out;
+    size_t out_len;
+    size_t out_off;
+    int file_fd;
+    uint64_t file_remaining;
+    mc_lz4_encoder_t *encoder; /* compressed DOWNLOAD: each read is sent as one block */
+    uint8_t *zbuf;           /* that block (MC_LZ4_BLOCK_BOUND bytes) */
+    mc_archive_t *archive;   /* ARCHIVE: the tar stream stands in for the file reads */
+    mc_mapped_body_t map;    /* MC_DOWNLOAD_IO=mmap: the body is sent from here, no reads */
+    const uint8_t *mapped;   /* the piece of map being sent */
+    mc_offload_job_t *job;   /* offloaded work producing the response; no op is in flight meanwhile */
+} mc_uconn_t;
+
+typedef struct {
+    const mc_server_config_t *config;
+    mc_ring_t ring;
+    int listen_fd;
+    struct sockaddr_in accept_addr;
+    socklen_t accept_addr_len;
+    bool accept_armed;
+    int spare_fd;  /* /dev/null held back so a full descriptor table can still drop a connection */
+    bool fd_freed; /* a connection closed since accepting last ran out of descriptors */
+    mc_offload_t *offload; /* NULL: offloadable work runs inline */
+    mc_uconn_t *conns;
+} mc_uloop_t;
+
+/* user_data tags for the listener's accept, for one that only drops the
+ * connection, and for the poll on the offload eventfd */
+static const uint64_t MC_URING_ACCEPT_TAG = 1;
+static const uint64_t MC_URING_DROP_TAG = 2;
+static const uint64_t MC_URING_OFFLOAD_TAG = 3;
+
+/* hot-file cache hits are copied out here and queued at once */
+static uint8_t g_cached[MC_CACHE_MAX_FILE];
+static uint8_t g_cached_block[MC_LZ4_BLOCK_BOUND];
+
+static void conn_free(mc_uloop_t *loop, mc_uconn_t *conn) {
+    if (conn->job) {
+        conn->job->owner = NULL; /* freed when it comes back */
+    }
+    if (conn->upload) {
+        mc_storage_abort_upload(conn->upload);
+        free(conn->upload);
+    }
+    if (conn->file_fd != -1) {
+        close(conn->file_fd);
+    }
+    free(conn->decoder);
+    free(conn->token);
+    free(conn->query);
+    free(conn->bundle);
+    free(conn->path);
+    if (conn->dir_fd != -1) {
+        close(conn->dir_fd);
+    }
+    free(conn->stx);
+    free(conn->buf);
+    free(conn->encoder);
+    free(conn->zbuf);
+    mc_archive_close(conn->archive);
+    mc_server_unmap_body(&conn->map);
+    free(conn->out);
+    close(conn->fd); /* close() 시스템 콜로 클라이언트 소켓 정리 */
+    loop->fd_freed = true;
+
+    if (conn->prev) {
+        conn->prev->next = conn->next;
+    } else {
+        loop->conns = conn->next;
+    }
+    if (conn->next) {
+        conn->next->prev = conn->prev;
+    }
+    free(conn);
+}
+
+static struct io_uring_sqe *conn_sqe(mc_uloop_t *loop, mc_uconn_t *conn, op_t op, uint8_t opcode, int fd) {
+    struct io_uring_sqe *sqe = ring_get_sqe(&loop->ring);
+    if (!sqe) {
+        return NULL;
+    }
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = (uint64_t)(uintptr_t)conn;
+    conn->op = op;
+    return sqe;
+}
+
+static int ensure_buf(mc_uconn_t *conn) {
+    if (!conn->buf) {
+        conn->buf = malloc(MC_URING_IO_CHUNK);
+        if (!conn->buf) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Queues the reply header, filename and the body pieces as one buffer. */
+static int queue_iov(mc_uconn_t *conn,
+                     mc_command_t cmd,
+                     const char *filename,
+                     uint64_t payload_len,
+                     const struct iovec *body,
+                     int count) {
+    mc_packet_header_t header;
+    if (mc_build_reply_header(&header, &conn->info.header, cmd, filename, payload_len) != 0) {
+        return -1;
+    }
+    size_t name_len = header.filename_len;
+    size_t header_len = mc_header_wire_size(&header);
+    mc_header_host_to_network(&header);
+
+    size_t body_len = 0;
+    for (int i = 0; i < count; ++i) {
+        body_len += body[i].iov_len;
+    }
+    char *out = malloc(header_len + name_len + body_len);
+    if (!out) {
+        return -1;
+    }
+    memcpy(out, &header, header_len);
+    if (name_len > 0) {
+        memcpy(out + header_len, filename, name_len);
+    }
+    size_t at = header_len + name_len;
+    for (int i = 0; i < count; ++i) {
+        if (body[i].iov_len > 0) {
+            memcpy(out + at, body[i].iov_base, body[i].iov_len);
+            at += body[i].iov_len;
+        }
+    }
+    free(conn->out);
+    conn->out = out;
+    conn->out_len = at;
+    conn->out_off = 0;
+    return 0;
+}
+
+static int queue(mc_uconn_t *conn,
+                 mc_command_t cmd,
+                 const char *filename,
+                 uint64_t payload_len,
+                 const void *body,
+                 size_t body_len) {
+    struct iovec piece = {.iov_base = (void *)body, .iov_len = body_len};
+    return queue_iov(conn, cmd, filename, payload_len, &piece, 1);
+}
+
+static int queue_message(mc_uconn_t *conn, mc_command_t cmd, const char *filename, const char *text) {
+    size_t len = strlen(text);
+    return queue(conn, cmd, filename, (uint64_t)len, text, len);
+}
+
+static int queue_errorf(mc_uconn_t *conn, const char *fmt, ...) {
+    char buffer[512];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buffer, sizeof(buffer), fmt, ap);
+    va_end(ap);
+    return queue_message(conn, MC_CMD_ERROR, NULL, buffer);
+}
+
+static int submit_recv_header(mc_uloop_t *loop, mc_uconn_t *conn) {
+    uint8_t *dst = (uint8_t *)&conn->info.header;
+    if (conn->have == 0) {
+        conn->info.header.request_id = 0;
+    }
+    /* the v1 part first; its version byte sizes the rest */
+    size_t want = conn->have < MC_HEADER_V1_SIZE ? MC_HEADER_V1_SIZE : mc_header_wire_size(&conn->info.header);
+    struct io_uring_sqe *sqe = conn_sqe(loop, conn, OP_RECV_HEADER, IORING_OP_RECV, conn->fd);
+    if (!sqe) {
+        return -1;
+    }
+    sqe->addr = (uint64_t)(uintptr_t)(dst + conn->have);
+    sqe->len = (uint32_t)(want - conn->have);
+    return 0;
+}
+
+static int submit_recv_filename(mc_uloop_t *loop, mc_uconn_t *conn) {
+    struct io_uring_sqe *sqe = conn_sqe(loop, conn, OP_RECV_FILENAME, IORING_OP_RECV, conn->fd);
+    if (!sqe) {
+        return -1;
+    }
+    sqe->addr = (uint64_t)(uintptr_t)(conn->info.filename + conn->have);
+    sqe->len = (uint32_t)(conn->info.header.filename_len - conn->have);
+    return 0;
+}
+
+static int submit_send_out(mc_uloop_t *loop, mc_uconn_t *conn) {
+    struct io_uring_sqe *sqe = conn_sqe(loop, conn, OP_SEND_OUT, IORING_OP_SEND, conn->fd);
+    if (!sqe) {
+        return -1;
+    }
+    sqe->addr = (uint64_t)(uintptr_t)(conn->out + conn->out_off);
+    sqe->len = (uint32_t)(conn->out_len - conn->out_off);
+    sqe->msg_flags = MSG_NOSIGNAL | (conn->file_remaining > 0 ? MSG_MORE : 0);
+    return 0;
+}
+
+static int submit_send_file(mc_uloop_t *loop, mc_uconn_t *conn);
+
+/* len body bytes are at data (read into buf, or in the mapping): hash and/or encode them and send. */
+static int send_file_piece(mc_uloop_t *loop, mc_uconn_t *conn, const uint8_t *data, size_t len) {
+    conn->buf_len = len;
+    conn->buf_off = 0;
+    conn->file_off += (uint64_t)len;
+    conn->file_remaining -= (uint64_t)len;
+    if (conn->checksum_pending && !conn->crc_known) {
+        conn->crc = mc_crc32c_update(conn->crc, data, len);
+    }
+    if (conn->encoder) {
+        conn->buf_len = mc_lz4_encode_block(conn->encoder, data, len, conn->zbuf);
+    }
+    return submit_send_file(loop, conn);
+}
+
+/* Next piece of the download body: a READ into buf, or straight from the mapping. */
+static int submit_read_file(mc_uloop_t *loop, mc_uconn_t *conn) {
+    size_t max = conn->encoder ? MC_LZ4_BLOCK_MAX : conn->map.base ? MC_URING_MAPPED_CHUNK : MC_URING_IO_CHUNK;
+    size_t chunk = conn->file_remaining > max ? max : (size_t)conn->file_remaining;
+    if (conn->map.base) {
+        conn->mapped = mc_server_mapped_at(&conn->map, conn->file_off);
+        return send_file_piece(loop, conn, conn->mapped, chunk);
+    }
+    if (ensure_buf(conn) != 0) {
+        return -1;
+    }
+    if (conn->archive) {
+        /* produced inline: the file reads behind it are small pieces of the page cache */
+        return send_file_piece(loop, conn, conn->buf, mc_archive_read(conn->archive, conn->buf, chunk));
+    }
+    struct io_uring_sqe *sqe = conn_sqe(loop, conn, OP_READ_FILE, IORING_OP_READ, conn->file_fd);
+    if (!sqe) {
+        return -1;
+    }
+    sqe->addr = (uint64_t)(uintptr_t)conn->buf;
+    sqe->len = (uint32_t)chunk;
+    sqe->off = conn->file_off;
+    return 0;
+}
+
+static int submit_send_file(mc_uloop_t *loop, mc_uconn_t *conn) {
+    struct io_uring_sqe *sqe = conn_sqe(loop, conn, OP_SEND_FILE, IORING_OP_SEND, conn->fd);
+    if (!sqe) {
+        return -1;
+    }
+    const uint8_t *src = conn->encoder ? conn->zbuf : conn->map.base ? conn->mapped : conn->buf;
+    sqe->addr = (uint64_t)(uintptr_t)(src + conn->buf_off);
+    sqe->len = (uint32_t)(conn->buf_len - conn->buf_off);
+    sqe->msg_flags = MSG_NOSIGNAL | (conn->checksum_pending ? MSG_MORE : 0);
+    return 0;
+}
+
+/* Starts sending whatever response has been queued. */
+static int begin_response(mc_uloop_t *loop, mc_uconn_t *conn) {
+    free(conn->buf);
+    conn->buf = NULL;
+    return submit_send_out(loop, conn);
+}
+
+static int submit_recv_payload(mc_uloop_t *loop, mc_uconn_t *conn) {
+    /* the destination is settled before the SQE is taken: a failure here must
+     * not leave a RECV queued into memory conn_free() is about to release */
+    uint8_t *dst;
+    size_t len;
+    if (conn->sink == SINK_TOKEN || conn->sink == SINK_RANGE || conn->sink == SINK_BEGIN || conn->sink == SINK_HAVE ||
+        conn->sink == SINK_QUERY || conn->sink == SINK_BUNDLE) {
+        size_t offset = (size_t)(conn->info.header.payload_len - conn->payload_remaining);
+        dst = conn->sink == SINK_TOKEN   ? (uint8_t *)conn->token
+              : conn->sink == SINK_RANGE ? (uint8_t *)&conn->range
+              : conn->sink == SINK_BEGIN ? (uint8_t *)&conn->begin
+              : conn->sink == SINK_HAVE  ? (uint8_t *)&conn->digest
+              : conn->sink == SINK_QUERY ? (uint8_t *)conn->query
+                                         : conn->bundle;
+        dst += offset;
+        len = (size_t)conn->payload_remaining;
+    } else if (conn->payload_remaining <= conn->trailer_len) {
+        /* body done: the last bytes are the checksum trailer */
+        dst = (uint8_t *)&conn->trailer + (conn->trailer_len - conn->payload_remaining);
+        len = (size_t)conn->payload_remaining;
+    } else {
+        uint64_t body_remaining = conn->payload_remaining - conn->trailer_len;
+        if (conn->decoder && conn->sink == SINK_UPLOAD && !conn->sink_failed && conn->problem == 0) {
+            /* compressed: straight into the decoder, one header or block at a time */
+            size_t want = 0;
+            dst = mc_lz4_decoder_want(conn->decoder, &want);
+            len = want < body_remaining ? want : (size_t)body_remaining;
+        } else {
+            if (ensure_buf(conn) != 0) {
+                return -1;
+            }
+            dst = conn->buf;
+            len = body_remaining > MC_URING_IO_CHUNK ? MC_URING_IO_CHUNK : (size_t)body_remaining;
+        }
+    }
+    struct io_uring_sqe *sqe = conn_sqe(loop, conn, OP_RECV_PAYLOAD, IORING_OP_RECV, conn->fd);
+    if (!sqe) {
+        return -1;
+    }
+    sqe->addr = (uint64_t)(uintptr_t)dst;
+    sqe->len = (uint32_t)len;
+    return 0;
+}
+
+static int submit_write_file(mc_uloop_t *loop, mc_uconn_t *conn) {
+    struct io_uring_sqe *sqe = conn_sqe(loop, conn, OP_WRITE_FILE, IORING_OP_WRITE, conn->upload->fd);
+    if (!sqe) {
+        return -1;
+    }
+    const uint8_t *src = conn->decoder ? conn->decoder->out : conn->buf;
+    sqe->addr = (uint64_t)(uintptr_t)(src + conn->buf_off);
+    sqe->len = (uint32_t)(conn->buf_len - conn->buf_off);
+    sqe->off = conn->file_off;
+    return 0;
+}
+
+static int submit_path_op(mc_uloop_t *loop, mc_uconn_t *conn, op_t op) {
+    struct io_uring_sqe *sqe = NULL;
+    switch (op) {
+        case OP_OPEN_UPLOAD:
+            /* relative to the directory prepare checked, never through a symlink */
+            sqe = conn_sqe(loop, conn, op, IORING_OP_OPENAT, conn->upload->dir_fd);
+            if (sqe) {
+                sqe->addr = (uint64_t)(uintptr_t)mc_storage_leaf(conn->upload->tmp_path);
+                /* an UPLOAD_APPEND session file must already exist and keeps its bytes */
+                sqe->open_flags = conn->upload->keep_partial ? O_WRONLY | O_NOFOLLOW | O_CLOEXEC
+                                                             : O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC;
+                sqe->len = 0644;
+            }
+            break;
+        case OP_RENAME:
+            sqe = conn_sqe(loop, conn, op, IORING_OP_RENAMEAT, conn->upload->dir_fd);
+            if (sqe) {
+                sqe->addr = (uint64_t)(uintptr_t)mc_storage_leaf(conn->upload->tmp_path);
+                sqe->len = (uint32_t)conn->upload->dir_fd;
+                sqe->addr2 = (uint64_t)(uintptr_t)mc_storage_leaf(conn->upload->final_path);
+            }
+            break;
+        case OP_OPEN_DOWNLOAD:
+            sqe = conn_sqe(loop, conn, op, IORING_OP_OPENAT, conn->dir_fd);
+            if (sqe) {
+                sqe->addr = (uint64_t)(uintptr_t)conn->path;
+                sqe->open_flags = O_RDONLY | O_NOFOLLOW | O_CLOEXEC;
+            }
+            break;
+        case OP_STATX:
+            conn->stx = calloc(1, sizeof(*conn->stx));
+            if (!conn->stx) {
+                return -1;
+            }
+            sqe = conn_sqe(loop, conn, op, IORING_OP_STATX, conn->file_fd);
+            if (sqe) {
+                sqe->addr = (uint64_t)(uintptr_t)"";
+                sqe->statx_flags = AT_EMPTY_PATH;
+                sqe->len = STATX_TYPE | STATX_SIZE | STATX_INO | STATX_MTIME;
+                sqe->off = (uint64_t)(uintptr_t)conn->stx;
+            }
+            break;
+        case OP_UNLINK:
+            sqe = conn_sqe(loop, conn, op, IORING_OP_UNLINKAT, conn->dir_fd);
+            if (sqe) {
+                sqe->addr = (uint64_t)(uintptr_t)conn->path;
+            }
+            break;
+        default:
+            return -1;
+    }
+    return sqe ? 0 : -1;
+}
+
+static int dispatch_request(mc_uloop_t *loop, mc_uconn_t *conn);
+
+/* A hot-file cache hit (in g_cached): the whole reply is queued from memory. */
+static int queue_cached(mc_uconn_t *conn, const mc_download_t *body) {
+    bool ranged = conn->info.header.command == MC_CMD_DOWNLOAD_RANGE;
+    mc_range_if_t served;
+    size_t served_len = mc_server_range_prefix(&conn->info.header, body, &served);
+    uint32_t trailer;
+    struct iovec iov[3];
+    int count = 0;
+    if (served_len > 0) {
+        iov[count++] = (struct iovec){.iov_base = &served, .iov_len = served_len};
+    }
+    unsigned int applied = mc_reply_caps(conn->caps, conn->info.header.command);
+    int pieces = mc_server_cached_body(g_cached, body, applied, g_cached_block, &trailer, iov + count);
+    if (pieces < 0) {
+        return -1;
+    }
+    return queue_iov(conn,
+                     ranged ? MC_CMD_DOWNLOAD_RANGE : MC_CMD_DOWNLOAD,
+                     conn->info.filename,
+                     served_len + body->length,
+                     iov,
+                     count + pieces);
+}
+
+/* The reply body is settled (see mc_download_t): queue the DOWNLOAD(_RANGE) reply. */
+static int queue_download(mc_uloop_t *loop, mc_uconn_t *conn, const mc_download_t *body) {
+    int rc;
+    conn->file_fd = body->fd;
+    if (conn->info.header.command != MC_CMD_DOWNLOAD_RANGE) {
+        rc = queue(conn, MC_CMD_DOWNLOAD, conn->info.filename, body->length, NULL, 0);
+    } else {
+        mc_range_if_t served;
+        size_t served_len = mc_server_range_prefix(&conn->info.header, body, &served);
+        rc = queue(conn, MC_CMD_DOWNLOAD_RANGE, conn->info.filename, served_len + body->length, &served, served_len);
+    }
+    if (rc != 0) {
+        return -1;
+    }
+    conn->file_off = body->offset;
+    conn->file_remaining = body->length;
+
+    /* a checksummed body is hashed as it is read: the trailer follows it */
+    unsigned int applied = mc_reply_caps(conn->caps, conn->info.header.command);
+    conn->checksum_pending = (applied & MC_AUTH_CAP_CRC32C) != 0;
+    conn->crc = 0;
+    if (body->stored_blocks) {
+        /* the container's blocks are already the wire form: sent as they are read */
+        conn->file_off = body->wire_offset;
+        conn->file_remaining = body->wire_len;
+        conn->crc = body->crc;
+        conn->crc_known = true;
+        (void)mc_server_map_body(loop->config, conn->file_fd, conn->file_off, conn->file_remaining, &conn->map);
+        return 0;
+    }
+    if (applied & MC_AUTH_CAP_LZ4) {
+        conn->encoder = malloc(sizeof(*conn->encoder));
+        conn->zbuf = malloc(MC_LZ4_BLOCK_BOUND);
+        if (!conn->encoder || !conn->zbuf) {
+            return -1;
+        }
+        mc_lz4_encoder_init(conn->encoder);
+    }
+    (void)mc_server_map_body(loop->config, conn->file_fd, conn->file_off, conn->file_remaining, &conn->map);
+    return 0;
+}
+
+/* ARCHIVE: the header is queued and the tar stream goes out piece by piece behind it. */
+static int queue_archive(mc_uloop_t *loop, mc_uconn_t *conn) {
+    char err[256];
+    uint64_t total = 0;
+    if (mc_archive_open(loop->config, conn->info.filename, &conn->archive, &total, err, sizeof(err)) != 0) {
+        return queue_errorf(conn, "%s", err);
+    }
+    if (queue(conn, MC_CMD_ARCHIVE, conn->info.filename, total, NULL, 0) != 0) {
+        return -1;
+    }
+    unsigned int applied = mc_reply_caps(conn->caps, conn->info.header.command);
+    conn->file_off = 0;
+    conn->file_remaining = total;
+    conn->checksum_pending = (applied & MC_AUTH_CAP_CRC32C) != 0;
+    conn->crc = 0;
+    if (applied & MC_AUTH_CAP_LZ4) {
+        conn->encoder = malloc(sizeof(*conn->encoder));
+        conn->zbuf = malloc(MC_LZ4_BLOCK_BOUND);
+        if (!conn->encoder || !conn->zbuf) {
+            return -1;
+        }
+        mc_lz4_encoder_init(conn->encoder);
+    }
+    return 0;
+}
+
+/* conn->file_fd is open on a plain file of size bytes: clamp the range and queue the reply. */
+static int queue_file_download(mc_uloop_t *loop, mc_uconn_t *conn, uint64_t size) {
+    const struct statx *stx = conn->stx;
+    bool ranged = conn->info.header.command == MC_CMD_DOWNLOAD_RANGE;
+    mc_download_t body = {.fd = conn->file_fd, .file_size = size};
+    char err[256];
+    if (ranged) {
+        mc_range_if_network_to_host(&conn->range);
+    }
+    mc_storage_start_range(ranged ? &conn->range : NULL,
+                           mc_storage_validator(stx->stx_ino, stx->stx_mtime.tv_sec, stx->stx_mtime.tv_nsec, stx->stx_size),
+                           &body);
+    if (mc_storage_clamp_range(size, body.offset, &body.length, err, sizeof(err)) != 0) {
+        return queue_errorf(conn, "%s", err);
+    }
+    return queue_download(loop, conn, &body);
+}
+
+/* Entire payload consumed (or none expected): decide what happens next. */
+static int finish_payload(mc_uloop_t *loop, mc_uconn_t *conn) {
+    const mc_server_config_t *config = loop->config;
+
+    if (conn->sink == SINK_UPLOAD) {
+        conn->sink = SINK_DISCARD;
+        if (conn->problem == 0 && conn->decoder && !mc_lz4_decoder_idle(conn->decoder)) {
+            conn->problem = EPROTO; /* ended inside a block */
+        }
+        free(conn->decoder);
+        conn->decoder = NULL;
+        if (conn->problem == 0 && conn->trailer_len > 0 && ntohl(conn->trailer) != conn->crc) {
+            conn->problem = EBADMSG;
+        }
+        if (conn->sink_failed) {
+            mc_storage_abort_upload(conn->upload);
+            free(conn->upload);
+            conn->upload = NULL;
+            if (queue_errorf(conn, "Failed to receive file data") != 0) {
+                return -1;
+            }
+            return begin_response(loop, conn);
+        }
+        if (conn->problem != 0) {
+            char err[256];
+            mc_storage_reject_upload(conn->upload);
+            free(conn->upload);
+            conn->upload = NULL;
+            mc_server_body_error(config, conn->problem, err, sizeof(err));
+            return queue_errorf(conn, "%s", err) != 0 ? -1 : begin_response(loop, conn);
+        }
+        if (conn->upload->keep_partial) {
+            char err[256];
+            uint64_t committed = 0;
+            int rc = mc_storage_finish_append(conn->upload, &committed, err, sizeof(err));
+            free(conn->upload);
+            conn->upload = NULL;
+            if (rc != 0) {
+                rc = queue_errorf(conn, "%s", err);
+            } else {
+                mc_range_t progress = {.offset = committed, .length = 0};
+                mc_range_host_to_network(&progress);
+                rc = queue(conn, MC_CMD_UPLOAD_APPEND, conn->info.filename, MC_RANGE_SIZE, &progress, sizeof(progress));
+            }
+            return rc != 0 ? -1 : begin_response(loop, conn);
+        }
+        if (conn->info.header.command == MC_CMD_DELTA) {
+            /* applying reads the old copy and the delta back: done inline */
+            char err[256];
+            int rc = mc_storage_apply_delta(config, conn->info.filename, conn->upload, err, sizeof(err)) != 0
+                         ? queue_errorf(conn, "%s", err)
+                         : queue_message(conn, MC_CMD_DELTA, conn->info.filename, "UPLOAD OK");
+            free(conn->upload);
+            conn->upload = NULL;
+            return rc != 0 ? -1 : begin_response(loop, conn);
+        }
+        if (conn->upload->chunk_root || conn->upload->compress) {
+            /* chunking or packing reads the whole file back: done inline like the other storage calls */
+            char err[256];
+            int rc = mc_storage_commit_upload(conn->upload, err, sizeof(err)) != 0
+                         ? queue_errorf(conn, "%s", err)
+                         : queue_message(conn, MC_CMD_UPLOAD, conn->info.filename, "UPLOAD OK");
+            free(conn->upload);
+            conn->upload = NULL;
+            return rc != 0 ? -1 : begin_response(loop, conn);
+        }
+        close(conn->upload->fd); /* close() 시스템 콜로 임시 파일 닫기 */
+        conn->upload->fd = -1;
+        return submit_path_op(loop, conn, OP_RENAME);
+    }
+    if (conn->sink == SINK_BEGIN || conn->sink == SINK_HAVE || conn->sink == SINK_QUERY || conn->sink == SINK_BUNDLE) {
+        conn->sink = SINK_DISCARD;
+        return dispatch_request(loop, conn);
+    }
+    if (conn->sink == SINK_TOKEN) {
+        conn->sink = SINK_DISCARD;
+        conn->token[conn->info.header.payload_len] = '\0';
+        int rc;
+        if (strcmp(conn->token, config->auth_token) != 0) {
+            rc = queue_errorf(conn, "Invalid auth token");
+            conn->close_after_write = true;
+        } else {
+            char options[MC_AUTH_ECHO_MAX];
+            conn->caps = mc_server_auth_options(&conn->info, options, sizeof(options));
+            conn->authenticated = true;
+            rc = queue_message(conn, MC_CMD_AUTH, options, "AUTH OK");
+        }
+        free(conn->token);
+        conn->token = NULL;
+        return rc != 0 ? -1 : begin_response(loop, conn);
+    }
+    if (conn->out) {
+        return begin_response(loop, conn); /* answered up front */
+    }
+    return dispatch_request(loop, conn);
+}
+
+static int continue_payload(mc_uloop_t *loop, mc_uconn_t *conn) {
+    if (conn->payload_remaining == 0) {
+        return finish_payload(loop, conn);
+    }
+    return submit_recv_payload(loop, conn);
+}
+
+/* The upload file is open (and an append checked): a compressed payload gets its decoder. */
+static int start_upload_body(mc_uloop_t *loop, mc_uconn_t *conn, bool compressed) {
+    if (compressed) {
+        conn->decoder = malloc(sizeof(*conn->decoder));
+        if (!conn->decoder) {
+            return -1;
+        }
+        mc_lz4_decoder_init(conn->decoder, mc_storage_upload_room(loop->config, conn->upload));
+    }
+    return continue_payload(loop, conn);
+}
+
+/* The response to a job that has run, offloaded or not. */
+static int queue_offloaded(mc_uconn_t *conn, const mc_offload_job_t *job) {
+    if (job->rc != 0) {
+        return queue_errorf(conn, "%s", job->err);
+    }
+    if (job->command == MC_CMD_HAVE) {
+        return queue_message(conn, MC_CMD_HAVE, conn->info.filename, job->stored ? MC_HAVE_STORED : MC_HAVE_MISSING);
+    }
+    return queue(conn, MC_CMD_SIGNATURES, conn->info.filename, (uint64_t)job->payload_len, job->payload, job->payload_len);
+}
+
+/*
+ * Runs job on a thread and leaves conn with nothing in flight until it comes
+ * back (see on_offloaded), or inline when that cannot be.
+ */
+static int submit_offload(mc_uloop_t *loop, mc_uconn_t *conn, mc_offload_job_t *job) {
+    snprintf(job->filename, sizeof(job->filename), "%s", conn->info.filename);
+    job->owner = conn;
+    if (loop->offload && mc_offload_submit(loop->offload, job) == 0) {
+        conn->job = job;
+        return 0;
+    }
+    mc_offload_run(loop->config, job);
+    int rc = queue_offloaded(conn, job);
+    mc_offload_free_job(job);
+    return rc != 0 ? -1 : begin_response(loop, conn);
+}
+
+static int dispatch_request(mc_uloop_t *loop, mc_uconn_t *conn) {
+    const mc_server_config_t *config = loop->config;
+    char err[256];
+
+    switch (conn->info.header.command) {
+        case MC_CMD_DOWNLOAD:
+        case MC_CMD_DOWNLOAD_RANGE:
+        case MC_CMD_DELETE: {
+            bool download = conn->info.header.command != MC_CMD_DELETE;
+            const char *op = download ? "DOWNLOAD" : "DELETE";
+            if (download) {
+                /* conn->range stays in network order for the paths below */
+                bool ranged = conn->info.header.command == MC_CMD_DOWNLOAD_RANGE;
+                mc_range_if_t range = conn->range;
+                mc_download_t body;
+                mc_range_if_network_to_host(&range);
+                int hit = mc_storage_cached_reply(config, conn->info.filename, ranged ? &range : NULL, g_cached, &body, err,
+                                                  sizeof(err));
+                if (hit != 0) {
+                    int rc = hit < 0 ? queue_errorf(conn, "%s", err) : queue_cached(conn, &body);
+                    return rc != 0 ? -1 : begin_response(loop, conn);
+                }
+            }
+            if (download && config->storage_mode != MC_STORAGE_MODE_PLAIN) {
+                /* reassembling chunks or decoding blocks is a run of copies: done inline */
+                bool ranged = conn->info.header.command == MC_CMD_DOWNLOAD_RANGE;
+                unsigned int applied = mc_reply_caps(conn->caps, conn->info.header.command);
+                mc_download_t body;
+                if (ranged) {
+                    mc_range_if_network_to_host(&conn->range);
+                }
+                int rc = mc_storage_open_reply(config, conn->info.filename, ranged ? &conn->range : NULL, applied, &body, err,
+                                               sizeof(err)) != 0
+                             ? queue_errorf(conn, "%s", err)
+                             : queue_download(loop, conn, &body);
+                return rc != 0 ? -1 : begin_response(loop, conn);
+            }
+            conn->path = malloc(MC_STORAGE_PATH_MAX);
+            if (!conn->path) {
+                return -1;
+            }
+            if (mc_storage_resolve(config, conn->info.filename, op, &conn->dir_fd, conn->path, MC_STORAGE_PATH_MAX, err,
+                                   sizeof(err)) != 0) {
+                free(conn->path);
+                conn->path = NULL;
+                return queue_errorf(conn, "%s", err) != 0 ? -1 : begin_response(loop, conn);
+            }
+            return submit_path_op(loop, conn, download ? OP_OPEN_DOWNLOAD : OP_UNLINK);
+        }
+        case MC_CMD_ARCHIVE:
+            return queue_archive(loop, conn) != 0 ? -1 : begin_response(loop, conn);
+        case MC_CMD_LIST: {
+            char *listing = NULL;
+            size_t len = 0;
+            int rc;
+            if (mc_storage_build_listing(config, conn->info.filename, &listing, &len, err, sizeof(err)) != 0) {
+                rc = queue_errorf(conn, "%s", err);
+            } else {
+                rc = queue(conn, MC_CMD_LIST, NULL, (uint64_t)len, listing, len);
+                free(listing);
+            }
+            return rc != 0 ? -1 : begin_response(loop, conn);
+        }
+        case MC_CMD_MKDIR:
+        case MC_CMD_RMDIR: {
+            bool make = conn->info.header.command == MC_CMD_MKDIR;
+            int rc = make ? mc_storage_mkdir(config, conn->info.filename, err, sizeof(err))
+                          : mc_storage_rmdir(config, conn->info.filename, err, sizeof(err));
+            rc = rc != 0 ? queue_errorf(conn, "%s", err)
+                         : queue_message(conn, (mc_command_t)conn->info.header.command, conn->info.filename,
+                                         make ? "MKDIR OK" : "RMDIR OK");
+            return rc != 0 ? -1 : begin_response(loop, conn);
+        }
+        case MC_CMD_SIGNATURES: {
+            /* a read of the whole file: offloaded */
+            mc_offload_job_t *job = calloc(1, sizeof(*job));
+            if (!job) {
+                return -1;
+            }
+            job->command = MC_CMD_SIGNATURES;
+            return submit_offload(loop, conn, job);
+        }
+        case MC_CMD_HAVE: {
+            /* index lookups inline; hashing an unindexed copy is offloaded */
+            bool stored = false;
+            mc_have_network_to_host(&conn->digest);
+            int found = mc_storage_have_unhashed(config, conn->info.filename, &conn->digest, &stored, err, sizeof(err));
+            if (found == 1) {
+                mc_offload_job_t *job = calloc(1, sizeof(*job));
+                if (!job) {
+                    return -1;
+                }
+                job->command = MC_CMD_HAVE;
+                job->have = conn->digest;
+                return submit_offload(loop, conn, job);
+            }
+            int rc = found < 0 ? queue_errorf(conn, "%s", err)
+                               : queue_message(conn, MC_CMD_HAVE, conn->info.filename,
+                                               stored ? MC_HAVE_STORED : MC_HAVE_MISSING);
+            return rc != 0 ? -1 : begin_response(loop, conn);
+        }
+        case MC_CMD_LIST_QUERY: {
+            uint8_t *page = NULL;
+            size_t len = 0;
+            int rc;
+            mc_list_query_network_to_host(conn->query);
+            if (mc_storage_query_listing(config, conn->info.filename, conn->query, &page, &len, err, sizeof(err)) != 0) {
+                rc = queue_errorf(conn, "%s", err);
+            } else {
+                rc = queue(conn, MC_CMD_LIST_QUERY, NULL, (uint64_t)len, page, len);
+                free(page);
+            }
+            free(conn->query);
+            conn->query = NULL;
+            return rc != 0 ? -1 : begin_response(loop, conn);
+        }
+        case MC_CMD_BUNDLE_UPLOAD:
+        case MC_CMD_BUNDLE_DOWNLOAD: {
+            /* small files by definition: stored or read inline */
+            size_t len = (size_t)conn->info.header.payload_len;
+            int rc;
+            if (conn->info.header.command == MC_CMD_BUNDLE_UPLOAD) {
+                long stored = 0;
+                if (mc_storage_store_bundle(config, conn->bundle, len, &stored, err, sizeof(err)) != 0) {
+                    rc = queue_errorf(conn, "%s", err);
+                } else {
+                    char text[64];
+                    snprintf(text, sizeof(text), "UPLOAD OK: %ld files", stored);
+                    rc = queue_message(conn, MC_CMD_BUNDLE_UPLOAD, NULL, text);
+                }
+            } else {
+                uint8_t *reply = NULL;
+                size_t reply_len = 0;
+                if (mc_storage_build_bundle(config, conn->bundle, len, &reply, &reply_len, err, sizeof(err)) != 0) {
+                    rc = queue_errorf(conn, "%s", err);
+                } else {
+                    rc = queue(conn, MC_CMD_BUNDLE_DOWNLOAD, NULL, (uint64_t)reply_len, reply, reply_len);
+                    free(reply);
+                }
+            }
+            free(conn->bundle);
+            conn->bundle = NULL;
+            return rc != 0 ? -1 : begin_response(loop, conn);
+        }
+        case MC_CMD_UPLOAD_BEGIN:
+        case MC_CMD_UPLOAD_COMMIT: {
+            /* session bookkeeping is a few metadata calls: done inline */
+            int rc;
+            mc_upload_begin_network_to_host(&conn->begin);
+            if (conn->info.header.command == MC_CMD_UPLOAD_COMMIT) {
+                if (mc_storage_commit_session(config, conn->info.filename, &conn->begin, err, sizeof(err)) != 0) {
+                    rc = queue_errorf(conn, "%s", err);
+                } else {
+                    rc = queue_message(conn, MC_CMD_UPLOAD_COMMIT, conn->info.filename, "UPLOAD OK");
+                }
+                return rc != 0 ? -1 : begin_response(loop, conn);
+            }
+            char key[MC_UPLOAD_KEY_LEN + 1];
+            uint64_t committed = 0;
+            if (mc_storage_begin_session(config, conn->info.filename, &conn->begin, key, &committed, err, sizeof(err)) != 0) {
+                rc = queue_errorf(conn, "%s", err);
+            } else {
+                mc_range_t progress = {.offset = committed, .length = conn->begin.total_size};
+                mc_range_host_to_network(&progress);
+                rc = queue(conn, MC_CMD_UPLOAD_BEGIN, key, MC_RANGE_SIZE, &progress, sizeof(progress));
+            }
+            return rc != 0 ? -1 : begin_response(loop, conn);
+        }
+        case MC_CMD_QUIT:
+            conn->close_after_write = true;
+            return queue_message(conn, MC_CMD_QUIT, NULL, "Goodbye") != 0 ? -1 : begin_response(loop, conn);
+        case MC_CMD_ERROR:
+        default:
+            return queue_errorf(conn, "Unsupported command") != 0 ? -1 : begin_response(loop, conn);
+    }
+}
+
+/* Header and filename are in: route the payload. */
+static int start_request(mc_uloop_t *loop, mc_uconn_t *conn) {
+    const mc_server_config_t *config = loop->config;
+    const mc_packet_header_t *header = &conn->info.header;
+    char err[256];
+    int rc = 0;
+
+    mc_server_log_command(&conn->addr, &conn->info);
+
+    unsigned int applied = mc_request_caps(conn->caps, header->command);
+    conn->trailer_len = (applied & MC_AUTH_CAP_CRC32C) ? MC_CHECKSUM_SIZE : 0U;
+    conn->payload_remaining = header->payload_len + conn->trailer_len;
+    conn->crc = 0;
+    conn->sink = SINK_DISCARD;
+    conn->sink_failed = false;
+    conn->problem = 0;
+
+    if (!conn->authenticated && header->command != MC_CMD_AUTH) {
+        rc = queue_errorf(conn, "Authentication required");
+    } else if (header->command == MC_CMD_UPLOAD || header->command == MC_CMD_UPLOAD_APPEND ||
+               header->command == MC_CMD_DELTA) {
+        mc_upload_t *upload = malloc(sizeof(*upload));
+        if (!upload) {
+            return -1;
+        }
+        /* a compressed payload is held to the limit as it decodes instead */
+        uint64_t checked_len = (applied & MC_AUTH_CAP_LZ4) ? 0 : header->payload_len;
+        int prepared = header->command != MC_CMD_UPLOAD_APPEND
+                           ? mc_storage_prepare_upload(config, conn->info.filename, checked_len, upload, err, sizeof(err))
+                           : mc_storage_prepare_append(config, conn->info.filename, upload, err, sizeof(err));
+        if (prepared != 0) {
+            free(upload);
+            rc = queue_errorf(conn, "%s", err);
+        } else {
+            conn->upload = upload;
+            conn->file_off = 0;
+            return submit_path_op(loop, conn, OP_OPEN_UPLOAD);
+        }
+    } else if (header->command == MC_CMD_DOWNLOAD_RANGE) {
+        if (header->payload_len != MC_RANGE_SIZE && header->payload_len != MC_RANGE_IF_SIZE) {
+            rc = queue_errorf(conn, "Invalid range request");
+        } else {
+            memset(&conn->range, 0, sizeof(conn->range)); /* an mc_range_t request leaves no validator */
+            conn->sink = SINK_RANGE;
+        }
+    } else if (header->command == MC_CMD_UPLOAD_BEGIN || header->command == MC_CMD_UPLOAD_COMMIT) {
+        if (header->payload_len != sizeof(mc_upload_begin_t)) {
+            rc = queue_errorf(conn, "Invalid upload request");
+        } else {
+            conn->sink = SINK_BEGIN;
+        }
+    } else if (header->command == MC_CMD_HAVE) {
+        if (header->payload_len != sizeof(mc_have_t)) {
+            rc = queue_errorf(conn, "Invalid have request");
+        } else {
+            conn->sink = SINK_HAVE;
+        }
+    } else if (header->command == MC_CMD_LIST_QUERY) {
+        if (header->payload_len != sizeof(mc_list_query_t)) {
+            rc = queue_errorf(conn, "Invalid list query");
+        } else {
+            conn->query = malloc(sizeof(*conn->query));
+            if (!conn->query) {
+                return -1;
+            }
+            conn->sink = SINK_QUERY;
+        }
+    } else if (header->command == MC_CMD_BUNDLE_UPLOAD || header->command == MC_CMD_BUNDLE_DOWNLOAD) {
+        if (header->payload_len > MC_BUNDLE_WIRE_MAX) {
+            rc = queue_errorf(conn, "Bundle too large");
+        } else {
+            conn->bundle = malloc(header->payload_len ? (size_t)header->payload_len : 1U);
+            if (!conn->bundle) {
+                return -1;
+            }
+            conn->sink = SINK_BUNDLE;
+        }
+    } else if (header->command == MC_CMD_AUTH) {
+        char options[MC_AUTH_ECHO_MAX];
+        unsigned int accepted = mc_server_auth_options(&conn->info, options, sizeof(options));
+        if (conn->authenticated) {
+            conn->caps = accepted;
+            rc = queue_message(conn, MC_CMD_AUTH, options, "Already authenticated");
+        } else if (!config->auth_token || !config->auth_token[0]) {
+            conn->authenticated = true;
+            conn->caps = accepted;
+            rc = queue_message(conn, MC_CMD_AUTH, options, "AUTH not required");
+        } else if (header->payload_len == 0 || header->payload_len > MC_MAX_AUTH_TOKEN_LEN) {
+            rc = queue_errorf(conn, "Invalid auth token length");
+        } else {
+            conn->token = malloc((size_t)header->payload_len + 1);
+            if (!conn->token) {
+                return -1;
+            }
+            conn->sink = SINK_TOKEN;
+        }
+    }
+
+    if (rc != 0) {
+        return -1;
+    }
+    return continue_payload(loop, conn);
+}
+
+static int response_done(mc_uloop_t *loop, mc_uconn_t *conn) {
+    if (conn->checksum_pending) {
+        /* body done: the trailer reuses the (always larger) header buffer */
+        uint32_t trailer = htonl(conn->crc);
+        memcpy(conn->out, &trailer, sizeof(trailer));
+        conn->out_len = sizeof(trailer);
+        conn->out_off = 0;
+        conn->checksum_pending = false;
+        return submit_send_out(loop, conn);
+    }
+    free(conn->out);
+    conn->out = NULL;
+    free(conn->buf);
+    conn->buf = NULL;
+    free(conn->encoder);
+    conn->encoder = NULL;
+    free(conn->zbuf);
+    conn->zbuf = NULL;
+    mc_archive_close(conn->archive);
+    conn->archive = NULL;
+    mc_server_unmap_body(&conn->map);
+    conn->crc_known = false;
+    if (conn->file_fd != -1) {
+        close(conn->file_fd); /* close() 시스템 콜로 다운로드 파일 닫기 */
+        conn->file_fd = -1;
+    }
+    if (conn->close_after_write) {
+        return -1;
+    }
+    conn->have = 0;
+    return submit_recv_header(loop, conn);
+}
+
+/* Handles one completion; returns -1 when the connection must be released. */
+static int on_completion(mc_uloop_t *loop, mc_uconn_t *conn, int res) {
+    switch (conn->op) {
+        case OP_RECV_HEADER:
+            if (res <= 0) {
+                return -1;
+            }
+            conn->have += (size_t)res;
+            if (conn->have >= MC_HEADER_V1_SIZE && conn->info.header.version > MC_PROTOCOL_VERSION_MAX) {
+                return -1;
+            }
+            if (conn->have < MC_HEADER_V1_SIZE || conn->have < mc_header_wire_size(&conn->info.header)) {
+                return submit_recv_header(loop, conn);
+            }
+            mc_header_network_to_host(&conn->info.header);
+            if (mc_validate_header(&conn->info.header) != 0) {
+                return -1;
+            }
+            /* framed mode (v3) is fork-engine only: answer as v2 */
+            if (conn->info.header.version > MC_PROTOCOL_VERSION_PIPELINED) {
+                conn->info.header.version = MC_PROTOCOL_VERSION_PIPELINED;
+            }
+            conn->have = 0;
+            if (conn->info.header.filename_len == 0) {
+                conn->info.filename[0] = '\0';
+                return start_request(loop, conn);
+            }
+            return submit_recv_filename(loop, conn);
+
+        case OP_RECV_FILENAME:
+            if (res <= 0) {
+                return -1;
+            }
+            conn->have += (size_t)res;
+            if (conn->have < conn->info.header.filename_len) {
+                return submit_recv_filename(loop, conn);
+            }
+            conn->info.filename[conn->have] = '\0';
+            conn->have = 0;
+            return start_request(loop, conn);
+
+        case OP_OPEN_UPLOAD: {
+            char err[256];
+            int rc = 0;
+            if (res < 0 && conn->upload->keep_partial) {
+                rc = queue_errorf(conn, res == -ENOENT ? "Unknown upload session" : "Failed to open upload session");
+            } else if (res < 0) {
+                rc = queue_errorf(conn, "Failed to open temp file: %s", strerror(-res));
+            } else {
+                conn->upload->fd = res;
+                conn->sink = SINK_UPLOAD;
+                bool compressed = (mc_request_caps(conn->caps, conn->info.header.command) & MC_AUTH_CAP_LZ4) != 0;
+                if (!conn->upload->keep_partial) {
+                    return start_upload_body(loop, conn, compressed);
+                }
+                /* lock and size the session; writes then carry the offset */
+                uint64_t committed = 0;
+                uint64_t checked_len = compressed ? 0 : conn->info.header.payload_len;
+                if (mc_storage_check_append(loop->config, conn->upload, checked_len, &committed, err, sizeof(err)) == 0) {
+                    conn->file_off = committed;
+                    return start_upload_body(loop, conn, compressed);
+                }
+                close(res);
+                conn->sink = SINK_DISCARD;
+                rc = queue_errorf(conn, "%s", err);
+            }
+            mc_storage_release_upload(conn->upload);
+            free(conn->upload);
+            conn->upload = NULL;
+            return rc != 0 ? -1 : continue_payload(loop, conn);
+        }
+
+        case OP_RECV_PAYLOAD: {
+            if (res <= 0) {
+                return -1;
+            }
+            if (conn->payload_remaining <= conn->trailer_len) {
+                conn->payload_remaining -= (uint64_t)res; /* trailer bytes */
+                return continue_payload(loop, conn);
+            }
+            conn->payload_remaining -= (uint64_t)res;
+            if (conn->sink != SINK_UPLOAD || conn->sink_failed || conn->problem != 0) {
+                return continue_payload(loop, conn);
+            }
+            const uint8_t *data = conn->buf;
+            size_t len = (size_t)res;
+            if (conn->decoder) {
+                int got = mc_lz4_decoder_received(conn->decoder, len);
+                if (got < 0) {
+                    conn->problem = errno; /* the rest is drained, then rejected */
+                }
+                if (got != 1) {
+                    return continue_payload(loop, conn);
+                }
+                data = conn->decoder->out;
+                len = conn->decoder->out_len;
+            }
+            if (conn->trailer_len > 0) {
+                conn->crc = mc_crc32c_update(conn->crc, data, len);
+            }
+            conn->buf_len = len;
+            conn->buf_off = 0;
+            return submit_write_file(loop, conn);
+        }
+
+        case OP_WRITE_FILE:
+            if (res <= 0) {
+                conn->sink_failed = true; /* keep draining, answer with an error */
+                return continue_payload(loop, conn);
+            }
+            conn->buf_off += (size_t)res;
+            conn->file_off += (uint64_t)res;
+            if (conn->buf_off < conn->buf_len) {
+                return submit_write_file(loop, conn);
+            }
+            return continue_payload(loop, conn);
+
+        case OP_RENAME: {
+            int rc;
+            if (res < 0) {
+                unlinkat(conn->upload->dir_fd, mc_storage_leaf(conn->upload->tmp_path), 0);
+                rc = queue_errorf(conn, "Failed to store file: %s", strerror(-res));
+            } else {
+                mc_storage_note_committed(conn->upload);
+                rc = queue_message(conn, MC_CMD_UPLOAD, conn->info.filename, "UPLOAD OK");
+            }
+            mc_storage_release_upload(conn->upload);
+            free(conn->upload);
+            conn->upload = NULL;
+            return rc != 0 ? -1 : begin_response(loop, conn);
+        }
+
+        case OP_OPEN_DOWNLOAD:
+            free(conn->path);
+            conn->path = NULL;
+            close(conn->dir_fd);
+            conn->dir_fd = -1;
+            if (res < 0) {
+                return queue_errorf(conn, "File not found") != 0 ? -1 : begin_response(loop, conn);
+            }
+            conn->file_fd = res;
+            return submit_path_op(loop, conn, OP_STATX);
+
+        case OP_STATX: {
+            int rc;
+            if (res < 0) {
+                rc = queue_errorf(conn, "Failed to stat file");
+            } else if (!S_ISREG(conn->stx->stx_mode)) {
+                rc = queue_errorf(conn, "Not a regular file");
+            } else {
+                rc = queue_file_download(loop, conn, conn->stx->stx_size);
+            }
+            free(conn->stx);
+            conn->stx = NULL;
+            return rc != 0 ? -1 : submit_send_out(loop, conn);
+        }
+
+        case OP_UNLINK: {
+            free(conn->path);
+            conn->path = NULL;
+            close(conn->dir_fd);
+            conn->dir_fd = -1;
+            int rc;
+            if (res == -ENOENT) {
+                rc = queue_errorf(conn, "File not found");
+            } else if (res == -EISDIR) {
+                rc = queue_errorf(conn, "Is a directory (use RMDIR)");
+            } else if (res < 0) {
+                rc = queue_errorf(conn, "Failed to delete file: %s", strerror(-res));
+            } else {
+                mc_storage_note_deleted(conn->info.filename);
+                rc = queue_message(conn, MC_CMD_DELETE, conn->info.filename, "DELETE OK");
+            }
+            return rc != 0 ? -1 : begin_response(loop, conn);
+        }
+
+        case OP_SEND_OUT:
+            if (res <= 0) {
+                return -1;
+            }
+            conn->out_off += (size_t)res;
+            if (conn->out_off < conn->out_len) {
+                return submit_send_out(loop, conn);
+            }
+            if (conn->file_remaining > 0) {
+                return submit_read_file(loop, conn);
+            }
+            return response_done(loop, conn);
+
+        case OP_READ_FILE:
+            if (res <= 0) {
+                return -1; /* file shrank; the length is already on the wire */
+            }
+            return send_file_piece(loop, conn, conn->buf, (size_t)res);
+
+        case OP_SEND_FILE:
+            if (res <= 0) {
+                return -1;
+            }
+            conn->buf_off += (size_t)res;
+            if (conn->buf_off < conn->buf_len) {
+                return submit_send_file(loop, conn);
+            }
+            if (conn->file_remaining > 0) {
+                return submit_read_file(loop, conn);
+            }
+            return response_done(loop, conn);
+
+        default:
+            return -1;
+    }
+}
+
+static int arm_accept(mc_uloop_t *loop, uint64_t tag) {
+    struct io_uring_sqe *sqe = ring_get_sqe(&loop->ring);
+    if (!sqe) {
+        return -1;
+    }
+    loop->accept_addr_len = sizeof(loop->accept_addr);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = loop->listen_fd;
+    sqe->addr = (uint64_t)(uintptr_t)&loop->accept_addr;
+    sqe->addr2 = (uint64_t)(uintptr_t)&loop->accept_addr_len;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = tag;
+    loop->accept_armed = true;
+    return 0;
+}
+
+static void on_accept(mc_uloop_t *loop, int res) {
+    loop->accept_armed = false;
+    if (res >= 0) {
+        mc_uconn_t *conn = calloc(1, sizeof(*conn));
+        if (!conn) {
+            close(res);
+        } else {
+            conn->fd = res;
+            conn->addr = loop->accept_addr;
+            conn->file_fd = -1;
+            conn->dir_fd = -1;
+            conn->authenticated = !(loop->config->auth_token && loop->config->auth_token[0]);
+            conn->next = loop->conns;
+            if (loop->conns) {
+                loop->conns->prev = conn;
+            }
+            loop->conns = conn;
+            if (submit_recv_header(loop, conn) != 0) {
+                conn_free(loop, conn);
+            }
+        }
+    } else if (res == -EMFILE || res == -ENFILE) {
+        /* Out of descriptors: re-arming as is would fail straight away, over
+         * and over. Free the reserved one and let the next accept take the
+         * pending connection only to drop it; with no spare left, wait for a
+         * connection to close (see the main loop). */
+        if (loop->spare_fd == -1) {
+            fprintf(stderr, "[uring] descriptor limit reached, pausing accept\n");
+            loop->fd_freed = false;
+            return;
+        }
+        close(loop->spare_fd);
+        loop->spare_fd = -1;
+        fprintf(stderr, "[uring] descriptor limit reached, dropping connection\n");
+        if (arm_accept(loop, MC_URING_DROP_TAG) != 0) {
+            fprintf(stderr, "[uring] failed to re-arm accept\n");
+        }
+        return;
+    } else if (res != -EINTR && res != -ECONNABORTED) {
+        fprintf(stderr, "[uring] accept: %s\n", strerror(-res));
+    }
+    if (arm_accept(loop, MC_URING_ACCEPT_TAG) != 0) {
+        fprintf(stderr, "[uring] failed to re-arm accept\n");
+    }
+}
+
+static int arm_offload(mc_uloop_t *loop) {
+    struct io_uring_sqe *sqe = ring_get_sqe(&loop->ring);
+    if (!sqe) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = mc_offload_fd(loop->offload);
+    sqe->poll_events = POLLIN;
+    sqe->user_data = MC_URING_OFFLOAD_TAG;
+    return 0;
+}
+
+/* Offloaded jobs came back: queue their responses and start sending them. */
+static void on_offloaded(mc_uloop_t *loop) {
+    mc_offload_job_t *job = mc_offload_reap(loop->offload);
+    while (job) {
+        mc_offload_job_t *next = job->next;
+        mc_uconn_t *conn = job->owner;
+        if (conn) {
+            conn->job = NULL;
+            if (queue_offloaded(conn, job) != 0 || begin_response(loop, conn) != 0) {
+                conn_free(loop, conn);
+            }
+        }
+        mc_offload_free_job(job);
+        job = next;
+    }
+    if (arm_offload(loop) != 0) {
+        fprintf(stderr, "[uring] failed to re-arm the offload poll\n");
+    }
+}
+
+/* The accept armed by on_accept() with the spare descriptor freed. */
+static void on_drop(mc_uloop_t *loop, int res) {
+    loop->accept_armed = false;
+    if (res >= 0) {
+        close(res);
+    }
+    loop->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (arm_accept(loop, MC_URING_ACCEPT_TAG) != 0) {
+        fprintf(stderr, "[uring] failed to re-arm accept\n");
+    }
+}
+
+int mc_server_run_uring(const mc_server_config_t *config, int listen_fd) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    mc_uloop_t loop;
+    memset(&loop, 0, sizeof(loop));
+    loop.config = config;
+    loop.listen_fd = listen_fd;
+
+    if (ring_setup(&loop.ring, MC_URING_ENTRIES) != 0) {
+        return -1;
+    }
+    if (ring_probe(&loop.ring) != 0) {
+        ring_teardown(&loop.ring);
+        errno = ENOSYS;
+        return -1;
+    }
+    if (arm_accept(&loop, MC_URING_ACCEPT_TAG) != 0) {
+        ring_teardown(&loop.ring);
+        return -1;
+    }
+    loop.spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    loop.offload = mc_offload_create(config);
+    if (loop.offload && arm_offload(&loop) != 0) {
+        mc_offload_destroy(loop.offload);
+        loop.offload = NULL;
+    }
+
+    int rc = 0;
+    while (!mc_server_should_terminate()) {
+        if (ring_enter(&loop.ring, 1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EBUSY || errno == EAGAIN) {
+                /* completion queue backed up: reap below before submitting more */
+            } else {
+                perror("io_uring_enter");
+                rc = -1;
+                break;
+            }
+        }
+
+        unsigned int head = *loop.ring.cq_head;
+        unsigned int tail = __atomic_load_n(loop.ring.cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe *cqe = &loop.ring.cqes[head & *loop.ring.cq_mask];
+            uint64_t user_data = cqe->user_data;
+            int res = cqe->res;
+            head++;
+            __atomic_store_n(loop.ring.cq_head, head, __ATOMIC_RELEASE);
+
+            if (user_data == MC_URING_ACCEPT_TAG) {
+                on_accept(&loop, res);
+            } else if (user_data == MC_URING_DROP_TAG) {
+                on_drop(&loop, res);
+            } else if (user_data == MC_URING_OFFLOAD_TAG) {
+                on_offloaded(&loop);
+            } else {
+                mc_uconn_t *conn = (mc_uconn_t *)(uintptr_t)user_data;
+                if (on_completion(&loop, conn, res) != 0) {
+                    conn_free(&loop, conn);
+                }
+            }
+            tail = __atomic_load_n(loop.ring.cq_tail, __ATOMIC_ACQUIRE);
+        }
+        if (!loop.accept_armed && loop.fd_freed && arm_accept(&loop, MC_URING_ACCEPT_TAG) != 0) {
+            fprintf(stderr, "[uring] failed to re-arm accept\n");
+        }
+    }
+
+    /* Tear the ring down first so no in-flight operation still points at a
+     * connection buffer when it is freed. */
+    ring_teardown(&loop.ring);
+    while (loop.conns) {
+        conn_free(&loop, loop.conns);
+    }
+    mc_offload_destroy(loop.offload);
+    if (loop.spare_fd != -1) {
+        close(loop.spare_fd);
+    }
+    return rc;
+}
+
+#endif /* MC_HAVE_IO_URING */
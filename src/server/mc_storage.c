@@ -0,0 +1,2642 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mc_storage.h"
+#include "mc_cache.h"
+#include "mc_chunkstore.h"
+#include "mc_crc32c.h"
+#include "mc_delta.h"
+#include "mc_meta.h"
+#include "mc_sha256.h"
+#include "mc_zfile.h"
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+static unsigned int g_upload_seq = 0;
+
+static int set_error(char *err, size_t err_len, const char *fmt, ...) {
+    if (err && err_len > 0) {
+        va_list ap;
+        va_start(ap, fmt);
+        vsnprintf(err, err_len, fmt, ap);
+        va_end(ap);
+    }
+    return -1;
+}
+
+int mc_storage_mark_format(int fd, const char *format) {
+    return fsetxattr(fd, MC_STORAGE_FORMAT_XATTR, format, strlen(format), 0); /* fsetxattr() 시스템 콜로 저장 형식 표시 */
+}
+
+bool mc_storage_has_format(int fd, const char *format) {
+    char value[32];
+    ssize_t len = fgetxattr(fd, MC_STORAGE_FORMAT_XATTR, value, sizeof(value)); /* fgetxattr() 시스템 콜로 저장 형식 확인 */
+    return len >= 0 && (size_t)len == strlen(format) && memcmp(value, format, (size_t)len) == 0;
+}
+
+/* The server's own entries in the storage root. */
+static bool is_reserved(const char *component, size_t len) {
+    static const char *const reserved[] = {MC_STORAGE_SESSION_DIR, MC_CHUNKSTORE_DIR, MC_STORAGE_BLOB_DIR,
+                                           MC_STORAGE_META_LOG, MC_STORAGE_LAYOUT_FILE, MC_STORAGE_LAYOUT_STAGING};
+    for (size_t i = 0; i < sizeof(reserved) / sizeof(reserved[0]); ++i) {
+        if (strlen(reserved[i]) == len && memcmp(component, reserved[i], len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int mc_storage_is_safe_name(const char *name) {
+    if (!name || !*name) {
+        return 0;
+    }
+    if (strstr(name, "..")) {
+        return 0;
+    }
+    /* no empty or "." components, so no leading, trailing or doubled "/" either */
+    const char *component = name;
+    for (;;) {
+        size_t len = strcspn(component, "/");
+        if (len == 0 || (len == 1 && component[0] == '.')) {
+            return 0;
+        }
+        if (component == name && is_reserved(component, len)) {
+            return 0;
+        }
+        if (component[len] == '\0') {
+            return 1;
+        }
+        component += len + 1;
+    }
+}
+
+static const char *last_component(const char *name) {
+    const char *slash = strrchr(name, '/');
+    return slash ? slash + 1 : name;
+}
+
+static int build_storage_path(const mc_server_config_t *config,
+                              const char *filename,
+                              char *out,
+                              size_t out_len) {
+    if (!config || !filename || !out) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int written = snprintf(out, out_len, "%s/%s", config->storage_dir, filename);
+    if (written < 0 || (size_t)written >= out_len) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+/* Shard directories (see MC_STORAGE_LAYOUT_FILE) are named by two lowercase hex digits. */
+static bool is_shard_name(const char *name) {
+    for (size_t i = 0; i < 2; ++i) {
+        if (!((name[i] >= '0' && name[i] <= '9') || (name[i] >= 'a' && name[i] <= 'f'))) {
+            return false;
+        }
+    }
+    return name[2] == '\0';
+}
+
+/* "xx/yy" for an entry named component: the low two bytes of its FNV-1a hash. */
+static void shard_dirs(const char *component, size_t len, char out[6]) {
+    uint32_t hash = 2166136261U;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (uint8_t)component[i];
+        hash *= 16777619U;
+    }
+    snprintf(out, 6, "%02x/%02x", (unsigned int)(hash >> 8) & 0xffU, (unsigned int)hash & 0xffU);
+}
+
+/* name's path below the storage root in layout; -1 with ENAMETOOLONG if it does not fit. */
+static int layout_path(mc_storage_layout_t layout, const char *name, char *out, size_t out_len) {
+    size_t used = 0;
+    const char *component = name;
+    for (;;) {
+        size_t len = strcspn(component, "/");
+        char shard[6] = "";
+        if (layout == MC_STORAGE_LAYOUT_SHARDED) {
+            shard_dirs(component, len, shard);
+        }
+        int written = snprintf(out + used,
+                               out_len - used,
+                               "%s%s%s%.*s",
+                               used ? "/" : "",
+                               shard,
+                               shard[0] ? "/" : "",
+                               (int)len,
+                               component);
+        if (written < 0 || (size_t)written >= out_len - used) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        used += (size_t)written;
+        if (component[len] == '\0') {
+            return 0;
+        }
+        component += len + 1;
+    }
+}
+
+static int build_object_path(const mc_server_config_t *config, const char *name, char *out, size_t out_len) {
+    char path[MC_STORAGE_PATH_MAX];
+    if (layout_path(config->storage_layout, name, path, sizeof(path)) != 0) {
+        return -1;
+    }
+    return build_storage_path(config, path, out, out_len);
+}
+
+/* A directory's index entry: "name/", with no size or mtime. */
+static void index_directory(const char *name, size_t len) {
+    char key[MC_MAX_FILENAME_LEN + 2];
+    if (!mc_meta_enabled() || len + 1 >= sizeof(key)) {
+        return;
+    }
+    memcpy(key, name, len);
+    key[len] = '/';
+    key[len + 1] = '\0';
+    mc_meta_info_t info;
+    memset(&info, 0, sizeof(info));
+    (void)mc_meta_put(key, &info);
+}
+
+/*
+ * Opens the directory holding name's last component, walking down from the
+ * storage root one component at a time (shard directories included);
+ * O_NOFOLLOW keeps a symlink from leading anywhere else. With create,
+ * missing directories are made on the way and the ones that are names get
+ * indexed. Returns the descriptor, or -1 with errno.
+ */
+static int open_parent(const mc_server_config_t *config, const char *name, bool create) {
+    char path[MC_STORAGE_PATH_MAX];
+    if (layout_path(config->storage_layout, name, path, sizeof(path)) != 0) {
+        return -1;
+    }
+    int dir_fd = open(config->storage_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC); /* open() 시스템 콜로 저장소 루트 열기 */
+    if (dir_fd == -1) {
+        return -1;
+    }
+    bool sharded = config->storage_layout == MC_STORAGE_LAYOUT_SHARDED;
+    size_t depth = 0;
+    size_t name_len = 0; /* how much of name the directories entered so far cover */
+    char component[MC_MAX_FILENAME_LEN + 1];
+    const char *start = path;
+    const char *slash;
+    while ((slash = strchr(start, '/')) != NULL) {
+        size_t len = (size_t)(slash - start);
+        if (len >= sizeof(component)) {
+            close(dir_fd);
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        memcpy(component, start, len);
+        component[len] = '\0';
+        bool is_name = !sharded || depth % 3 == 2;
+        if (is_name) {
+            name_len += (name_len ? 1 : 0) + len;
+        }
+        if (create) {
+            if (mkdirat(dir_fd, component, 0755) == 0) { /* mkdirat() 시스템 콜로 없는 상위 디렉터리 생성 */
+                if (is_name) {
+                    index_directory(name, name_len);
+                }
+            } else if (errno != EEXIST) {
+                int saved = errno;
+                close(dir_fd);
+                errno = saved;
+                return -1;
+            }
+        }
+        int next = openat(dir_fd, component, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC); /* openat() 시스템 콜로 한 단계 내려가기 */
+        int saved = errno;
+        close(dir_fd);
+        if (next == -1) {
+            errno = saved;
+            return -1;
+        }
+        dir_fd = next;
+        start = slash + 1;
+        ++depth;
+    }
+    return dir_fd;
+}
+
+/* Client-facing message for an open_parent() failure; missing is the one for ENOENT. */
+static int parent_error(const char *missing, char *err, size_t err_len) {
+    if (errno == ENOENT) {
+        return set_error(err, err_len, "%s", missing);
+    }
+    if (errno == ENOTDIR || errno == ELOOP) {
+        return set_error(err, err_len, "Not a directory");
+    }
+    return set_error(err, err_len, "Failed to open directory: %s", strerror(errno));
+}
+
+static int check_name(const char *name, const char *op, char *err, size_t err_len) {
+    if (!name || !name[0]) {
+        return set_error(err, err_len, "%s requires filename", op);
+    }
+    if (!mc_storage_is_safe_name(name)) {
+        return set_error(err, err_len, "Invalid filename");
+    }
+    return 0;
+}
+
+int mc_storage_prepare_upload(const mc_server_config_t *config,
+                              const char *name,
+                              uint64_t payload_len,
+                              mc_upload_t *out,
+                              char *err,
+                              size_t err_len) {
+    out->fd = -1;
+    out->dir_fd = -1;
+    out->keep_partial = false;
+    out->compress = config->storage_mode == MC_STORAGE_MODE_COMPRESSED;
+    out->digest_known = false;
+    out->append_from = 0;
+    out->chunk_root = config->storage_mode == MC_STORAGE_MODE_CHUNKED ? config->storage_dir : NULL;
+    if (check_name(name, "UPLOAD", err, err_len) != 0) {
+        return -1;
+    }
+    snprintf(out->name, sizeof(out->name), "%s", name);
+    if (config->max_upload_bytes > 0 && payload_len > config->max_upload_bytes) {
+        return set_error(err,
+                         err_len,
+                         "Upload exceeds limit (%" PRIu64 " bytes)",
+                         (uint64_t)config->max_upload_bytes);
+    }
+    if (build_object_path(config, name, out->final_path, sizeof(out->final_path)) != 0) {
+        return set_error(err, err_len, "Path too long");
+    }
+    /* kept open until the upload is published or dropped: every later step
+     * works relative to the directory checked here */
+    out->dir_fd = open_parent(config, name, true);
+    if (out->dir_fd == -1) {
+        return parent_error("Directory not found", err, err_len);
+    }
+
+    /* The temp file sits next to the target so the rename stays in one
+     * directory. pid + sequence keeps temp names unique across forked
+     * workers, across concurrent uploads inside one event-driven process and
+     * across the stream threads of a multiplexed connection. */
+    const char *leaf = last_component(out->final_path);
+    int written = snprintf(out->tmp_path,
+                           sizeof(out->tmp_path),
+                           "%.*s.%s.%ld.%u.tmp",
+                           (int)(leaf - out->final_path),
+                           out->final_path,
+                           leaf,
+                           (long)getpid(),
+                           __atomic_fetch_add(&g_upload_seq, 1U, __ATOMIC_RELAXED));
+    if (written < 0 || (size_t)written >= sizeof(out->tmp_path)) {
+        mc_storage_release_upload(out);
+        return set_error(err, err_len, "Path too long");
+    }
+    return 0;
+}
+
+int mc_storage_begin_upload(const mc_server_config_t *config,
+                            const char *name,
+                            uint64_t payload_len,
+                            mc_upload_t *out,
+                            char *err,
+                            size_t err_len) {
+    if (mc_storage_prepare_upload(config, name, payload_len, out, err, err_len) != 0) {
+        return -1;
+    }
+
+    out->fd = openat(out->dir_fd,
+                     last_component(out->tmp_path),
+                     O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+                     0644); /* openat() 시스템 콜로 임시 파일 생성 */
+    if (out->fd == -1) {
+        int saved = errno;
+        mc_storage_release_upload(out);
+        return set_error(err, err_len, "Failed to open temp file: %s", strerror(saved));
+    }
+    return 0;
+}
+
+/* read() until len bytes or EOF; returns the count, or -1. */
+static ssize_t read_full(int fd, void *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t got = read(fd, (uint8_t *)buf + done, len - done); /* read() 시스템 콜로 데이터 읽기 */
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (got == 0) {
+            break;
+        }
+        done += (size_t)got;
+    }
+    return (ssize_t)done;
+}
+
+/* SHA-256 of what is left to read from fd; 0, or -1 with errno. */
+static int hash_fd(int fd, uint8_t digest[MC_SHA256_DIGEST_LEN]) {
+    uint8_t *buf = malloc(64 * 1024);
+    if (!buf) {
+        errno = ENOMEM;
+        return -1;
+    }
+    mc_sha256_t sha;
+    mc_sha256_init(&sha);
+    ssize_t got;
+    while ((got = read_full(fd, buf, 64 * 1024)) > 0) {
+        mc_sha256_update(&sha, buf, (size_t)got);
+    }
+    free(buf);
+    if (got < 0) {
+        return -1;
+    }
+    mc_sha256_final(&sha, digest);
+    return 0;
+}
+
+/* FNV-1a over name, total size, tag and content hash: the same source resumes the same session. */
+static void session_key(const char *name, const mc_upload_begin_t *begin, char *out) {
+    uint64_t hash = 1469598103934665603ULL;
+    const uint8_t *parts[4] = {(const uint8_t *)name,
+                               (const uint8_t *)&begin->total_size,
+                               (const uint8_t *)&begin->tag,
+                               begin->sha256};
+    size_t lens[4] = {strlen(name) + 1, sizeof(begin->total_size), sizeof(begin->tag), sizeof(begin->sha256)};
+    for (size_t p = 0; p < 4; ++p) {
+        for (size_t i = 0; i < lens[p]; ++i) {
+            hash ^= parts[p][i];
+            hash *= 1099511628211ULL;
+        }
+    }
+    snprintf(out, MC_UPLOAD_KEY_LEN + 1, "%016" PRIx64, hash);
+}
+
+static int session_path(const mc_server_config_t *config, const char *key, char *out, size_t out_len) {
+    int written = snprintf(out, out_len, "%s/%s/%s.part", config->storage_dir, MC_STORAGE_SESSION_DIR, key);
+    if (written < 0 || (size_t)written >= out_len) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Running SHA-256 of a session file, kept beside it in <key>.part.sha256:
+ * each UPLOAD_APPEND hashes only the bytes it added, a resumed upload goes on
+ * from the saved state and commit reads only what no append covered. hashed
+ * is how many leading bytes of the session file ctx has taken in.
+ */
+typedef struct {
+    uint64_t hashed;
+    mc_sha256_t ctx;
+} session_hash_t;
+
+#define MC_SESSION_HASH_SUFFIX ".sha256"
+
+static int session_hash_name(const char *part, char *out, size_t out_len) {
+    int written = snprintf(out, out_len, "%s%s", part, MC_SESSION_HASH_SUFFIX);
+    return written < 0 || (size_t)written >= out_len ? -1 : 0;
+}
+
+/* The saved state of session file part, or a fresh one when there is none (or it is torn). */
+static void load_session_hash(int session_fd, const char *part, session_hash_t *out) {
+    char name[MC_STORAGE_PATH_MAX];
+    out->hashed = 0;
+    mc_sha256_init(&out->ctx);
+    if (session_hash_name(part, name, sizeof(name)) != 0) {
+        return;
+    }
+    int fd = openat(session_fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC); /* openat() 시스템 콜로 세션 해시 상태 열기 */
+    if (fd == -1) {
+        return;
+    }
+    session_hash_t saved;
+    if (read_full(fd, &saved, sizeof(saved)) == (ssize_t)sizeof(saved) && saved.ctx.block_len < sizeof(saved.ctx.block)) {
+        *out = saved;
+    }
+    close(fd);
+}
+
+/* Best effort: a state that fails to save is rebuilt from the file later. */
+static void save_session_hash(int session_fd, const char *part, const session_hash_t *hash) {
+    char name[MC_STORAGE_PATH_MAX];
+    if (session_hash_name(part, name, sizeof(name)) != 0) {
+        return;
+    }
+    int fd = openat(session_fd, name, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0644); /* openat() 시스템 콜로 세션 해시 상태 저장 */
+    if (fd == -1) {
+        return;
+    }
+    if (write(fd, hash, sizeof(*hash)) != (ssize_t)sizeof(*hash)) { /* write() 시스템 콜로 해시 상태 기록 */
+        close(fd);
+        unlinkat(session_fd, name, 0); /* a short state would only be thrown away on load */
+        return;
+    }
+    close(fd);
+}
+
+static void drop_session_hash(int session_fd, const char *part) {
+    char name[MC_STORAGE_PATH_MAX];
+    if (session_hash_name(part, name, sizeof(name)) == 0) {
+        unlinkat(session_fd, name, 0); /* unlinkat() 시스템 콜로 세션 해시 상태 제거 */
+    }
+}
+
+/* Feeds bytes [hash->hashed, size) of fd into hash; 0, or -1 with errno. */
+static int advance_session_hash(int fd, uint64_t size, session_hash_t *hash) {
+    if (hash->hashed > size) {
+        /* the file was cut back under the state: start over */
+        hash->hashed = 0;
+        mc_sha256_init(&hash->ctx);
+    }
+    if (hash->hashed == size) {
+        return 0;
+    }
+    uint8_t *buf = malloc(64 * 1024);
+    if (!buf) {
+        errno = ENOMEM;
+        return -1;
+    }
+    int rc = 0;
+    while (hash->hashed < size) {
+        size_t want = size - hash->hashed > 64 * 1024 ? 64 * 1024 : (size_t)(size - hash->hashed);
+        ssize_t got = pread(fd, buf, want, (off_t)hash->hashed); /* pread() 시스템 콜로 아직 해시하지 않은 부분 읽기 */
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            if (got == 0) {
+                errno = EIO;
+            }
+            rc = -1;
+            break;
+        }
+        mc_sha256_update(&hash->ctx, buf, (size_t)got);
+        hash->hashed += (uint64_t)got;
+    }
+    free(buf);
+    return rc;
+}
+
+/* Opens the session directory below the root (creating it first with create); -1 with errno. */
+static int open_session_dir(const mc_server_config_t *config, bool create) {
+    int root_fd = open(config->storage_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC); /* open() 시스템 콜로 저장소 루트 열기 */
+    if (root_fd == -1) {
+        return -1;
+    }
+    if (create && mkdirat(root_fd, MC_STORAGE_SESSION_DIR, 0755) == -1 && errno != EEXIST) { /* mkdirat() 시스템 콜로 세션 디렉터리 생성 */
+        int saved = errno;
+        close(root_fd);
+        errno = saved;
+        return -1;
+    }
+    int dir_fd = openat(root_fd, MC_STORAGE_SESSION_DIR, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC); /* openat() 시스템 콜로 세션 디렉터리 열기 */
+    int saved = errno;
+    close(root_fd);
+    errno = saved;
+    return dir_fd;
+}
+
+static int is_session_key(const char *key) {
+    if (strlen(key) != MC_UPLOAD_KEY_LEN) {
+        return 0;
+    }
+    for (const char *p = key; *p; ++p) {
+        if (!((*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'f'))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int mc_storage_begin_session(const mc_server_config_t *config,
+                             const char *name,
+                             const mc_upload_begin_t *begin,
+                             char *key_out,
+                             uint64_t *committed,
+                             char *err,
+                             size_t err_len) {
+    mc_upload_t target;
+    if (mc_storage_prepare_upload(config, name, begin->total_size, &target, err, err_len) != 0) {
+        return -1;
+    }
+    mc_storage_release_upload(&target); /* only the name is checked here */
+
+    char path[MC_STORAGE_PATH_MAX];
+    session_key(name, begin, key_out);
+    if (session_path(config, key_out, path, sizeof(path)) != 0) {
+        return set_error(err, err_len, "Path too long");
+    }
+    int dir_fd = open_session_dir(config, true);
+    if (dir_fd == -1) {
+        return set_error(err, err_len, "Failed to create session dir: %s", strerror(errno));
+    }
+
+    int fd = openat(dir_fd, last_component(path), O_WRONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644); /* openat() 시스템 콜로 세션 파일 열기 */
+    close(dir_fd);
+    if (fd == -1) {
+        return set_error(err, err_len, "Failed to open upload session: %s", strerror(errno));
+    }
+    struct stat st;
+    int rc = fstat(fd, &st); /* fstat() 시스템 콜로 이미 받은 크기 확인 */
+    if (rc == 0 && (uint64_t)st.st_size > begin->total_size) {
+        rc = ftruncate(fd, 0); /* more than the source has: start over */
+        st.st_size = 0;
+    }
+    close(fd);
+    if (rc == 0 && st.st_size == 0) {
+        int session_fd = open_session_dir(config, false);
+        if (session_fd != -1) {
+            drop_session_hash(session_fd, last_component(path));
+            close(session_fd);
+        }
+    }
+    if (rc != 0) {
+        return set_error(err, err_len, "Failed to inspect upload session: %s", strerror(errno));
+    }
+    *committed = (uint64_t)st.st_size;
+    return 0;
+}
+
+int mc_storage_prepare_append(const mc_server_config_t *config,
+                              const char *key,
+                              mc_upload_t *out,
+                              char *err,
+                              size_t err_len) {
+    out->fd = -1;
+    out->dir_fd = -1;
+    out->keep_partial = true;
+    out->compress = false;
+    out->append_from = 0;
+    out->chunk_root = NULL;
+    out->name[0] = '\0';
+    out->final_path[0] = '\0';
+    if (!key || !is_session_key(key)) {
+        return set_error(err, err_len, "Invalid upload session");
+    }
+    if (session_path(config, key, out->tmp_path, sizeof(out->tmp_path)) != 0) {
+        return set_error(err, err_len, "Path too long");
+    }
+    out->dir_fd = open_session_dir(config, false);
+    if (out->dir_fd == -1) {
+        return set_error(err, err_len, errno == ENOENT ? "Unknown upload session" : "Failed to open upload session");
+    }
+    return 0;
+}
+
+int mc_storage_check_append(const mc_server_config_t *config,
+                            mc_upload_t *upload,
+                            uint64_t payload_len,
+                            uint64_t *committed,
+                            char *err,
+                            size_t err_len) {
+    /* two clients appending to one session would interleave their bytes */
+    if (flock(upload->fd, LOCK_EX | LOCK_NB) == -1) { /* flock() 시스템 콜로 세션 잠금 */
+        return set_error(err, err_len, "Upload session busy");
+    }
+    struct stat st;
+    if (fstat(upload->fd, &st) == -1) { /* fstat() 시스템 콜로 현재 크기 확인 */
+        return set_error(err, err_len, "Failed to inspect upload session: %s", strerror(errno));
+    }
+    if (config->max_upload_bytes > 0 && (uint64_t)st.st_size + payload_len > config->max_upload_bytes) {
+        return set_error(err,
+                         err_len,
+                         "Upload exceeds limit (%" PRIu64 " bytes)",
+                         (uint64_t)config->max_upload_bytes);
+    }
+    upload->append_from = (uint64_t)st.st_size;
+    *committed = (uint64_t)st.st_size;
+    return 0;
+}
+
+int mc_storage_begin_append(const mc_server_config_t *config,
+                            const char *key,
+                            uint64_t payload_len,
+                            mc_upload_t *out,
+                            char *err,
+                            size_t err_len) {
+    if (mc_storage_prepare_append(config, key, out, err, err_len) != 0) {
+        return -1;
+    }
+    /* no O_APPEND: splice() refuses append-mode targets, so seek instead */
+    out->fd = openat(out->dir_fd, last_component(out->tmp_path), O_WRONLY | O_NOFOLLOW | O_CLOEXEC); /* openat() 시스템 콜로 세션 파일 열기 */
+    if (out->fd == -1) {
+        bool missing = errno == ENOENT;
+        mc_storage_release_upload(out);
+        return set_error(err, err_len, missing ? "Unknown upload session" : "Failed to open upload session");
+    }
+    uint64_t committed = 0;
+    int rc = mc_storage_check_append(config, out, payload_len, &committed, err, err_len);
+    if (rc == 0 && lseek(out->fd, (off_t)committed, SEEK_SET) == -1) { /* lseek() 시스템 콜로 이어쓸 위치 이동 */
+        rc = set_error(err, err_len, "Failed to seek upload session: %s", strerror(errno));
+    }
+    if (rc != 0) {
+        close(out->fd);
+        out->fd = -1;
+        mc_storage_release_upload(out);
+    }
+    return rc;
+}
+
+int mc_storage_finish_append(mc_upload_t *upload, uint64_t *committed, char *err, size_t err_len) {
+    struct stat st;
+    int rc = fstat(upload->fd, &st); /* fstat() 시스템 콜로 커밋된 크기 확인 */
+    if (rc == 0) {
+        /* still under the append lock: take in what this request added, read
+         * back from the page cache, so commit does not hash the whole file */
+        const char *part = last_component(upload->tmp_path);
+        int read_fd = openat(upload->dir_fd, part, O_RDONLY | O_NOFOLLOW | O_CLOEXEC); /* openat() 시스템 콜로 세션 파일 읽기용 열기 */
+        if (read_fd != -1) {
+            session_hash_t hash;
+            load_session_hash(upload->dir_fd, part, &hash);
+            if (advance_session_hash(read_fd, (uint64_t)st.st_size, &hash) == 0) {
+                save_session_hash(upload->dir_fd, part, &hash);
+            }
+            close(read_fd);
+        }
+    }
+    close(upload->fd); /* close() 시스템 콜로 세션 파일 닫기 (잠금도 해제) */
+    upload->fd = -1;
+    mc_storage_release_upload(upload);
+    if (rc == -1) {
+        return set_error(err, err_len, "Failed to inspect upload session: %s", strerror(errno));
+    }
+    *committed = (uint64_t)st.st_size;
+    return 0;
+}
+
+/* A stored file's content size: a manifest's or container's total in those modes, else as is. */
+static int probe_content(mc_storage_mode_t mode, int fd, uint64_t *size) {
+    if (mode == MC_STORAGE_MODE_CHUNKED) {
+        return mc_chunkstore_probe(fd, size) < 0 ? -1 : 0;
+    }
+    if (mode == MC_STORAGE_MODE_COMPRESSED) {
+        return mc_zfile_probe(fd, size) < 0 ? -1 : 0;
+    }
+    return 0;
+}
+
+/* Stats the stored file path in dir_fd; *size is the content size (see probe_content). */
+static int stat_content(mc_storage_mode_t mode, int dir_fd, const char *path, struct stat *st, uint64_t *size) {
+    int fd = openat(dir_fd, path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC); /* openat() 시스템 콜로 저장 파일 열기 */
+    if (fd == -1) {
+        return -1;
+    }
+    int rc = fstat(fd, st); /* fstat() 시스템 콜로 크기와 inode 확인 */
+    if (rc == 0 && !S_ISREG(st->st_mode)) {
+        rc = -1;
+    }
+    if (rc == 0) {
+        *size = (uint64_t)st->st_size;
+        rc = probe_content(mode, fd, size);
+    }
+    close(fd);
+    return rc;
+}
+
+static mc_storage_mode_t upload_mode(const mc_upload_t *upload) {
+    return upload->chunk_root ? MC_STORAGE_MODE_CHUNKED
+           : upload->compress ? MC_STORAGE_MODE_COMPRESSED
+                              : MC_STORAGE_MODE_PLAIN;
+}
+
+/* Records what is now published at path in dir_fd, under name, in the metadata index. */
+static void index_stored(mc_storage_mode_t mode, int dir_fd, const char *path, const char *name, const uint8_t *digest) {
+    if (!mc_meta_enabled()) {
+        return;
+    }
+    struct stat st;
+    mc_meta_info_t info;
+    memset(&info, 0, sizeof(info));
+    if (stat_content(mode, dir_fd, path, &st, &info.size) != 0) {
+        return;
+    }
+    info.mtime = (int64_t)st.st_mtime;
+    if (digest) {
+        info.has_digest = true;
+        memcpy(info.digest, digest, sizeof(info.digest));
+    }
+    (void)mc_meta_put(name, &info);
+}
+
+void mc_storage_note_committed(const mc_upload_t *upload) {
+    mc_cache_invalidate(upload->name);
+    index_stored(upload_mode(upload),
+                 upload->dir_fd,
+                 last_component(upload->final_path),
+                 upload->name,
+                 upload->digest_known ? upload->digest : NULL);
+}
+
+void mc_storage_note_deleted(const char *name) {
+    mc_cache_invalidate(name);
+    if (mc_meta_enabled()) {
+        (void)mc_meta_remove(name);
+    }
+}
+
+/* Chunked mode: the temp file's content goes to the chunk store and a manifest takes its place. */
+static int commit_chunked(mc_upload_t *upload, char *err, size_t err_len) {
+    const char *tmp = last_component(upload->tmp_path);
+    /* the payload was written through a write-only descriptor */
+    if (upload->fd != -1) {
+        close(upload->fd);
+    }
+    upload->fd = openat(upload->dir_fd, tmp, O_RDONLY | O_NOFOLLOW | O_CLOEXEC); /* openat() 시스템 콜로 임시 파일 다시 열기 */
+    if (upload->fd == -1) {
+        return set_error(err, err_len, "Failed to store file: %s", strerror(errno));
+    }
+    char manifest_tmp[MC_STORAGE_PATH_MAX];
+    int written = snprintf(manifest_tmp, sizeof(manifest_tmp), "%s.m", tmp);
+    int rc = -1;
+    if (written < 0 || (size_t)written >= sizeof(manifest_tmp)) {
+        set_error(err, err_len, "Path too long");
+    } else {
+        rc = mc_chunkstore_ingest(upload->chunk_root,
+                                  upload->fd,
+                                  upload->dir_fd,
+                                  manifest_tmp,
+                                  last_component(upload->final_path),
+                                  err,
+                                  err_len);
+    }
+    close(upload->fd);
+    upload->fd = -1;
+    if (rc == 0 || !upload->keep_partial) {
+        unlinkat(upload->dir_fd, tmp, 0); /* unlinkat() 시스템 콜로 원본 임시 파일 제거 */
+    }
+    return rc;
+}
+
+/* Compressed mode: the temp file is packed into a container, which is published if it came out smaller. */
+static int commit_compressed(mc_upload_t *upload, char *err, size_t err_len) {
+    const char *tmp = last_component(upload->tmp_path);
+    if (upload->fd != -1) {
+        close(upload->fd);
+    }
+    upload->fd = openat(upload->dir_fd, tmp, O_RDONLY | O_NOFOLLOW | O_CLOEXEC); /* openat() 시스템 콜로 임시 파일 다시 열기 */
+    if (upload->fd == -1) {
+        return set_error(err, err_len, "Failed to store file: %s", strerror(errno));
+    }
+    char packed_tmp[MC_STORAGE_PATH_MAX];
+    int written = snprintf(packed_tmp, sizeof(packed_tmp), "%s.z", tmp);
+    int packed = -1;
+    if (written < 0 || (size_t)written >= sizeof(packed_tmp)) {
+        set_error(err, err_len, "Path too long");
+    } else {
+        packed = mc_zfile_pack(upload->fd, upload->dir_fd, packed_tmp, err, err_len);
+    }
+    close(upload->fd);
+    upload->fd = -1;
+
+    int rc = -1;
+    if (packed >= 0) {
+        const char *source = packed == 1 ? packed_tmp : tmp;
+        rc = renameat(upload->dir_fd, source, upload->dir_fd, last_component(upload->final_path)); /* renameat() 시스템 콜로 원자적 교체 */
+        if (rc == -1) {
+            int saved = errno;
+            if (packed == 1) {
+                unlinkat(upload->dir_fd, packed_tmp, 0);
+            }
+            set_error(err, err_len, "Failed to store file: %s", strerror(saved));
+        }
+    }
+    if (rc == 0 ? packed == 1 : !upload->keep_partial) {
+        unlinkat(upload->dir_fd, tmp, 0); /* unlinkat() 시스템 콜로 원본 임시 파일 제거 */
+    }
+    return rc;
+}
+
+/* mc_storage_commit_upload() without releasing dir_fd. */
+static int commit_upload_at(mc_upload_t *upload, char *err, size_t err_len) {
+    int rc = 0;
+    if (upload->chunk_root) {
+        rc = commit_chunked(upload, err, err_len);
+    } else if (upload->compress) {
+        rc = commit_compressed(upload, err, err_len);
+    } else {
+        if (upload->fd != -1) {
+            close(upload->fd); /* close() 시스템 콜로 임시 파일 닫기 */
+            upload->fd = -1;
+        }
+        const char *tmp = last_component(upload->tmp_path);
+        if (renameat(upload->dir_fd, tmp, upload->dir_fd, last_component(upload->final_path)) == -1) { /* renameat() 시스템 콜로 원자적 교체 */
+            int saved = errno;
+            unlinkat(upload->dir_fd, tmp, 0);
+            return set_error(err, err_len, "Failed to store file: %s", strerror(saved));
+        }
+    }
+    if (rc == 0) {
+        mc_storage_note_committed(upload);
+    }
+    return rc;
+}
+
+int mc_storage_commit_upload(mc_upload_t *upload, char *err, size_t err_len) {
+    int rc = commit_upload_at(upload, err, err_len);
+    mc_storage_release_upload(upload);
+    return rc;
+}
+
+/*
+ * Whether the session file part hashes to begin->sha256: 1, 0, or -1 with
+ * errno. The appends already hashed it; only bytes they missed are read here.
+ */
+static int session_matches(int session_fd, const char *part, const mc_upload_begin_t *begin) {
+    int fd = openat(session_fd, part, O_RDONLY | O_NOFOLLOW | O_CLOEXEC); /* openat() 시스템 콜로 세션 파일 열기 */
+    if (fd == -1) {
+        return -1;
+    }
+    session_hash_t hash;
+    load_session_hash(session_fd, part, &hash);
+    int rc = advance_session_hash(fd, begin->total_size, &hash);
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    if (rc != 0) {
+        return -1;
+    }
+    uint8_t digest[MC_SHA256_DIGEST_LEN];
+    mc_sha256_final(&hash.ctx, digest);
+    return memcmp(digest, begin->sha256, sizeof(digest)) == 0;
+}
+
+int mc_storage_commit_session(const mc_server_config_t *config,
+                              const char *name,
+                              const mc_upload_begin_t *begin,
+                              char *err,
+                              size_t err_len) {
+    mc_upload_t target;
+    if (mc_storage_prepare_upload(config, name, begin->total_size, &target, err, err_len) != 0) {
+        return -1;
+    }
+    char key[MC_UPLOAD_KEY_LEN + 1];
+    char path[MC_STORAGE_PATH_MAX];
+    session_key(name, begin, key);
+    if (session_path(config, key, path, sizeof(path)) != 0) {
+        mc_storage_release_upload(&target);
+        return set_error(err, err_len, "Path too long");
+    }
+
+    const char *part = last_component(path);
+    int session_fd = open_session_dir(config, false);
+    struct stat st;
+    if (session_fd == -1 || fstatat(session_fd, part, &st, AT_SYMLINK_NOFOLLOW) == -1) { /* fstatat() 시스템 콜로 세션 크기 확인 */
+        if (session_fd != -1) {
+            close(session_fd);
+        }
+        mc_storage_release_upload(&target);
+        return set_error(err, err_len, "Unknown upload session");
+    }
+    int rc = 0;
+    int matches = 0;
+    if (!S_ISREG(st.st_mode) || (uint64_t)st.st_size != begin->total_size) {
+        rc = set_error(err,
+                       err_len,
+                       "Upload incomplete (%" PRIu64 " of %" PRIu64 " bytes)",
+                       (uint64_t)st.st_size,
+                       (uint64_t)begin->total_size);
+    } else if ((matches = session_matches(session_fd, part, begin)) != 1) {
+        if (matches == 0) {
+            unlinkat(session_fd, part, 0); /* unlinkat() 시스템 콜로 내용이 다른 세션 버리기 (다음 BEGIN은 처음부터) */
+            rc = set_error(err, err_len, "Checksum mismatch");
+        } else {
+            rc = set_error(err, err_len, "Failed to read upload session: %s", strerror(errno));
+        }
+    } else if (target.chunk_root || target.compress) {
+        /* moved next to the target as its temp file, so the commit stays in one directory */
+        const char *tmp = last_component(target.tmp_path);
+        if (renameat(session_fd, part, target.dir_fd, tmp) == -1) { /* renameat() 시스템 콜로 세션 파일 옮기기 */
+            rc = set_error(err, err_len, "Failed to store file: %s", strerror(errno));
+        } else {
+            target.keep_partial = true;
+            rc = commit_upload_at(&target, err, err_len);
+            if (rc != 0) {
+                renameat(target.dir_fd, tmp, session_fd, part); /* a failed ingest leaves the session to retry */
+            }
+        }
+    } else if (renameat(session_fd, part, target.dir_fd, last_component(target.final_path)) == -1) { /* renameat() 시스템 콜로 완성된 파일 게시 */
+        rc = set_error(err, err_len, "Failed to store file: %s", strerror(errno));
+    } else {
+        mc_storage_note_committed(&target);
+    }
+    if (rc == 0 || matches == 0) {
+        drop_session_hash(session_fd, part); /* the session file is gone with it */
+    }
+    close(session_fd);
+    mc_storage_release_upload(&target);
+    return rc;
+}
+
+void mc_storage_abort_upload(mc_upload_t *upload) {
+    if (upload->fd != -1) {
+        close(upload->fd);
+        upload->fd = -1;
+    }
+    if (!upload->keep_partial && upload->dir_fd != -1) {
+        unlinkat(upload->dir_fd, last_component(upload->tmp_path), 0); /* unlinkat() 시스템 콜로 임시 파일 제거 */
+    }
+    mc_storage_release_upload(upload);
+}
+
+void mc_storage_release_upload(mc_upload_t *upload) {
+    if (upload->dir_fd != -1) {
+        close(upload->dir_fd); /* close() 시스템 콜로 대상 디렉터리 닫기 */
+        upload->dir_fd = -1;
+    }
+}
+
+const char *mc_storage_leaf(const char *path) {
+    return last_component(path);
+}
+
+void mc_storage_reject_upload(mc_upload_t *upload) {
+    if (upload->keep_partial && upload->fd != -1 &&
+        ftruncate(upload->fd, (off_t)upload->append_from) == -1) { /* ftruncate() 시스템 콜로 이번 추가분 되돌리기 */
+        upload->keep_partial = false; /* cannot cut it back: drop the session instead */
+    }
+    mc_storage_abort_upload(upload);
+}
+
+uint64_t mc_storage_upload_room(const mc_server_config_t *config, const mc_upload_t *upload) {
+    if (config->max_upload_bytes == 0) {
+        return UINT64_MAX;
+    }
+    uint64_t max = config->max_upload_bytes;
+    return upload->append_from >= max ? 0 : max - upload->append_from;
+}
+
+int mc_storage_resolve(const mc_server_config_t *config,
+                       const char *name,
+                       const char *op,
+                       int *dir_fd,
+                       char *leaf,
+                       size_t leaf_len,
+                       char *err,
+                       size_t err_len) {
+    *dir_fd = -1;
+    if (check_name(name, op, err, err_len) != 0) {
+        return -1;
+    }
+    /* the root for a flat name; the leaf is only ever opened against it */
+    *dir_fd = open_parent(config, name, false);
+    if (*dir_fd == -1) {
+        return parent_error("File not found", err, err_len);
+    }
+    snprintf(leaf, leaf_len, "%s", last_component(name));
+    return 0;
+}
+
+/* Opens the file stored under name as it is on disk; returns the descriptor, or -1. */
+static int open_stored(const mc_server_config_t *config, const char *name, struct stat *st, char *err, size_t err_len) {
+    int dir_fd;
+    char path[MC_STORAGE_PATH_MAX];
+    if (mc_storage_resolve(config, name, "DOWNLOAD", &dir_fd, path, sizeof(path), err, err_len) != 0) {
+        return -1;
+    }
+
+    int file_fd = openat(dir_fd, path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC); /* openat() 시스템 콜로 다운로드 파일 오픈 */
+    close(dir_fd);
+    if (file_fd == -1) {
+        return set_error(err, err_len, "File not found");
+    }
+
+    if (fstat(file_fd, st) == -1) { /* fstat() 시스템 콜로 파일 크기 확인 */
+        close(file_fd);
+        return set_error(err, err_len, "Failed to stat file");
+    }
+    if (!S_ISREG(st->st_mode)) {
+        close(file_fd);
+        return set_error(err, err_len, "Not a regular file");
+    }
+    return file_fd;
+}
+
+/* open_download, also handing back the stat of the file as stored (the validator's and the hot-file cache's input). */
+static int open_content(const mc_server_config_t *config,
+                        const char *name,
+                        int *out_fd,
+                        uint64_t *out_size,
+                        struct stat *stored,
+                        char *err,
+                        size_t err_len) {
+    int file_fd = open_stored(config, name, stored, err, err_len);
+    if (file_fd == -1) {
+        return -1;
+    }
+    struct stat st = *stored;
+
+    if (config->storage_mode == MC_STORAGE_MODE_CHUNKED) {
+        /* files stored before chunked mode was enabled are served as they are */
+        mc_manifest_t manifest;
+        int is_manifest = mc_chunkstore_read_manifest(file_fd, &manifest);
+        if (is_manifest != 0) {
+            close(file_fd);
+            if (is_manifest < 0) {
+                return set_error(err, err_len, "Failed to read manifest");
+            }
+            file_fd = mc_chunkstore_materialize(config->storage_dir, &manifest, err, err_len);
+            st.st_size = (off_t)manifest.total_size;
+            mc_chunkstore_free_manifest(&manifest);
+            if (file_fd == -1) {
+                return -1;
+            }
+        }
+    } else if (config->storage_mode == MC_STORAGE_MODE_COMPRESSED) {
+        /* uploads that did not shrink were stored as they are */
+        mc_zfile_index_t index;
+        int is_container = mc_zfile_read_index(file_fd, &index);
+        if (is_container < 0) {
+            close(file_fd);
+            return set_error(err, err_len, "Failed to read compressed file");
+        }
+        if (is_container == 1) {
+            int plain_fd = mc_zfile_materialize(config->storage_dir, file_fd, &index, 0, index.total_size, err, err_len);
+            close(file_fd);
+            file_fd = plain_fd;
+            st.st_size = (off_t)index.total_size;
+            mc_zfile_free_index(&index);
+            if (file_fd == -1) {
+                return -1;
+            }
+        }
+    }
+
+    *out_fd = file_fd;
+    *out_size = (uint64_t)st.st_size;
+    return 0;
+}
+
+int mc_storage_open_download(const mc_server_config_t *config,
+                             const char *name,
+                             int *out_fd,
+                             uint64_t *out_size,
+                             char *err,
+                             size_t err_len) {
+    struct stat stored;
+    return open_content(config, name, out_fd, out_size, &stored, err, err_len);
+}
+
+static uint64_t stat_validator(const struct stat *st) {
+    return mc_storage_validator((uint64_t)st->st_ino,
+                                (int64_t)st->st_mtim.tv_sec,
+                                (int64_t)st->st_mtim.tv_nsec,
+                                (uint64_t)st->st_size);
+}
+
+uint64_t mc_storage_validator(uint64_t ino, int64_t mtime_sec, int64_t mtime_nsec, uint64_t size) {
+    uint64_t fields[4] = {ino, (uint64_t)mtime_sec, (uint64_t)mtime_nsec, size};
+    uint64_t hash = 1469598103934665603ULL;
+    const uint8_t *bytes = (const uint8_t *)fields;
+    for (size_t i = 0; i < sizeof(fields); ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash ? hash : 1;
+}
+
+void mc_storage_start_range(const mc_range_if_t *range, uint64_t validator, mc_download_t *out) {
+    out->validator = validator;
+    out->offset = 0;
+    out->length = 0;
+    if (range && (range->validator == 0 || range->validator == validator)) {
+        out->offset = range->offset;
+        out->length = range->length;
+    }
+}
+
+static void cache_stamp(const struct stat *st, mc_cache_stamp_t *stamp) {
+    stamp->dev = (uint64_t)st->st_dev;
+    stamp->ino = (uint64_t)st->st_ino;
+    stamp->mtime_sec = (int64_t)st->st_mtim.tv_sec;
+    stamp->mtime_nsec = (int64_t)st->st_mtim.tv_nsec;
+    stamp->size = (uint64_t)st->st_size;
+}
+
+/* A small file about to be sent whole from fd: offered to the hot-file cache under the stat it was opened with. */
+static void offer_to_cache(const char *name, const struct stat *stored, const mc_download_t *body) {
+    if (!mc_cache_enabled() || body->stored_blocks || body->offset != 0 || body->length != body->file_size ||
+        body->file_size > MC_CACHE_MAX_FILE) {
+        return;
+    }
+    uint8_t data[MC_CACHE_MAX_FILE];
+    size_t len = (size_t)body->file_size;
+    if (pread(body->fd, data, len, 0) != (ssize_t)len) { /* pread() 시스템 콜로 캐시에 담을 내용 읽기 */
+        return;
+    }
+    mc_cache_stamp_t stamp;
+    cache_stamp(stored, &stamp);
+    mc_cache_put(name, &stamp, data, len, mc_crc32c_update(0, data, len));
+}
+
+int mc_storage_cached_reply(const mc_server_config_t *config,
+                            const char *name,
+                            const mc_range_if_t *range,
+                            uint8_t *data,
+                            mc_download_t *out,
+                            char *err,
+                            size_t err_len) {
+    if (!mc_cache_enabled()) {
+        return 0;
+    }
+    int dir_fd;
+    char path[MC_STORAGE_PATH_MAX];
+    char ignored[256];
+    if (mc_storage_resolve(config, name, "DOWNLOAD", &dir_fd, path, sizeof(path), ignored, sizeof(ignored)) != 0) {
+        return 0; /* open_reply reports it */
+    }
+    struct stat st;
+    int rc = fstatat(dir_fd, path, &st, 0); /* fstatat() 시스템 콜로 캐시 항목이 최신인지 확인 */
+    close(dir_fd);
+    if (rc == -1 || !S_ISREG(st.st_mode)) {
+        return 0;
+    }
+    if (config->storage_mode == MC_STORAGE_MODE_PLAIN && (uint64_t)st.st_size > MC_CACHE_MAX_FILE) {
+        return 0; /* never cached: skip the lock */
+    }
+    mc_cache_stamp_t stamp;
+    uint32_t crc = 0;
+    cache_stamp(&st, &stamp);
+    long len = mc_cache_get(name, &stamp, data, &crc);
+    if (len < 0) {
+        return 0;
+    }
+
+    out->fd = -1;
+    out->file_size = (uint64_t)len;
+    mc_storage_start_range(range, stat_validator(&st), out);
+    out->stored_blocks = false;
+    out->wire_offset = 0;
+    out->wire_len = 0;
+    if (mc_storage_clamp_range(out->file_size, out->offset, &out->length, err, err_len) != 0) {
+        return -1;
+    }
+    out->crc = out->length == out->file_size ? crc : mc_crc32c_update(0, data + out->offset, (size_t)out->length);
+    return 1;
+}
+
+int mc_storage_open_reply(const mc_server_config_t *config,
+                          const char *name,
+                          const mc_range_if_t *range,
+                          unsigned int caps,
+                          mc_download_t *out,
+                          char *err,
+                          size_t err_len) {
+    out->fd = -1;
+    out->stored_blocks = false;
+    out->wire_offset = 0;
+    out->wire_len = 0;
+    out->crc = 0;
+    if (config->storage_mode != MC_STORAGE_MODE_COMPRESSED) {
+        struct stat stored;
+        if (open_content(config, name, &out->fd, &out->file_size, &stored, err, err_len) != 0) {
+            return -1;
+        }
+        mc_storage_start_range(range, stat_validator(&stored), out);
+        if (mc_storage_clamp_range(out->file_size, out->offset, &out->length, err, err_len) != 0) {
+            close(out->fd);
+            out->fd = -1;
+            return -1;
+        }
+        offer_to_cache(name, &stored, out);
+        return 0;
+    }
+
+    struct stat st;
+    int file_fd = open_stored(config, name, &st, err, err_len);
+    if (file_fd == -1) {
+        return -1;
+    }
+
+    mc_zfile_index_t index;
+    int is_container = mc_zfile_read_index(file_fd, &index);
+    if (is_container < 0) {
+        close(file_fd);
+        return set_error(err, err_len, "Failed to read compressed file");
+    }
+    out->file_size = is_container == 1 ? index.total_size : (uint64_t)st.st_size;
+    mc_storage_start_range(range, stat_validator(&st), out);
+    if (mc_storage_clamp_range(out->file_size, out->offset, &out->length, err, err_len) != 0) {
+        if (is_container == 1) {
+            mc_zfile_free_index(&index);
+        }
+        close(file_fd);
+        return -1;
+    }
+    if (is_container == 0) {
+        out->fd = file_fd;
+        offer_to_cache(name, &st, out);
+        return 0;
+    }
+
+    /* the stored blocks carry only the whole file's checksum */
+    int rc = 0;
+    if ((caps & MC_AUTH_CAP_LZ4) && (!(caps & MC_AUTH_CAP_CRC32C) || out->offset == 0) &&
+        mc_zfile_block_span(&index, out->offset, out->length, &out->wire_offset)) {
+        out->fd = file_fd;
+        out->stored_blocks = true;
+        out->wire_len = index.offsets[index.count] - out->wire_offset;
+        out->crc = index.crc;
+    } else {
+        out->fd = mc_zfile_materialize(config->storage_dir, file_fd, &index, out->offset, out->length, err, err_len);
+        close(file_fd);
+        rc = out->fd == -1 ? -1 : 0;
+        if (rc == 0) {
+            offer_to_cache(name, &st, out);
+        }
+    }
+    mc_zfile_free_index(&index);
+    return rc;
+}
+
+int mc_storage_clamp_range(uint64_t file_size,
+                           uint64_t offset,
+                           uint64_t *length,
+                           char *err,
+                           size_t err_len) {
+    if (offset > file_size) {
+        return set_error(err, err_len, "Range offset %" PRIu64 " is past the end (%" PRIu64 " bytes)", offset, file_size);
+    }
+    uint64_t available = file_size - offset;
+    if (*length == 0 || *length > available) {
+        *length = available;
+    }
+    return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len) {
+    const uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t put = write(fd, p, len); /* write() 시스템 콜로 결과 파일 기록 */
+        if (put < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += put;
+        len -= (size_t)put;
+    }
+    return 0;
+}
+
+int mc_storage_build_signatures(const mc_server_config_t *config,
+                                const char *name,
+                                uint8_t **out,
+                                size_t *out_len,
+                                char *err,
+                                size_t err_len) {
+    int fd = -1;
+    uint64_t size = 0;
+    if (mc_storage_open_download(config, name, &fd, &size, err, err_len) != 0) {
+        return -1;
+    }
+
+    uint32_t block_size = mc_delta_block_size(size);
+    uint64_t count = (size + block_size - 1) / block_size;
+    if (count > UINT32_MAX) {
+        close(fd);
+        return set_error(err, err_len, "File too large for delta sync");
+    }
+    size_t total = sizeof(mc_signature_header_t) + (size_t)count * sizeof(mc_block_sig_t);
+    uint8_t *payload = malloc(total);
+    uint8_t *block = malloc(block_size);
+    if (!payload || !block) {
+        free(payload);
+        free(block);
+        close(fd);
+        return set_error(err, err_len, "Out of memory");
+    }
+
+    mc_signature_header_t header = {.block_size = block_size, .block_count = (uint32_t)count, .file_size = size};
+    mc_signature_host_to_network(&header);
+    memcpy(payload, &header, sizeof(header));
+
+    mc_block_sig_t *sigs = (mc_block_sig_t *)(payload + sizeof(header));
+    for (uint64_t i = 0; i < count; ++i) {
+        size_t want = (size_t)(i + 1 < count ? block_size : size - i * block_size);
+        if (read_full(fd, block, want) != (ssize_t)want) {
+            free(payload);
+            free(block);
+            close(fd);
+            return set_error(err, err_len, "Failed to read file");
+        }
+        sigs[i].weak = htonl(mc_delta_weak(block, want));
+        mc_delta_strong(block, want, sigs[i].strong);
+    }
+    free(block);
+    close(fd);
+
+    *out = payload;
+    *out_len = total;
+    return 0;
+}
+
+/* Runs the ops in delta_fd against base_fd into out_fd, hashing what it writes. */
+static int run_delta(int delta_fd,
+                     int base_fd,
+                     const mc_delta_header_t *header,
+                     int out_fd,
+                     char *err,
+                     size_t err_len) {
+    enum { BUF_SIZE = 64 * 1024 };
+    uint8_t *buf = malloc(header->block_size > BUF_SIZE ? header->block_size : BUF_SIZE);
+    if (!buf) {
+        return set_error(err, err_len, "Out of memory");
+    }
+    mc_sha256_t sha;
+    mc_sha256_init(&sha);
+    uint64_t written = 0;
+    int rc = 0;
+
+    for (;;) {
+        mc_delta_op_t op;
+        ssize_t got = read_full(delta_fd, &op, sizeof(op));
+        if (got == 0) {
+            break;
+        }
+        if (got != (ssize_t)sizeof(op)) {
+            rc = set_error(err, err_len, "Invalid delta");
+            break;
+        }
+        op.arg = ntohl(op.arg);
+        op.count = ntohl(op.count);
+
+        if (op.type == MC_DELTA_OP_COPY) {
+            if (op.arg >= header->block_count || op.count > header->block_count - op.arg) {
+                rc = set_error(err, err_len, "Invalid delta");
+                break;
+            }
+            for (uint64_t i = op.arg; i < (uint64_t)op.arg + op.count && rc == 0; ++i) {
+                uint64_t off = i * header->block_size;
+                size_t len = (size_t)(header->base_size - off < header->block_size ? header->base_size - off
+                                                                                     : header->block_size);
+                if (pread(base_fd, buf, len, (off_t)off) != (ssize_t)len) { /* pread() 시스템 콜로 기존 블록 읽기 */
+                    rc = set_error(err, err_len, "Failed to read file");
+                } else if (write_full(out_fd, buf, len) != 0) {
+                    rc = set_error(err, err_len, "Failed to write file: %s", strerror(errno));
+                } else {
+                    mc_sha256_update(&sha, buf, len);
+                    written += len;
+                }
+            }
+        } else if (op.type == MC_DELTA_OP_LITERAL) {
+            uint64_t remaining = op.arg;
+            while (remaining > 0 && rc == 0) {
+                size_t len = remaining > BUF_SIZE ? BUF_SIZE : (size_t)remaining;
+                if (read_full(delta_fd, buf, len) != (ssize_t)len) {
+                    rc = set_error(err, err_len, "Invalid delta");
+                } else if (write_full(out_fd, buf, len) != 0) {
+                    rc = set_error(err, err_len, "Failed to write file: %s", strerror(errno));
+                } else {
+                    mc_sha256_update(&sha, buf, len);
+                    written += len;
+                    remaining -= len;
+                }
+            }
+        } else {
+            rc = set_error(err, err_len, "Invalid delta");
+        }
+        if (rc != 0 || written > header->new_size) {
+            rc = rc != 0 ? rc : set_error(err, err_len, "Invalid delta");
+            break;
+        }
+    }
+    free(buf);
+    if (rc != 0) {
+        return -1;
+    }
+
+    uint8_t digest[MC_SHA256_DIGEST_LEN];
+    mc_sha256_final(&sha, digest);
+    if (written != header->new_size || memcmp(digest, header->sha256, sizeof(digest)) != 0) {
+        return set_error(err, err_len, "Delta result does not match");
+    }
+    return 0;
+}
+
+int mc_storage_apply_delta(const mc_server_config_t *config,
+                           const char *name,
+                           mc_upload_t *delta,
+                           char *err,
+                           size_t err_len) {
+    /* the delta was written through a write-only descriptor */
+    if (delta->fd != -1) {
+        close(delta->fd);
+    }
+    const char *tmp = last_component(delta->tmp_path);
+    delta->fd = openat(delta->dir_fd, tmp, O_RDONLY | O_NOFOLLOW | O_CLOEXEC); /* openat() 시스템 콜로 델타 파일 열기 */
+    unlinkat(delta->dir_fd, tmp, 0); /* unlinkat() 시스템 콜로 델타 임시 파일 제거 (열린 fd는 유지) */
+    mc_storage_release_upload(delta);
+    if (delta->fd == -1) {
+        return set_error(err, err_len, "Failed to read delta: %s", strerror(errno));
+    }
+
+    int rc = -1;
+    int base_fd = -1;
+    uint64_t base_size = 0;
+    mc_delta_header_t header;
+    mc_upload_t result;
+    if (read_full(delta->fd, &header, sizeof(header)) != (ssize_t)sizeof(header)) {
+        set_error(err, err_len, "Invalid delta");
+        goto out;
+    }
+    mc_delta_network_to_host(&header);
+    if (mc_storage_open_download(config, name, &base_fd, &base_size, err, err_len) != 0) {
+        goto out;
+    }
+    /* the signatures the client worked from must still describe this copy */
+    if (header.base_size != base_size || header.block_size != mc_delta_block_size(base_size) ||
+        (uint64_t)header.block_count != (base_size + header.block_size - 1) / header.block_size) {
+        set_error(err, err_len, "Base file changed");
+        goto out;
+    }
+    if (mc_storage_begin_upload(config, name, header.new_size, &result, err, err_len) != 0) {
+        goto out;
+    }
+    rc = run_delta(delta->fd, base_fd, &header, result.fd, err, err_len);
+    if (rc == 0) {
+        /* run_delta checked the result against this hash */
+        result.digest_known = true;
+        memcpy(result.digest, header.sha256, sizeof(result.digest));
+        rc = mc_storage_commit_upload(&result, err, err_len);
+    } else {
+        mc_storage_abort_upload(&result);
+    }
+
+out:
+    if (base_fd != -1) {
+        close(base_fd);
+    }
+    close(delta->fd);
+    delta->fd = -1;
+    return rc;
+}
+
+static int hash_stored(const mc_server_config_t *config,
+                       const char *name,
+                       uint8_t digest[MC_SHA256_DIGEST_LEN],
+                       char *err,
+                       size_t err_len) {
+    int fd = -1;
+    uint64_t size = 0;
+    if (mc_storage_open_download(config, name, &fd, &size, err, err_len) != 0) {
+        return -1;
+    }
+    int rc = hash_fd(fd, digest);
+    close(fd);
+    if (rc != 0) {
+        return set_error(err, err_len, "Failed to read file");
+    }
+    return 0;
+}
+
+/*
+ * mc_storage_have() for a prepared target: every name is looked up in
+ * target->dir_fd. Without may_hash, returns 1 where name would have to be hashed.
+ */
+static int have_at(const mc_server_config_t *config,
+                   const char *name,
+                   const mc_have_t *have,
+                   const mc_upload_t *target,
+                   bool may_hash,
+                   bool *stored,
+                   char *err,
+                   size_t err_len) {
+    const char *leaf = last_component(target->final_path);
+    const char *tmp = last_component(target->tmp_path);
+    char hex[MC_SHA256_HEX_LEN + 1];
+    char blob[MC_STORAGE_PATH_MAX];
+    mc_sha256_to_hex(have->sha256, hex);
+    int written = snprintf(blob, sizeof(blob), "%s/%s/%.2s/%s", config->storage_dir, MC_STORAGE_BLOB_DIR, hex, hex);
+    if (written < 0 || (size_t)written >= sizeof(blob)) {
+        return set_error(err, err_len, "Path too long");
+    }
+
+    struct stat blob_st;
+    struct stat name_st;
+    uint64_t size = 0;
+    if (stat_content(config->storage_mode, AT_FDCWD, blob, &blob_st, &size) == 0 && size == have->size) {
+        if (fstatat(target->dir_fd, leaf, &name_st, AT_SYMLINK_NOFOLLOW) == 0 && name_st.st_dev == blob_st.st_dev && /* fstatat() 시스템 콜로 같은 inode인지 확인 */
+            name_st.st_ino == blob_st.st_ino) {
+            *stored = true;
+            return 0;
+        }
+        /* publish like an upload: a temp name first, then the atomic rename */
+        if (linkat(AT_FDCWD, blob, target->dir_fd, tmp, 0) == -1) { /* linkat() 시스템 콜로 같은 내용의 blob 연결 */
+            return set_error(err, err_len, "Failed to link blob: %s", strerror(errno));
+        }
+        if (renameat(target->dir_fd, tmp, target->dir_fd, leaf) == -1) { /* renameat() 시스템 콜로 원자적 교체 */
+            int saved = errno;
+            unlinkat(target->dir_fd, tmp, 0);
+            return set_error(err, err_len, "Failed to store file: %s", strerror(saved));
+        }
+        mc_cache_invalidate(name);
+        index_stored(config->storage_mode, target->dir_fd, leaf, name, have->sha256);
+        *stored = true;
+        return 0;
+    }
+
+    /* not indexed yet: the copy already under name is the likely match */
+    if (stat_content(config->storage_mode, target->dir_fd, leaf, &name_st, &size) != 0 || size != have->size) {
+        return 0;
+    }
+    /* the metadata index may already know the hash of this very copy */
+    uint8_t digest[MC_SHA256_DIGEST_LEN];
+    mc_meta_info_t info;
+    if (mc_meta_get(name, &info) == 1 && info.has_digest && info.size == size &&
+        info.mtime == (int64_t)name_st.st_mtime) {
+        memcpy(digest, info.digest, sizeof(digest));
+    } else if (!may_hash) {
+        return 1;
+    } else if (hash_stored(config, name, digest, err, err_len) != 0) {
+        return -1;
+    } else {
+        struct stat now_st;
+        /* remember it only if nothing replaced name while it was hashed */
+        if (fstatat(target->dir_fd, leaf, &now_st, AT_SYMLINK_NOFOLLOW) == 0 && now_st.st_ino == name_st.st_ino && /* fstatat() 시스템 콜로 교체 여부 확인 */
+            now_st.st_mtime == name_st.st_mtime) {
+            memset(&info, 0, sizeof(info));
+            info.size = size;
+            info.mtime = (int64_t)name_st.st_mtime;
+            info.has_digest = true;
+            memcpy(info.digest, digest, sizeof(info.digest));
+            (void)mc_meta_put(name, &info);
+        }
+    }
+    if (memcmp(digest, have->sha256, sizeof(digest)) != 0) {
+        return 0;
+    }
+
+    char dir[MC_STORAGE_PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s/%s", config->storage_dir, MC_STORAGE_BLOB_DIR);
+    mkdir(dir, 0755); /* mkdir() 시스템 콜로 blob 디렉터리 생성 */
+    snprintf(dir, sizeof(dir), "%s/%s/%.2s", config->storage_dir, MC_STORAGE_BLOB_DIR, hex);
+    mkdir(dir, 0755);
+    if (linkat(target->dir_fd, leaf, AT_FDCWD, blob, 0) == 0) { /* linkat() 시스템 콜로 내용 색인에 등록 */
+        /* name may have been replaced while it was hashed: index only what was hashed */
+        if (stat(blob, &blob_st) == -1 || blob_st.st_dev != name_st.st_dev || blob_st.st_ino != name_st.st_ino) {
+            unlink(blob);
+            return 0;
+        }
+    }
+    *stored = true;
+    return 0;
+}
+
+static int have_checked(const mc_server_config_t *config,
+                        const char *name,
+                        const mc_have_t *have,
+                        bool may_hash,
+                        bool *stored,
+                        char *err,
+                        size_t err_len) {
+    *stored = false;
+    mc_upload_t target;
+    if (mc_storage_prepare_upload(config, name, have->size, &target, err, err_len) != 0) {
+        return -1;
+    }
+    int rc = have_at(config, name, have, &target, may_hash, stored, err, err_len);
+    mc_storage_release_upload(&target);
+    return rc;
+}
+
+int mc_storage_have(const mc_server_config_t *config,
+                    const char *name,
+                    const mc_have_t *have,
+                    bool *stored,
+                    char *err,
+                    size_t err_len) {
+    return have_checked(config, name, have, true, stored, err, err_len);
+}
+
+int mc_storage_have_unhashed(const mc_server_config_t *config,
+                             const char *name,
+                             const mc_have_t *have,
+                             bool *stored,
+                             char *err,
+                             size_t err_len) {
+    return have_checked(config, name, have, false, stored, err, err_len);
+}
+
+long mc_storage_gc_blobs(const mc_server_config_t *config) {
+    char root[MC_STORAGE_PATH_MAX];
+    snprintf(root, sizeof(root), "%s/%s", config->storage_dir, MC_STORAGE_BLOB_DIR);
+    DIR *blobs = opendir(root); /* opendir() 시스템 콜로 blob 색인 열기 */
+    if (!blobs) {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    long removed = 0;
+    struct dirent *entry;
+    while ((entry = readdir(blobs)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        int sub_fd = openat(dirfd(blobs), entry->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        DIR *sub = sub_fd == -1 ? NULL : fdopendir(sub_fd);
+        if (!sub) {
+            if (sub_fd != -1) {
+                close(sub_fd);
+            }
+            continue;
+        }
+        struct dirent *blob;
+        while ((blob = readdir(sub)) != NULL) {
+            struct stat st;
+            if (blob->d_name[0] == '.' || fstatat(dirfd(sub), blob->d_name, &st, 0) == -1) { /* fstatat() 시스템 콜로 링크 수 확인 */
+                continue;
+            }
+            /* the index's own link is the last one: the file was deleted or replaced */
+            if (st.st_nlink <= 1 && unlinkat(dirfd(sub), blob->d_name, 0) == 0) { /* unlinkat() 시스템 콜로 고아 blob 제거 */
+                ++removed;
+            }
+        }
+        closedir(sub);
+    }
+    closedir(blobs);
+    return removed;
+}
+
+int mc_storage_delete(const mc_server_config_t *config,
+                      const char *name,
+                      char *err,
+                      size_t err_len) {
+    int dir_fd;
+    char target_path[MC_STORAGE_PATH_MAX];
+    if (mc_storage_resolve(config, name, "DELETE", &dir_fd, target_path, sizeof(target_path), err, err_len) != 0) {
+        return -1;
+    }
+
+    int rc = unlinkat(dir_fd, target_path, 0); /* unlinkat() 시스템 콜로 파일 삭제 */
+    int saved = errno;
+    close(dir_fd);
+    if (rc == -1) {
+        if (saved == ENOENT) {
+            return set_error(err, err_len, "File not found");
+        }
+        if (saved == EISDIR) {
+            return set_error(err, err_len, "Is a directory (use RMDIR)");
+        }
+        return set_error(err, err_len, "Failed to delete file: %s", strerror(saved));
+    }
+    mc_storage_note_deleted(name);
+    return 0;
+}
+
+int mc_storage_mkdir(const mc_server_config_t *config,
+                     const char *name,
+                     char *err,
+                     size_t err_len) {
+    if (check_name(name, "MKDIR", err, err_len) != 0) {
+        return -1;
+    }
+    int dir_fd = open_parent(config, name, true);
+    if (dir_fd == -1) {
+        return parent_error("Directory not found", err, err_len);
+    }
+    int rc = mkdirat(dir_fd, last_component(name), 0755); /* mkdirat() 시스템 콜로 디렉터리 생성 */
+    int saved = errno;
+    close(dir_fd);
+    if (rc == -1) {
+        if (saved == EEXIST) {
+            return set_error(err, err_len, "Already exists");
+        }
+        return set_error(err, err_len, "Failed to create directory: %s", strerror(saved));
+    }
+    index_directory(name, strlen(name));
+    return 0;
+}
+
+/* Opens name below dir_fd as a directory, never through a symlink; NULL with errno. */
+static DIR *open_dir_at(int dir_fd, const char *name) {
+    int fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC); /* openat() 시스템 콜로 하위 디렉터리 열기 */
+    if (fd == -1) {
+        return NULL;
+    }
+    DIR *dir = fdopendir(fd);
+    if (!dir) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+    }
+    return dir;
+}
+
+/*
+ * Removes the shard directories in dir_fd that are empty. Deletes leave them
+ * behind, so a sharded directory the client sees as empty still has them
+ * until it is removed itself.
+ */
+static void prune_shards(int dir_fd) {
+    DIR *dir = open_dir_at(dir_fd, ".");
+    if (!dir) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) { /* readdir() 시스템 콜로 샤드 디렉터리 열람 */
+        if (!is_shard_name(entry->d_name)) {
+            continue;
+        }
+        DIR *sub = open_dir_at(dirfd(dir), entry->d_name);
+        if (sub) {
+            struct dirent *inner;
+            while ((inner = readdir(sub)) != NULL) {
+                if (is_shard_name(inner->d_name)) {
+                    unlinkat(dirfd(sub), inner->d_name, AT_REMOVEDIR); /* unlinkat(AT_REMOVEDIR)으로 빈 샤드 제거, 비어 있지 않으면 실패 */
+                }
+            }
+            closedir(sub);
+        }
+        unlinkat(dirfd(dir), entry->d_name, AT_REMOVEDIR);
+    }
+    closedir(dir);
+}
+
+int mc_storage_rmdir(const mc_server_config_t *config,
+                     const char *name,
+                     char *err,
+                     size_t err_len) {
+    if (check_name(name, "RMDIR", err, err_len) != 0) {
+        return -1;
+    }
+    int dir_fd = open_parent(config, name, false);
+    if (dir_fd == -1) {
+        return parent_error("Directory not found", err, err_len);
+    }
+    if (config->storage_layout == MC_STORAGE_LAYOUT_SHARDED) {
+        int target = openat(dir_fd, last_component(name), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC); /* openat() 시스템 콜로 지울 디렉터리 열기 */
+        if (target != -1) {
+            prune_shards(target);
+            close(target);
+        }
+    }
+    int rc = unlinkat(dir_fd, last_component(name), AT_REMOVEDIR); /* unlinkat(AT_REMOVEDIR)으로 빈 디렉터리 제거 */
+    int saved = errno;
+    close(dir_fd);
+    if (rc == -1) {
+        if (saved == ENOENT) {
+            return set_error(err, err_len, "Directory not found");
+        }
+        if (saved == ENOTDIR) {
+            return set_error(err, err_len, "Not a directory");
+        }
+        if (saved == ENOTEMPTY || saved == EEXIST) {
+            return set_error(err, err_len, "Directory not empty");
+        }
+        return set_error(err, err_len, "Failed to remove directory: %s", strerror(saved));
+    }
+    if (mc_meta_enabled()) {
+        char key[MC_MAX_FILENAME_LEN + 2];
+        snprintf(key, sizeof(key), "%s/", name);
+        (void)mc_meta_remove(key);
+    }
+    return 0;
+}
+
+typedef int (*stored_visit_t)(const char *name, const mc_meta_info_t *info, void *ctx);
+
+/* Shard levels between a directory and its entries in config's layout. */
+static int shard_levels(const mc_server_config_t *config) {
+    return config->storage_layout == MC_STORAGE_LAYOUT_SHARDED ? 2 : 0;
+}
+
+/*
+ * Depth-first over one directory of the tree; name holds its path below the
+ * root ("" or "a/b/"), len bytes of it. shards is how many shard levels
+ * remain above the entries themselves. Symlinked directories are not
+ * followed.
+ */
+static int walk_dir(const mc_server_config_t *config,
+                    DIR *dir,
+                    char *name,
+                    size_t len,
+                    int shards,
+                    stored_visit_t visit,
+                    void *ctx) {
+    int rc = 0;
+    struct dirent *entry;
+    while (rc == 0 && (entry = readdir(dir)) != NULL) { /* readdir() 시스템 콜로 항목 열람 */
+        if (shards > 0) {
+            DIR *sub = is_shard_name(entry->d_name) ? open_dir_at(dirfd(dir), entry->d_name) : NULL;
+            if (sub) {
+                rc = walk_dir(config, sub, name, len, shards - 1, visit, ctx);
+                closedir(sub);
+            }
+            continue;
+        }
+        size_t entry_len = strlen(entry->d_name);
+        struct stat st;
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+            len + entry_len > MC_MAX_FILENAME_LEN) {
+            continue;
+        }
+        memcpy(name + len, entry->d_name, entry_len + 1);
+        if (!mc_storage_is_safe_name(name) ||
+            fstatat(dirfd(dir), entry->d_name, &st, 0) == -1) { /* fstatat() 시스템 콜로 종류, 크기, 수정 시각 조회 */
+            continue;
+        }
+        mc_meta_info_t info;
+        memset(&info, 0, sizeof(info));
+        if (S_ISDIR(st.st_mode)) {
+            DIR *sub = open_dir_at(dirfd(dir), entry->d_name);
+            if (!sub) {
+                continue;
+            }
+            name[len + entry_len] = '/';
+            name[len + entry_len + 1] = '\0';
+            rc = visit(name, &info, ctx);
+            if (rc == 0) {
+                rc = walk_dir(config, sub, name, len + entry_len + 1, shard_levels(config), visit, ctx);
+            }
+            closedir(sub);
+        } else if (S_ISREG(st.st_mode)) {
+            info.size = (uint64_t)st.st_size;
+            info.mtime = (int64_t)st.st_mtime;
+            if (config->storage_mode != MC_STORAGE_MODE_PLAIN) {
+                int fd = openat(dirfd(dir), entry->d_name, O_RDONLY | O_CLOEXEC); /* openat() 시스템 콜로 내용 크기 확인 */
+                if (fd != -1) {
+                    (void)probe_content(config->storage_mode, fd, &info.size);
+                    close(fd);
+                }
+            }
+            rc = visit(name, &info, ctx);
+        }
+    }
+    return rc;
+}
+
+/*
+ * Calls visit for everything stored: files by name with their content size
+ * and mtime, directories as "name/" (see MC_MAX_FILENAME_LEN). Stops at the
+ * first nonzero visit and returns it; -1 with errno if the root cannot be
+ * opened.
+ */
+static int walk_stored(const mc_server_config_t *config, stored_visit_t visit, void *ctx) {
+    DIR *dir = opendir(config->storage_dir); /* opendir() 시스템 콜로 저장소 열기 */
+    if (!dir) {
+        return -1;
+    }
+    char name[MC_MAX_FILENAME_LEN + 2] = "";
+    int rc = walk_dir(config, dir, name, 0, shard_levels(config), visit, ctx);
+    closedir(dir);
+    return rc;
+}
+
+typedef struct {
+    bool with_sizes;
+    char *buf;
+    size_t used;
+    size_t cap;
+} listing_t;
+
+static int append_listing(const char *name, const mc_meta_info_t *info, void *ctx) {
+    listing_t *list = ctx;
+    char size_col[24] = "";
+    if (list->with_sizes) {
+        snprintf(size_col, sizeof(size_col), "\t%" PRIu64, info->size);
+    }
+    size_t len = strlen(name) + strlen(size_col) + 1;
+    while (list->used + len + 1 >= list->cap) {
+        char *tmp = realloc(list->buf, list->cap * 2);
+        if (!tmp) {
+            errno = ENOMEM;
+            return -1;
+        }
+        list->buf = tmp;
+        list->cap *= 2;
+    }
+    list->used += (size_t)snprintf(list->buf + list->used, list->cap - list->used, "%s%s\n", name, size_col);
+    return 0;
+}
+
+int mc_storage_build_listing(const mc_server_config_t *config,
+                             const char *options,
+                             char **out,
+                             size_t *out_len,
+                             char *err,
+                             size_t err_len) {
+    bool with_sizes = options && strcmp(options, MC_LIST_OPT_SIZES) == 0;
+    if (mc_meta_enabled()) {
+        if (mc_meta_list(with_sizes, out, out_len) != 0) {
+            return set_error(err, err_len, "Out of memory");
+        }
+        return 0;
+    }
+
+    listing_t list = {.with_sizes = with_sizes, .buf = malloc(1024), .used = 0, .cap = 1024};
+    if (!list.buf) {
+        return set_error(err, err_len, "Out of memory");
+    }
+    list.buf[0] = '\0';
+    if (walk_stored(config, append_listing, &list) != 0) {
+        int saved = errno;
+        free(list.buf);
+        return set_error(err, err_len, saved == ENOMEM ? "Out of memory" : "Failed to open storage dir");
+    }
+
+    if (list.used == 0) {
+        strcpy(list.buf, "(empty)\n");
+        list.used = strlen(list.buf);
+    }
+
+    *out = list.buf;
+    *out_len = list.used;
+    return 0;
+}
+
+typedef struct {
+    mc_meta_item_t *items;
+    size_t count;
+    size_t cap;
+} item_list_t;
+
+static int append_item(const char *name, const mc_meta_info_t *info, void *ctx) {
+    item_list_t *list = ctx;
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 256;
+        mc_meta_item_t *grown = realloc(list->items, cap * sizeof(*grown));
+        if (!grown) {
+            errno = ENOMEM;
+            return -1;
+        }
+        list->items = grown;
+        list->cap = cap;
+    }
+    mc_meta_item_t *item = &list->items[list->count];
+    item->name = strdup(name);
+    if (!item->name) {
+        errno = ENOMEM;
+        return -1;
+    }
+    item->info = *info;
+    ++list->count;
+    return 0;
+}
+
+int mc_storage_query_listing(const mc_server_config_t *config,
+                             const char *pattern,
+                             const mc_list_query_t *query,
+                             uint8_t **out,
+                             size_t *out_len,
+                             char *err,
+                             size_t err_len) {
+    int rc;
+    if (mc_meta_enabled()) {
+        rc = mc_meta_query(pattern, query, out, out_len);
+    } else {
+        /* no index: the whole tree, every time */
+        item_list_t list = {0};
+        if (walk_stored(config, append_item, &list) != 0) {
+            rc = errno == ENOMEM ? -1 : -2;
+        } else {
+            rc = mc_meta_page(list.items, list.count, pattern, query, out, out_len);
+        }
+        int saved = errno;
+        /* the page may have reordered items; the names are all still there */
+        for (size_t i = 0; i < list.count; ++i) {
+            free((char *)list.items[i].name);
+        }
+        free(list.items);
+        errno = saved;
+        if (rc == -2) {
+            return set_error(err, err_len, "Failed to open storage dir");
+        }
+    }
+    if (rc != 0) {
+        return set_error(err, err_len, errno == EINVAL ? "Invalid list query" : "Out of memory");
+    }
+    return 0;
+}
+
+static int compare_items(const void *a, const void *b) {
+    return strcmp(((const mc_meta_item_t *)a)->name, ((const mc_meta_item_t *)b)->name);
+}
+
+void mc_storage_free_items(mc_meta_item_t *items, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        free((char *)items[i].name);
+    }
+    free(items);
+}
+
+int mc_storage_list_tree(const mc_server_config_t *config,
+                         const char *dir_name,
+                         mc_meta_item_t **items,
+                         size_t *count,
+                         char *err,
+                         size_t err_len) {
+    char name[MC_MAX_FILENAME_LEN + 2] = "";
+    size_t len = 0;
+    DIR *dir;
+    if (!dir_name || !dir_name[0]) {
+        dir = opendir(config->storage_dir); /* opendir() 시스템 콜로 저장소 열기 */
+        if (!dir) {
+            return set_error(err, err_len, "Failed to open storage dir");
+        }
+    } else {
+        if (check_name(dir_name, "ARCHIVE", err, err_len) != 0) {
+            return -1;
+        }
+        int dir_fd = open_parent(config, dir_name, false);
+        if (dir_fd == -1) {
+            return parent_error("Directory not found", err, err_len);
+        }
+        dir = open_dir_at(dir_fd, last_component(dir_name));
+        int saved = errno;
+        close(dir_fd);
+        if (!dir) {
+            errno = saved;
+            return parent_error("Directory not found", err, err_len);
+        }
+        len = (size_t)snprintf(name, sizeof(name), "%s/", dir_name);
+    }
+
+    item_list_t list = {0};
+    int rc = 0;
+    if (len > 0) {
+        mc_meta_info_t info;
+        memset(&info, 0, sizeof(info));
+        rc = append_item(name, &info, &list);
+    }
+    if (rc == 0) {
+        rc = walk_dir(config, dir, name, len, shard_levels(config), append_item, &list);
+    }
+    closedir(dir);
+    if (rc != 0) {
+        mc_storage_free_items(list.items, list.count);
+        return set_error(err, err_len, "Out of memory");
+    }
+    /* a directory sorts ahead of everything in it: "a/" is a prefix of "a/..." */
+    qsort(list.items, list.count, sizeof(*list.items), compare_items);
+    *items = list.items;
+    *count = list.count;
+    return 0;
+}
+
+/*
+ * Reads the record at *pos of a bundle: entry in host order, name
+ * NUL-terminated, data pointing at its size bytes (with_data) or none.
+ */
+static int next_bundle_entry(const uint8_t *payload,
+                             size_t len,
+                             size_t *pos,
+                             bool with_data,
+                             mc_bundle_entry_t *entry,
+                             char *name,
+                             const uint8_t **data,
+                             char *err,
+                             size_t err_len) {
+    if (len - *pos < sizeof(*entry)) {
+        return set_error(err, err_len, "Malformed bundle");
+    }
+    memcpy(entry, payload + *pos, sizeof(*entry));
+    mc_bundle_entry_network_to_host(entry);
+    *pos += sizeof(*entry);
+    if (entry->name_len == 0 || entry->name_len > MC_MAX_FILENAME_LEN || len - *pos < entry->name_len) {
+        return set_error(err, err_len, "Malformed bundle");
+    }
+    memcpy(name, payload + *pos, entry->name_len);
+    name[entry->name_len] = '\0';
+    *pos += entry->name_len;
+    if (!with_data) {
+        *data = NULL;
+        return entry->size == 0 ? 0 : set_error(err, err_len, "Malformed bundle");
+    }
+    if (entry->size > len - *pos) {
+        return set_error(err, err_len, "Malformed bundle");
+    }
+    *data = payload + *pos;
+    *pos += (size_t)entry->size;
+    return 0;
+}
+
+int mc_storage_store_bundle(const mc_server_config_t *config,
+                            const uint8_t *payload,
+                            size_t len,
+                            long *stored,
+                            char *err,
+                            size_t err_len) {
+    mc_bundle_entry_t entry;
+    char name[MC_MAX_FILENAME_LEN + 1];
+    const uint8_t *data;
+    uint64_t total = 0;
+    long count = 0;
+    *stored = 0;
+
+    /* all or nothing as far as the content goes: check every record first */
+    for (size_t pos = 0; pos < len; ++count) {
+        if (next_bundle_entry(payload, len, &pos, true, &entry, name, &data, err, err_len) != 0) {
+            return -1;
+        }
+        if ((unsigned long)count >= MC_BUNDLE_MAX_FILES) {
+            return set_error(err, err_len, "Bundle holds more than %u files", MC_BUNDLE_MAX_FILES);
+        }
+        if (!mc_storage_is_safe_name(name)) {
+            return set_error(err, err_len, "%s: Invalid filename", name);
+        }
+        total += entry.size;
+        if (entry.size > MC_BUNDLE_FILE_MAX || total > MC_BUNDLE_DATA_MAX) {
+            return set_error(err, err_len, "%s: Too large for a bundle", name);
+        }
+        if (config->max_upload_bytes > 0 && entry.size > config->max_upload_bytes) {
+            return set_error(err,
+                             err_len,
+                             "%s: Upload exceeds limit (%" PRIu64 " bytes)",
+                             name,
+                             (uint64_t)config->max_upload_bytes);
+        }
+        if (mc_crc32c_update(0, data, (size_t)entry.size) != entry.crc) {
+            return set_error(err, err_len, "%s: Checksum mismatch", name);
+        }
+    }
+
+    char why[256];
+    for (size_t pos = 0; pos < len; ++*stored) {
+        mc_upload_t upload;
+        next_bundle_entry(payload, len, &pos, true, &entry, name, &data, why, sizeof(why));
+        if (mc_storage_begin_upload(config, name, entry.size, &upload, why, sizeof(why)) != 0) {
+            return set_error(err, err_len, "%s: %s (%ld of %ld stored)", name, why, *stored, count);
+        }
+        if (write_full(upload.fd, data, (size_t)entry.size) != 0) {
+            snprintf(why, sizeof(why), "Failed to write file: %s", strerror(errno));
+            mc_storage_abort_upload(&upload);
+            return set_error(err, err_len, "%s: %s (%ld of %ld stored)", name, why, *stored, count);
+        }
+        if (mc_storage_commit_upload(&upload, why, sizeof(why)) != 0) {
+            return set_error(err, err_len, "%s: %s (%ld of %ld stored)", name, why, *stored, count);
+        }
+    }
+    return 0;
+}
+
+typedef struct {
+    uint8_t *buf;
+    size_t used;
+    size_t cap;
+    uint64_t data; /* OK and ERROR record bytes so far */
+} bundle_out_t;
+
+/* Appends a record and returns where its size bytes of data go, or NULL. */
+static uint8_t *add_bundle_entry(bundle_out_t *out, const char *name, uint8_t status, uint64_t size, uint32_t crc) {
+    size_t name_len = strlen(name);
+    size_t need = sizeof(mc_bundle_entry_t) + name_len + (size_t)size;
+    while (out->cap - out->used < need) {
+        size_t cap = out->cap ? out->cap * 2 : 64 * 1024;
+        uint8_t *grown = realloc(out->buf, cap);
+        if (!grown) {
+            return NULL;
+        }
+        out->buf = grown;
+        out->cap = cap;
+    }
+    mc_bundle_entry_t entry = {.size = size, .crc = crc, .name_len = (uint16_t)name_len, .status = status};
+    mc_bundle_entry_host_to_network(&entry);
+    memcpy(out->buf + out->used, &entry, sizeof(entry));
+    memcpy(out->buf + out->used + sizeof(entry), name, name_len);
+    uint8_t *data = out->buf + out->used + sizeof(entry) + name_len;
+    out->used += need;
+    out->data += size;
+    return data;
+}
+
+/* One BUNDLE_DOWNLOAD record: from the hot-file cache, else read whole from disk. */
+static int add_bundle_file(const mc_server_config_t *config, const char *name, bundle_out_t *out) {
+    char why[256];
+    uint8_t cached[MC_CACHE_MAX_FILE];
+    mc_download_t body;
+    int hit = mc_storage_cached_reply(config, name, NULL, cached, &body, why, sizeof(why));
+    if (hit == 0 && mc_storage_open_reply(config, name, NULL, 0, &body, why, sizeof(why)) != 0) {
+        hit = -1;
+    }
+
+    uint8_t *data;
+    if (hit == -1) {
+        size_t why_len = strlen(why);
+        if (out->data + why_len > MC_BUNDLE_DATA_MAX) {
+            return add_bundle_entry(out, name, MC_BUNDLE_SKIPPED, 0, 0) ? 0 : -1;
+        }
+        data = add_bundle_entry(out, name, MC_BUNDLE_ERROR, why_len, mc_crc32c_update(0, why, why_len));
+        if (!data) {
+            return -1;
+        }
+        memcpy(data, why, why_len);
+        return 0;
+    }
+
+    int rc = 0;
+    if (body.length > MC_BUNDLE_FILE_MAX || out->data + body.length > MC_BUNDLE_DATA_MAX) {
+        rc = add_bundle_entry(out, name, MC_BUNDLE_SKIPPED, 0, 0) ? 0 : -1;
+    } else if (hit == 1) {
+        data = add_bundle_entry(out, name, MC_BUNDLE_OK, body.length, body.crc);
+        if (data) {
+            memcpy(data, cached, (size_t)body.length);
+        } else {
+            rc = -1;
+        }
+    } else {
+        size_t length = (size_t)body.length;
+        size_t mark = out->used;
+        uint64_t data_mark = out->data;
+        data = add_bundle_entry(out, name, MC_BUNDLE_OK, length, 0);
+        if (!data) {
+            rc = -1;
+        } else if (pread(body.fd, data, length, 0) != (ssize_t)length) { /* pread() 시스템 콜로 번들에 담을 내용 읽기 */
+            /* changed under us: leave it to a DOWNLOAD of its own */
+            out->used = mark;
+            out->data = data_mark;
+            rc = add_bundle_entry(out, name, MC_BUNDLE_SKIPPED, 0, 0) ? 0 : -1;
+        } else {
+            uint32_t crc = htonl(mc_crc32c_update(0, data, length));
+            memcpy(out->buf + mark + offsetof(mc_bundle_entry_t, crc), &crc, sizeof(crc));
+        }
+    }
+    if (body.fd != -1) {
+        close(body.fd);
+    }
+    return rc;
+}
+
+int mc_storage_build_bundle(const mc_server_config_t *config,
+                            const uint8_t *request,
+                            size_t request_len,
+                            uint8_t **out,
+                            size_t *out_len,
+                            char *err,
+                            size_t err_len) {
+    mc_bundle_entry_t entry;
+    char name[MC_MAX_FILENAME_LEN + 1];
+    const uint8_t *unused;
+    bundle_out_t reply = {0};
+    unsigned int count = 0;
+
+    for (size_t pos = 0; pos < request_len; ++count) {
+        if (next_bundle_entry(request, request_len, &pos, false, &entry, name, &unused, err, err_len) != 0) {
+            free(reply.buf);
+            return -1;
+        }
+        if (count >= MC_BUNDLE_MAX_FILES) {
+            free(reply.buf);
+            return set_error(err, err_len, "Bundle holds more than %u files", MC_BUNDLE_MAX_FILES);
+        }
+        if (add_bundle_file(config, name, &reply) != 0) {
+            free(reply.buf);
+            return set_error(err, err_len, "Out of memory");
+        }
+    }
+
+    *out = reply.buf;
+    *out_len = reply.used;
+    return 0;
+}
+
+static int seed_item(const char *name, const mc_meta_info_t *info, void *ctx) {
+    (void)ctx;
+    return mc_meta_seed(name, info);
+}
+
+long mc_storage_open_index(const mc_server_config_t *config) {
+    if (config->meta_mode == MC_META_INDEX_OFF) {
+        return 0;
+    }
+    char path[MC_STORAGE_PATH_MAX];
+    if (build_storage_path(config, MC_STORAGE_META_LOG, path, sizeof(path)) != 0) {
+        return -1;
+    }
+    int loaded = mc_meta_open(path, config->meta_mode == MC_META_INDEX_PERSIST);
+    if (loaded < 0) {
+        return -1;
+    }
+    if (loaded == 0 && walk_stored(config, seed_item, NULL) != 0) {
+        return -1;
+    }
+    if (mc_meta_commit() != 0) {
+        return -1;
+    }
+    return (long)mc_meta_count();
+}
+
+static const char *layout_name(mc_storage_layout_t layout) {
+    return layout == MC_STORAGE_LAYOUT_SHARDED ? "sharded" : "flat";
+}
+
+/* The layout a marker in dir_fd names; no marker is flat. -1 with errno if unreadable. */
+static int read_layout(int dir_fd, mc_storage_layout_t *out) {
+    *out = MC_STORAGE_LAYOUT_FLAT;
+    int fd = openat(dir_fd, MC_STORAGE_LAYOUT_FILE, O_RDONLY | O_CLOEXEC); /* openat() 시스템 콜로 레이아웃 표시 파일 열기 */
+    if (fd == -1) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    char buf[16];
+    ssize_t got = read(fd, buf, sizeof(buf) - 1); /* read() 시스템 콜로 레이아웃 이름 읽기 */
+    int saved = errno;
+    close(fd);
+    if (got < 0) {
+        errno = saved;
+        return -1;
+    }
+    buf[got] = '\0';
+    buf[strcspn(buf, "\n")] = '\0';
+    if (strcmp(buf, "sharded") == 0) {
+        *out = MC_STORAGE_LAYOUT_SHARDED;
+    } else if (strcmp(buf, "flat") != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+/* Replaces the marker in dir_fd with one naming layout. */
+static int write_layout(int dir_fd, mc_storage_layout_t layout) {
+    static const char tmp_name[] = MC_STORAGE_LAYOUT_FILE ".tmp";
+    int fd = openat(dir_fd, tmp_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644); /* openat() 시스템 콜로 표시 파일 생성 */
+    if (fd == -1) {
+        return -1;
+    }
+    char line[16];
+    int len = snprintf(line, sizeof(line), "%s\n", layout_name(layout));
+    int rc = write(fd, line, (size_t)len) == len && fsync(fd) == 0 ? 0 : -1; /* write(), fsync() 시스템 콜로 기록 */
+    int saved = errno;
+    close(fd);
+    if (rc == 0) {
+        rc = renameat(dir_fd, tmp_name, dir_fd, MC_STORAGE_LAYOUT_FILE); /* renameat() 시스템 콜로 원자적 교체 */
+        saved = errno;
+    }
+    if (rc != 0) {
+        unlinkat(dir_fd, tmp_name, 0);
+    }
+    errno = saved;
+    return rc;
+}
+
+/* The root's marker: sharded storage has one, flat storage none. */
+static int mark_root(int root_fd, mc_storage_layout_t layout) {
+    if (layout == MC_STORAGE_LAYOUT_SHARDED) {
+        return write_layout(root_fd, layout);
+    }
+    if (unlinkat(root_fd, MC_STORAGE_LAYOUT_FILE, 0) == -1 && errno != ENOENT) { /* unlinkat() 시스템 콜로 표시 파일 제거 */
+        return -1;
+    }
+    return 0;
+}
+
+/* Whether the root holds anything but the server's own entries. */
+static int has_stored_entries(int root_fd) {
+    DIR *dir = open_dir_at(root_fd, ".");
+    if (!dir) {
+        return -1;
+    }
+    int found = 0;
+    struct dirent *entry;
+    while (!found && (entry = readdir(dir)) != NULL) { /* readdir() 시스템 콜로 항목 열람 */
+        found = strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0 &&
+                !is_reserved(entry->d_name, strlen(entry->d_name));
+    }
+    closedir(dir);
+    return found;
+}
+
+int mc_storage_check_layout(const mc_server_config_t *config, char *err, size_t err_len) {
+    int root_fd = open(config->storage_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC); /* open() 시스템 콜로 저장소 루트 열기 */
+    if (root_fd == -1) {
+        return set_error(err, err_len, "Failed to open storage dir: %s", strerror(errno));
+    }
+    struct stat st;
+    mc_storage_layout_t on_disk;
+    int rc = 0;
+    if (fstatat(root_fd, MC_STORAGE_LAYOUT_STAGING, &st, AT_SYMLINK_NOFOLLOW) == 0) { /* fstatat() 시스템 콜로 중단된 이전 확인 */
+        rc = set_error(err, err_len, "%s holds an interrupted layout migration; rerun migrate_layout", config->storage_dir);
+    } else if (read_layout(root_fd, &on_disk) != 0) {
+        rc = set_error(err, err_len, "Unreadable %s: %s", MC_STORAGE_LAYOUT_FILE, strerror(errno));
+    } else if (on_disk != config->storage_layout) {
+        /* nothing stored yet: nothing to migrate */
+        int stored = on_disk == MC_STORAGE_LAYOUT_FLAT ? has_stored_entries(root_fd) : 1;
+        if (stored != 0 || mark_root(root_fd, config->storage_layout) != 0) {
+            rc = set_error(err,
+                           err_len,
+                           "%s uses the %s layout; run migrate_layout %s %s first",
+                           config->storage_dir,
+                           layout_name(on_disk),
+                           config->storage_dir,
+                           layout_name(config->storage_layout));
+        }
+    }
+    close(root_fd);
+    return rc;
+}
+
+typedef struct {
+    char **names;
+    size_t count;
+    size_t cap;
+} name_list_t;
+
+static int push_name(name_list_t *list, const char *name) {
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 64;
+        char **grown = realloc(list->names, cap * sizeof(*grown));
+        if (!grown) {
+            return -1;
+        }
+        list->names = grown;
+        list->cap = cap;
+    }
+    list->names[list->count] = strdup(name);
+    return list->names[list->count++] ? 0 : -1;
+}
+
+static void free_names(name_list_t *list) {
+    for (size_t i = 0; i < list->count; ++i) {
+        free(list->names[i]);
+    }
+    free(list->names);
+}
+
+/*
+ * Collects the entries of dir_fd as stored in layout, as paths relative to
+ * it ("leaf" or "xx/yy/leaf"), shards levels down. The root's own entries
+ * are left out. Collected first so the moves do not disturb readdir().
+ */
+static int list_entries(int dir_fd, const char *prefix, int shards, bool root, name_list_t *out) {
+    DIR *dir = open_dir_at(dir_fd, prefix[0] ? prefix : ".");
+    if (!dir) {
+        return -1;
+    }
+    int rc = 0;
+    struct dirent *entry;
+    while (rc == 0 && (entry = readdir(dir)) != NULL) { /* readdir() 시스템 콜로 옮길 항목 수집 */
+        char path[MC_STORAGE_PATH_MAX];
+        snprintf(path, sizeof(path), "%s%s%s", prefix, prefix[0] ? "/" : "", entry->d_name);
+        if (shards > 0) {
+            if (is_shard_name(entry->d_name)) {
+                rc = list_entries(dir_fd, path, shards - 1, false, out);
+            }
+        } else if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0 &&
+                   !(root && is_reserved(entry->d_name, strlen(entry->d_name)))) {
+            rc = push_name(out, path);
+        }
+    }
+    closedir(dir);
+    return rc;
+}
+
+/*
+ * Moves everything in src_fd, stored in layout from, into dst_fd in layout
+ * to. Files move by renameat(); a directory is created (or, when resuming,
+ * found) on the other side, emptied recursively and removed.
+ */
+static int migrate_dir(int src_fd,
+                       int dst_fd,
+                       mc_storage_layout_t from,
+                       mc_storage_layout_t to,
+                       bool root,
+                       long *moved,
+                       char *err,
+                       size_t err_len) {
+    name_list_t list = {0};
+    if (list_entries(src_fd, "", from == MC_STORAGE_LAYOUT_SHARDED ? 2 : 0, root, &list) != 0) {
+        free_names(&list);
+        return set_error(err, err_len, "Failed to read directory: %s", strerror(errno));
+    }
+    int rc = 0;
+    for (size_t i = 0; rc == 0 && i < list.count; ++i) {
+        const char *path = list.names[i];
+        const char *leaf = last_component(path);
+        int parent = dst_fd;
+        if (to == MC_STORAGE_LAYOUT_SHARDED) {
+            char shard[6];
+            char top[3] = "";
+            shard_dirs(leaf, strlen(leaf), shard);
+            memcpy(top, shard, 2);
+            if ((mkdirat(dst_fd, top, 0755) == -1 && errno != EEXIST) || /* mkdirat() 시스템 콜로 샤드 디렉터리 생성 */
+                (mkdirat(dst_fd, shard, 0755) == -1 && errno != EEXIST) ||
+                (parent = openat(dst_fd, shard, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) == -1) {
+                rc = set_error(err, err_len, "Failed to create %s: %s", shard, strerror(errno));
+                break;
+            }
+        }
+        struct stat st;
+        if (fstatat(src_fd, path, &st, AT_SYMLINK_NOFOLLOW) == -1) { /* fstatat() 시스템 콜로 항목 종류 확인 */
+            rc = set_error(err, err_len, "Failed to stat %s: %s", path, strerror(errno));
+        } else if (S_ISDIR(st.st_mode)) {
+            int sub_src = openat(src_fd, path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC); /* openat() 시스템 콜로 옮길 디렉터리 열기 */
+            int sub_dst = -1;
+            if (sub_src != -1 && (mkdirat(parent, leaf, st.st_mode & 07777) == 0 || errno == EEXIST)) {
+                sub_dst = openat(parent, leaf, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            }
+            if (sub_dst == -1) {
+                rc = set_error(err, err_len, "Failed to move directory %s: %s", path, strerror(errno));
+            } else {
+                rc = migrate_dir(sub_src, sub_dst, from, to, false, moved, err, err_len);
+            }
+            if (rc == 0 && unlinkat(src_fd, path, AT_REMOVEDIR) == -1) { /* unlinkat(AT_REMOVEDIR)으로 비운 디렉터리 제거 */
+                rc = set_error(err, err_len, "Failed to remove %s: %s", path, strerror(errno));
+            }
+            if (sub_src != -1) {
+                close(sub_src);
+            }
+            if (sub_dst != -1) {
+                close(sub_dst);
+            }
+        } else if (renameat(src_fd, path, parent, leaf) == -1) { /* renameat() 시스템 콜로 파일 옮기기 */
+            rc = set_error(err, err_len, "Failed to move %s: %s", path, strerror(errno));
+        }
+        if (rc == 0) {
+            ++*moved;
+        }
+        if (parent != dst_fd) {
+            close(parent);
+        }
+    }
+    free_names(&list);
+    if (rc == 0 && from == MC_STORAGE_LAYOUT_SHARDED) {
+        prune_shards(src_fd);
+    }
+    return rc;
+}
+
+int mc_storage_migrate_layout(const char *storage_dir,
+                              mc_storage_layout_t to,
+                              long *moved,
+                              char *err,
+                              size_t err_len) {
+    *moved = 0;
+    int root_fd = open(storage_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC); /* open() 시스템 콜로 저장소 루트 열기 */
+    if (root_fd == -1) {
+        return set_error(err, err_len, "Failed to open storage dir: %s", strerror(errno));
+    }
+    int staging_fd = -1;
+    int rc = 0;
+    mc_storage_layout_t from;
+    mc_storage_layout_t pending;
+    if (read_layout(root_fd, &from) != 0) {
+        rc = set_error(err, err_len, "Unreadable %s: %s", MC_STORAGE_LAYOUT_FILE, strerror(errno));
+    } else if (mkdirat(root_fd, MC_STORAGE_LAYOUT_STAGING, 0755) == 0) { /* mkdirat() 시스템 콜로 임시 트리 생성 */
+        staging_fd = openat(root_fd, MC_STORAGE_LAYOUT_STAGING, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (staging_fd == -1 || write_layout(staging_fd, to) != 0) {
+            rc = set_error(err, err_len, "Failed to set up %s: %s", MC_STORAGE_LAYOUT_STAGING, strerror(errno));
+        }
+    } else if (errno != EEXIST) {
+        rc = set_error(err, err_len, "Failed to create %s: %s", MC_STORAGE_LAYOUT_STAGING, strerror(errno));
+    } else {
+        /* an interrupted run: carry on only towards the same layout */
+        staging_fd = openat(root_fd, MC_STORAGE_LAYOUT_STAGING, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (staging_fd == -1 || read_layout(staging_fd, &pending) != 0) {
+            rc = set_error(err, err_len, "Unreadable %s: %s", MC_STORAGE_LAYOUT_STAGING, strerror(errno));
+        } else if (pending != to) {
+            rc = set_error(err, err_len, "An interrupted migration to %s is pending; finish it first", layout_name(pending));
+        }
+    }
+
+    /* 1: everything into the staging tree in the new layout; the marker
+     * flips once the root is empty. 2: the staging tree's entries back into
+     * the root, where they cannot collide with anything left. */
+    if (rc == 0 && from != to) {
+        rc = migrate_dir(root_fd, staging_fd, from, to, true, moved, err, err_len);
+        if (rc == 0 && mark_root(root_fd, to) != 0) {
+            rc = set_error(err, err_len, "Failed to update %s: %s", MC_STORAGE_LAYOUT_FILE, strerror(errno));
+        }
+    }
+    if (rc == 0) {
+        name_list_t list = {0};
+        if (list_entries(staging_fd, "", 0, true, &list) != 0) {
+            rc = set_error(err, err_len, "Failed to read %s: %s", MC_STORAGE_LAYOUT_STAGING, strerror(errno));
+        }
+        for (size_t i = 0; rc == 0 && i < list.count; ++i) {
+            if (renameat(staging_fd, list.names[i], root_fd, list.names[i]) == -1) { /* renameat() 시스템 콜로 루트로 되돌리기 */
+                rc = set_error(err, err_len, "Failed to move %s: %s", list.names[i], strerror(errno));
+            }
+        }
+        free_names(&list);
+    }
+    if (rc == 0 && (unlinkat(staging_fd, MC_STORAGE_LAYOUT_FILE, 0) == -1 ||
+                    unlinkat(root_fd, MC_STORAGE_LAYOUT_STAGING, AT_REMOVEDIR) == -1)) { /* unlinkat() 시스템 콜로 임시 트리 정리 */
+        rc = set_error(err, err_len, "Failed to remove %s: %s", MC_STORAGE_LAYOUT_STAGING, strerror(errno));
+    }
+    if (staging_fd != -1) {
+        close(staging_fd);
+    }
+    close(root_fd);
+    return rc;
+}
@@ -0,0 +1,301 @@
+#define _GNU_SOURCE
+
+#include "mc_zfile.h"
+#include "mc_crc32c.h"
+#include "mc_lz4.h"
+#include "mc_storage.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+static unsigned int g_zfile_seq = 0;
+
+static int set_error(char *err, size_t err_len, const char *fmt, ...) {
+    if (err && err_len > 0) {
+        va_list ap;
+        va_start(ap, fmt);
+        vsnprintf(err, err_len, fmt, ap);
+        va_end(ap);
+    }
+    return -1;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t written = write(fd, p, len); /* write() 시스템 콜로 컨테이너 기록 */
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += written;
+        len -= (size_t)written;
+    }
+    return 0;
+}
+
+/* read() until len bytes or EOF; returns the count, or -1. */
+static ssize_t read_full(int fd, uint8_t *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t got = read(fd, buf + done, len - done); /* read() 시스템 콜로 원본 읽기 */
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (got == 0) {
+            break;
+        }
+        done += (size_t)got;
+    }
+    return (ssize_t)done;
+}
+
+int mc_zfile_pack(int src_fd, int dir_fd, const char *tmp_name, char *err, size_t err_len) {
+    if (lseek(src_fd, 0, SEEK_SET) == -1) { /* lseek() 시스템 콜로 처음부터 읽기 */
+        return set_error(err, err_len, "Failed to read upload: %s", strerror(errno));
+    }
+
+    mc_lz4_encoder_t *enc = malloc(sizeof(*enc));
+    uint8_t *raw = malloc(MC_LZ4_BLOCK_MAX);
+    uint8_t *wire = malloc(MC_LZ4_BLOCK_BOUND);
+    size_t cap = 64;
+    uint64_t *offsets = malloc(cap * sizeof(*offsets));
+    if (!enc || !raw || !wire || !offsets) {
+        free(enc);
+        free(raw);
+        free(wire);
+        free(offsets);
+        return set_error(err, err_len, "Out of memory");
+    }
+    mc_lz4_encoder_init(enc);
+
+    int fd = openat(dir_fd, tmp_name, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0644); /* openat() 시스템 콜로 컨테이너 생성 */
+    int rc = fd == -1 ? set_error(err, err_len, "Failed to write file: %s", strerror(errno)) : 0;
+
+    mc_zfile_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MC_ZFILE_MAGIC, sizeof(header.magic));
+    uint64_t pos = sizeof(header);
+    size_t count = 0;
+    uint32_t crc = 0;
+    /* the header is filled in last, once the index is down */
+    if (rc == 0 && lseek(fd, (off_t)pos, SEEK_SET) == -1) {
+        rc = set_error(err, err_len, "Failed to write file: %s", strerror(errno));
+    }
+    while (rc == 0) {
+        ssize_t got = read_full(src_fd, raw, MC_LZ4_BLOCK_MAX);
+        if (got < 0) {
+            rc = set_error(err, err_len, "Failed to read upload: %s", strerror(errno));
+            break;
+        }
+        if (got == 0) {
+            break;
+        }
+        if (count + 1 == cap) {
+            cap *= 2;
+            uint64_t *grown = realloc(offsets, cap * sizeof(*offsets));
+            if (!grown) {
+                rc = set_error(err, err_len, "Out of memory");
+                break;
+            }
+            offsets = grown;
+        }
+        crc = mc_crc32c_update(crc, raw, (size_t)got);
+        size_t wire_len = mc_lz4_encode_block(enc, raw, (size_t)got, wire);
+        if (write_all(fd, wire, wire_len) != 0) {
+            rc = set_error(err, err_len, "Failed to write file: %s", strerror(errno));
+            break;
+        }
+        offsets[count++] = pos;
+        pos += wire_len;
+        header.total_size += (uint64_t)got;
+        if ((size_t)got < MC_LZ4_BLOCK_MAX) {
+            break;
+        }
+    }
+    free(enc);
+    free(raw);
+    free(wire);
+
+    if (rc == 0) {
+        offsets[count] = pos;
+        header.block_count = count;
+        header.index_offset = pos;
+        header.crc = crc;
+        if (write_all(fd, offsets, (count + 1) * sizeof(*offsets)) != 0 ||
+            pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) { /* pwrite() 시스템 콜로 헤더 기록 */
+            rc = set_error(err, err_len, "Failed to write file: %s", strerror(errno));
+        } else if (pos + (count + 1) * sizeof(*offsets) >= header.total_size) {
+            rc = 0; /* not worth it: the caller keeps the original */
+        } else if (mc_storage_mark_format(fd, MC_ZFILE_FORMAT) != 0) {
+            /* untagged it would read back as the user's bytes: keep the original */
+            rc = errno == ENOTSUP ? 0 : set_error(err, err_len, "Failed to write file: %s", strerror(errno));
+        } else {
+            rc = 1;
+        }
+    }
+    free(offsets);
+    if (fd != -1 && close(fd) == -1 && rc == 1) {
+        rc = set_error(err, err_len, "Failed to write file: %s", strerror(errno));
+    }
+    if (rc != 1 && fd != -1) {
+        unlinkat(dir_fd, tmp_name, 0); /* unlinkat() 시스템 콜로 쓰지 않을 컨테이너 제거 */
+    }
+    return rc;
+}
+
+static int read_header(int fd, mc_zfile_header_t *header) {
+    if (!mc_storage_has_format(fd, MC_ZFILE_FORMAT)) {
+        return 0;
+    }
+    ssize_t got = pread(fd, header, sizeof(*header), 0); /* pread() 시스템 콜로 컨테이너 헤더 확인 */
+    if (got < 0) {
+        return -1;
+    }
+    if ((size_t)got < sizeof(*header) || memcmp(header->magic, MC_ZFILE_MAGIC, sizeof(header->magic)) != 0) {
+        return 0;
+    }
+    return 1;
+}
+
+int mc_zfile_probe(int fd, uint64_t *total_size) {
+    mc_zfile_header_t header;
+    int rc = read_header(fd, &header);
+    if (rc == 1) {
+        *total_size = header.total_size;
+    }
+    return rc;
+}
+
+int mc_zfile_read_index(int fd, mc_zfile_index_t *out) {
+    mc_zfile_header_t header;
+    int rc = read_header(fd, &header);
+    if (rc != 1) {
+        return rc;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return -1;
+    }
+    uint64_t blocks = header.total_size / MC_LZ4_BLOCK_MAX + (header.total_size % MC_LZ4_BLOCK_MAX != 0);
+    if (header.block_count != blocks || header.block_count >= SIZE_MAX / sizeof(uint64_t) ||
+        header.index_offset < sizeof(header) ||
+        (uint64_t)st.st_size != header.index_offset + (header.block_count + 1) * sizeof(uint64_t)) {
+        errno = EBADMSG;
+        return -1;
+    }
+
+    size_t bytes = ((size_t)header.block_count + 1) * sizeof(uint64_t);
+    out->total_size = header.total_size;
+    out->crc = header.crc;
+    out->count = (size_t)header.block_count;
+    out->offsets = malloc(bytes);
+    if (!out->offsets) {
+        return -1;
+    }
+    if (pread(fd, out->offsets, bytes, (off_t)header.index_offset) != (ssize_t)bytes) { /* pread() 시스템 콜로 블록 색인 읽기 */
+        mc_zfile_free_index(out);
+        errno = EBADMSG;
+        return -1;
+    }
+    /* every block must fit where the decoder expects it */
+    bool sane = out->offsets[0] == sizeof(header) && out->offsets[out->count] == header.index_offset;
+    for (size_t i = 0; sane && i < out->count; ++i) {
+        uint64_t span = out->offsets[i + 1] - out->offsets[i];
+        sane = out->offsets[i + 1] > out->offsets[i] && span > MC_LZ4_BLOCK_HEADER && span <= MC_LZ4_BLOCK_BOUND;
+    }
+    if (!sane) {
+        mc_zfile_free_index(out);
+        errno = EBADMSG;
+        return -1;
+    }
+    return 1;
+}
+
+void mc_zfile_free_index(mc_zfile_index_t *index) {
+    free(index->offsets);
+    index->offsets = NULL;
+    index->count = 0;
+}
+
+bool mc_zfile_block_span(const mc_zfile_index_t *index, uint64_t offset, uint64_t length, uint64_t *wire_offset) {
+    if (length == 0 || offset % MC_LZ4_BLOCK_MAX != 0 || offset + length != index->total_size) {
+        return false;
+    }
+    *wire_offset = index->offsets[offset / MC_LZ4_BLOCK_MAX];
+    return true;
+}
+
+int mc_zfile_materialize(const char *storage_dir,
+                         int fd,
+                         const mc_zfile_index_t *index,
+                         uint64_t offset,
+                         uint64_t length,
+                         char *err,
+                         size_t err_len) {
+    int out_fd = open(storage_dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600); /* open(O_TMPFILE)으로 이름 없는 임시 파일 생성 */
+    if (out_fd == -1) {
+        char tmp[MC_STORAGE_PATH_MAX];
+        snprintf(tmp, sizeof(tmp), "%s/.materialize.z.%ld.%u", storage_dir, (long)getpid(),
+                 __atomic_fetch_add(&g_zfile_seq, 1U, __ATOMIC_RELAXED));
+        out_fd = open(tmp, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (out_fd != -1) {
+            unlink(tmp); /* unlink() 시스템 콜로 이름 제거 (열린 동안만 유지) */
+        }
+    }
+    if (out_fd == -1) {
+        return set_error(err, err_len, "Failed to create temp file: %s", strerror(errno));
+    }
+    if (ftruncate(out_fd, (off_t)index->total_size) == -1) { /* ftruncate() 시스템 콜로 전체 크기의 빈 파일 만들기 */
+        close(out_fd);
+        return set_error(err, err_len, "Failed to create temp file: %s", strerror(errno));
+    }
+    if (length == 0) {
+        return out_fd;
+    }
+
+    mc_lz4_decoder_t *dec = malloc(sizeof(*dec));
+    uint8_t *wire = malloc(MC_LZ4_BLOCK_BOUND);
+    if (!dec || !wire) {
+        free(dec);
+        free(wire);
+        close(out_fd);
+        return set_error(err, err_len, "Out of memory");
+    }
+    size_t first = (size_t)(offset / MC_LZ4_BLOCK_MAX);
+    size_t last = (size_t)((offset + length - 1) / MC_LZ4_BLOCK_MAX);
+    int rc = 0;
+    for (size_t i = first; i <= last && rc == 0; ++i) {
+        size_t span = (size_t)(index->offsets[i + 1] - index->offsets[i]);
+        uint64_t at = (uint64_t)i * MC_LZ4_BLOCK_MAX;
+        size_t expect = index->total_size - at < MC_LZ4_BLOCK_MAX ? (size_t)(index->total_size - at) : MC_LZ4_BLOCK_MAX;
+        const uint8_t *data = wire;
+        size_t left = span;
+        mc_lz4_decoder_init(dec, UINT64_MAX);
+        if (pread(fd, wire, span, (off_t)index->offsets[i]) != (ssize_t)span || /* pread() 시스템 콜로 압축 블록 읽기 */
+            mc_lz4_decoder_push(dec, &data, &left) != 1 || left != 0 || dec->out_len != expect) {
+            rc = set_error(err, err_len, "Block %zu of %zu is damaged", i + 1, index->count);
+        } else if (pwrite(out_fd, dec->out, dec->out_len, (off_t)at) != (ssize_t)dec->out_len) { /* pwrite() 시스템 콜로 복원한 블록 기록 */
+            rc = set_error(err, err_len, "Failed to write temp file: %s", strerror(errno));
+        }
+    }
+    free(dec);
+    free(wire);
+    if (rc != 0) {
+        close(out_fd);
+        return -1;
+    }
+    return out_fd;
+}
@@ -0,0 +1,36 @@
+#include "mc_storage.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s <storage_dir> <flat|sharded>\n", prog);
+    fprintf(stderr, "Stop the server first; names, the metadata journal and blobs stay valid.\n");
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    mc_storage_layout_t to;
+    if (strcmp(argv[2], "flat") == 0) {
+        to = MC_STORAGE_LAYOUT_FLAT;
+    } else if (strcmp(argv[2], "sharded") == 0) {
+        to = MC_STORAGE_LAYOUT_SHARDED;
+    } else {
+        fprintf(stderr, "Invalid layout: %s (expected flat or sharded)\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    long moved = 0;
+    char err[512];
+    if (mc_storage_migrate_layout(argv[1], to, &moved, err, sizeof(err)) != 0) {
+        fprintf(stderr, "migrate_layout: %s (moved %ld entries so far; rerun to continue)\n", err, moved);
+        return EXIT_FAILURE;
+    }
+    printf("%s: %s layout, moved %ld entries\n", argv[1], argv[2], moved);
+    return EXIT_SUCCESS;
+}
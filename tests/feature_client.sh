@@ -0,0 +1,469 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+# Behavior checks for the features above plain UPLOAD/DOWNLOAD: each case
+# drives the real client (or a raw-protocol helper) against a fresh storage
+# directory and compares what comes back.
+
+ROOT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
+BIN_DIR="$ROOT_DIR/bin"
+PORT=${PORT:-9700}
+ENGINE=${ENGINE:-fork}
+STORAGE_MODE=${STORAGE_MODE:-plain}
+DOWNLOAD_IO=${DOWNLOAD_IO:-sendfile}
+
+make -C "$ROOT_DIR" server client list_query_client range_client session_client >/dev/null
+
+WORK_DIR=$(mktemp -d -t mc-features.XXXXXX)
+STORAGE_DIR="$WORK_DIR/storage"
+SERVER_LOG="$WORK_DIR/server.log"
+CLIENT_LOG="$WORK_DIR/client.log"
+mkdir -p "$STORAGE_DIR"
+
+stop_server() {
+    if [[ -n "${SERVER_PID:-}" ]]; then
+        kill -INT "$SERVER_PID" 2>/dev/null || true
+        wait "$SERVER_PID" 2>/dev/null || true
+        SERVER_PID=
+    fi
+}
+
+cleanup() {
+    stop_server
+    rm -rf "$WORK_DIR"
+}
+
+trap cleanup EXIT
+
+# start_server [VAR=value...]: (re)starts the server on STORAGE_DIR with extra environment.
+# The previous server's workers may hold the port a moment longer: retry until it binds.
+start_server() {
+    stop_server
+    for _ in 1 2 3 4 5 6 7 8 9 10; do
+        env MC_SERVER_ENGINE="$ENGINE" MC_STORAGE_MODE="$STORAGE_MODE" MC_DOWNLOAD_IO="$DOWNLOAD_IO" "$@" \
+            "$BIN_DIR/server" "$PORT" "$STORAGE_DIR" >>"$SERVER_LOG" 2>&1 &
+        SERVER_PID=$!
+        sleep 0.5
+        kill -0 "$SERVER_PID" 2>/dev/null && return
+        wait "$SERVER_PID" 2>/dev/null || true
+    done
+    SERVER_PID=
+    fail "the server did not start"
+}
+
+fail() {
+    echo "FAIL: $*" >&2
+    echo "--- client log ---" >&2
+    cat "$CLIENT_LOG" >&2 || true
+    echo "--- server log ---" >&2
+    tail -n 50 "$SERVER_LOG" >&2 || true
+    exit 1
+}
+
+# client <dir> [VAR=value...] -- <command>...: runs the client in dir, one command per argument.
+client() {
+    local dir=$1
+    shift
+    local envs=()
+    while [[ $# -gt 0 && $1 != "--" ]]; do
+        envs+=("$1")
+        shift
+    done
+    shift
+    mkdir -p "$dir"
+    (cd "$dir" && { printf '%s\n' "$@"; echo QUIT; } | env "${envs[@]}" "$BIN_DIR/client" 127.0.0.1 "$PORT" >"$CLIENT_LOG" 2>&1) ||
+        fail "client exited with an error: $*"
+}
+
+# expect_query <expected lines> <pattern> <sort> [cursor] [limit]
+expect_query() {
+    local expected=$1
+    shift
+    local got
+    got=$("$BIN_DIR/list_query_client" 127.0.0.1 "$PORT" "$@" | paste -sd' ' -) || fail "LIST_QUERY $* failed"
+    [[ "$got" == "$expected" ]] || fail "LIST_QUERY $*: expected '$expected', got '$got'"
+    kill -0 "$SERVER_PID" 2>/dev/null || fail "server died on LIST_QUERY $*"
+}
+
+# walk_query <pattern> <sort> <limit>: follows cursors to the last page and prints every name once.
+walk_query() {
+    local pattern=$1 sort=$2 limit=$3 cursor=- names=() page line
+    for _ in $(seq 100); do
+        page=$("$BIN_DIR/list_query_client" 127.0.0.1 "$PORT" "$pattern" "$sort" "$cursor" "$limit") ||
+            fail "LIST_QUERY $pattern $sort $cursor $limit failed"
+        cursor=-
+        while IFS= read -r line; do
+            if [[ $line == cursor=* ]]; then
+                cursor=${line#cursor=}
+            elif [[ -n $line ]]; then
+                names+=("$line")
+            fi
+        done <<<"$page"
+        if [[ $cursor == - ]]; then
+            echo "${names[*]}"
+            return
+        fi
+    done
+    fail "LIST_QUERY $pattern $sort $limit never reached its last page"
+}
+
+start_server
+
+# --- LIST_QUERY: pattern, sort, cursor and pagination -------------------------
+SRC="$WORK_DIR/src"
+mkdir -p "$SRC"
+for name in a1 a2 b1 b2 c1; do
+    head -c "$(( ${#name} * 100 + ${name:1} * 10 ))" /dev/urandom >"$SRC/$name"
+done
+client "$SRC" -- "UPLOAD a1 a2 b1 b2 c1"
+
+expect_query "b1 b2" "b*" 0
+expect_query "b1 b2" "b*" 0 a
+expect_query "b2" "b*" 0 b1
+expect_query "" "b*" 0 zzz
+expect_query "b2 b1" "b*" 1
+expect_query "b2 b1" "b*" 1 zzz
+expect_query "b1" "b*" 1 b2
+expect_query "" "b*" 1 a
+expect_query "b1 cursor=b1" "b*" 0 - 1
+expect_query "b2" "b*" 0 b1 1
+expect_query "b2 cursor=b2" "b*" 1 - 1
+expect_query "a1 a2 b1 b2 c1" - 0
+expect_query "c1 b2 b1 a2 a1" - 1
+expect_query "b2 b1" "b*" 2
+expect_query "b1 cursor=210/b1" "b*" 3 - 1
+expect_query "b2" "b*" 3 210/b1
+# page by page, every order yields exactly the one-page listing (sizes tie: 210 and 220)
+for pattern in - "[ab]*" "c*"; do
+    for sort in 0 1 2 3 4; do
+        whole=$("$BIN_DIR/list_query_client" 127.0.0.1 "$PORT" "$pattern" "$sort" | paste -sd' ' -)
+        for limit in 1 2 3; do
+            walked=$(walk_query "$pattern" "$sort" "$limit")
+            [[ "$walked" == "$whole" ]] ||
+                fail "LIST_QUERY $pattern sort=$sort in pages of $limit: '$walked', in one page: '$whole'"
+        done
+    done
+done
+client "$WORK_DIR/list" -- "LIST b* --sort=name-desc"
+grep -q "b2" "$CLIENT_LOG" && ! grep -q "a1" "$CLIENT_LOG" || fail "LIST with a pattern"
+
+# --- stored formats: an upload that looks like a container stays the user's bytes
+# random bytes then zeros: the container shrinks the zeros and cannot shrink further
+{ head -c 70000 /dev/urandom; head -c 70000 /dev/zero; } >"$SRC/lookalike-src"
+client "$SRC" -- "UPLOAD lookalike-src"
+if [[ $STORAGE_MODE != plain ]]; then
+    cmp -s "$SRC/lookalike-src" "$STORAGE_DIR/lookalike-src" && fail "$STORAGE_MODE mode stored lookalike-src as is"
+fi
+# the stored container (or manifest) itself, uploaded as an ordinary file in
+# this mode and, as a file left from plain mode, with the server in plain mode
+cp "$STORAGE_DIR/lookalike-src" "$SRC/lookalike"
+cp "$SRC/lookalike" "$SRC/lookalike-plain"
+client "$SRC" -- "UPLOAD lookalike"
+start_server MC_STORAGE_MODE=plain
+client "$SRC" -- "UPLOAD lookalike-plain"
+start_server
+client "$WORK_DIR/formats" -- "DOWNLOAD lookalike lookalike-plain lookalike-src"
+for name in lookalike lookalike-plain lookalike-src; do
+    cmp -s "$SRC/$name" "$WORK_DIR/formats/$name" || fail "$name came back changed"
+done
+
+# --- symlinks planted in storage lead nowhere, as a directory or as the file
+OUTSIDE="$WORK_DIR/outside"
+mkdir -p "$OUTSIDE"
+echo "not for clients" >"$OUTSIDE/secret"
+ln -s "$OUTSIDE" "$STORAGE_DIR/escape"
+ln -s "$OUTSIDE/secret" "$STORAGE_DIR/leaf-link"
+client "$WORK_DIR/links" -- "DOWNLOAD escape/secret leaf-link"
+[[ -e "$WORK_DIR/links/secret" || -e "$WORK_DIR/links/leaf-link" ]] && fail "a download followed a symlink"
+cp "$SRC/a1" "$SRC/secret"
+client "$SRC" -- "UPLOAD secret --to=escape" "DELETE escape/secret"
+[[ -e "$OUTSIDE/secret" ]] && cmp -s "$OUTSIDE/secret" <(echo "not for clients") ||
+    fail "an upload or delete went through a symlinked directory"
+client "$SRC" -- "DELETE leaf-link"
+cmp -s "$OUTSIDE/secret" <(echo "not for clients") || fail "a delete followed a symlinked file"
+[[ -L "$STORAGE_DIR/leaf-link" ]] && fail "DELETE left the symlink itself"
+
+# --- DOWNLOAD_RANGE: a range, then resuming a partial copy only while it is current
+head -c 200000 /dev/urandom >"$SRC/ranged"
+client "$SRC" -- "UPLOAD ranged"
+read -r offset size validator < <("$BIN_DIR/range_client" 127.0.0.1 "$PORT" ranged 1000 5000 - "$WORK_DIR/slice") ||
+    fail "DOWNLOAD_RANGE failed"
+[[ $offset == 1000 && $size == 200000 ]] || fail "DOWNLOAD_RANGE served $offset of $size"
+cmp -s "$WORK_DIR/slice" <(tail -c +1001 "$SRC/ranged" | head -c 5000) || fail "DOWNLOAD_RANGE served the wrong bytes"
+read -r offset _ _ < <("$BIN_DIR/range_client" 127.0.0.1 "$PORT" ranged 1000 0 "$validator" "$WORK_DIR/slice")
+[[ $offset == 1000 ]] || fail "a matching validator did not resume at 1000 (got $offset)"
+
+RESUME="$WORK_DIR/resume"
+mkdir -p "$RESUME"
+head -c 70000 "$SRC/ranged" >"$RESUME/ranged.part"
+echo "$validator" >"$RESUME/ranged.part.validator"
+client "$RESUME" -- "DOWNLOAD ranged"
+grep -q "이어받기" "$CLIENT_LOG" || fail "the partial download was not resumed"
+cmp -s "$SRC/ranged" "$RESUME/ranged" || fail "the resumed download differs"
+[[ -e "$RESUME/ranged.part" || -e "$RESUME/ranged.part.validator" ]] && fail "a finished download left its partial files"
+
+# the server copy changes under a partial file: the stale bytes are not joined to the new ones
+cp "$SRC/ranged" "$WORK_DIR/ranged-old"
+head -c 200000 /dev/urandom >"$SRC/ranged"
+client "$SRC" -- "UPLOAD ranged"
+read -r offset _ _ < <("$BIN_DIR/range_client" 127.0.0.1 "$PORT" ranged 1000 0 "$validator" "$WORK_DIR/slice")
+[[ $offset == 0 ]] || fail "a stale validator resumed at $offset"
+cmp -s "$WORK_DIR/slice" "$SRC/ranged" || fail "a stale validator did not get the whole new file"
+rm -f "$RESUME/ranged"
+head -c 70000 "$WORK_DIR/ranged-old" >"$RESUME/ranged.part"
+echo "$validator" >"$RESUME/ranged.part.validator"
+client "$RESUME" -- "DOWNLOAD ranged"
+cmp -s "$SRC/ranged" "$RESUME/ranged" || fail "a stale partial file was resumed into the new copy"
+# nor is a partial file whose validator was lost
+rm -f "$RESUME/ranged"
+head -c 70000 "$WORK_DIR/ranged-old" >"$RESUME/ranged.part"
+client "$RESUME" -- "DOWNLOAD ranged"
+cmp -s "$SRC/ranged" "$RESUME/ranged" || fail "a partial file without a validator was resumed"
+
+# --- upload sessions: an interrupted upload resumes, a changed source never does
+# (files above 8 MiB go through UPLOAD_BEGIN/APPEND/COMMIT)
+head -c $((9 * 1024 * 1024)) /dev/urandom >"$SRC/session"
+"$BIN_DIR/session_client" 127.0.0.1 "$PORT" session "$SRC/session" $((3 * 1024 * 1024)) |
+    grep -qx "committed=3145728" || fail "could not leave a session half done"
+compgen -G "$STORAGE_DIR/.uploads/*.part.sha256" >/dev/null ||
+    fail "the appends left no running hash beside the session"
+client "$SRC" -- "UPLOAD session"
+grep -q "이어올리기" "$CLIENT_LOG" || fail "the interrupted upload did not resume"
+compgen -G "$STORAGE_DIR/.uploads/*" >/dev/null && fail "a committed session left files in .uploads"
+client "$WORK_DIR/sessions" -- "DOWNLOAD session"
+cmp -s "$SRC/session" "$WORK_DIR/sessions/session" || fail "the resumed upload differs"
+
+# same name, size and mtime, other content: the old session's bytes are not reused
+"$BIN_DIR/session_client" 127.0.0.1 "$PORT" session "$SRC/session" $((3 * 1024 * 1024)) >/dev/null
+touch -r "$SRC/session" "$WORK_DIR/session.stamp"
+head -c $((9 * 1024 * 1024)) /dev/urandom >"$SRC/session"
+touch -r "$WORK_DIR/session.stamp" "$SRC/session"
+client "$SRC" -- "UPLOAD session"
+grep -q "이어올리기" "$CLIENT_LOG" && fail "a changed source continued an old session"
+client "$WORK_DIR/sessions" -- "DOWNLOAD session"
+cmp -s "$SRC/session" "$WORK_DIR/sessions/session" || fail "the re-uploaded session file differs"
+
+# a session whose bytes do not hash to what BEGIN announced is not published
+head -c $((9 * 1024 * 1024)) /dev/urandom >"$WORK_DIR/session-other"
+got=$("$BIN_DIR/session_client" 127.0.0.1 "$PORT" forged "$SRC/session" $((9 * 1024 * 1024)) "$WORK_DIR/session-other")
+[[ $got == *"ERROR: Checksum mismatch"* ]] || fail "COMMIT of the wrong content answered '$got'"
+[[ -e "$STORAGE_DIR/forged" ]] && fail "COMMIT published content that does not match its hash"
+
+# --- directories: MKDIR/RMDIR, uploads into them and nested names everywhere
+client "$SRC" -- "MKDIR docs/deep/er" "MKDIR docs" "UPLOAD a1 b1 --to=docs/deep" "UPLOAD c1 --to=fresh/sub/"
+grep -q "Already exists" "$CLIENT_LOG" || fail "MKDIR of an existing directory was not refused"
+[[ -d "$STORAGE_DIR/docs/deep/er" && -d "$STORAGE_DIR/fresh/sub" ]] || fail "MKDIR or UPLOAD --to= did not create the directories"
+expect_query "docs/ docs/deep/ docs/deep/a1 docs/deep/b1 docs/deep/er/" "docs/*" 0
+expect_query "docs/deep/er/ docs/deep/b1 docs/deep/a1 docs/deep/ docs/" "docs/*" 1
+expect_query "docs/deep/a1 cursor=docs/deep/a1" "docs/deep/?1" 0 - 1
+expect_query "docs/deep/b1" "docs/deep/?1" 0 docs/deep/a1 1
+client "$WORK_DIR/list" -- "LIST fresh/*"
+grep -q "fresh/sub/c1" "$CLIENT_LOG" || fail "LIST did not reach into subdirectories"
+client "$WORK_DIR/nested" -- "DOWNLOAD docs/deep/a1 fresh/sub/c1"
+cmp -s "$SRC/a1" "$WORK_DIR/nested/docs/deep/a1" || fail "a nested download came back changed"
+cmp -s "$SRC/c1" "$WORK_DIR/nested/fresh/sub/c1" || fail "a nested download came back changed"
+client "$WORK_DIR/nested" -- "DOWNLOAD docs/../a1" "DOWNLOAD docs//a1" "UPLOAD a1 --to=docs/.." "DELETE docs" "RMDIR docs/deep"
+kill -0 "$SERVER_PID" 2>/dev/null || fail "the server died on a bad path"
+[[ -e "$WORK_DIR/nested/a1" || -e "$STORAGE_DIR/a1.part" ]] && fail "a path with .. or an empty component was accepted"
+grep -q "Is a directory" "$CLIENT_LOG" || fail "DELETE of a directory was not refused"
+grep -q "Directory not empty" "$CLIENT_LOG" || fail "RMDIR of a full directory was not refused"
+[[ -f "$STORAGE_DIR/docs/deep/a1" ]] || fail "a refused DELETE or RMDIR removed something"
+# the names of one command are pipelined, so a parent goes on a later line than its children
+client "$SRC" -- "DELETE docs/deep/a1 docs/deep/b1 fresh/sub/c1" "RMDIR docs/deep/er fresh/sub" "RMDIR docs/deep fresh" "RMDIR docs"
+[[ -e "$STORAGE_DIR/docs" || -e "$STORAGE_DIR/fresh" ]] && fail "RMDIR left the emptied directories"
+expect_query "" "docs*" 0
+expect_query "" "fresh*" 0
+
+# --- delta re-upload: an edited file sends only what changed
+head -c $((3 * 1024 * 1024)) /dev/urandom >"$SRC/delta"
+client "$SRC" -- "UPLOAD delta"
+# bytes overwritten in place, bytes inserted (shifting the rest) and a new tail
+{
+    head -c 1000000 "$SRC/delta"
+    printf 'edited in place'
+    head -c 2000015 "$SRC/delta" | tail -c 1000000
+    printf 'inserted, so every later block moves'
+    tail -c +2000016 "$SRC/delta"
+    head -c 5000 /dev/urandom
+} >"$WORK_DIR/delta-new"
+mv "$WORK_DIR/delta-new" "$SRC/delta"
+client "$SRC" -- "UPLOAD delta"
+sent=$(sed -n 's/.*델타 업로드: delta ([0-9]* bytes 중 \([0-9]*\) bytes 새로 전송.*/\1/p' "$CLIENT_LOG")
+[[ -n $sent ]] || fail "the re-upload did not go as a delta"
+(( sent < 256 * 1024 )) || fail "the delta re-sent $sent bytes for three small edits"
+client "$WORK_DIR/delta" -- "DOWNLOAD delta"
+cmp -s "$SRC/delta" "$WORK_DIR/delta/delta" || fail "the file rebuilt from the delta differs"
+# without the client's delta the same upload still works
+head -c 4096 /dev/urandom | dd of="$SRC/delta" bs=4096 seek=10 conv=notrunc status=none
+client "$SRC" MC_CLIENT_DELTA=0 -- "UPLOAD delta"
+grep -q "델타 업로드" "$CLIENT_LOG" && fail "MC_CLIENT_DELTA=0 still sent a delta"
+client "$WORK_DIR/delta" -- "DOWNLOAD delta"
+cmp -s "$SRC/delta" "$WORK_DIR/delta/delta" || fail "the full re-upload differs"
+
+# --- HAVE: content the server already holds is not sent again
+head -c $((2 * 1024 * 1024)) /dev/urandom >"$SRC/have-a"
+client "$SRC" -- "UPLOAD have-a"
+grep -q "전송 생략" "$CLIENT_LOG" && fail "HAVE skipped a file the server never had"
+client "$SRC" -- "UPLOAD have-a"
+grep -q "전송 생략: have-a" "$CLIENT_LOG" || fail "HAVE did not skip an unchanged re-upload"
+# same content under another name: linked from the content index
+cp "$SRC/have-a" "$SRC/have-b"
+client "$SRC" -- "UPLOAD have-b"
+grep -q "전송 생략: have-b" "$CLIENT_LOG" || fail "HAVE did not find the content under another name"
+# same size, other content: uploaded after all
+head -c $((2 * 1024 * 1024)) /dev/urandom >"$SRC/have-a"
+client "$SRC" -- "UPLOAD have-a"
+grep -q "전송 생략" "$CLIENT_LOG" && fail "HAVE skipped changed content"
+cp "$SRC/have-a" "$SRC/have-c"
+client "$SRC" MC_CLIENT_HAVE=0 -- "UPLOAD have-c"
+grep -q "전송 생략" "$CLIENT_LOG" && fail "MC_CLIENT_HAVE=0 still asked HAVE"
+client "$WORK_DIR/have" -- "DOWNLOAD have-a have-b have-c"
+cmp -s "$SRC/have-a" "$WORK_DIR/have/have-a" || fail "have-a came back changed"
+cmp -s "$SRC/have-b" "$WORK_DIR/have/have-b" || fail "the linked have-b came back changed"
+cmp -s "$SRC/have-c" "$WORK_DIR/have/have-c" || fail "have-c came back changed"
+# a copy put in storage behind the server's back is hashed once (off the loop) and found
+head -c $((2 * 1024 * 1024)) /dev/urandom >"$SRC/have-d"
+cp "$SRC/have-d" "$STORAGE_DIR/have-d"
+client "$SRC" -- "UPLOAD have-d"
+grep -q "전송 생략: have-d" "$CLIENT_LOG" || fail "HAVE did not hash an unindexed copy"
+
+# --- bundles: many small files in one request each way, the rest one by one
+BUNDLE="$WORK_DIR/bundle-src"
+mkdir -p "$BUNDLE"
+names=()
+for i in $(seq 0 19); do
+    head -c $(( i * 997 )) /dev/urandom >"$BUNDLE/small$i"
+    names+=("small$i")
+done
+head -c $((1024 * 1024 + 1)) /dev/urandom >"$BUNDLE/large"
+client "$BUNDLE" -- "UPLOAD ${names[*]} large"
+grep -q "번들 업로드: 20개 파일" "$CLIENT_LOG" || fail "the small files did not go as one bundle"
+client "$WORK_DIR/bundle" -- "DOWNLOAD ${names[*]} large missing"
+grep -q "번들 다운로드 요청: 22개 파일" "$CLIENT_LOG" || fail "the downloads did not go as one bundle"
+for name in "${names[@]}" large; do
+    cmp -s "$BUNDLE/$name" "$WORK_DIR/bundle/$name" || fail "bundled $name came back changed"
+done
+[[ -e "$WORK_DIR/bundle/missing" ]] && fail "a missing name in a bundle produced a file"
+# a name with a partial file left over resumes on its own; the others still bundle
+rm -f "$WORK_DIR/bundle/small5" "$WORK_DIR/bundle/small6"
+head -c 100 "$BUNDLE/small5" >"$WORK_DIR/bundle/small5.part"
+client "$WORK_DIR/bundle" -- "DOWNLOAD small5 small6 small7"
+grep -q "번들 다운로드 요청: 2개 파일" "$CLIENT_LOG" || fail "a name with a .part went into the bundle"
+cmp -s "$BUNDLE/small5" "$WORK_DIR/bundle/small5" || fail "small5 did not come back whole"
+cmp -s "$BUNDLE/small6" "$WORK_DIR/bundle/small6" || fail "small6 came back changed"
+client "$BUNDLE" MC_CLIENT_BUNDLE=0 -- "UPLOAD ${names[*]}"
+grep -q "번들" "$CLIENT_LOG" && fail "MC_CLIENT_BUNDLE=0 still sent a bundle"
+
+# --- large bodies: whole, ranged, checksummed and compressed, several connections at once
+BIG="$WORK_DIR/big-src"
+mkdir -p "$BIG"
+{ head -c $((3 * 1024 * 1024)) /dev/zero; head -c $((2 * 1024 * 1024 + 123)) /dev/urandom; } >"$BIG/big"
+client "$BIG" -- "UPLOAD big"
+for opts in "" "MC_CLIENT_COMPRESS=0" "MC_CLIENT_CHECKSUM=0 MC_CLIENT_COMPRESS=0" "MC_CLIENT_PIPELINE=1"; do
+    rm -rf "$WORK_DIR/big"
+    # shellcheck disable=SC2086
+    client "$WORK_DIR/big" $opts -- "DOWNLOAD big"
+    cmp -s "$BIG/big" "$WORK_DIR/big/big" || fail "big came back changed ($opts)"
+done
+pids=()
+for i in 0 1 2 3; do
+    "$BIN_DIR/range_client" 127.0.0.1 "$PORT" big $(( i * 1000003 )) 0 - "$WORK_DIR/big-$i" >/dev/null &
+    pids+=($!)
+done
+for i in 0 1 2 3; do
+    wait "${pids[$i]}" || fail "concurrent DOWNLOAD_RANGE $i failed"
+    cmp -s "$WORK_DIR/big-$i" <(tail -c +$(( i * 1000003 + 1 )) "$BIG/big") || fail "concurrent DOWNLOAD_RANGE $i served the wrong bytes"
+done
+read -r offset _ _ < <("$BIN_DIR/range_client" 127.0.0.1 "$PORT" big 1048583 2097152 - "$WORK_DIR/slice")
+[[ $offset == 1048583 ]] || fail "DOWNLOAD_RANGE of big served $offset"
+cmp -s "$WORK_DIR/slice" <(tail -c +1048584 "$BIG/big" | head -c 2097152) || fail "DOWNLOAD_RANGE of big served the wrong bytes"
+# an upload replacing big while it is being sent: the reader gets one version or the other, whole
+cp "$BIG/big" "$WORK_DIR/big-old"
+head -c $((5 * 1024 * 1024)) /dev/urandom >"$BIG/big"
+"$BIN_DIR/range_client" 127.0.0.1 "$PORT" big 0 0 - "$WORK_DIR/big-racing" >/dev/null &
+racer=$!
+client "$BIG" MC_CLIENT_DELTA=0 MC_CLIENT_HAVE=0 -- "UPLOAD big"
+wait "$racer" || fail "DOWNLOAD_RANGE racing an upload failed"
+cmp -s "$WORK_DIR/big-racing" "$WORK_DIR/big-old" || cmp -s "$WORK_DIR/big-racing" "$BIG/big" ||
+    fail "a download racing an upload mixed the two versions"
+
+# --- hot-file cache: small files come back right on every hit and after every change
+HOT="$WORK_DIR/hot-src"
+mkdir -p "$HOT"
+hot=(hot0 hot1 hot2 hot3 hot-edge)
+for i in 0 1 2 3; do
+    head -c $(( i * 16000 + 100 )) /dev/urandom >"$HOT/hot$i"
+done
+head -c 65536 /dev/urandom >"$HOT/hot-edge"
+client "$HOT" -- "UPLOAD ${hot[*]}"
+# repeated one-by-one downloads are what gets cached; plain, checksummed and v1 replies alike
+for opts in "" "MC_CLIENT_CHECKSUM=0 MC_CLIENT_COMPRESS=0" "MC_CLIENT_PIPELINE=1"; do
+    for _ in 1 2 3; do
+        rm -rf "$WORK_DIR/hot"
+        # shellcheck disable=SC2086
+        client "$WORK_DIR/hot" MC_CLIENT_BUNDLE=0 $opts -- "DOWNLOAD ${hot[*]}"
+        for name in "${hot[@]}"; do
+            cmp -s "$HOT/$name" "$WORK_DIR/hot/$name" || fail "$name came back changed ($opts)"
+        done
+    done
+done
+read -r offset size _ < <("$BIN_DIR/range_client" 127.0.0.1 "$PORT" hot3 40000 1000 - "$WORK_DIR/slice")
+[[ $offset == 40000 && $size == 48100 ]] || fail "DOWNLOAD_RANGE of a cached file served $offset of $size"
+cmp -s "$WORK_DIR/slice" <(tail -c +40001 "$HOT/hot3" | head -c 1000) || fail "DOWNLOAD_RANGE of a cached file served the wrong bytes"
+# a same-size overwrite, whole or as a delta, replaces what the cache holds
+head -c 16100 /dev/urandom >"$HOT/hot1"
+client "$HOT" MC_CLIENT_DELTA=0 MC_CLIENT_HAVE=0 -- "UPLOAD hot1"
+dd if=/dev/urandom of="$HOT/hot2" bs=1 seek=5000 count=64 conv=notrunc status=none
+client "$HOT" -- "UPLOAD hot2"
+rm -rf "$WORK_DIR/hot"
+client "$WORK_DIR/hot" MC_CLIENT_BUNDLE=0 -- "DOWNLOAD hot1 hot2"
+cmp -s "$HOT/hot1" "$WORK_DIR/hot/hot1" || fail "an overwritten cached file came back stale"
+cmp -s "$HOT/hot2" "$WORK_DIR/hot/hot2" || fail "a delta-updated cached file came back stale"
+client "$HOT" -- "DELETE hot0"
+rm -rf "$WORK_DIR/hot"
+client "$WORK_DIR/hot" MC_CLIENT_BUNDLE=0 -- "DOWNLOAD hot0"
+[[ -e "$WORK_DIR/hot/hot0" ]] && fail "a deleted cached file was still served"
+
+# --- metadata journal: rewritten once it outgrows the index, followed by every process
+expect_query "a1 a2 b1 b2 c1" "[abc][12]" 0
+uploads=()
+for _ in $(seq 130); do
+    uploads+=("UPLOAD a1 a2 b1 b2 c1")
+done
+# two connections (two processes with fork or workers) journaling at once
+client "$SRC" -- "${uploads[@]}" &
+JOURNAL_PID=$!
+client "$SRC" -- "${uploads[@]}"
+wait "$JOURNAL_PID" || fail "the concurrent uploads failed"
+journal_size=$(stat -c %s "$STORAGE_DIR/.meta.log")
+(( journal_size < 40000 )) || fail "the journal was not compacted ($journal_size bytes after 1300 records)"
+expect_query "a1 a2 b1 b2 c1" "[abc][12]" 0
+client "$SRC" -- "DELETE c1"
+expect_query "a1 a2 b1 b2" "[abc][12]" 0
+start_server MC_META_INDEX=persist
+expect_query "a1 a2 b1 b2" "[abc][12]" 0
+client "$SRC" -- "UPLOAD c1"
+start_server
+
+# --- DOWNLOAD ALL --archive: the whole tree as one tar stream, or one directory of it
+long=$(printf 'n%.0s' $(seq 120))
+cp "$SRC/a2" "$SRC/$long"
+client "$SRC" -- "UPLOAD a1 --to=arch/one" "UPLOAD b2 $long --to=arch/two/three" "MKDIR arch/empty"
+client "$WORK_DIR/archive" -- "DOWNLOAD ALL --archive"
+grep -q "download-all 완료" "$CLIENT_LOG" || fail "DOWNLOAD ALL --archive did not finish"
+for name in a1 a2 b1 b2 c1 ranged session delta have-a have-b; do
+    cmp -s "$SRC/$name" "$WORK_DIR/archive/$name" || fail "$name came out of the archive changed"
+done
+cmp -s "$SRC/a1" "$WORK_DIR/archive/arch/one/a1" || fail "arch/one/a1 came out of the archive changed"
+cmp -s "$SRC/b2" "$WORK_DIR/archive/arch/two/three/b2" || fail "arch/two/three/b2 came out of the archive changed"
+# a path past ustar's 100-byte name field
+cmp -s "$SRC/$long" "$WORK_DIR/archive/arch/two/three/$long" || fail "the long name came out of the archive changed"
+[[ -d "$WORK_DIR/archive/arch/empty" ]] || fail "the archive lost the empty arch/empty"
+for internal in .meta.log .uploads .chunks .blobs; do
+    [[ -e "$WORK_DIR/archive/$internal" ]] && fail "the archive carried the server's $internal"
+done
+client "$WORK_DIR/archive-sub" -- "DOWNLOAD ALL --archive=arch/two"
+cmp -s "$SRC/b2" "$WORK_DIR/archive-sub/arch/two/three/b2" || fail "--archive=arch/two lost arch/two/three/b2"
+[[ -e "$WORK_DIR/archive-sub/arch/one" || -e "$WORK_DIR/archive-sub/a1" ]] && fail "--archive=arch/two carried files outside it"
+
+echo "Feature test completed successfully (engine=$ENGINE, storage=$STORAGE_MODE, io=$DOWNLOAD_IO)." >&2
@@ -0,0 +1,141 @@
+#include "mc_protocol.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/*
+ * Sends one LIST_QUERY with a caller-chosen pattern, sort, cursor and limit
+ * and prints the page: one name per line, then "cursor=<cursor>" when more
+ * files follow. Lets tests hand the server cursors the client never would.
+ */
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s <ip> <port> <pattern|-> <sort> [cursor|-] [limit]\n", prog);
+}
+
+static int connect_to(const char *ip, const char *port_text) {
+    char *end = NULL;
+    long port = strtol(port_text, &end, 10);
+    if (!end || *end != '\0' || port <= 0 || port > 65535) {
+        fprintf(stderr, "Invalid port: %s\n", port_text);
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0); /* socket() 시스템 콜로 클라이언트 소켓 생성 */
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    if (inet_pton(AF_INET, ip, &addr.sin_addr) != 1 ||
+        connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) { /* connect() 시스템 콜로 서버 접속 */
+        perror("connect");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int print_page(const uint8_t *buf, size_t len) {
+    mc_list_page_t page;
+    if (len < sizeof(page)) {
+        return -1;
+    }
+    memcpy(&page, buf, sizeof(page));
+    mc_list_page_network_to_host(&page);
+    size_t used = sizeof(page);
+    if (len - used < page.cursor_len) {
+        return -1;
+    }
+    const char *cursor = (const char *)buf + used;
+    used += page.cursor_len;
+    for (uint32_t i = 0; i < page.count; ++i) {
+        mc_list_record_t record;
+        if (len - used < sizeof(record)) {
+            return -1;
+        }
+        memcpy(&record, buf + used, sizeof(record));
+        mc_list_record_network_to_host(&record);
+        used += sizeof(record);
+        if (len - used < record.name_len) {
+            return -1;
+        }
+        printf("%.*s\n", (int)record.name_len, (const char *)buf + used);
+        used += record.name_len;
+    }
+    if (page.cursor_len > 0) {
+        printf("cursor=%.*s\n", (int)page.cursor_len, cursor);
+    }
+    return used == len ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 5 || argc > 7) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *pattern = strcmp(argv[3], "-") == 0 ? NULL : argv[3];
+    const char *cursor = argc > 5 && strcmp(argv[5], "-") != 0 ? argv[5] : "";
+
+    mc_list_query_t query;
+    memset(&query, 0, sizeof(query));
+    query.sort = (uint8_t)atoi(argv[4]);
+    query.limit = argc > 6 ? (uint32_t)strtoul(argv[6], NULL, 10) : 0;
+    query.cursor_len = (uint16_t)strlen(cursor);
+    if (query.cursor_len > MC_LIST_CURSOR_MAX) {
+        fprintf(stderr, "Cursor too long\n");
+        return EXIT_FAILURE;
+    }
+    memcpy(query.cursor, cursor, query.cursor_len);
+    mc_list_query_host_to_network(&query);
+
+    int fd = connect_to(argv[1], argv[2]);
+    if (fd == -1) {
+        return EXIT_FAILURE;
+    }
+    mc_packet_header_t header;
+    if (mc_build_header(&header, MC_CMD_LIST_QUERY, pattern, sizeof(query)) != 0) {
+        perror("mc_build_header");
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    header.version = MC_PROTOCOL_VERSION_PIPELINED;
+    header.request_id = 1;
+    if (mc_send_packet(fd, &header, pattern, &query, sizeof(query), false) != 0) {
+        perror("send");
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    mc_packet_header_t reply;
+    if (mc_recv_header(fd, &reply) != 0 || reply.filename_len > 0) {
+        fprintf(stderr, "Bad reply header\n");
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    uint8_t *buf = malloc((size_t)reply.payload_len + 1);
+    if (!buf || mc_recv_all(fd, buf, (size_t)reply.payload_len) != (ssize_t)reply.payload_len) {
+        fprintf(stderr, "Short reply\n");
+        free(buf);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    int rc = EXIT_SUCCESS;
+    if (reply.command != MC_CMD_LIST_QUERY) {
+        buf[reply.payload_len] = '\0';
+        printf("ERROR: %s\n", (const char *)buf);
+    } else if (print_page(buf, (size_t)reply.payload_len) != 0) {
+        fprintf(stderr, "Malformed page\n");
+        rc = EXIT_FAILURE;
+    }
+    free(buf);
+    close(fd); /* close() 시스템 콜로 소켓 종료 */
+    return rc;
+}
@@ -9,9 +9,15 @@ ROUNDS=${ROUNDS:-3}
 STORAGE_DIR=${STORAGE_DIR:-"$ROOT_DIR/storage"}
 AUTH_TOKEN=${AUTH_TOKEN:-"mini-cloud-secret"}
 MAX_UPLOAD_BYTES=${MAX_UPLOAD_BYTES:-0}
+ENGINE=${ENGINE:-fork}
+WORKERS=${WORKERS:-0}
+STORAGE_MODE=${STORAGE_MODE:-plain}
+STORAGE_LAYOUT=${STORAGE_LAYOUT:-flat}
 
 mkdir -p "$STORAGE_DIR"
-make -C "$ROOT_DIR" server client >/dev/null
+make -C "$ROOT_DIR" server client migrate >/dev/null
+# whatever an earlier run left behind is moved into the layout under test
+"$BIN_DIR/migrate_layout" "$STORAGE_DIR" "$STORAGE_LAYOUT" >/dev/null
 
 SERVER_LOG=$(mktemp -t mc-stress-server.XXXXXX)
 CLIENT_LOG_DIR=$(mktemp -d -t mc-stress-clients.XXXXXX)
@@ -37,7 +43,7 @@ cleanup() {
 
 trap cleanup EXIT
 
-MC_SERVER_TOKEN="$AUTH_TOKEN" MC_MAX_UPLOAD_BYTES="$MAX_UPLOAD_BYTES" \
+MC_SERVER_TOKEN="$AUTH_TOKEN" MC_MAX_UPLOAD_BYTES="$MAX_UPLOAD_BYTES" MC_SERVER_ENGINE="$ENGINE" MC_SERVER_WORKERS="$WORKERS" MC_STORAGE_MODE="$STORAGE_MODE" MC_STORAGE_LAYOUT="$STORAGE_LAYOUT" \
     "$BIN_DIR/server" "$PORT" "$STORAGE_DIR" >"$SERVER_LOG" 2>&1 &
 SERVER_PID=$!
 sleep 1
@@ -48,11 +54,12 @@ run_client() {
     for ((round=1; round<=ROUNDS; ++round)); do
         local tmp_file
         tmp_file=$(mktemp -t mc-stress-upload.XXXXXX)
-        echo "client $idx round $round $(date --iso-8601=ns)" >"$tmp_file"
+        { echo "client $idx round $round $(date --iso-8601=ns)"; seq 1 20000; } >"$tmp_file"
         local base
         base=$(basename "$tmp_file")
         printf "UPLOAD %s\nDOWNLOAD %s\nLIST\nQUIT\n" "$tmp_file" "$base" |
             MC_CLIENT_TOKEN="$AUTH_TOKEN" "$BIN_DIR/client" 127.0.0.1 "$PORT" >>"$log_file" 2>&1 || return 1
+        cmp -s "$tmp_file" "$base" || { echo "client $idx round $round: $base differs after round trip" >>"$log_file"; return 1; }
         rm -f "$tmp_file" "$base"
     done
     return 0
@@ -77,5 +84,5 @@ if [[ $status -ne 0 ]]; then
     exit $status
 fi
 
-echo "Stress test completed successfully with $CLIENTS clients x $ROUNDS rounds." >&2
+echo "Stress test completed successfully with $CLIENTS clients x $ROUNDS rounds (engine=$ENGINE, workers=$WORKERS, storage=$STORAGE_MODE, layout=$STORAGE_LAYOUT)." >&2
 exit 0
@@ -1,18 +1,23 @@
+#include "mc_crc32c.h"
+#include "mc_lz4.h"
 #include "mc_protocol.h"
+#include "mc_sha256.h"
 
 #include <errno.h>
 #include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 static void print_header(const mc_packet_header_t *header) {
-    printf("magic=0x%08X, version=%u, cmd=%u, filename_len=%u, payload_len=%" PRIu64 "\n",
+    printf("magic=0x%08X, version=%u, cmd=%u, filename_len=%u, payload_len=%" PRIu64 ", request_id=%u\n",
            header->magic,
            header->version,
            header->command,
            header->filename_len,
-           (uint64_t)header->payload_len);
+           (uint64_t)header->payload_len,
+           header->request_id);
 }
 
 int main(void) {
@@ -40,6 +45,204 @@ int main(void) {
     }
 
     print_header(&received);
+
+    /* v2: the reply mirrors version and request_id of the request */
+    mc_packet_header_t request = header;
+    request.version = MC_PROTOCOL_VERSION_PIPELINED;
+    request.request_id = 42;
+    mc_packet_header_t reply;
+    if (mc_build_reply_header(&reply, &request, MC_CMD_DOWNLOAD, "demo.bin", 4096) != 0) {
+        perror("mc_build_reply_header");
+        return 1;
+    }
+    if (mc_send_header(fds[1], &reply) != 0) {
+        perror("mc_send_header");
+        return 1;
+    }
+    if (mc_recv_header(fds[0], &received) != 0 || received.request_id != 42) {
+        fprintf(stderr, "v2 header round trip failed\n");
+        return 1;
+    }
+
+    print_header(&received);
+
+    /* DOWNLOAD_RANGE payloads are two 64-bit fields in network order */
+    mc_range_t range = {.offset = 1234567, .length = 0};
+    mc_range_host_to_network(&range);
+    mc_range_t range_in;
+    if (mc_send_all(fds[1], &range, sizeof(range)) != (ssize_t)MC_RANGE_SIZE ||
+        mc_recv_all(fds[0], &range_in, sizeof(range_in)) != (ssize_t)MC_RANGE_SIZE) {
+        fprintf(stderr, "range round trip failed\n");
+        return 1;
+    }
+    mc_range_network_to_host(&range_in);
+    if (range_in.offset != 1234567 || range_in.length != 0) {
+        fprintf(stderr, "range round trip failed\n");
+        return 1;
+    }
+    printf("range offset=%" PRIu64 ", length=%" PRIu64 "\n", (uint64_t)range_in.offset, (uint64_t)range_in.length);
+
+    /* UPLOAD_BEGIN/COMMIT payloads: total size, tag and content hash, same encoding */
+    mc_upload_begin_t begin = {.total_size = 40000000, .tag = 1700000000123456789ULL};
+    mc_sha256("session", 7, begin.sha256);
+    mc_upload_begin_host_to_network(&begin);
+    mc_upload_begin_t begin_in;
+    if (mc_send_all(fds[1], &begin, sizeof(begin)) != (ssize_t)sizeof(begin) ||
+        mc_recv_all(fds[0], &begin_in, sizeof(begin_in)) != (ssize_t)sizeof(begin_in)) {
+        fprintf(stderr, "upload begin round trip failed\n");
+        return 1;
+    }
+    mc_upload_begin_network_to_host(&begin_in);
+    uint8_t begin_sha[MC_SHA256_DIGEST_LEN];
+    mc_sha256("session", 7, begin_sha);
+    if (begin_in.total_size != 40000000 || begin_in.tag != 1700000000123456789ULL ||
+        memcmp(begin_in.sha256, begin_sha, sizeof(begin_sha)) != 0) {
+        fprintf(stderr, "upload begin round trip failed\n");
+        return 1;
+    }
+    printf("upload total=%" PRIu64 ", tag=%" PRIu64 "\n", (uint64_t)begin_in.total_size, (uint64_t)begin_in.tag);
+
+    mc_signature_header_t sig = {.block_size = 5120, .block_count = 5860, .file_size = 30000012};
+    mc_signature_host_to_network(&sig);
+    mc_signature_header_t sig_in;
+    if (mc_send_all(fds[1], &sig, sizeof(sig)) != (ssize_t)sizeof(sig) ||
+        mc_recv_all(fds[0], &sig_in, sizeof(sig_in)) != (ssize_t)sizeof(sig_in)) {
+        fprintf(stderr, "signature header round trip failed\n");
+        return 1;
+    }
+    mc_signature_network_to_host(&sig_in);
+    if (sig_in.block_size != 5120 || sig_in.block_count != 5860 || sig_in.file_size != 30000012) {
+        fprintf(stderr, "signature header round trip failed\n");
+        return 1;
+    }
+    printf("signatures block_size=%u, blocks=%u, size=%" PRIu64 "\n",
+           sig_in.block_size,
+           sig_in.block_count,
+           (uint64_t)sig_in.file_size);
+
+    mc_have_t have = {.size = 5000000};
+    memset(have.sha256, 0xab, sizeof(have.sha256));
+    mc_have_host_to_network(&have);
+    mc_have_t have_in;
+    if (mc_send_all(fds[1], &have, sizeof(have)) != (ssize_t)sizeof(have) ||
+        mc_recv_all(fds[0], &have_in, sizeof(have_in)) != (ssize_t)sizeof(have_in)) {
+        fprintf(stderr, "have round trip failed\n");
+        return 1;
+    }
+    mc_have_network_to_host(&have_in);
+    if (have_in.size != 5000000 || have_in.sha256[0] != 0xab || have_in.sha256[31] != 0xab) {
+        fprintf(stderr, "have round trip failed\n");
+        return 1;
+    }
+    printf("have size=%" PRIu64 "\n", (uint64_t)have_in.size);
+
+    mc_list_record_t record = {.size = 123456789012ULL, .mtime = -5, .name_len = 7, .flags = MC_LIST_HAS_DIGEST};
+    mc_list_record_host_to_network(&record);
+    mc_list_record_t record_in;
+    if (mc_send_all(fds[1], &record, sizeof(record)) != (ssize_t)sizeof(record) ||
+        mc_recv_all(fds[0], &record_in, sizeof(record_in)) != (ssize_t)sizeof(record_in)) {
+        fprintf(stderr, "list record round trip failed\n");
+        return 1;
+    }
+    mc_list_record_network_to_host(&record_in);
+    if (record_in.size != 123456789012ULL || record_in.mtime != -5 || record_in.name_len != 7 ||
+        record_in.flags != MC_LIST_HAS_DIGEST) {
+        fprintf(stderr, "list record round trip failed\n");
+        return 1;
+    }
+    printf("list record size=%" PRIu64 ", mtime=%" PRId64 "\n", record_in.size, record_in.mtime);
+
+    /* v3: frames carry a stream id and a length; an oversized length is refused */
+    mc_frame_header_t frame = {.stream_id = 7, .length = 512};
+    mc_frame_host_to_network(&frame);
+    mc_frame_header_t frame_in;
+    if (mc_send_all(fds[1], &frame, sizeof(frame)) != (ssize_t)sizeof(frame) ||
+        mc_recv_frame_header(fds[0], &frame_in) != 0 || frame_in.stream_id != 7 || frame_in.length != 512) {
+        fprintf(stderr, "v3 frame round trip failed\n");
+        return 1;
+    }
+    printf("frame stream_id=%u, length=%u\n", frame_in.stream_id, frame_in.length);
+    frame = (mc_frame_header_t){.stream_id = 7, .length = MC_FRAME_MAX_PAYLOAD + 1U};
+    mc_frame_host_to_network(&frame);
+    if (mc_send_all(fds[1], &frame, sizeof(frame)) != (ssize_t)sizeof(frame) ||
+        mc_recv_frame_header(fds[0], &frame_in) != -2) {
+        fprintf(stderr, "oversized v3 frame was accepted\n");
+        return 1;
+    }
+
+    /* checksum trailer: CRC32C check value, and the fast kernel agrees with the table one */
+    if (mc_crc32c_update(0, "123456789", 9) != 0xe3069283U) {
+        fprintf(stderr, "crc32c check value mismatch (%s)\n", mc_crc32c_impl());
+        return 1;
+    }
+    uint8_t sample[1031];
+    for (size_t i = 0; i < sizeof(sample); ++i) {
+        sample[i] = (uint8_t)(i * 131U + 7U);
+    }
+    uint32_t split = mc_crc32c_update(mc_crc32c_update(0, sample, 13), sample + 13, sizeof(sample) - 13);
+    if (split != mc_crc32c_portable(0, sample, sizeof(sample))) {
+        fprintf(stderr, "crc32c %s kernel disagrees with the portable one\n", mc_crc32c_impl());
+        return 1;
+    }
+    printf("crc32c kernel=%s\n", mc_crc32c_impl());
+
+    /* AUTH options: unknown names are ignored, the echo lists what was accepted */
+    char echo[64];
+    unsigned int caps = mc_auth_parse_options("lz4,future,crc32c");
+    mc_auth_format_options(caps, echo, sizeof(echo));
+    if (caps != (MC_AUTH_CAP_CRC32C | MC_AUTH_CAP_LZ4) || strcmp(echo, "crc32c,lz4") != 0) {
+        fprintf(stderr, "auth option list mismatch: %s\n", echo);
+        return 1;
+    }
+
+    /* LZ4 blocks: a compressible block shrinks, a random one is stored, and
+     * both decode back when the stream arrives a few bytes at a time */
+    static uint8_t input[2 * MC_LZ4_BLOCK_MAX];
+    static uint8_t wire[2 * MC_LZ4_BLOCK_BOUND];
+    static uint8_t output[2 * MC_LZ4_BLOCK_MAX];
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < MC_LZ4_BLOCK_MAX; ++i) {
+        input[i] = (uint8_t)"mini cloud lz4 "[(i / 3) % 15] + (uint8_t)(i % 1024 == 0);
+        seed = seed * 1103515245U + 12345U;
+        input[MC_LZ4_BLOCK_MAX + i] = (uint8_t)(seed >> 16);
+    }
+    mc_lz4_encoder_t *enc = malloc(sizeof(*enc));
+    mc_lz4_decoder_t *dec = malloc(sizeof(*dec));
+    if (!enc || !dec) {
+        return 1;
+    }
+    mc_lz4_encoder_init(enc);
+    size_t text_len = mc_lz4_encode_block(enc, input, MC_LZ4_BLOCK_MAX, wire);
+    size_t wire_len = text_len + mc_lz4_encode_block(enc, input + MC_LZ4_BLOCK_MAX, MC_LZ4_BLOCK_MAX, wire + text_len);
+    mc_lz4_decoder_init(dec, sizeof(output));
+    const uint8_t *cursor = wire;
+    size_t left = wire_len;
+    size_t decoded = 0;
+    while (left > 0) {
+        size_t piece = left < 7 ? left : 7;
+        size_t unread = piece;
+        while (unread > 0) {
+            int got = mc_lz4_decoder_push(dec, &cursor, &unread);
+            if (got < 0) {
+                fprintf(stderr, "lz4 decode failed: %s\n", strerror(errno));
+                return 1;
+            }
+            if (got == 1) {
+                memcpy(output + decoded, dec->out, dec->out_len);
+                decoded += dec->out_len;
+            }
+        }
+        left -= piece;
+    }
+    if (text_len >= MC_LZ4_BLOCK_MAX / 2 || wire_len - text_len != MC_LZ4_BLOCK_BOUND ||
+        decoded != sizeof(output) || !mc_lz4_decoder_idle(dec) || memcmp(input, output, sizeof(output)) != 0) {
+        fprintf(stderr, "lz4 round trip failed\n");
+        return 1;
+    }
+    printf("lz4 blocks=%zu+%zu bytes for %zu\n", text_len, wire_len - text_len, sizeof(input));
+    free(enc);
+    free(dec);
+
     close(fds[0]); /* close() 시스템 콜로 파이프 종료 */
     close(fds[1]); /* close() 시스템 콜로 파이프 종료 */
 
@@ -0,0 +1,133 @@
+#include "mc_protocol.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/*
+ * Sends one DOWNLOAD_RANGE in its mc_range_if_t form with a caller-chosen
+ * offset, length and validator, writes the bytes served to out_file and
+ * prints "<offset> <file size> <validator>" from the reply, the validator as
+ * 16 hex digits the way the client keeps it. Lets tests ask for ranges and
+ * validators the client never would.
+ */
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s <ip> <port> <name> <offset> <length> <validator|-> <out_file>\n", prog);
+}
+
+static int connect_to(const char *ip, const char *port_text) {
+    char *end = NULL;
+    long port = strtol(port_text, &end, 10);
+    if (!end || *end != '\0' || port <= 0 || port > 65535) {
+        fprintf(stderr, "Invalid port: %s\n", port_text);
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0); /* socket() 시스템 콜로 클라이언트 소켓 생성 */
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    if (inet_pton(AF_INET, ip, &addr.sin_addr) != 1 ||
+        connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) { /* connect() 시스템 콜로 서버 접속 */
+        perror("connect");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Copies len bytes of the reply body from fd to out_fd. */
+static int copy_body(int fd, int out_fd, uint64_t len) {
+    char buf[8192];
+    while (len > 0) {
+        size_t chunk = len < sizeof(buf) ? (size_t)len : sizeof(buf);
+        if (mc_recv_all(fd, buf, chunk) != (ssize_t)chunk ||
+            write(out_fd, buf, chunk) != (ssize_t)chunk) { /* write() 시스템 콜로 받은 범위 기록 */
+            return -1;
+        }
+        len -= chunk;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 8) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *name = argv[3];
+    mc_range_if_t range;
+    range.offset = strtoull(argv[4], NULL, 10);
+    range.length = strtoull(argv[5], NULL, 10);
+    range.validator = strcmp(argv[6], "-") == 0 ? 0 : strtoull(argv[6], NULL, 16);
+    mc_range_if_host_to_network(&range);
+
+    int fd = connect_to(argv[1], argv[2]);
+    if (fd == -1) {
+        return EXIT_FAILURE;
+    }
+    mc_packet_header_t header;
+    if (mc_build_header(&header, MC_CMD_DOWNLOAD_RANGE, name, sizeof(range)) != 0) {
+        perror("mc_build_header");
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    header.version = MC_PROTOCOL_VERSION_PIPELINED;
+    header.request_id = 1;
+    if (mc_send_packet(fd, &header, name, &range, sizeof(range), false) != 0) {
+        perror("send");
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    mc_packet_header_t reply;
+    char reply_name[MC_MAX_FILENAME_LEN + 1];
+    if (mc_recv_header(fd, &reply) != 0 || reply.filename_len > MC_MAX_FILENAME_LEN ||
+        mc_recv_all(fd, reply_name, reply.filename_len) != (ssize_t)reply.filename_len) {
+        fprintf(stderr, "Bad reply header\n");
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    if (reply.command != MC_CMD_DOWNLOAD_RANGE) {
+        char message[256] = {0};
+        size_t len = reply.payload_len < sizeof(message) - 1 ? (size_t)reply.payload_len : sizeof(message) - 1;
+        mc_recv_all(fd, message, len);
+        printf("ERROR: %s\n", message);
+        close(fd);
+        return EXIT_SUCCESS;
+    }
+    mc_range_if_t served;
+    if (reply.payload_len < MC_RANGE_IF_SIZE || mc_recv_all(fd, &served, sizeof(served)) != (ssize_t)sizeof(served)) {
+        fprintf(stderr, "Short reply\n");
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    mc_range_if_network_to_host(&served);
+
+    int out_fd = open(argv[7], O_WRONLY | O_CREAT | O_TRUNC, 0644); /* open() 시스템 콜로 출력 파일 생성 */
+    if (out_fd == -1) {
+        perror("open");
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    int rc = copy_body(fd, out_fd, reply.payload_len - MC_RANGE_IF_SIZE) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    close(out_fd);
+    close(fd); /* close() 시스템 콜로 소켓 종료 */
+    if (rc != EXIT_SUCCESS) {
+        fprintf(stderr, "Short body\n");
+        return rc;
+    }
+    printf("%" PRIu64 " %" PRIu64 " %016" PRIx64 "\n", served.offset, served.length, served.validator);
+    return rc;
+}
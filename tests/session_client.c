@@ -0,0 +1,182 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mc_protocol.h"
+#include "mc_sha256.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Drives one upload session by hand: UPLOAD_BEGIN describes file (size,
+ * mtime and SHA-256, as the client sends them), UPLOAD_APPEND then adds the
+ * bytes of data_file (file itself by default) from the committed offset up
+ * to <bytes>, and once the session holds the full size UPLOAD_COMMIT is
+ * sent. Prints "committed=<n>", then the COMMIT reply when there was one.
+ * Lets tests leave a session half done, or fill it with other content.
+ */
+
+#define SESSION_CHUNK (4U * 1024U * 1024U)
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s <ip> <port> <name> <file> <bytes> [data_file]\n", prog);
+}
+
+static int connect_to(const char *ip, const char *port_text) {
+    char *end = NULL;
+    long port = strtol(port_text, &end, 10);
+    if (!end || *end != '\0' || port <= 0 || port > 65535) {
+        fprintf(stderr, "Invalid port: %s\n", port_text);
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0); /* socket() 시스템 콜로 클라이언트 소켓 생성 */
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    if (inet_pton(AF_INET, ip, &addr.sin_addr) != 1 ||
+        connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) { /* connect() 시스템 콜로 서버 접속 */
+        perror("connect");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Size, mtime tag and SHA-256 of path, the way the client fills an mc_upload_begin_t. */
+static int describe(const char *path, mc_upload_begin_t *begin) {
+    int fd = open(path, O_RDONLY); /* open() 시스템 콜로 업로드할 파일 열기 */
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) { /* fstat() 시스템 콜로 크기와 수정 시각 확인 */
+        perror(path);
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    begin->total_size = (uint64_t)st.st_size;
+    begin->tag = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL + (uint64_t)st.st_mtim.tv_nsec;
+    mc_sha256_t sha;
+    mc_sha256_init(&sha);
+    uint8_t buf[64 * 1024];
+    ssize_t got;
+    while ((got = read(fd, buf, sizeof(buf))) > 0) { /* read() 시스템 콜로 해시할 내용 읽기 */
+        mc_sha256_update(&sha, buf, (size_t)got);
+    }
+    close(fd);
+    if (got < 0) {
+        perror(path);
+        return -1;
+    }
+    mc_sha256_final(&sha, begin->sha256);
+    return 0;
+}
+
+static int send_request(int fd, mc_command_t command, const char *name, const void *payload, size_t len) {
+    mc_packet_header_t header;
+    if (mc_build_header(&header, command, name, len) != 0) {
+        return -1;
+    }
+    header.version = MC_PROTOCOL_VERSION_PIPELINED;
+    header.request_id = 1;
+    return mc_send_packet(fd, &header, name, payload, len, false);
+}
+
+/*
+ * Reads one reply. A session reply of the expected command fills range and
+ * the key (when key is set); anything else is printed as "ERROR: <text>"
+ * or "<text>" and returns 1.
+ */
+static int recv_reply(int fd, mc_command_t expected, mc_range_t *range, char *key) {
+    mc_packet_header_t reply;
+    char name[MC_MAX_FILENAME_LEN + 1] = {0};
+    if (mc_recv_header(fd, &reply) != 0 || reply.filename_len > MC_MAX_FILENAME_LEN ||
+        mc_recv_all(fd, name, reply.filename_len) != (ssize_t)reply.filename_len) {
+        return -1;
+    }
+    if (reply.command == expected && reply.payload_len == MC_RANGE_SIZE && range) {
+        if (mc_recv_all(fd, range, sizeof(*range)) != (ssize_t)sizeof(*range)) {
+            return -1;
+        }
+        mc_range_network_to_host(range);
+        if (key) {
+            snprintf(key, MC_UPLOAD_KEY_LEN + 1, "%s", name);
+        }
+        return 0;
+    }
+    char text[256] = {0};
+    size_t len = reply.payload_len < sizeof(text) - 1 ? (size_t)reply.payload_len : sizeof(text) - 1;
+    if (mc_recv_all(fd, text, len) != (ssize_t)len) {
+        return -1;
+    }
+    printf("%s%s\n", reply.command == MC_CMD_ERROR ? "ERROR: " : "", text);
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 6 || argc > 7) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *name = argv[3];
+    uint64_t stop = strtoull(argv[5], NULL, 10);
+    mc_upload_begin_t begin;
+    if (describe(argv[4], &begin) != 0) {
+        return EXIT_FAILURE;
+    }
+    if (stop > begin.total_size) {
+        stop = begin.total_size;
+    }
+    int data_fd = open(argc > 6 ? argv[6] : argv[4], O_RDONLY); /* open() 시스템 콜로 보낼 내용 열기 */
+    uint8_t *buf = malloc(SESSION_CHUNK);
+    int fd = data_fd == -1 || !buf ? -1 : connect_to(argv[1], argv[2]);
+    if (fd == -1) {
+        perror("setup");
+        free(buf);
+        return EXIT_FAILURE;
+    }
+
+    mc_upload_begin_t wire = begin;
+    mc_upload_begin_host_to_network(&wire);
+    char key[MC_UPLOAD_KEY_LEN + 1] = {0};
+    mc_range_t progress = {0, 0};
+    int rc = send_request(fd, MC_CMD_UPLOAD_BEGIN, name, &wire, sizeof(wire)) == 0
+                 ? recv_reply(fd, MC_CMD_UPLOAD_BEGIN, &progress, key)
+                 : -1;
+    while (rc == 0 && progress.offset < stop) {
+        size_t chunk = stop - progress.offset < SESSION_CHUNK ? (size_t)(stop - progress.offset) : SESSION_CHUNK;
+        if (pread(data_fd, buf, chunk, (off_t)progress.offset) != (ssize_t)chunk || /* pread() 시스템 콜로 보낼 구간 읽기 */
+            send_request(fd, MC_CMD_UPLOAD_APPEND, key, buf, chunk) != 0) {
+            rc = -1;
+            break;
+        }
+        rc = recv_reply(fd, MC_CMD_UPLOAD_APPEND, &progress, NULL);
+    }
+    if (rc == 0) {
+        printf("committed=%" PRIu64 "\n", (uint64_t)progress.offset);
+    }
+    if (rc == 0 && progress.offset == begin.total_size) {
+        rc = send_request(fd, MC_CMD_UPLOAD_COMMIT, name, &wire, sizeof(wire)) == 0
+                 ? recv_reply(fd, MC_CMD_UPLOAD_COMMIT, NULL, NULL)
+                 : -1;
+    }
+    free(buf);
+    close(data_fd);
+    close(fd); /* close() 시스템 콜로 소켓 종료 */
+    if (rc < 0) {
+        fprintf(stderr, "Session request failed\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}